@@ -144,6 +144,7 @@ int main(int args, char *argv[])
     ("getpid", "Get Process ID for the server.")
     ("status", "Status for the server.")
     ("priority-status", "Queued jobs status by priority.")
+    ("latency", "Queue wait and run time percentiles by function.")
     ("workers", "Workers for the server.")
     ("ssl,S", "Enable SSL connections.")
             ;
@@ -185,6 +186,7 @@ int main(int args, char *argv[])
      vm.count("getpid") == 0 and
      vm.count("status") == 0 and
      vm.count("priority-status") == 0 and
+     vm.count("latency") == 0 and
      vm.count("workers") == 0)
   {
     std::cout << "No option execution operation given." << std::endl << std::endl;
@@ -203,6 +205,11 @@ int main(int args, char *argv[])
     instance.push(new util::Operation(util_literal_param("prioritystatus\r\n")));
   }
 
+  if (vm.count("latency"))
+  {
+    instance.push(new util::Operation(util_literal_param("latency\r\n")));
+  }
+
   if (vm.count("workers"))
   {
     instance.push(new util::Operation(util_literal_param("workers\r\n")));
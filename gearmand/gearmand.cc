@@ -109,6 +109,7 @@ int main(int argc, char *argv[])
   rlim_t fds= 0;
   uint32_t job_retries;
   uint32_t worker_wakeup;
+  uint32_t worker_timeout_min;
 
   std::string host;
   std::string user;
@@ -132,6 +133,15 @@ int main(int argc, char *argv[])
   int opt_keepalive_idle;
   int opt_keepalive_interval;
   int opt_keepalive_count;
+  size_t result_cache_size;
+  uint32_t status_interval;
+  bool opt_queue_batch;
+  uint32_t queue_batch_delay;
+  std::string queue_async_string;
+  uint32_t queue_replay_threads;
+  bool opt_queue_replay_background;
+  uint32_t queue_lazy_data;
+  uint32_t queue_prefetch;
 
 
   boost::program_options::options_description general("General options");
@@ -183,15 +193,42 @@ int main(int argc, char *argv[])
   ("protocol,r", boost::program_options::value(&protocol),
    "Load protocol module.")
 
+  ("result-cache-size", boost::program_options::value(&result_cache_size)->default_value(GEARMAND_DEFAULT_RESULT_CACHE_SIZE),
+   "Maximum number of bytes used to cache results of functions marked idempotent with the \"resultcache\" admin command. Least recently used results are dropped first. 0 disables the result cache.")
+
   ("round-robin,R", boost::program_options::bool_switch(&opt_round_robin)->default_value(false),
    "Assign work in round-robin order per worker connection. The default is to assign work in the order of functions added by the worker.")
 
   ("queue-type,q", boost::program_options::value(&queue_type)->default_value("builtin"),
    "Persistent queue type to use.")
 
+  ("queue-batch", boost::program_options::bool_switch(&opt_queue_batch)->default_value(false),
+   "Store the background jobs of each pass of the processing thread in one batch with a single flush. Their JOB_CREATED is held until the batch is stored.")
+
+  ("queue-batch-delay", boost::program_options::value(&queue_batch_delay)->default_value(0),
+   "Keep a batch open up to this many milliseconds to gather more jobs. Implies --queue-batch.")
+
+  ("queue-async", boost::program_options::value(&queue_async_string),
+   "Store batches on a thread of their own: 'strict' sends JOB_CREATED once the job is stored, 'relaxed' right away. Implies --queue-batch.")
+
+  ("queue-replay-threads", boost::program_options::value(&queue_replay_threads)->default_value(0),
+   "Number of threads building jobs while the queue is replayed at startup, 0 builds them on the thread reading the queue.")
+
+  ("queue-replay-background", boost::program_options::bool_switch(&opt_queue_replay_background)->default_value(false),
+   "Accept connections while the queue is still being replayed. Requires --queue-async and at least one thread.")
+
+  ("queue-lazy-data", boost::program_options::value(&queue_lazy_data)->default_value(0),
+   "Keep only the metadata of stored background jobs whose data is at least this many bytes in memory, reading the data back from the persistent queue when a worker takes the job. 0 keeps all data in memory. Only queues that can read a single job back support it.")
+
+  ("queue-prefetch", boost::program_options::value(&queue_prefetch)->default_value(8),
+   "Number of jobs following a taken one in its function's queue whose data --queue-lazy-data reads ahead on a thread of its own.")
+
   ("config-file", boost::program_options::value(&config_file)->default_value(GEARMAND_CONFIG),
    "Can be specified with '@name', too")
 
+  ("status-interval", boost::program_options::value(&status_interval)->default_value(0),
+   "Send each client connection at most one WORK_STATUS packet per this many milliseconds, coalescing updates in between to the latest values. 0 forwards every WORK_STATUS.")
+
   ("syslog", boost::program_options::bool_switch(&opt_syslog)->default_value(false),
    "Use syslog.")
 
@@ -210,6 +247,9 @@ int main(int argc, char *argv[])
   ("version,V", "Display the version of gearmand and exit.")
   ("worker-wakeup,w", boost::program_options::value(&worker_wakeup)->default_value(0),
    "Number of workers to wakeup for each job received. The default is to wakeup all available workers.")
+
+  ("worker-timeout-min", boost::program_options::value(&worker_timeout_min)->default_value(GEARMAND_DEFAULT_WORKER_TIMEOUT_MIN),
+   "Least number of seconds a job may run under the timeout its worker gave with CAN_DO_TIMEOUT; shorter timeouts are raised to it.")
   ;
 
   boost::program_options::options_description all("Allowed options");
@@ -309,6 +349,24 @@ int main(int argc, char *argv[])
     return EXIT_FAILURE;
   }
 
+  gearmand_queue_async_t queue_async= GEARMAND_QUEUE_ASYNC_NONE;
+  if (queue_async_string.empty() == false)
+  {
+    if (queue_async_string.compare("strict") == 0)
+    {
+      queue_async= GEARMAND_QUEUE_ASYNC_STRICT;
+    }
+    else if (queue_async_string.compare("relaxed") == 0)
+    {
+      queue_async= GEARMAND_QUEUE_ASYNC_RELAXED;
+    }
+    else
+    {
+      error::message("Invalid value for --queue-async supplied, use strict or relaxed");
+      return EXIT_FAILURE;
+    }
+  }
+
   if (hashtable_buckets <= 0)
   {
     error::message("hashtable-buckets has to be greater than 0");
@@ -392,6 +450,26 @@ int main(int argc, char *argv[])
 
   gearmand_config_sockopt_keepalive_interval(gearmand_config, opt_keepalive_interval);
 
+  gearmand_config_result_cache_size(gearmand_config, result_cache_size);
+
+  gearmand_config_status_interval(gearmand_config, status_interval);
+
+  gearmand_config_queue_batch(gearmand_config, opt_queue_batch or queue_batch_delay or queue_async != GEARMAND_QUEUE_ASYNC_NONE);
+
+  gearmand_config_queue_batch_delay(gearmand_config, queue_batch_delay);
+
+  gearmand_config_queue_async(gearmand_config, queue_async);
+
+  gearmand_config_queue_replay_threads(gearmand_config, queue_replay_threads);
+
+  gearmand_config_queue_replay_background(gearmand_config, opt_queue_replay_background);
+
+  gearmand_config_queue_lazy_data(gearmand_config, queue_lazy_data);
+
+  gearmand_config_queue_prefetch(gearmand_config, queue_prefetch);
+
+  gearmand_config_worker_timeout_min(gearmand_config, worker_timeout_min);
+
   gearmand_st *_gearmand= gearmand_create(gearmand_config,
                                           host.empty() ? NULL : host.c_str(),
                                           threads, backlog,
@@ -534,10 +612,17 @@ extern "C" void _shutdown_handler(int signal_, siginfo_t*, void*)
 extern "C" void _reset_log_handler(int, siginfo_t*, void*) // signal_arg
 {
   gearmand_log_info_st *log_info= static_cast<gearmand_log_info_st *>(Gearmand()->log_context);
-  
-  log_info->write(GEARMAND_VERBOSE_NOTICE, "SIGHUP, reopening log file");
 
-  log_info->reset();
+  log_info->request_reset();
+}
+
+/* Write out what is still buffered for the log, _exit() skips the writer. */
+static void _flush_log()
+{
+  if (Gearmand() and Gearmand()->log_context)
+  {
+    static_cast<gearmand_log_info_st *>(Gearmand()->log_context)->flush();
+  }
 }
 
 static bool segfaulted= false;
@@ -550,6 +635,7 @@ extern "C" void _crash_handler(int signal_, siginfo_t*, void*)
   }
 
   segfaulted= true;
+  _flush_log();
   custom_backtrace();
   _exit(EXIT_FAILURE); /* Quit without running destructors */
 }
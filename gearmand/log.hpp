@@ -37,8 +37,127 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/uio.h>
+
+#ifndef IOV_MAX
+# define IOV_MAX 1024
+#endif
+
+#define GEARMAND_LOG_RING_SIZE (256 * 1024)
+#define GEARMAND_LOG_IDLE_WAIT 100 // Milliseconds the writer sleeps when there is nothing to write.
+#define GEARMAND_LOG_FLUSH_TRIES 1000 // Yields flush() waits for the writer to finish a drain.
+
 namespace gearmand {
 
+/*
+  Lines are formatted by the thread logging them, timestamp included, and
+  copied into a ring owned by that thread. A writer thread drains every
+  ring with writev(), so a slow disk never stalls the threads running
+  jobs. A full ring drops the line and counts it instead of blocking.
+  When its thread exits the ring is retired, and the writer frees it once
+  it has been drained.
+*/
+struct gearmand_log_ring_st
+{
+  struct record_st
+  {
+    uint32_t size; // Bytes the record takes in the ring, 0 means skip to the start of the ring.
+    uint32_t length; // Bytes of line that follow.
+    int verbose;
+    uint32_t reserved;
+  };
+
+  char *buffer;
+  uint64_t head; // Written only by the owning thread.
+  uint64_t tail; // Written only by the writer thread.
+  uint64_t dropped; // Written only by the owning thread.
+  uint64_t dropped_reported; // Written only by the writer thread.
+  bool retired; // The owning thread has exited.
+  gearmand_log_ring_st *next;
+
+  gearmand_log_ring_st() :
+    buffer(new char[GEARMAND_LOG_RING_SIZE]),
+    head(0),
+    tail(0),
+    dropped(0),
+    dropped_reported(0),
+    retired(false),
+    next(NULL)
+  {
+  }
+
+  ~gearmand_log_ring_st()
+  {
+    delete [] buffer;
+  }
+
+  static size_t align(size_t size)
+  {
+    return (size + sizeof(record_st) -1) & ~(sizeof(record_st) -1);
+  }
+
+  /* Called by the owning thread only. */
+  bool push(gearmand_verbose_t verbose, const char *mesg)
+  {
+    size_t mesg_length= strlen(mesg);
+    size_t max_length= 8 + mesg_length + 1; // "%7s " prefix, message, newline.
+    if (max_length > GEARMAN_MAX_ERROR_SIZE)
+    {
+      max_length= GEARMAN_MAX_ERROR_SIZE;
+    }
+    size_t size= align(sizeof(record_st) + max_length);
+
+    uint64_t local_head= head;
+    uint64_t local_tail= __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+    size_t offset= size_t(local_head % GEARMAND_LOG_RING_SIZE);
+    size_t skip= (GEARMAND_LOG_RING_SIZE - offset < size) ? GEARMAND_LOG_RING_SIZE - offset : 0;
+
+    if (local_head + skip + size - local_tail > GEARMAND_LOG_RING_SIZE)
+    {
+      __atomic_store_n(&dropped, dropped +1, __ATOMIC_RELAXED);
+      return false;
+    }
+
+    if (skip)
+    {
+      record_st *pad= reinterpret_cast<record_st *>(buffer + offset);
+      pad->size= 0;
+      local_head+= skip;
+      offset= 0;
+    }
+
+    record_st *record= reinterpret_cast<record_st *>(buffer + offset);
+    char *line= buffer + offset + sizeof(record_st);
+    int length= snprintf(line, max_length, "%7s %s", gearmand_verbose_name(verbose), mesg);
+    if (length < 0)
+    {
+      length= 0;
+    }
+    else if (size_t(length) >= max_length)
+    {
+      length= int(max_length -1);
+    }
+    line[length++]= '\n';
+
+    record->length= uint32_t(length);
+    record->verbose= int(verbose);
+    record->size= uint32_t(align(sizeof(record_st) + size_t(length)));
+
+    __atomic_store_n(&head, local_head + record->size, __ATOMIC_SEQ_CST);
+
+    return true;
+  }
+};
+
 struct gearmand_log_info_st
 {
   std::string filename;
@@ -46,13 +165,29 @@ struct gearmand_log_info_st
   bool opt_syslog;
   bool opt_file;
   bool init_success;
+  bool writer_started;
+  bool writer_shutdown;
+  bool writer_sleeping;
+  bool reset_requested;
+  bool draining; // Held by the thread draining the rings.
+  pthread_t writer;
+  pthread_mutex_t lock;
+  pthread_cond_t wakeup;
+  gearmand_log_ring_st *ring_list;
+  pthread_key_t ring_key;
 
   gearmand_log_info_st(const std::string &filename_arg, const bool syslog_arg) :
     filename(filename_arg),
     fd(-1),
     opt_syslog(syslog_arg),
     opt_file(false),
-    init_success(false)
+    init_success(false),
+    writer_started(false),
+    writer_shutdown(false),
+    writer_sleeping(false),
+    reset_requested(false),
+    draining(false),
+    ring_list(NULL)
   {
     if (opt_syslog)
     {
@@ -99,6 +234,19 @@ struct gearmand_log_info_st
       }
     }
 
+    if (opt_file or opt_syslog)
+    {
+      if (pthread_mutex_init(&lock, NULL) != 0 or
+          pthread_cond_init(&wakeup, NULL) != 0 or
+          pthread_key_create(&ring_key, _ring_retire) != 0 or
+          pthread_create(&writer, NULL, _writer_run, this) != 0)
+      {
+        error::perror("Could not start log writer thread.");
+        return;
+      }
+      writer_started= true;
+    }
+
     init_success= true;
   }
 
@@ -119,6 +267,12 @@ struct gearmand_log_info_st
     }
   }
 
+  /* Safe to call from a signal handler, the writer thread reopens the file. */
+  void request_reset()
+  {
+    __atomic_store_n(&reset_requested, true, __ATOMIC_RELAXED);
+  }
+
   int file() const
   {
     return fd;
@@ -126,33 +280,87 @@ struct gearmand_log_info_st
 
   void write(gearmand_verbose_t verbose, const char *mesg)
   {
-    if (opt_file)
+    if (writer_started == false)
     {
-      char buffer[GEARMAN_MAX_ERROR_SIZE];
-      int buffer_length= snprintf(buffer, GEARMAN_MAX_ERROR_SIZE, "%7s %s\n", gearmand_verbose_name(verbose), mesg);
-      if (::write(file(), buffer, buffer_length) == -1)
+      return;
+    }
+
+    gearmand_log_ring_st *ring= static_cast<gearmand_log_ring_st *>(pthread_getspecific(ring_key));
+    if (ring == NULL)
+    {
+      if ((ring= new (std::nothrow) gearmand_log_ring_st) == NULL)
       {
-        error::perror("Could not write to log file.");
-        if (opt_syslog)
-        {
-          char getcwd_buffer[1024];
-          char *ptr_buffer= getcwd(getcwd_buffer, sizeof(getcwd_buffer));
-          syslog(LOG_ERR, "Could not open log file \"%.*s\", from \"%s\", open failed with (%s)", 
-                 int(filename.size()), filename.c_str(), 
-                 ptr_buffer,
-                 strerror(errno));
-        }
+        return;
       }
+
+      pthread_mutex_lock(&lock);
+      ring->next= ring_list;
+      __atomic_store_n(&ring_list, ring, __ATOMIC_RELEASE);
+      pthread_mutex_unlock(&lock);
+      pthread_setspecific(ring_key, ring);
     }
 
-    if (opt_syslog)
+    if (verbose == GEARMAND_VERBOSE_FATAL)
     {
-      syslog(int(verbose), "%7s %s", gearmand_verbose_name(verbose), mesg);
+      ring->push(verbose, mesg);
+      flush();
+    }
+    else if (ring->push(verbose, mesg) and __atomic_load_n(&writer_sleeping, __ATOMIC_SEQ_CST))
+    {
+      pthread_mutex_lock(&lock);
+      pthread_cond_signal(&wakeup);
+      pthread_mutex_unlock(&lock);
+    }
+  }
+
+  /*
+    Writes out every ring from the calling thread, for a fatal message or
+    a crash that is about to _exit(). Best effort from a signal handler: it
+    takes no locks, and gives up if the writer does not finish its own
+    drain, which is the case when the writer is the thread that crashed.
+  */
+  void flush()
+  {
+    if (writer_started == false)
+    {
+      return;
+    }
+
+    for (uint32_t tries= 0; tries < GEARMAND_LOG_FLUSH_TRIES; tries++)
+    {
+      if (__atomic_exchange_n(&draining, true, __ATOMIC_ACQUIRE) == false)
+      {
+        _drain(false);
+        __atomic_store_n(&draining, false, __ATOMIC_RELEASE);
+        return;
+      }
+
+      sched_yield();
     }
   }
 
   ~gearmand_log_info_st()
   {
+    if (writer_started)
+    {
+      pthread_mutex_lock(&lock);
+      writer_shutdown= true;
+      pthread_cond_signal(&wakeup);
+      pthread_mutex_unlock(&lock);
+      pthread_join(writer, NULL);
+
+      while (ring_list)
+      {
+        gearmand_log_ring_st *ring= ring_list;
+        ring_list= ring->next;
+        delete ring;
+      }
+
+      pthread_key_delete(ring_key);
+      pthread_cond_destroy(&wakeup);
+      pthread_mutex_destroy(&lock);
+    }
+
     if (fd != -1 and fd != STDERR_FILENO)
     {
       close(fd);
@@ -163,6 +371,261 @@ struct gearmand_log_info_st
       closelog();
     }
   }
+
+private:
+  void _write_error()
+  {
+    error::perror("Could not write to log file.");
+    if (opt_syslog)
+    {
+      char getcwd_buffer[1024];
+      char *ptr_buffer= getcwd(getcwd_buffer, sizeof(getcwd_buffer));
+      syslog(LOG_ERR, "Could not open log file \"%.*s\", from \"%s\", open failed with (%s)", 
+             int(filename.size()), filename.c_str(), 
+             ptr_buffer,
+             strerror(errno));
+    }
+  }
+
+  void _writev(struct iovec *iov, int iov_count)
+  {
+    while (iov_count)
+    {
+      ssize_t written= ::writev(file(), iov, iov_count);
+      if (written == -1)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+
+        _write_error();
+        return;
+      }
+
+      while (iov_count and size_t(written) >= iov->iov_len)
+      {
+        written-= ssize_t(iov->iov_len);
+        iov++;
+        iov_count--;
+      }
+
+      if (iov_count)
+      {
+        iov->iov_base= static_cast<char *>(iov->iov_base) + written;
+        iov->iov_len-= size_t(written);
+      }
+    }
+  }
+
+  /* Write a line from the writer thread itself. */
+  void _write_direct(gearmand_verbose_t verbose, const char *mesg)
+  {
+    if (opt_file)
+    {
+      char buffer[GEARMAN_MAX_ERROR_SIZE];
+      int buffer_length= snprintf(buffer, sizeof(buffer), "%7s %s\n", gearmand_verbose_name(verbose), mesg);
+      if (buffer_length > 0)
+      {
+        struct iovec iov= { buffer, std::min(size_t(buffer_length), sizeof(buffer) -1) };
+        _writev(&iov, 1);
+      }
+    }
+
+    if (opt_syslog)
+    {
+      syslog(int(verbose), "%7s %s", gearmand_verbose_name(verbose), mesg);
+    }
+  }
+
+  static void _ring_retire(void *ring)
+  {
+    __atomic_store_n(&static_cast<gearmand_log_ring_st *>(ring)->retired, true, __ATOMIC_RELEASE);
+  }
+
+  /* Unlinks and frees a retired ring, called by the writer only. */
+  void _ring_free(gearmand_log_ring_st *prev, gearmand_log_ring_st *ring)
+  {
+    pthread_mutex_lock(&lock);
+    if (prev)
+    {
+      prev->next= ring->next;
+    }
+    else
+    {
+      __atomic_store_n(&ring_list, ring->next, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&lock);
+
+    delete ring;
+  }
+
+  /*
+    Drain every ring once, returns true if anything was written. Called
+    with draining held. Retired rings are freed when reap is set.
+  */
+  bool _drain(bool reap)
+  {
+    bool wrote= false;
+    struct iovec iov[IOV_MAX];
+    int iov_count= 0;
+
+    gearmand_log_ring_st *prev= NULL;
+    gearmand_log_ring_st *next= NULL;
+    for (gearmand_log_ring_st *ring= __atomic_load_n(&ring_list, __ATOMIC_ACQUIRE);
+         ring != NULL;
+         ring= next)
+    {
+      next= ring->next;
+      bool retired= __atomic_load_n(&ring->retired, __ATOMIC_ACQUIRE);
+
+      uint64_t dropped= __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+      if (dropped != ring->dropped_reported)
+      {
+        if (iov_count)
+        {
+          _writev(iov, iov_count);
+          iov_count= 0;
+        }
+
+        char mesg[128];
+        snprintf(mesg, sizeof(mesg), "Log buffer full, dropped %" PRIu64 " messages", dropped - ring->dropped_reported);
+        _write_direct(GEARMAND_VERBOSE_WARN, mesg);
+        ring->dropped_reported= dropped;
+        wrote= true;
+      }
+
+      uint64_t head= __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+      uint64_t tail= ring->tail;
+      while (tail != head)
+      {
+        size_t offset= size_t(tail % GEARMAND_LOG_RING_SIZE);
+        const gearmand_log_ring_st::record_st *record= reinterpret_cast<const gearmand_log_ring_st::record_st *>(ring->buffer + offset);
+        if (record->size == 0)
+        {
+          tail+= GEARMAND_LOG_RING_SIZE - offset;
+          continue;
+        }
+
+        char *line= ring->buffer + offset + sizeof(gearmand_log_ring_st::record_st);
+        if (opt_syslog)
+        {
+          syslog(record->verbose, "%.*s", int(record->length -1), line);
+        }
+
+        if (opt_file)
+        {
+          iov[iov_count].iov_base= line;
+          iov[iov_count].iov_len= record->length;
+          if (++iov_count == IOV_MAX)
+          {
+            _writev(iov, iov_count);
+            iov_count= 0;
+          }
+        }
+
+        tail+= record->size;
+        wrote= true;
+      }
+
+      /* The lines must be written before the ring space is handed back. */
+      if (iov_count)
+      {
+        _writev(iov, iov_count);
+        iov_count= 0;
+      }
+      __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+      /* A retired ring has no writer left, so head read above is final. */
+      if (reap and retired)
+      {
+        _ring_free(prev, ring);
+        continue;
+      }
+      prev= ring;
+    }
+
+    return wrote;
+  }
+
+  bool _drain_all()
+  {
+    while (__atomic_exchange_n(&draining, true, __ATOMIC_ACQUIRE))
+    {
+      sched_yield();
+    }
+
+    bool wrote= _drain(true);
+    __atomic_store_n(&draining, false, __ATOMIC_RELEASE);
+
+    return wrote;
+  }
+
+  bool _pending()
+  {
+    for (gearmand_log_ring_st *ring= __atomic_load_n(&ring_list, __ATOMIC_ACQUIRE);
+         ring != NULL;
+         ring= ring->next)
+    {
+      if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) != ring->tail or
+          __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED) != ring->dropped_reported)
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  void _writer()
+  {
+    while (1)
+    {
+      if (__atomic_exchange_n(&reset_requested, false, __ATOMIC_RELAXED))
+      {
+        _write_direct(GEARMAND_VERBOSE_NOTICE, "SIGHUP, reopening log file");
+        if (opt_file)
+        {
+          reset();
+        }
+      }
+
+      if (_drain_all())
+      {
+        continue;
+      }
+
+      pthread_mutex_lock(&lock);
+      if (writer_shutdown)
+      {
+        pthread_mutex_unlock(&lock);
+        _drain_all();
+        return;
+      }
+
+      __atomic_store_n(&writer_sleeping, true, __ATOMIC_SEQ_CST);
+      if (_pending() == false)
+      {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec+= GEARMAND_LOG_IDLE_WAIT * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+          deadline.tv_sec++;
+          deadline.tv_nsec-= 1000000000L;
+        }
+        pthread_cond_timedwait(&wakeup, &lock, &deadline);
+      }
+      __atomic_store_n(&writer_sleeping, false, __ATOMIC_SEQ_CST);
+      pthread_mutex_unlock(&lock);
+    }
+  }
+
+  static void *_writer_run(void *context)
+  {
+    static_cast<gearmand_log_info_st *>(context)->_writer();
+    return NULL;
+  }
 };
 
 } // namespace gearmand
@@ -541,6 +541,24 @@ gearman_task_st *gearman_client_add_task_background(gearman_client_st *client,
                                                     size_t workload_size,
                                                     gearman_return_t *ret_ptr);
 
+/**
+ * Add a batch of background tasks for one function that is sent to the
+ * server as a single SUBMIT_JOB_BATCH packet. The returned task completes
+ * once the server has queued every job, gearman_task_batch_job_handles()
+ * then returns the job handles. unique may be NULL, as may any of its
+ * entries, in which case a unique is generated.
+ */
+GEARMAN_API
+gearman_task_st *gearman_client_add_task_background_batch(gearman_client_st *client,
+                                                          gearman_task_st *task,
+                                                          void *context,
+                                                          const char *function_name,
+                                                          size_t count,
+                                                          const char * const *unique,
+                                                          const void * const *workload,
+                                                          const size_t *workload_size,
+                                                          gearman_return_t *ret_ptr);
+
 /**
  * Add a high priority background task to be run in parallel. See
  * gearman_client_add_task() for details.
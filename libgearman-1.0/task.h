@@ -176,6 +176,20 @@ bool gearman_task_has_exception(const gearman_task_st* task_shell);
 GEARMAN_API
 gearman_string_t gearman_task_exception(const gearman_task_st *);
 
+/**
+ * Get the number of jobs submitted by a batch task.
+ */
+GEARMAN_API
+size_t gearman_task_batch_count(const gearman_task_st *task);
+
+/**
+ * Get the job handles assigned to a batch task, one NULL terminated handle
+ * per job in the order they were submitted. A job the server could not
+ * queue has an empty handle.
+ */
+GEARMAN_API
+gearman_string_t gearman_task_batch_job_handles(const gearman_task_st *task);
+
 /**
  * Get status on whether a task is running or not.
  */
@@ -179,6 +179,20 @@ int gearman_worker_timeout(gearman_worker_st *worker);
 GEARMAN_API
 void gearman_worker_set_timeout(gearman_worker_st *worker, int timeout);
 
+/**
+ * Get the number of jobs the worker asks for with each grab request.
+ */
+GEARMAN_API
+uint32_t gearman_worker_grab_count(const gearman_worker_st *worker);
+
+/**
+ * Set the number of jobs the worker asks for with each grab request. With a
+ * count greater than one the worker sends GRAB_JOBS and runs the assigned
+ * jobs locally before asking the server again.
+ */
+GEARMAN_API
+gearman_return_t gearman_worker_set_grab_count(gearman_worker_st *worker, uint32_t count);
+
 /**
  * Get the application context for a worker.
  *
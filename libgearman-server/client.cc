@@ -89,6 +89,8 @@ void gearman_server_client_free(gearman_server_client_st *client)
 {
   if (client)
   {
+    gearman_server_work_status_cancel(Server, client);
+
     GEARMAND_LIST_DEL(client->con->client, client, con_);
 
     if (client->job)
@@ -44,6 +44,7 @@
 #pragma once
 
 #include <libgearman-server/gearmand.h>
+#include <libgearman-server/probes.h>
 #include "libgearman-server/config.hpp"
 
 #include "libgearman/assert.hpp"
@@ -84,3 +84,83 @@ void gearmand_config_sockopt_keepalive_count(gearmand_config_st *config, int kee
     config->config.sockopt().keepalive_count(keepalive_count_);
   }
 }
+
+void gearmand_config_result_cache_size(gearmand_config_st *config, size_t result_cache_size_)
+{
+  if (config)
+  {
+    config->config.result_cache_size(result_cache_size_);
+  }
+}
+
+void gearmand_config_status_interval(gearmand_config_st *config, uint32_t status_interval_)
+{
+  if (config)
+  {
+    config->config.status_interval(status_interval_);
+  }
+}
+
+void gearmand_config_queue_batch(gearmand_config_st *config, bool queue_batch_)
+{
+  if (config)
+  {
+    config->config.queue_batch(queue_batch_);
+  }
+}
+
+void gearmand_config_queue_batch_delay(gearmand_config_st *config, uint32_t queue_batch_delay_)
+{
+  if (config)
+  {
+    config->config.queue_batch_delay(queue_batch_delay_);
+  }
+}
+
+void gearmand_config_queue_async(gearmand_config_st *config, gearmand_queue_async_t queue_async_)
+{
+  if (config)
+  {
+    config->config.queue_async(queue_async_);
+  }
+}
+
+void gearmand_config_queue_replay_threads(gearmand_config_st *config, uint32_t queue_replay_threads_)
+{
+  if (config)
+  {
+    config->config.queue_replay_threads(queue_replay_threads_);
+  }
+}
+
+void gearmand_config_queue_replay_background(gearmand_config_st *config, bool queue_replay_background_)
+{
+  if (config)
+  {
+    config->config.queue_replay_background(queue_replay_background_);
+  }
+}
+
+void gearmand_config_queue_lazy_data(gearmand_config_st *config, uint32_t queue_lazy_data_)
+{
+  if (config)
+  {
+    config->config.queue_lazy_data(queue_lazy_data_);
+  }
+}
+
+void gearmand_config_queue_prefetch(gearmand_config_st *config, uint32_t queue_prefetch_)
+{
+  if (config)
+  {
+    config->config.queue_prefetch(queue_prefetch_);
+  }
+}
+
+void gearmand_config_worker_timeout_min(gearmand_config_st *config, uint32_t worker_timeout_min_)
+{
+  if (config)
+  {
+    config->config.worker_timeout_min(worker_timeout_min_);
+  }
+}
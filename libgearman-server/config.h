@@ -65,6 +65,36 @@ GEARMAN_API
 GEARMAN_API
   void gearmand_config_sockopt_keepalive_count(gearmand_config_st *config, int keepalive_count_);
 
+GEARMAN_API
+  void gearmand_config_result_cache_size(gearmand_config_st *config, size_t result_cache_size_);
+
+GEARMAN_API
+  void gearmand_config_status_interval(gearmand_config_st *config, uint32_t status_interval_);
+
+GEARMAN_API
+  void gearmand_config_queue_batch(gearmand_config_st *config, bool queue_batch_);
+
+GEARMAN_API
+  void gearmand_config_queue_batch_delay(gearmand_config_st *config, uint32_t queue_batch_delay_);
+
+GEARMAN_API
+  void gearmand_config_queue_async(gearmand_config_st *config, gearmand_queue_async_t queue_async_);
+
+GEARMAN_API
+  void gearmand_config_queue_replay_threads(gearmand_config_st *config, uint32_t queue_replay_threads_);
+
+GEARMAN_API
+  void gearmand_config_queue_replay_background(gearmand_config_st *config, bool queue_replay_background_);
+
+GEARMAN_API
+  void gearmand_config_queue_lazy_data(gearmand_config_st *config, uint32_t queue_lazy_data_);
+
+GEARMAN_API
+  void gearmand_config_queue_prefetch(gearmand_config_st *config, uint32_t queue_prefetch_);
+
+GEARMAN_API
+  void gearmand_config_worker_timeout_min(gearmand_config_st *config, uint32_t worker_timeout_min_);
+
 #ifdef __cplusplus
 }
 #endif
@@ -45,7 +45,17 @@ namespace gearmand {
 class Config
 {
 public:
-  Config()
+  Config() :
+    _result_cache_size(GEARMAND_DEFAULT_RESULT_CACHE_SIZE),
+    _status_interval(0),
+    _queue_batch(false),
+    _queue_batch_delay(0),
+    _queue_async(GEARMAND_QUEUE_ASYNC_NONE),
+    _queue_replay_threads(0),
+    _queue_replay_background(false),
+    _queue_lazy_data(0),
+    _queue_prefetch(8),
+    _worker_timeout_min(GEARMAND_DEFAULT_WORKER_TIMEOUT_MIN)
   {
   }
 
@@ -54,8 +64,118 @@ public:
     return _sockopt;
   }
 
+  size_t result_cache_size() const
+  {
+    return _result_cache_size;
+  }
+
+  void result_cache_size(size_t result_cache_size_)
+  {
+    _result_cache_size= result_cache_size_;
+  }
+
+  uint32_t status_interval() const
+  {
+    return _status_interval;
+  }
+
+  void status_interval(uint32_t status_interval_)
+  {
+    _status_interval= status_interval_;
+  }
+
+  bool queue_batch() const
+  {
+    return _queue_batch;
+  }
+
+  void queue_batch(bool queue_batch_)
+  {
+    _queue_batch= queue_batch_;
+  }
+
+  uint32_t queue_batch_delay() const
+  {
+    return _queue_batch_delay;
+  }
+
+  void queue_batch_delay(uint32_t queue_batch_delay_)
+  {
+    _queue_batch_delay= queue_batch_delay_;
+  }
+
+  gearmand_queue_async_t queue_async() const
+  {
+    return _queue_async;
+  }
+
+  void queue_async(gearmand_queue_async_t queue_async_)
+  {
+    _queue_async= queue_async_;
+  }
+
+  uint32_t queue_replay_threads() const
+  {
+    return _queue_replay_threads;
+  }
+
+  void queue_replay_threads(uint32_t queue_replay_threads_)
+  {
+    _queue_replay_threads= queue_replay_threads_;
+  }
+
+  bool queue_replay_background() const
+  {
+    return _queue_replay_background;
+  }
+
+  void queue_replay_background(bool queue_replay_background_)
+  {
+    _queue_replay_background= queue_replay_background_;
+  }
+
+  uint32_t queue_lazy_data() const
+  {
+    return _queue_lazy_data;
+  }
+
+  void queue_lazy_data(uint32_t queue_lazy_data_)
+  {
+    _queue_lazy_data= queue_lazy_data_;
+  }
+
+  uint32_t queue_prefetch() const
+  {
+    return _queue_prefetch;
+  }
+
+  void queue_prefetch(uint32_t queue_prefetch_)
+  {
+    _queue_prefetch= queue_prefetch_;
+  }
+
+  uint32_t worker_timeout_min() const
+  {
+    return _worker_timeout_min;
+  }
+
+  void worker_timeout_min(uint32_t worker_timeout_min_)
+  {
+    _worker_timeout_min= worker_timeout_min_;
+  }
+
 private:
   gearmand_st::SocketOpt _sockopt;
+  size_t _result_cache_size;
+  uint32_t _status_interval;
+  bool _queue_batch;
+  uint32_t _queue_batch_delay;
+  gearmand_queue_async_t _queue_async;
+  uint32_t _queue_replay_threads;
+  bool _queue_replay_background;
+  uint32_t _queue_lazy_data;
+  uint32_t _queue_prefetch;
+  uint32_t _worker_timeout_min;
 };
 
 } //namespace gearmand
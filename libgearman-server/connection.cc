@@ -116,6 +116,7 @@ static gearman_server_con_st * _server_con_create(gearman_server_thread_st *thre
 
   con->is_sleeping= false;
   con->is_exceptions= Gearmand()->_exceptions;
+  con->is_assign_on_complete= false;
   con->is_dead= false;
   con->is_cleaned_up = false;
   con->is_noop_sent= false;
@@ -129,6 +130,9 @@ static gearman_server_con_st * _server_con_create(gearman_server_thread_st *thre
   con->proc_packet_count= 0;
   con->worker_count= 0;
   con->client_count= 0;
+  con->proc_pending= 0;
+  con->batch_held= 0;
+  con->status_time= 0;
   con->thread= thread;
   con->packet= NULL;
   con->io_packet_list= NULL;
@@ -146,7 +150,7 @@ static gearman_server_con_st * _server_con_create(gearman_server_thread_st *thre
   con->_host= dcon->host;
   con->_port= dcon->port;
   strcpy(con->id, "-");
-  con->timeout_event= NULL;
+  con->stats_slot= gearman_server_stats_con_add(Server->stats, dcon->fd, con->_host);
 
   con->protocol= NULL;
   con->_ssl= NULL;
@@ -187,10 +191,10 @@ void gearman_server_con_attempt_free(gearman_server_con_st *con)
   {
     if (!(con->proc_removed) and !(Server->proc_shutdown))
     {
-      gearman_server_con_delete_timeout(con);
       con->is_dead= true;
       con->is_sleeping= false;
       con->is_exceptions= Gearmand()->_exceptions;
+      con->is_assign_on_complete= false;
       con->is_noop_sent= false;
       gearman_server_con_proc_add(con);
     }
@@ -218,8 +222,6 @@ void gearman_server_con_free(gearman_server_con_st *con)
 #endif // defined(HAVE_SSL)
 
 
-  gearman_server_con_delete_timeout(con);
-
   if (con->is_cleaned_up)
   {
     gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "con %llu is already cleaned-up. returning", con);
@@ -228,6 +230,9 @@ void gearman_server_con_free(gearman_server_con_st *con)
   
   gearmand_io_free(&(con->con));
 
+  gearman_server_stats_con_remove(Server->stats, con->stats_slot);
+  con->stats_slot= GEARMAND_STATS_NONE;
+
   con->protocol_release();
 
   if (con->packet != NULL)
@@ -259,16 +264,6 @@ void gearman_server_con_free(gearman_server_con_st *con)
     gearman_server_client_free(con->client_list);
   }
 
-  if (con->timeout_event != NULL)
-  {
-    if (event_del(con->timeout_event) == -1)
-    {
-      gearmand_log_fatal_perror(GEARMAN_DEFAULT_LOG_PARAM, errno, "calling event_del() on timeout_event failed");
-    }
-    free(con->timeout_event);
-    con->timeout_event= NULL;
-  }
-
   if (con->proc_list)
   {
     gearman_server_con_proc_remove(con);
@@ -331,6 +326,7 @@ void gearman_server_con_set_id(gearman_server_con_st *con,
 
   memcpy(con->id, id, min_size);
   con->id[min_size]= 0;
+  gearman_server_stats_con_set_id(Server->stats, con->stats_slot, con->id);
 
   gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM,
                      "identifier set to %.*s", 
@@ -645,24 +641,28 @@ gearman_server_con_proc_next(gearman_server_thread_st *thread)
   return con;
 }
 
+static void _server_timeout_wheel_add_event(gearman_server_st *server, uint32_t wait)
+{
+  struct timeval timeout_tv= { 0 , 0 };
+  timeout_tv.tv_sec= wait / 1000;
+  timeout_tv.tv_usec= suseconds_t(wait % 1000) * 1000;
+  if (timeout_add(server->timeout_event, &timeout_tv) == -1)
+  {
+    gearmand_perror(errno, "timeout_add");
+  }
+}
+
 static void _server_job_timeout(int fd, short event, void *arg)
 {
   (void)fd;
   (void)event;
-  gearman_server_job_st *job= (gearman_server_job_st *)arg;
-
-  /* A timeout has ocurred on a job, re-queue it */
-  gearmand_log_warning(GEARMAN_DEFAULT_LOG_PARAM,
-                       "Worker timeout reached on job, requeueing: %s %s",
-                       job->job_handle, job->unique);
+  gearman_server_st *server= (gearman_server_st *)arg;
 
-  gearmand_error_t ret= gearman_server_job_queue(job);
-  if (ret != GEARMAND_SUCCESS)
+  /* Timeouts have ocurred on jobs, re-queue them */
+  uint32_t wait= gearman_server_timeout_wheel_expire(server);
+  if (wait)
   {
-    gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM,
-                       "Failed trying to requeue job after timeout, job lost: %s %s",
-                       job->job_handle, job->unique);
-    gearman_server_job_free(job);
+    _server_timeout_wheel_add_event(server, wait);
   }
 }
 
@@ -687,42 +687,46 @@ gearmand_error_t gearman_server_con_add_job_timeout(gearman_server_con_st *con,
       // We treat 0 and -1 as being the same (i.e. no timer)
       if (worker->timeout > 0)
       {
-        if (worker->timeout < 1000)
+        if (worker->timeout < long(Server->worker_timeout_min))
         {
-          worker->timeout= 1000;
+          worker->timeout= long(Server->worker_timeout_min);
         }
 
         gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "Adding timeout on %s for %s (%dl)",
                            job->function->function_name,
                            job->job_handle,
                            worker->timeout);
-        if (con->timeout_event == NULL)
+
+        bool wheel_idle= (Server->timeout_count == 0);
+        gearman_server_timeout_wheel_add(Server, job, uint64_t(worker->timeout) * 1000);
+
+        /*
+          The proc thread expires the wheel itself, a single threaded server
+          needs an event on its base to do it.
+        */
+        if (wheel_idle and Server->flags.threaded == false)
         {
-          gearmand_con_st *dcon= con->con.context;
-          con->timeout_event= (struct event *)malloc(sizeof(struct event)); // libevent POD
-          if (con->timeout_event == NULL)
-          {
-            return gearmand_merror("malloc(sizeof(struct event)", struct event, 1);
-          }
-          timeout_set(con->timeout_event, _server_job_timeout, job);
-          if (event_base_set(dcon->thread->base, con->timeout_event) == -1)
+          if (Server->timeout_event == NULL)
           {
-            gearmand_perror(errno, "event_base_set");
+            gearmand_con_st *dcon= con->con.context;
+            Server->timeout_event= (struct event *)malloc(sizeof(struct event)); // libevent POD
+            if (Server->timeout_event == NULL)
+            {
+              return gearmand_merror("malloc(sizeof(struct event)", struct event, 1);
+            }
+            timeout_set(Server->timeout_event, _server_job_timeout, Server);
+            if (event_base_set(dcon->thread->base, Server->timeout_event) == -1)
+            {
+              gearmand_perror(errno, "event_base_set");
+            }
           }
-        }
-
-        /* XXX Right now, if a worker has diff timeouts for functions I think
-          this will overwrite any existing timeouts on that event. One
-          solution to that would be to record the timeout from last time,
-          and only set this one if it is longer than that one. */
 
-        struct timeval timeout_tv = { 0 , 0 };
-        timeout_tv.tv_sec= worker->timeout;
-        timeout_add(con->timeout_event, &timeout_tv);
+          _server_timeout_wheel_add_event(Server, GEARMAND_TIMEOUT_WHEEL_TICK);
+        }
       }
-      else if (con->timeout_event) // Delete the timer if it exists
+      else
       {
-        gearman_server_con_delete_timeout(con);
+        gearman_server_timeout_wheel_remove(Server, job);
       }
     }
   }
@@ -730,16 +734,6 @@ gearmand_error_t gearman_server_con_add_job_timeout(gearman_server_con_st *con,
   return GEARMAND_SUCCESS;
 }
 
-void gearman_server_con_delete_timeout(gearman_server_con_st *con)
-{
-  if (con->timeout_event)
-  {
-    timeout_del(con->timeout_event);
-    free(con->timeout_event);
-    con->timeout_event= NULL;
-  }
-}
-
 gearman_server_con_st *gearmand_ready(gearmand_connection_list_st *universal)
 {
   if (universal->ready_con_list)
@@ -186,12 +186,6 @@ gearman_server_con_proc_next(gearman_server_thread_st *thread);
 GEARMAN_API
 gearmand_error_t gearman_server_con_add_job_timeout(gearman_server_con_st *con, gearman_server_job_st *job);
 
-/**
- * Delete timeout event for a server con
- */
-GEARMAN_API
-void gearman_server_con_delete_timeout(gearman_server_con_st *con);
-
 void gearman_server_con_protocol_release(gearman_server_con_st *con);
 
 gearman_server_con_st* build_gearman_server_con_st(void);
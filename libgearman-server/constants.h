@@ -65,10 +65,13 @@
 #define GEARMAND_CONF_MAX_OPTION_SHORT 128
 #define GEARMAND_DEFAULT_BACKLOG 64
 #define GEARMAND_DEFAULT_MAX_QUEUE_SIZE 0
+#define GEARMAND_DEFAULT_RESULT_CACHE_SIZE (64 * 1024 * 1024)
 #define GEARMAND_DEFAULT_SOCKET_RECV_SIZE 32768
 #define GEARMAND_DEFAULT_SOCKET_SEND_SIZE 32768
 #define GEARMAND_DEFAULT_SOCKET_TIMEOUT 10
+#define GEARMAND_DEFAULT_WORKER_TIMEOUT_MIN 1000
 #define GEARMAND_JOB_HANDLE_SIZE 64
+#define GEARMAND_JOB_LOAD_RETRIES 3
 #define GEARMAND_DEFAULT_HASH_SIZE 991
 #define GEARMAND_MAX_COMMAND_ARGS 8
 #define GEARMAND_MAX_FREE_SERVER_CLIENT 1000
@@ -76,13 +79,25 @@
 #define GEARMAND_MAX_FREE_SERVER_JOB 1000
 #define GEARMAND_MAX_FREE_SERVER_PACKET 2000
 #define GEARMAND_MAX_FREE_SERVER_WORKER 1000
+#define GEARMAND_MAX_GRAB_JOBS 256
 #define GEARMAND_OPTION_SIZE 64
 #define GEARMAND_PACKET_HEADER_SIZE 12
 #define GEARMAND_PIPE_BUFFER_SIZE 256
 #define GEARMAND_RECV_BUFFER_SIZE 8192
 #define GEARMAND_SEND_BUFFER_SIZE 8192
 #define GEARMAND_SERVER_CON_ID_SIZE 128
+#define GEARMAND_STATS_CHUNK_SIZE 1024
+#define GEARMAND_STATS_MAX_CHUNKS 1024
+#define GEARMAND_STATS_NONE UINT32_MAX
+#define GEARMAND_STATS_READ_SPINS 64
+#define GEARMAND_STATS_READ_YIELDS 1000
 #define GEARMAND_TEXT_RESPONSE_SIZE 8192
+#define GEARMAND_TIMEOUT_WHEEL_SIZE 1024
+#define GEARMAND_TIMEOUT_WHEEL_TICK 100
+
+#define GEARMAND_LATENCY_SUB_BUCKET_BITS 4
+#define GEARMAND_LATENCY_MAX_BIT 36
+#define GEARMAND_LATENCY_BUCKETS ((GEARMAND_LATENCY_MAX_BIT - GEARMAND_LATENCY_SUB_BUCKET_BITS + 2) << GEARMAND_LATENCY_SUB_BUCKET_BITS)
 #define GEARMAN_MAGIC_MEMORY (void*)(0x000001)
 
 /** @} */
@@ -97,6 +112,14 @@ enum gearmand_connection_options_t
   GEARMAND_CON_MAX
 };
 
+/* When --queue-async answers a background job relative to storing it. */
+enum gearmand_queue_async_t
+{
+  GEARMAND_QUEUE_ASYNC_NONE,
+  GEARMAND_QUEUE_ASYNC_STRICT,
+  GEARMAND_QUEUE_ASYNC_RELAXED
+};
+
 
 struct gearman_server_thread_st;
 struct gearman_server_st;
@@ -125,6 +148,9 @@ typedef gearmand_error_t (gearman_queue_add_fn)(gearman_server_st *server,
 typedef gearmand_error_t (gearman_queue_flush_fn)(gearman_server_st *server,
                                                  void *context);
 
+typedef bool (gearman_queue_rollback_fn)(gearman_server_st *server,
+                                         void *context);
+
 typedef gearmand_error_t (gearman_queue_done_fn)(gearman_server_st *server,
                                                  void *context,
                                                  const char *unique,
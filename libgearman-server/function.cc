@@ -91,7 +91,15 @@ static gearman_server_function_st* gearman_server_function_create(gearman_server
   function->job_count= 0;
   function->job_total= 0;
   function->job_running= 0;
+  memset(function->job_queued, 0, sizeof(function->job_queued));
+  function->job_submitted= 0;
+  function->job_completed= 0;
+  function->job_failed= 0;
+  function->job_retried= 0;
+  gearman_server_latency_init(&function->queue_latency);
+  gearman_server_latency_init(&function->run_latency);
   memset(function->max_queue_size, GEARMAND_DEFAULT_MAX_QUEUE_SIZE, sizeof(uint32_t) * GEARMAN_JOB_PRIORITY_MAX);
+  function->result_cache_ttl= 0;
 
   function->function_name= new char[function_name_size +1];
   if (function->function_name == NULL)
@@ -104,6 +112,7 @@ static gearman_server_function_st* gearman_server_function_create(gearman_server
   memcpy(function->function_name, function_name, function_name_size);
   function->function_name[function_name_size]= 0;
   function->function_name_size= function_name_size;
+  function->stats_slot= gearman_server_stats_function_add(server->stats, function_name, function_name_size);
   function->worker_list= NULL;
   memset(function->job_list, 0,
          sizeof(gearman_server_job_st *) * GEARMAN_JOB_PRIORITY_MAX);
@@ -114,14 +123,12 @@ static gearman_server_function_st* gearman_server_function_create(gearman_server
 }
 
 gearman_server_function_st *
-gearman_server_function_get(gearman_server_st *server,
-                            const char *function_name,
-                            size_t function_name_size)
+gearman_server_function_find(gearman_server_st *server,
+                             const char *function_name,
+                             size_t function_name_size)
 {
-  gearman_server_function_st *function;
-
   uint32_t function_hash = _server_function_hash(function_name, function_name_size) % GEARMAND_DEFAULT_HASH_SIZE;
-  for (function= server->function_hash[function_hash]; function != NULL;
+  for (gearman_server_function_st *function= server->function_hash[function_hash]; function != NULL;
        function= function->next)
   {
     if (function->function_name_size == function_name_size and
@@ -131,6 +138,21 @@ gearman_server_function_get(gearman_server_st *server,
     }
   }
 
+  return NULL;
+}
+
+gearman_server_function_st *
+gearman_server_function_get(gearman_server_st *server,
+                            const char *function_name,
+                            size_t function_name_size)
+{
+  gearman_server_function_st *function= gearman_server_function_find(server, function_name, function_name_size);
+  if (function)
+  {
+    return function;
+  }
+
+  uint32_t function_hash = _server_function_hash(function_name, function_name_size) % GEARMAND_DEFAULT_HASH_SIZE;
   return gearman_server_function_create(server, function_name, function_name_size, function_hash);
 }
 
@@ -140,6 +162,10 @@ void gearman_server_function_free(gearman_server_st *server, gearman_server_func
   function_key= _server_function_hash(function->function_name, function->function_name_size);
   function_key= function_key % GEARMAND_DEFAULT_HASH_SIZE;
   GEARMAND_HASH__DEL(server->function, function_key, function);
+  gearman_server_result_cache_flush(server, function);
+  gearman_server_stats_function_remove(server->stats, function->stats_slot);
+  gearman_server_latency_free(&function->queue_latency);
+  gearman_server_latency_free(&function->run_latency);
   delete [] function->function_name;
   delete function;
 }
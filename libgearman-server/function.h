@@ -67,6 +67,14 @@ GEARMAN_API
                                                            const char *function_name,
                                                            size_t function_name_size);
 
+/**
+  Find a function without adding it, NULL if the server has none by that name.
+ */
+GEARMAN_API
+  gearman_server_function_st * gearman_server_function_find(gearman_server_st *server,
+                                                            const char *function_name,
+                                                            size_t function_name_size);
+
 /**
  * Free a server function structure.
  */
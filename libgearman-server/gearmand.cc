@@ -61,6 +61,10 @@
 #include "libgearman-server/plugins.h"
 #include "libgearman-server/timer.h"
 #include "libgearman-server/queue.h"
+#include "libgearman-server/queue.hpp"
+#include "libgearman-server/replay.hpp"
+#include "libgearman-server/prefetch.hpp"
+#include "libgearman-server/plugins/queue/base.h"
 
 #include "util/memory.h"
 using namespace org::tangent;
@@ -128,6 +132,16 @@ static void gearman_server_free(gearman_server_st& server)
   /* All threads should be cleaned up before calling this. */
   assert(server.thread_list == NULL);
 
+  delete server.queue_replay;
+  server.queue_replay= NULL;
+
+  delete server.queue_prefetch;
+  server.queue_prefetch= NULL;
+
+  gearman_queue_batch_drain(&server);
+  delete server.queue_batch;
+  server.queue_batch= NULL;
+
   for (uint32_t key= 0; key < server.hashtable_buckets; key++)
   {
     while (server.job_hash[key] != NULL)
@@ -191,9 +205,18 @@ static void gearman_server_free(gearman_server_st& server)
     gearmand_debug("Unknown queue type in removal");
   }
 
+  gearman_server_result_cache_flush(&server, NULL);
+
   free(server.job_hash);
   free(server.unique_hash);
+  free(server.result_hash);
   free(server.function_hash);
+
+  /* The event base went away with the threads, which removed the event. */
+  free(server.timeout_event);
+  free(server.status_event);
+  free(server.timeout_wheel);
+  gearman_server_stats_free(server.stats);
 }
 
 /** @} */
@@ -235,7 +258,7 @@ gearmand_st *gearmand_create(gearmand_config_st *config,
   assert(_global_gearmand == NULL);
   if (_global_gearmand)
   {
-    gearmand_error("You have called gearmand_create() twice within your application.");
+    gearmand_fatal("You have called gearmand_create() twice within your application.");
     _exit(EXIT_FAILURE);
   }
 
@@ -257,6 +280,63 @@ gearmand_st *gearmand_create(gearmand_config_st *config,
     _global_gearmand= NULL;
     return NULL;
   }
+  gearmand->server.result_cache_max_size= config->config.result_cache_size();
+  gearmand->server.status_interval= config->config.status_interval();
+  gearmand->server.worker_timeout_min= config->config.worker_timeout_min();
+
+  if (config->config.queue_batch())
+  {
+    /* Without a proc thread there is nothing to take the queue off of. */
+    gearmand_queue_async_t queue_async= threads_arg ? config->config.queue_async() : GEARMAND_QUEUE_ASYNC_NONE;
+
+    gearmand->server.queue_batch= new (std::nothrow) gearmand::queue::Batch(config->config.queue_batch_delay(), queue_async);
+    if (gearmand->server.queue_batch == NULL)
+    {
+      gearmand_merror("new", gearmand::queue::Batch, 1);
+      gearmand_free(gearmand);
+      _global_gearmand= NULL;
+      return NULL;
+    }
+
+    if (gearmand_failed(gearmand->server.queue_batch->start(&gearmand->server)))
+    {
+      gearmand_free(gearmand);
+      _global_gearmand= NULL;
+      return NULL;
+    }
+  }
+
+  {
+    /* Background replay leans on the --queue-async thread to keep the queue to itself. */
+    bool background= config->config.queue_replay_background();
+    if (background and (threads_arg == 0 or config->config.queue_async() == GEARMAND_QUEUE_ASYNC_NONE))
+    {
+      gearmand_warning("--queue-replay-background requires --queue-async and at least one thread, replaying the queue at startup");
+      background= false;
+    }
+
+    gearmand->server.queue_replay= new (std::nothrow) gearmand::queue::Replay(config->config.queue_replay_threads(), background);
+    if (gearmand->server.queue_replay == NULL)
+    {
+      gearmand_merror("new", gearmand::queue::Replay, 1);
+      gearmand_free(gearmand);
+      _global_gearmand= NULL;
+      return NULL;
+    }
+  }
+
+  if (config->config.queue_lazy_data())
+  {
+    gearmand->server.queue_prefetch= new (std::nothrow) gearmand::queue::Prefetch(config->config.queue_lazy_data(),
+                                                                                  config->config.queue_prefetch());
+    if (gearmand->server.queue_prefetch == NULL)
+    {
+      gearmand_merror("new", gearmand::queue::Prefetch, 1);
+      gearmand_free(gearmand);
+      _global_gearmand= NULL;
+      return NULL;
+    }
+  }
 
   gearmand_set_log_fn(gearmand, log_function, log_context, verbose_arg);
 
@@ -308,6 +388,7 @@ static void gearmand_set_log_fn(gearmand_st *gearmand, gearmand_log_fn *function
   gearmand->log_fn= function;
   gearmand->log_context= context;
   gearmand->verbose= verbose;
+  gearmand_log_verbose= verbose;
 }
 
 bool gearmand_exceptions(gearmand_st *gearmand)
@@ -388,6 +469,31 @@ gearmand_error_t gearmand_run(gearmand_st *gearmand)
     }
     while (x < gearmand->threads);
 
+    if (gearmand->server.queue_prefetch)
+    {
+      /* The queue is only known now; it has to read a single job back. */
+      gearmand::queue::Prefetch *prefetch= gearmand->server.queue_prefetch;
+      gearmand->server.queue_prefetch= NULL;
+
+      if (gearmand->server.queue_version == QUEUE_VERSION_CLASS and
+          gearmand->server.queue.object->can_fetch() and
+          gearmand->server.queue.object->store_on_shutdown() == false)
+      {
+        gearmand->ret= prefetch->start(&gearmand->server, gearmand->server.queue.object);
+        if (gearmand_failed(gearmand->ret))
+        {
+          delete prefetch;
+          return gearmand->ret;
+        }
+        gearmand->server.queue_prefetch= prefetch;
+      }
+      else
+      {
+        gearmand_warning("--queue-lazy-data requires a queue that can read a job back, keeping job data in memory");
+        delete prefetch;
+      }
+    }
+
     gearmand_debug("replaying queue: begin");
     gearmand->ret= gearman_server_queue_replay(gearmand->server);
     if (gearmand_failed(gearmand->ret))
@@ -1223,10 +1329,36 @@ static bool gearman_server_create(gearman_server_st& server,
   server.free_job_list= NULL;
   server.free_client_list= NULL;
   server.free_worker_list= NULL;
+  server.result_count= 0;
+  server.result_cache_size= 0;
+  server.result_cache_max_size= GEARMAND_DEFAULT_RESULT_CACHE_SIZE;
+  server.result_hash= NULL;
+  server.result_lru_list= NULL;
+  server.result_lru_end= NULL;
+  server.status_interval= 0;
+  server.status_pending_count= 0;
+  server.status_pending_list= NULL;
+  server.status_event= NULL;
+  server.timeout_count= 0;
+  server.timeout_tick= 0;
+  server.timeout_wheel= NULL;
+  server.timeout_event= NULL;
+  server.worker_timeout_min= GEARMAND_DEFAULT_WORKER_TIMEOUT_MIN;
+  server.stats= NULL;
 
   server.queue_version= QUEUE_VERSION_NONE;
   server.queue.object= NULL;
   server.queue.functions= NULL;
+  server.queue_batch= NULL;
+  server.queue_replay= NULL;
+  server.queue_prefetch= NULL;
+
+  server.stats= gearman_server_stats_create();
+  if (server.stats == NULL)
+  {
+    gearmand_merror("new", server.stats, 1);
+    return false;
+  }
 
   server.function_hash= (gearman_server_function_st **) calloc(GEARMAND_DEFAULT_HASH_SIZE, sizeof(gearman_server_function_st *));
   if (server.function_hash == NULL)
@@ -1250,6 +1382,20 @@ static bool gearman_server_create(gearman_server_st& server,
     return false;
   }
 
+  server.result_hash= (gearman_server_result_st **) calloc(hashtable_buckets, sizeof(gearman_server_result_st *));
+  if (server.result_hash == NULL)
+  {
+    gearmand_merror("calloc", server.result_hash, hashtable_buckets);
+    return false;
+  }
+
+  server.timeout_wheel= (gearman_server_job_st **) calloc(GEARMAND_TIMEOUT_WHEEL_SIZE, sizeof(gearman_server_job_st *));
+  if (server.timeout_wheel == NULL)
+  {
+    gearmand_merror("calloc", server.timeout_wheel, GEARMAND_TIMEOUT_WHEEL_SIZE);
+    return false;
+  }
+
   int checked_length= -1;
   if (job_handle_prefix)
   {
@@ -63,7 +63,12 @@
 #ifdef __cplusplus
 #include <libgearman-server/connection.hpp>
 #endif
+#include <libgearman-server/stats.h>
+#include <libgearman-server/latency.h>
 #include <libgearman-server/function.h>
+#include <libgearman-server/result_cache.h>
+#include <libgearman-server/work_status.h>
+#include <libgearman-server/timeout_wheel.h>
 #include <libgearman-server/client.h>
 #include <libgearman-server/worker.h>
 #include <libgearman-server/job.h>
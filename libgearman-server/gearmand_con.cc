@@ -45,7 +45,12 @@
 #include "libgearman-server/common.h"
 #include <libgearman-server/gearmand.h>
 #include <libgearman-server/queue.h>
+#include <libgearman-server/replay.hpp>
+#include <libgearman-server/prefetch.hpp>
+#include <algorithm>
 #include <cstring>
+#include <ctime>
+#include <vector>
 
 #include <cerrno>
 #include <cassert>
@@ -135,11 +140,11 @@ void _con_ready(int, short events, void *arg)
     return;
   }
 
-  gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, 
-                     "%s:%s Ready     %6s %s",
-                     dcon->host, dcon->port,
-                     revents & POLLIN ? "POLLIN" : "",
-                     revents & POLLOUT ? "POLLOUT" : "");
+  gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM, 
+                         "%s:%s Ready     %6s %s",
+                         dcon->host, dcon->port,
+                         revents & POLLIN ? "POLLIN" : "",
+                         revents & POLLOUT ? "POLLOUT" : "");
 
   gearmand_thread_run(dcon->thread);
 }
@@ -191,7 +196,7 @@ void _server_con_worker_list_append(gearman_server_worker_st *list,
 
 void destroy_gearman_server_job_st(gearman_server_job_st* arg)
 {
-  gearmand_debug("delete gearman_server_con_st");
+  gearmand_debug_hot("delete gearman_server_con_st");
   delete arg;
 }
 
@@ -206,9 +211,9 @@ gearman_server_job_st *gearman_server_job_get_by_unique(gearman_server_st *serve
   for (server_job= server->unique_hash[key % server->hashtable_buckets];
        server_job != NULL; server_job= server_job->unique_next)
   {
-    gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "COMPARE unique \"%s\"(%u) == \"%s\"(%u)",
-                       bool(server_job->unique[0]) ? server_job->unique :  "<null>", uint32_t(strlen(server_job->unique)),
-                       unique, uint32_t(unique_length));
+    gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM, "COMPARE unique \"%s\"(%u) == \"%s\"(%u)",
+                           bool(server_job->unique[0]) ? server_job->unique :  "<null>", uint32_t(strlen(server_job->unique)),
+                           unique, uint32_t(unique_length));
 
     if (bool(server_job->unique[0]) and
         (strcmp(server_job->unique, unique) == 0))
@@ -261,7 +266,7 @@ gearmand_error_t gearman_server_job_cancel(gearman_server_st& server,
   gearmand_error_t ret= GEARMAND_NO_JOBS;
   uint32_t key= _server_job_hash(job_handle, job_handle_length);
 
-  gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "cancel: %.*s", int(job_handle_length), job_handle);
+  gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM, "cancel: %.*s", int(job_handle_length), job_handle);
 
   for (gearman_server_job_st *server_job= server.job_hash[key % server.hashtable_buckets];
        server_job != NULL;
@@ -326,9 +331,11 @@ gearman_server_job_st * gearman_server_job_peek(gearman_server_con_st *server_co
 
         int64_t current_time= (int64_t)time(NULL);
 
+        /* A job waiting for its data is handed out once it is read. */
         while(server_job && 
-              server_job->when != 0 && 
-              server_job->when > current_time)
+              ((server_job->when != 0 && 
+                server_job->when > current_time) ||
+               server_job->data_waiting))
         {
           server_job= server_job->function_next;  
         }
@@ -357,15 +364,54 @@ gearman_server_job_st * gearman_server_job_peek(gearman_server_con_st *server_co
   return NULL;
 }
 
-gearman_server_job_st *gearman_server_job_take(gearman_server_con_st *server_con)
+/*
+  Undo the take of a job whose data is not read yet or could not be: it
+  goes back to the head of its list as if never taken, without counting
+  a retry.
+*/
+static void _server_job_untake(gearman_server_job_st *server_job)
+{
+  gearman_server_function_st *function= server_job->function;
+  gearman_job_priority_t priority= server_job->priority;
+
+  GEARMAND_LIST_DEL(server_job->worker->job, server_job, worker_);
+  server_job->worker= NULL;
+  function->job_running--;
+
+  server_job->function_next= function->job_list[priority];
+  function->job_list[priority]= server_job;
+  if (function->job_end[priority] == NULL)
+  {
+    function->job_end[priority]= server_job;
+  }
+  function->job_count++;
+  function->job_queued[priority]++;
+  gearman_server_stats_function_update(Server->stats, function);
+}
+
+static bool _server_job_skipped(const std::vector<gearman_server_job_st*>& skipped,
+                                const gearman_server_job_st *server_job)
+{
+  return std::find(skipped.begin(), skipped.end(), server_job) != skipped.end();
+}
+
+/*
+  skipped holds the jobs whose data could not be read during this take,
+  so the worker gets the next job instead. When the job found is dropped
+  or skipped, again is set and NULL returned; the caller looks once more
+  rather than this recursing once per dropped job.
+*/
+static gearman_server_job_st *_server_job_take(gearman_server_con_st *server_con,
+                                               std::vector<gearman_server_job_st*>& skipped,
+                                               bool& again)
 {
   for (gearman_server_worker_st *server_worker= server_con->worker_list; server_worker; server_worker= server_worker->con_next)
   {
     if (server_worker->function and server_worker->function->job_count)
     {
-      gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "Jobs available for %.*s: %lu",
-                         (int)server_worker->function->function_name_size, server_worker->function->function_name,
-                         (unsigned long)(server_worker->function->job_count));
+      gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM, "Jobs available for %.*s: %lu",
+                             (int)server_worker->function->function_name_size, server_worker->function->function_name,
+                             (unsigned long)(server_worker->function->job_count));
 
       if (Server->flags.round_robin)
       {
@@ -393,7 +439,9 @@ gearman_server_job_st *gearman_server_job_take(gearman_server_con_st *server_con
   
       int64_t current_time= (int64_t)time(NULL);
   
-      while (server_job and server_job->when != 0 and server_job->when > current_time)
+      while (server_job and ((server_job->when != 0 and server_job->when > current_time) or
+                             server_job->data_waiting or
+                             _server_job_skipped(skipped, server_job)))
       {
         previous_job= server_job;
         server_job= server_job->function_next;  
@@ -418,16 +466,89 @@ gearman_server_job_st *gearman_server_job_take(gearman_server_con_st *server_con
           server_job->function->job_end[priority]= previous_job;
         }
         server_job->function->job_count--;
+        server_job->function->job_queued[priority]--;
 
         server_job->worker= server_worker;
         GEARMAND_LIST_ADD(server_worker->job, server_job, worker_);
         server_job->function->job_running++;
+        gearman_server_stats_function_update(Server->stats, server_job->function);
 
         if (server_job->ignore_job)
         {
           gearman_server_job_free(server_job);
-          return gearman_server_job_take(server_con);
+          again= true;
+          return NULL;
+        }
+
+        if (Server->queue_prefetch)
+        {
+          /* --queue-lazy-data left the data in the queue until now. */
+          if (server_job->data_lazy)
+          {
+            gearmand_error_t ret= Server->queue_prefetch->load(server_job);
+            if (ret == GEARMAND_IO_WAIT)
+            {
+              /* Not read yet: the worker gets another job, or sleeps until
+                 Prefetch::loaded() wakes it for this one. */
+              _server_job_untake(server_job);
+              again= true;
+              return NULL;
+            }
+
+            if (ret == GEARMAND_NO_JOBS)
+            {
+              gearmand_log_warning(GEARMAN_DEFAULT_LOG_PARAM, "Dropped job no longer in the queue: %s %.*s",
+                                   server_job->job_handle,
+                                   (int)server_job->unique_length, server_job->unique);
+              gearman_server_job_free(server_job);
+              again= true;
+              return NULL;
+            }
+
+            if (gearmand_failed(ret))
+            {
+              gearmand_gerror("failed to read job data from the queue", ret);
+              _server_job_untake(server_job);
+
+              /* It stays queued, and is read again when next taken. */
+              if (++server_job->load_failures == GEARMAND_JOB_LOAD_RETRIES)
+              {
+                gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "Data of job could not be read %u times, leaving it queued: %s %.*s",
+                                   uint32_t(server_job->load_failures),
+                                   server_job->job_handle,
+                                   (int)server_job->unique_length, server_job->unique);
+                server_job->load_failures= 0;
+              }
+              skipped.push_back(server_job);
+
+              /* Give up for now rather than read every job of a queue that is down. */
+              if (skipped.size() == GEARMAND_JOB_LOAD_RETRIES)
+              {
+                return NULL;
+              }
+
+              again= true;
+              return NULL;
+            }
+          }
+
+          Server->queue_prefetch->ahead(server_job);
+        }
+
+        server_job->taken_usec= gearman_server_latency_now();
+        gearman_server_latency_record(&server_job->function->queue_latency,
+                                      server_job->queued_usec, server_job->taken_usec);
+#if defined(HAVE_SYS_SDT_H) && HAVE_SYS_SDT_H
+        // 0 rather than a wrapped value when queued_usec was never set.
+        uint64_t queue_usec= 0;
+        if (server_job->queued_usec and server_job->taken_usec > server_job->queued_usec)
+        {
+          queue_usec= server_job->taken_usec - server_job->queued_usec;
         }
+#endif
+        GEARMAND_PROBE5(job__take, server_job->job_handle,
+                        server_job->function->function_name, server_job->function->function_name_size,
+                        server_job->data_size, queue_usec);
         
         return server_job;
       }
@@ -437,12 +558,71 @@ gearman_server_job_st *gearman_server_job_take(gearman_server_con_st *server_con
   return NULL;
 }
 
+gearman_server_job_st *gearman_server_job_take(gearman_server_con_st *server_con)
+{
+  std::vector<gearman_server_job_st*> skipped;
+  gearman_server_job_st *server_job;
+  bool again;
+  do
+  {
+    again= false;
+    server_job= _server_job_take(server_con, skipped, again);
+  } while (again);
+
+  return server_job;
+}
+
+uint32_t gearman_server_job_take_many(gearman_server_con_st *server_con,
+                                      gearman_server_job_st **jobs,
+                                      uint32_t max_jobs)
+{
+  uint32_t count= 0;
+  while (count < max_jobs)
+  {
+    gearman_server_job_st *server_job= gearman_server_job_take(server_con);
+    if (server_job == NULL)
+    {
+      break;
+    }
+
+    jobs[count++]= server_job;
+  }
+
+  return count;
+}
+
+void gearman_server_proc_wakeup(gearman_server_st *server)
+{
+  int error;
+  if ((error= pthread_mutex_lock(&(server->proc_lock))) == 0)
+  {
+    server->proc_wakeup= true;
+    if ((error= pthread_cond_signal(&(server->proc_cond))))
+    {
+      gearmand_log_fatal_perror(GEARMAN_DEFAULT_LOG_PARAM, error, "pthread_cond_signal");
+    }
+
+    if ((error= pthread_mutex_unlock(&(server->proc_lock))))
+    {
+      gearmand_log_fatal_perror(GEARMAN_DEFAULT_LOG_PARAM, error, "pthread_mutex_unlock");
+    }
+  }
+  else
+  {
+    gearmand_log_fatal_perror(GEARMAN_DEFAULT_LOG_PARAM, error, "pthread_mutex_lock");
+  }
+}
+
 void *_proc(void *data)
 {
   gearman_server_st *server= (gearman_server_st *)data;
 
   (void)gearmand_initialize_thread_logging("[  proc ]");
 
+  uint32_t status_wait= 0;
+  uint32_t timeout_wait= 0;
+  uint32_t batch_wait= 0;
+  bool replay_ready= false;
   while (1)
   {
     int pthread_error;
@@ -452,7 +632,7 @@ void *_proc(void *data)
       return NULL;
     }
 
-    while (server->proc_wakeup == false)
+    while (server->proc_wakeup == false and (replay_ready == false or server->proc_shutdown))
     {
       if (server->proc_shutdown)
       {
@@ -460,10 +640,50 @@ void *_proc(void *data)
         {
           gearmand_log_fatal_perror(GEARMAN_DEFAULT_LOG_PARAM, pthread_error, "pthread_mutex_unlock");
         }
+
+        /* A background replay keeps the queue from the --queue-async thread until it is done. */
+        if (server->queue_replay)
+        {
+          server->queue_replay->stop();
+        }
+
+        /* Held responses are handed back while their connections still exist. */
+        gearman_queue_batch_drain(server);
         return NULL;
       }
 
-      (void) pthread_cond_wait(&(server->proc_cond), &(server->proc_lock));
+      /* Wake up in time for held WORK_STATUS packets, job timeouts and the queue batch. */
+      uint32_t wait= status_wait;
+      if (timeout_wait and (wait == 0 or timeout_wait < wait))
+      {
+        wait= timeout_wait;
+      }
+      if (batch_wait and (wait == 0 or batch_wait < wait))
+      {
+        wait= batch_wait;
+      }
+
+      if (wait)
+      {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec+= wait / 1000;
+        deadline.tv_nsec+= long(wait % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+          deadline.tv_sec++;
+          deadline.tv_nsec-= 1000000000;
+        }
+
+        if (pthread_cond_timedwait(&(server->proc_cond), &(server->proc_lock), &deadline) == ETIMEDOUT)
+        {
+          break;
+        }
+      }
+      else
+      {
+        (void) pthread_cond_wait(&(server->proc_cond), &(server->proc_lock));
+      }
     }
     server->proc_wakeup= false;
 
@@ -489,6 +709,7 @@ void *_proc(void *data)
           }
 
           con->ret= gearman_server_run_command(con, &(packet->packet));
+          __atomic_sub_fetch(&con->proc_pending, 1, __ATOMIC_RELEASE);
           packet_sent = true;
           gearmand_packet_free(&(packet->packet));
           gearman_server_packet_free(packet, con->thread, false);
@@ -506,6 +727,15 @@ void *_proc(void *data)
         }
         else if (con->is_dead)
         {
+          /* Responses held for the batch still point at the connection. */
+          (void)gearman_queue_batch_flush(server, true);
+          if (__atomic_load_n(&con->proc_pending, __ATOMIC_ACQUIRE))
+          {
+            /* Not stored by the --queue-async thread yet; releasing them
+               sends the connection back through here. */
+            continue;
+          }
+
           gearman_server_con_free_workers(con);
 
           while (con->client_list != NULL)
@@ -516,6 +746,18 @@ void *_proc(void *data)
         }
       }
     }
+
+    timeout_wait= gearman_server_timeout_wheel_expire(server);
+    status_wait= gearman_server_work_status_flush(server);
+    batch_wait= gearman_queue_batch_flush(server, false);
+
+    if (server->queue_prefetch)
+    {
+      server->queue_prefetch->loaded();
+    }
+
+    /* Jobs read back by --queue-replay-background, a few chunks per pass. */
+    replay_ready= server->queue_replay and server->queue_replay->link(server);
   }
 }
 
@@ -537,9 +779,17 @@ gearman_server_job_st * gearman_server_job_create(gearman_server_st *server)
     }
   }
 
+  gearman_server_job_init(server_job);
+
+  return server_job;
+}
+
+void gearman_server_job_init(gearman_server_job_st *server_job)
+{
   server_job->ignore_job= false;
   server_job->job_queued= false;
   server_job->retries= 0;
+  server_job->load_failures= 0;
   server_job->priority= GEARMAN_JOB_PRIORITY_NORMAL;
   server_job->job_handle_key= 0;
   server_job->unique_key= 0;
@@ -553,6 +803,16 @@ gearman_server_job_st * gearman_server_job_create(gearman_server_st *server)
   server_job->unique_prev= NULL;
   server_job->worker_next= NULL;
   server_job->worker_prev= NULL;
+  server_job->timeout_next= NULL;
+  server_job->timeout_prev= NULL;
+  server_job->timeout_armed= false;
+  server_job->timeout_tick= 0;
+  server_job->queued_usec= 0;
+  server_job->taken_usec= 0;
+  server_job->data_lazy= false;
+  server_job->data_prefetch= false;
+  server_job->data_waiting= false;
+  server_job->queue_slot= 0;
   server_job->function= NULL;
   server_job->function_next= NULL;
   server_job->data= NULL;
@@ -561,8 +821,6 @@ gearman_server_job_st * gearman_server_job_create(gearman_server_st *server)
   server_job->job_handle[0]= 0;
   server_job->unique[0]= 0;
   server_job->unique_length= 0;
-
-  return server_job;
 }
 
 gearmand_error_t gearmand_con_create(gearmand_st *gearmand, int& fd,
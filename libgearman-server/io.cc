@@ -162,7 +162,7 @@ static size_t _connection_read(gearman_server_con_st *con, void *data, size_t da
             char errorString[SSL_ERROR_SIZE];
             ERR_error_string_n(ssl_error, errorString, sizeof(errorString));
             ret= GEARMAND_LOST_CONNECTION;
-            gearmand_log_info(GEARMAN_DEFAULT_LOG_PARAM, "SSL failure(%s) errno:%d", errorString);
+            gearmand_log_info_hot(GEARMAN_DEFAULT_LOG_PARAM, "SSL failure(%s) errno:%d", errorString);
             _connection_close(connection);
 
             return 0;
@@ -178,7 +178,7 @@ static size_t _connection_read(gearman_server_con_st *con, void *data, size_t da
     if (read_size == 0)
     {
       ret= GEARMAND_LOST_CONNECTION;
-      gearmand_log_info(GEARMAN_DEFAULT_LOG_PARAM, "Peer connection has called close()");
+      gearmand_log_info_hot(GEARMAN_DEFAULT_LOG_PARAM, "Peer connection has called close()");
       _connection_close(connection);
       return 0;
     }
@@ -206,7 +206,7 @@ static size_t _connection_read(gearman_server_con_st *con, void *data, size_t da
       case EHOSTDOWN:
         {
           ret= GEARMAND_LOST_CONNECTION;
-          gearmand_log_info(GEARMAN_DEFAULT_LOG_PARAM, "Peer connection has called close()");
+          gearmand_log_info_hot(GEARMAN_DEFAULT_LOG_PARAM, "Peer connection has called close()");
           _connection_close(connection);
           return 0;
         }
@@ -223,6 +223,8 @@ static size_t _connection_read(gearman_server_con_st *con, void *data, size_t da
     break;
   }
 
+  __atomic_store_n(&con->thread->bytes_in, con->thread->bytes_in + uint64_t(read_size), __ATOMIC_RELAXED);
+
   ret= GEARMAND_SUCCESS;
   return size_t(read_size);
 }
@@ -355,8 +357,8 @@ static gearmand_error_t _connection_flush(gearman_server_con_st *con)
         if (write_size == 0) // detect infinite loop?
         {
           ++loop_counter;
-          gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "send() sent zero bytes of %u",
-                             uint32_t(connection->send_buffer_size));
+          gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM, "send() sent zero bytes of %u",
+                                 uint32_t(connection->send_buffer_size));
 
           if (loop_counter > 5)
           {
@@ -400,8 +402,11 @@ static gearmand_error_t _connection_flush(gearman_server_con_st *con)
           return gearmand_perror(local_errno, "send() failed, closing connection");
         }
 
-        gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "send() %u bytes to peer",
-                           uint32_t(write_size));
+        gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM, "send() %u bytes to peer",
+                               uint32_t(write_size));
+
+        __atomic_store_n(&con->thread->bytes_out, con->thread->bytes_out + uint64_t(write_size), __ATOMIC_RELAXED);
+        GEARMAND_PROBE2(packet__flush, connection->fd(), write_size);
 
         connection->send_buffer_size-= static_cast<size_t>(write_size);
         if (connection->send_state == gearmand_io_st::GEARMAND_CON_SEND_UNIVERSAL_FLUSH_DATA)
@@ -705,7 +710,7 @@ gearmand_error_t gearman_io_send(gearman_server_con_st *con,
       {
         _connection_close(connection);
         local_ret= GEARMAND_LOST_CONNECTION;
-        gearmand_debug("closing connection after flush by request");
+        gearmand_debug_hot("closing connection after flush by request");
       }
       return local_ret;
     }
@@ -719,7 +724,7 @@ gearmand_error_t gearman_io_send(gearman_server_con_st *con,
     {
       _connection_close(connection);
       local_ret= GEARMAND_LOST_CONNECTION;
-      gearmand_debug("closing connection after flush by request");
+      gearmand_debug_hot("closing connection after flush by request");
     }
     return local_ret;
   }
@@ -795,8 +800,8 @@ gearmand_error_t gearman_io_recv(gearman_server_con_st *con, bool recv_data)
         }
         return ret;
       }
-      gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "read %lu bytes",
-                         (unsigned long)recv_size);
+      gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM, "read %lu bytes",
+                             (unsigned long)recv_size);
 
       connection->recv_buffer_size+= recv_size;
     }
@@ -1052,7 +1057,7 @@ void gearmand_sockfd_close(int& sockfd)
   }
   else
   {
-    gearmand_debug("gearmand_sockfd_close() called with an invalid socket, this was probably ok");
+    gearmand_debug_hot("gearmand_sockfd_close() called with an invalid socket, this was probably ok");
   }
 }
 
@@ -48,6 +48,8 @@
 #include <string.h>
 
 #include <libgearman-server/queue.h>
+#include <libgearman-server/queue.hpp>
+#include <libgearman-server/prefetch.hpp>
 
 /*
  * Private declarations
@@ -96,6 +98,60 @@ static gearman_server_job_st * _server_job_get_unique(gearman_server_st *server,
   return NULL;
 }
 
+/**
+ * Give a new job its handle and add it to the job and unique hashes. The
+ * unique key must already be set.
+ */
+static void _server_job_link(gearman_server_st *server,
+                             gearman_server_job_st *server_job,
+                             gearman_server_function_st *server_function)
+{
+  server_job->function= server_function;
+  server_function->job_total++;
+  server_function->job_submitted++;
+  gearman_server_stats_function_update(server->stats, server_function);
+
+  int checked_length;
+  checked_length= snprintf(server_job->job_handle, GEARMAND_JOB_HANDLE_SIZE, "%s:%u",
+                           server->job_handle_prefix, server->job_handle_count);
+
+  if (checked_length >= GEARMAND_JOB_HANDLE_SIZE || checked_length < 0)
+  {
+    gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "Job handle plus handle count beyond GEARMAND_JOB_HANDLE_SIZE: %s:%u",
+                       server->job_handle_prefix, server->job_handle_count);
+  }
+  server->job_handle_count++;
+
+  uint32_t key= server_job->unique_key % server->hashtable_buckets;
+  GEARMAND_HASH_ADD(server->unique, key, server_job, unique_);
+
+  key= _server_job_hash(server_job->job_handle,
+                        strlen(server_job->job_handle));
+  server_job->job_handle_key= key;
+  key= key % server->hashtable_buckets;
+  GEARMAND_HASH__ADD(server->job, key, server_job);
+
+  gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM, "JOB %s :%u",
+                         server_job->job_handle, server_job->job_handle_key);
+  GEARMAND_PROBE7(job__add, server_job->job_handle,
+                  server_function->function_name, server_function->function_name_size,
+                  server_job->unique, server_job->unique_length,
+                  server_job->data_size, int(server_job->priority));
+}
+
+/**
+ * Free a job that was never linked, along with its data.
+ */
+static void _server_job_discard(gearman_server_job_st *server_job)
+{
+  if (server_job->data != NULL)
+  {
+    free((void *)(server_job->data));
+  }
+
+  delete server_job;
+}
+
 /** @} */
 
 #pragma GCC diagnostic push
@@ -172,9 +228,9 @@ gearman_server_job_add_reducer(gearman_server_st *server,
 
   if (server_job == NULL)
   {
-    gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "Comparing queue %u to limit %u for priority %u",
-                       server_function->job_total, server_function->max_queue_size[priority],
-                       priority);
+    gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM, "Comparing queue %u to limit %u for priority %u",
+                           server_function->job_total, server_function->max_queue_size[priority],
+                           priority);
     if (server_function->max_queue_size[priority] > 0 &&
         server_function->job_total >= server_function->max_queue_size[priority])
     {
@@ -191,31 +247,17 @@ gearman_server_job_add_reducer(gearman_server_st *server,
 
     server_job->priority= priority;
 
-    server_job->function= server_function;
-    server_function->job_total++;
-
-    int checked_length;
-    checked_length= snprintf(server_job->job_handle, GEARMAND_JOB_HANDLE_SIZE, "%s:%u",
-                             server->job_handle_prefix, server->job_handle_count);
-
-    if (checked_length >= GEARMAND_JOB_HANDLE_SIZE || checked_length < 0)
-    {
-      gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "Job handle plus handle count beyond GEARMAND_JOB_HANDLE_SIZE: %s:%u",
-                         server->job_handle_prefix, server->job_handle_count);
-    }
-
     server_job->unique_length= unique_size;
-    checked_length= snprintf(server_job->unique, GEARMAN_MAX_UNIQUE_SIZE, "%.*s",
-                             (int)unique_size, unique);
+    int checked_length= snprintf(server_job->unique, GEARMAN_MAX_UNIQUE_SIZE, "%.*s",
+                                 (int)unique_size, unique);
     if (checked_length >= GEARMAN_MAX_UNIQUE_SIZE || checked_length < 0)
     {
       gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "We received a unique beyond GEARMAN_MAX_UNIQUE_SIZE: %.*s", (int)unique_size, unique);
     }
 
-    server->job_handle_count++;
     server_job->data= data;
     server_job->data_size= data_size;
-		server_job->when= when; 
+    server_job->when= when;
 
     if (reducer_size)
     {
@@ -226,19 +268,9 @@ gearman_server_job_add_reducer(gearman_server_st *server,
     {
       server_job->reducer[0]= 0;
     }
-		
-    server_job->unique_key= key;
-    key= key % server->hashtable_buckets;
-    GEARMAND_HASH_ADD(server->unique, key, server_job, unique_);
-
-    key= _server_job_hash(server_job->job_handle,
-                          strlen(server_job->job_handle));
-    server_job->job_handle_key= key;
-    key= key % server->hashtable_buckets;
-    GEARMAND_HASH__ADD(server->job, key, server_job);
 
-    gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "JOB %s :%u",
-                       server_job->job_handle, server_job->job_handle_key);
+    server_job->unique_key= key;
+    _server_job_link(server, server_job, server_function);
 
     if (server->state.queue_startup)
     {
@@ -260,6 +292,16 @@ gearman_server_job_add_reducer(gearman_server_st *server,
       }
 
       server_job->job_queued= true;
+
+      if (server->queue_batch)
+      {
+        server_job->queue_slot= server->queue_batch->current();
+      }
+      else if (server->queue_prefetch)
+      {
+        /* Once stored the data can be read back when the job is taken. */
+        (void)server->queue_prefetch->unload(server_job);
+      }
     }
 
     *ret_ptr= gearman_server_job_queue(server_job);
@@ -292,16 +334,246 @@ gearman_server_job_add_reducer(gearman_server_st *server,
   return server_job;
 }
 
+gearmand_error_t gearman_server_job_replay(gearman_server_st *server,
+                                           gearman_server_job_st *server_job,
+                                           const char *function_name, size_t function_name_size)
+{
+  gearman_server_function_st *server_function= gearman_server_function_get(server, function_name, function_name_size);
+  if (server_function == NULL)
+  {
+    _server_job_discard(server_job);
+    return GEARMAND_MEMORY_ALLOCATION_FAILURE;
+  }
+
+  if (server_job->unique_length)
+  {
+    gearman_server_job_st *existing= NULL;
+    if (server_job->unique_length == 1 && server_job->unique[0] == '-')
+    {
+      if (server_job->data_size)
+      {
+        existing= _server_job_get_unique(server, server_job->unique_key, server_function,
+                                         (const char*)server_job->data, server_job->data_size);
+      }
+    }
+    else
+    {
+      existing= _server_job_get_unique(server, server_job->unique_key, server_function,
+                                       server_job->unique, 0);
+    }
+
+    if (existing)
+    {
+      _server_job_discard(server_job);
+      return GEARMAND_JOB_EXISTS;
+    }
+  }
+
+  gearman_job_priority_t priority= server_job->priority;
+  if (server_function->max_queue_size[priority] > 0 &&
+      server_function->job_total >= server_function->max_queue_size[priority])
+  {
+    _server_job_discard(server_job);
+    return GEARMAND_JOB_QUEUE_FULL;
+  }
+
+  _server_job_link(server, server_job, server_function);
+  server_job->job_queued= true;
+
+  gearmand_error_t ret= gearman_server_job_queue(server_job);
+  if (gearmand_failed(ret))
+  {
+    gearman_server_job_free(server_job);
+  }
+
+  return ret;
+}
+
+static gearman_server_job_st *_server_job_get_stored(gearman_server_st *server,
+                                                     const char *unique, size_t unique_size,
+                                                     const char *function_name, size_t function_name_size,
+                                                     uint64_t queue_slot)
+{
+  uint32_t key= _server_job_hash(unique, unique_size);
+  for (gearman_server_job_st *server_job= server->unique_hash[key % server->hashtable_buckets];
+       server_job != NULL; server_job= server_job->unique_next)
+  {
+    if (server_job->queue_slot == queue_slot &&
+        server_job->unique_key == key &&
+        server_job->unique_length == unique_size &&
+        memcmp(server_job->unique, unique, unique_size) == 0 &&
+        server_job->function->function_name_size == function_name_size &&
+        memcmp(server_job->function->function_name, function_name, function_name_size) == 0)
+    {
+      return server_job;
+    }
+  }
+
+  return NULL;
+}
+
+void gearman_server_job_unload(gearman_server_st *server,
+                               const char *unique, size_t unique_size,
+                               const char *function_name, size_t function_name_size,
+                               uint64_t queue_slot)
+{
+  if (server->queue_prefetch == NULL or unique_size == 0)
+  {
+    return;
+  }
+
+  gearman_server_job_st *server_job= _server_job_get_stored(server,
+                                                            unique, unique_size,
+                                                            function_name, function_name_size,
+                                                            queue_slot);
+  if (server_job and server_job->job_queued)
+  {
+    (void)server->queue_prefetch->unload(server_job);
+  }
+}
+
+gearman_server_job_st *gearman_server_job_unstore(gearman_server_st *server,
+                                                  const char *unique, size_t unique_size,
+                                                  const char *function_name, size_t function_name_size,
+                                                  uint64_t queue_slot)
+{
+  if (unique_size == 0)
+  {
+    return NULL;
+  }
+
+  gearman_server_job_st *server_job= _server_job_get_stored(server,
+                                                            unique, unique_size,
+                                                            function_name, function_name_size,
+                                                            queue_slot);
+  if (server_job == NULL or server_job->job_queued == false)
+  {
+    return NULL;
+  }
+
+  /* Clients that attached to the job since get the same answer as on a cancel. */
+  for (gearman_server_client_st* client= server_job->client_list; client != NULL; client= client->job_next)
+  {
+    gearmand_error_t ret= gearman_server_io_packet_add(client->con, false,
+                                                       GEARMAN_MAGIC_RESPONSE,
+                                                       GEARMAN_COMMAND_WORK_FAIL,
+                                                       server_job->job_handle,
+                                                       (size_t)strlen(server_job->job_handle),
+                                                       NULL);
+    if (gearmand_failed(ret))
+    {
+      gearmand_log_gerror_warn(GEARMAN_DEFAULT_LOG_PARAM, ret, "Failed to send WORK_FAIL packet to %s:%s", client->con->host(), client->con->port());
+    }
+  }
+
+  server_job->job_queued= false;
+
+  if (server_job->worker)
+  {
+    gearmand_log_warning(GEARMAN_DEFAULT_LOG_PARAM, "Job already running was not stored: %s %.*s",
+                         server_job->job_handle,
+                         (int)server_job->unique_length, server_job->unique);
+  }
+  else
+  {
+    server_job->ignore_job= true;
+  }
+
+  return server_job;
+}
+
+gearmand_error_t gearman_server_job_hash_resize(gearman_server_st *server, uint32_t buckets)
+{
+  if (buckets <= server->hashtable_buckets)
+  {
+    return GEARMAND_SUCCESS;
+  }
+
+  gearman_server_job_st **job_hash= (gearman_server_job_st **) calloc(buckets, sizeof(gearman_server_job_st *));
+  gearman_server_job_st **unique_hash= (gearman_server_job_st **) calloc(buckets, sizeof(gearman_server_job_st *));
+  gearman_server_result_st **result_hash= (gearman_server_result_st **) calloc(buckets, sizeof(gearman_server_result_st *));
+  if (job_hash == NULL or unique_hash == NULL or result_hash == NULL)
+  {
+    free(job_hash);
+    free(unique_hash);
+    free(result_hash);
+    return gearmand_merror("calloc", gearman_server_job_st *, buckets);
+  }
+
+  for (uint32_t x= 0; x < server->hashtable_buckets; ++x)
+  {
+    gearman_server_job_st *server_job= server->job_hash[x];
+    while (server_job != NULL)
+    {
+      gearman_server_job_st *next= server_job->next;
+      uint32_t key= server_job->job_handle_key % buckets;
+      if (job_hash[key] != NULL)
+      {
+        job_hash[key]->prev= server_job;
+      }
+      server_job->next= job_hash[key];
+      server_job->prev= NULL;
+      job_hash[key]= server_job;
+      server_job= next;
+    }
+
+    server_job= server->unique_hash[x];
+    while (server_job != NULL)
+    {
+      gearman_server_job_st *next= server_job->unique_next;
+      uint32_t key= server_job->unique_key % buckets;
+      if (unique_hash[key] != NULL)
+      {
+        unique_hash[key]->unique_prev= server_job;
+      }
+      server_job->unique_next= unique_hash[key];
+      server_job->unique_prev= NULL;
+      unique_hash[key]= server_job;
+      server_job= next;
+    }
+
+    gearman_server_result_st *result= server->result_hash[x];
+    while (result != NULL)
+    {
+      gearman_server_result_st *next= result->next;
+      uint32_t key= result->unique_key % buckets;
+      if (result_hash[key] != NULL)
+      {
+        result_hash[key]->prev= result;
+      }
+      result->next= result_hash[key];
+      result->prev= NULL;
+      result_hash[key]= result;
+      result= next;
+    }
+  }
+
+  free(server->job_hash);
+  free(server->unique_hash);
+  free(server->result_hash);
+  server->job_hash= job_hash;
+  server->unique_hash= unique_hash;
+  server->result_hash= result_hash;
+  server->hashtable_buckets= buckets;
+
+  return GEARMAND_SUCCESS;
+}
+
 void gearman_server_job_free(gearman_server_job_st *server_job)
 {
   if (server_job)
   {
+    GEARMAND_PROBE3(job__free, server_job->job_handle,
+                    server_job->function->function_name, server_job->function->function_name_size);
+    gearman_server_timeout_wheel_remove(Server, server_job);
+
     if (server_job->worker != NULL)
     {
       server_job->function->job_running--;
     }
 
     server_job->function->job_total--;
+    gearman_server_stats_function_update(Server->stats, server_job->function);
 
     if (server_job->data != NULL)
     {
@@ -309,6 +581,11 @@ void gearman_server_job_free(gearman_server_job_st *server_job)
       server_job->data= NULL;
     }
 
+    if (server_job->data_prefetch and Server->queue_prefetch)
+    {
+      Server->queue_prefetch->forget(server_job);
+    }
+
     while (server_job->client_list != NULL)
     {
       gearman_server_client_free(server_job->client_list);
@@ -341,6 +618,12 @@ gearmand_error_t gearman_server_job_queue(gearman_server_job_st *job)
 {
   if (job->worker)
   {
+    gearman_server_timeout_wheel_remove(Server, job);
+
+    /* A status held from the run given up on goes out before the job is
+       dropped or its progress reset. */
+    gearman_server_work_status_flush_job(Server, job);
+
     job->retries++;
     if (Server->job_retries != 0 && Server->job_retries == job->retries)
     {
@@ -348,6 +631,7 @@ gearmand_error_t gearman_server_job_queue(gearman_server_job_st *job)
                           "Dropped job due to max retry count: %s %.*s",
                           job->job_handle,
                           (int)job->unique_length, job->unique);
+      job->function->job_failed++;
 
       for (gearman_server_client_st* client= job->client_list; client != NULL; client= client->job_next)
       {
@@ -383,11 +667,40 @@ gearmand_error_t gearman_server_job_queue(gearman_server_job_st *job)
     GEARMAND_LIST_DEL(job->worker->job, job, worker_);
     job->worker= NULL;
     job->function->job_running--;
+    job->function->job_retried++;
+    gearman_server_stats_function_update(Server->stats, job->function);
     job->function_next= NULL;
     job->numerator= 0;
     job->denominator= 0;
   }
 
+  gearman_server_job_wakeup(job);
+
+  /* Queue the job to be run. */
+  if (job->function->job_list[job->priority] == NULL)
+  {
+    job->function->job_list[job->priority]= job;
+  }
+  else
+  {
+    job->function->job_end[job->priority]->function_next= job;
+  }
+
+  job->function->job_end[job->priority]= job;
+  job->function->job_count++;
+  job->function->job_queued[job->priority]++;
+  job->queued_usec= gearman_server_latency_now();
+  GEARMAND_PROBE4(job__queue, job->job_handle,
+                  job->function->function_name, job->function->function_name_size,
+                  int(job->priority));
+  gearman_server_stats_function_update(Server->stats, job->function);
+
+  return GEARMAND_SUCCESS;
+}
+#pragma GCC diagnostic pop
+
+void gearman_server_job_wakeup(gearman_server_job_st *job)
+{
   /* Queue NOOP for possible sleeping workers. */
   if (job->function->worker_list != NULL)
   {
@@ -420,20 +733,4 @@ gearmand_error_t gearman_server_job_queue(gearman_server_job_st *job)
 
     job->function->worker_list= worker;
   }
-
-  /* Queue the job to be run. */
-  if (job->function->job_list[job->priority] == NULL)
-  {
-    job->function->job_list[job->priority]= job;
-  }
-  else
-  {
-    job->function->job_end[job->priority]->function_next= job;
-  }
-
-  job->function->job_end[job->priority]= job;
-  job->function->job_count++;
-
-  return GEARMAND_SUCCESS;
 }
-#pragma GCC diagnostic pop
@@ -93,6 +93,50 @@ GEARMAN_API
 gearman_server_job_st *
 gearman_server_job_create(gearman_server_st *server);
 
+/**
+ * Reset every field of a server job structure. Touches nothing but the
+ * job, so it is safe to call from any thread.
+ */
+GEARMAN_API
+void gearman_server_job_init(gearman_server_job_st *server_job);
+
+/**
+ * Add a job read back from the persistent queue. The job's unique, unique
+ * key, priority, data and when must be set. Takes ownership of the job,
+ * which is freed with its data unless GEARMAND_SUCCESS is returned.
+ */
+GEARMAN_API
+gearmand_error_t gearman_server_job_replay(gearman_server_st *server,
+                                           gearman_server_job_st *server_job,
+                                           const char *function_name, size_t function_name_size);
+
+/**
+ * Drop the data of the job stored by the --queue-batch batch queue_slot,
+ * for --queue-lazy-data. A job submitted again since then is left alone.
+ */
+GEARMAN_API
+void gearman_server_job_unload(gearman_server_st *server,
+                               const char *unique, size_t unique_size,
+                               const char *function_name, size_t function_name_size,
+                               uint64_t queue_slot);
+
+/**
+ * Drop the job the --queue-batch batch queue_slot failed to store, as
+ * gearman_server_job_cancel() would, and return it. A job already taken
+ * by a worker is left to run.
+ */
+GEARMAN_API
+gearman_server_job_st *gearman_server_job_unstore(gearman_server_st *server,
+                                                  const char *unique, size_t unique_size,
+                                                  const char *function_name, size_t function_name_size,
+                                                  uint64_t queue_slot);
+
+/**
+ * Grow the job, unique and result hash tables to buckets entries.
+ */
+GEARMAN_API
+gearmand_error_t gearman_server_job_hash_resize(gearman_server_st *server, uint32_t buckets);
+
 /**
  * Free a server job structure.
  */
@@ -122,16 +166,38 @@ GEARMAN_API
 gearman_server_job_st *
 gearman_server_job_take(gearman_server_con_st *server_con);
 
+/**
+ * Start running up to max_jobs jobs for the server worker connection,
+ * storing them in jobs. Returns the number of jobs taken, which is less
+ * than max_jobs once no job is left. The jobs are taken one at a time
+ * as by gearman_server_job_take(), not as a unit: each job taken is
+ * running whatever happens to the rest, and the caller must assign or
+ * give back every one of them.
+ */
+GEARMAN_API
+uint32_t gearman_server_job_take_many(gearman_server_con_st *server_con,
+                                      gearman_server_job_st **jobs,
+                                      uint32_t max_jobs);
+
 /**
  * Queue a job to be run.
  */
 GEARMAN_API
 gearmand_error_t gearman_server_job_queue(gearman_server_job_st *server_job);
 
+/**
+ * Queue a NOOP for the sleeping workers of a queued job's function.
+ */
+GEARMAN_API
+void gearman_server_job_wakeup(gearman_server_job_st *server_job);
+
 uint32_t _server_job_hash(const char *key, size_t key_size);
 
 void *_proc(void *data);
 
+/* Wakes up the proc thread from any other thread. */
+void gearman_server_proc_wakeup(gearman_server_st *server);
+
 void _server_con_worker_list_append(gearman_server_worker_st *list,
                                     gearman_server_worker_st *worker);
 
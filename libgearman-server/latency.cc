@@ -0,0 +1,174 @@
+/*  vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * 
+ *  Gearmand client and server library.
+ *
+ *  Copyright (C) 2011 Data Differential, http://datadifferential.com/
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *
+ *      * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following disclaimer
+ *  in the documentation and/or other materials provided with the
+ *  distribution.
+ *
+ *      * The names of its contributors may not be used to endorse or
+ *  promote products derived from this software without specific prior
+ *  written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+
+/**
+ * @file
+ * @brief Latency histogram definitions
+ */
+
+#include "gear_config.h"
+#include "libgearman-server/common.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#pragma GCC diagnostic push
+#ifndef __INTEL_COMPILER
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#endif
+
+#define GEARMAND_LATENCY_SUB_BUCKETS (1 << GEARMAND_LATENCY_SUB_BUCKET_BITS)
+
+/*
+ * Private definitions
+ */
+
+static inline uint32_t _latency_bucket(uint64_t value)
+{
+  if (value < GEARMAND_LATENCY_SUB_BUCKETS)
+  {
+    return uint32_t(value);
+  }
+
+  uint32_t high_bit= 63 - uint32_t(__builtin_clzll(value));
+  if (high_bit > GEARMAND_LATENCY_MAX_BIT)
+  {
+    return GEARMAND_LATENCY_BUCKETS -1;
+  }
+
+  uint32_t shift= high_bit - GEARMAND_LATENCY_SUB_BUCKET_BITS;
+  return ((shift +1) << GEARMAND_LATENCY_SUB_BUCKET_BITS) | uint32_t((value >> shift) & (GEARMAND_LATENCY_SUB_BUCKETS -1));
+}
+
+static inline uint64_t _latency_bucket_highest(uint32_t bucket)
+{
+  if (bucket < GEARMAND_LATENCY_SUB_BUCKETS)
+  {
+    return bucket;
+  }
+
+  uint32_t shift= (bucket >> GEARMAND_LATENCY_SUB_BUCKET_BITS) -1;
+  uint64_t sub_bucket= GEARMAND_LATENCY_SUB_BUCKETS + (bucket & (GEARMAND_LATENCY_SUB_BUCKETS -1));
+
+  return ((sub_bucket +1) << shift) -1;
+}
+
+/*
+ * Public definitions
+ */
+
+uint64_t gearman_server_latency_now(void)
+{
+  struct timespec now;
+  if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+  {
+    return 0;
+  }
+
+  return uint64_t(now.tv_sec) * 1000000 + uint64_t(now.tv_nsec / 1000);
+}
+
+void gearman_server_latency_init(gearman_server_latency_st *latency)
+{
+  memset(latency, 0, sizeof(gearman_server_latency_st));
+}
+
+void gearman_server_latency_free(gearman_server_latency_st *latency)
+{
+  free(latency->bucket);
+  latency->bucket= NULL;
+}
+
+void gearman_server_latency_record(gearman_server_latency_st *latency,
+                                   uint64_t since, uint64_t now)
+{
+  if (since == 0)
+  {
+    return;
+  }
+
+  if (latency->bucket == NULL)
+  {
+    latency->bucket= (uint64_t *)calloc(GEARMAND_LATENCY_BUCKETS, sizeof(uint64_t));
+    if (latency->bucket == NULL)
+    {
+      gearmand_merror("calloc", uint64_t, GEARMAND_LATENCY_BUCKETS);
+      return;
+    }
+  }
+
+  uint64_t value= now > since ? now - since : 0;
+
+  latency->bucket[_latency_bucket(value)]++;
+  latency->count++;
+  if (value > latency->max)
+  {
+    latency->max= value;
+  }
+}
+
+uint64_t gearman_server_latency_percentile(const gearman_server_latency_st *latency,
+                                           double percentile)
+{
+  if (latency->count == 0)
+  {
+    return 0;
+  }
+
+  uint64_t rank= uint64_t((percentile / 100.0) * double(latency->count) + 0.5);
+  if (rank == 0)
+  {
+    rank= 1;
+  }
+
+  uint64_t seen= 0;
+  for (uint32_t x= 0; x < GEARMAND_LATENCY_BUCKETS; x++)
+  {
+    seen+= latency->bucket[x];
+    if (seen >= rank)
+    {
+      uint64_t highest= _latency_bucket_highest(x);
+      return highest < latency->max ? highest : latency->max;
+    }
+  }
+
+  return latency->max;
+}
+#pragma GCC diagnostic pop
@@ -0,0 +1,103 @@
+/*  vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * 
+ *  Gearmand client and server library.
+ *
+ *  Copyright (C) 2011 Data Differential, http://datadifferential.com/
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *
+ *      * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following disclaimer
+ *  in the documentation and/or other materials provided with the
+ *  distribution.
+ *
+ *      * The names of its contributors may not be used to endorse or
+ *  promote products derived from this software without specific prior
+ *  written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+
+/**
+ * @file
+ * @brief Latency histogram declarations
+ */
+
+#pragma once
+
+#include <libgearman-server/struct/latency.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @addtogroup gearman_server_latency Latency Histogram Declarations
+ * @ingroup gearman_server
+ *
+ * Every function keeps one histogram for the time jobs wait in the queue
+ * and one for the time workers take to finish them. Jobs are stamped with
+ * the monotonic clock when they are queued and when a worker takes them.
+ * Histograms are only touched by the thread running commands.
+ *
+ * @{
+ */
+
+/**
+ * Current monotonic time in microseconds.
+ */
+GEARMAN_API
+uint64_t gearman_server_latency_now(void);
+
+/**
+ * Clear a histogram.
+ */
+GEARMAN_API
+void gearman_server_latency_init(gearman_server_latency_st *latency);
+
+/**
+ * Free the buckets of a histogram.
+ */
+GEARMAN_API
+void gearman_server_latency_free(gearman_server_latency_st *latency);
+
+/**
+ * Add the time from since until now to a histogram. A since of 0 means the
+ * job was never stamped and nothing is recorded.
+ */
+GEARMAN_API
+void gearman_server_latency_record(gearman_server_latency_st *latency,
+                                   uint64_t since, uint64_t now);
+
+/**
+ * Return the highest value, in microseconds, of the bucket holding the
+ * given percentile (0 to 100), or 0 if the histogram is empty.
+ */
+GEARMAN_API
+uint64_t gearman_server_latency_percentile(const gearman_server_latency_st *latency,
+                                           double percentile);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
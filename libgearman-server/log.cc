@@ -68,6 +68,8 @@
 #endif
 
 
+gearmand_verbose_t gearmand_log_verbose= GEARMAND_VERBOSE_DEBUG;
+
 static pthread_key_t logging_key;
 static pthread_once_t intitialize_log_once= PTHREAD_ONCE_INIT;
 
@@ -46,6 +46,7 @@
 
 #include "libgearman-1.0/string.h"
 #include "libgearman-server/error.h"
+#include "libgearman-server/verbose.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -117,6 +118,29 @@ void gearmand_log_warning(const char *position, const char *function, const char
 void gearmand_log_debug(const char *position, const char *function, const char *format, ...);
 #define gearmand_debug(_mesg) gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, (_mesg))
 
+/**
+ * Verbosity the server was started with, a copy of gearmand_st::verbose
+ * that the hot path macros below can test without a function call.
+ */
+extern gearmand_verbose_t gearmand_log_verbose;
+
+/*
+  Debug and info logging for the paths every job goes through. The
+  arguments are only evaluated when the level is enabled. When configured
+  with --disable-debug-log the calls are still type checked but compile to
+  nothing.
+*/
+#if !defined(GEARMAND_DEBUG_LOG) || GEARMAND_DEBUG_LOG
+# define gearmand_log_debug_hot(...) \
+  do { if (__builtin_expect(gearmand_log_verbose >= GEARMAND_VERBOSE_DEBUG, 0)) { gearmand_log_debug(__VA_ARGS__); } } while (0)
+# define gearmand_log_info_hot(...) \
+  do { if (__builtin_expect(gearmand_log_verbose >= GEARMAND_VERBOSE_INFO, 0)) { gearmand_log_info(__VA_ARGS__); } } while (0)
+#else
+# define gearmand_log_debug_hot(...) do { if (0) { gearmand_log_debug(__VA_ARGS__); } } while (0)
+# define gearmand_log_info_hot(...) do { if (0) { gearmand_log_info(__VA_ARGS__); } } while (0)
+#endif
+#define gearmand_debug_hot(_mesg) gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM, (_mesg))
+
 #ifdef __cplusplus
 }
 #endif
@@ -43,6 +43,7 @@
 
 #include "gear_config.h"
 #include "libgearman-server/common.h"
+#include "libgearman-server/queue.hpp"
 
 #include <libgearman/command.h>
 
@@ -137,6 +138,94 @@ void gearman_server_packet_free(gearman_server_packet_st *packet,
   }
 }
 
+/*
+  NOOP and NO_JOB carry no arguments, so every copy of them is the same
+  twelve bytes. They are queued as views of these instead of being packed.
+*/
+static const char _noop_response[GEARMAND_PACKET_HEADER_SIZE]=
+  { '\0', 'R', 'E', 'S', 0, 0, 0, char(GEARMAN_COMMAND_NOOP), 0, 0, 0, 0 };
+static const char _no_job_response[GEARMAND_PACKET_HEADER_SIZE]=
+  { '\0', 'R', 'E', 'S', 0, 0, 0, char(GEARMAN_COMMAND_NO_JOB), 0, 0, 0, 0 };
+
+static const char *_packet_preencoded(enum gearman_magic_t magic, gearman_command_t command)
+{
+  if (magic == GEARMAN_MAGIC_RESPONSE)
+  {
+    if (command == GEARMAN_COMMAND_NOOP)
+    {
+      return _noop_response;
+    }
+
+    if (command == GEARMAN_COMMAND_NO_JOB)
+    {
+      return _no_job_response;
+    }
+  }
+
+  return NULL;
+}
+
+/*
+  Size the arguments first so they are written once, into args_buffer when
+  they fit or a single allocation when they do not. Going through
+  gearmand_packet_create() per argument re-pointed every argument and
+  could realloc() on each one.
+*/
+static gearmand_error_t _packet_encode(gearmand_packet_st *packet,
+                                       const void *arg, va_list ap)
+{
+  const gearman_command_info_st *info= gearman_command_info(packet->command);
+  size_t offset= packet->magic == GEARMAN_MAGIC_TEXT ? 0 : GEARMAND_PACKET_HEADER_SIZE;
+
+  va_list size_ap;
+  va_copy(size_ap, ap);
+  size_t args_size= offset;
+  uint8_t argc= 0;
+  for (const void *next= arg; next; next= va_arg(size_ap, void *))
+  {
+    size_t arg_size= va_arg(size_ap, size_t);
+    if (argc < info->argc)
+    {
+      packet->arg_size[argc++]= arg_size;
+      args_size+= arg_size;
+    }
+    else if (info->data and packet->data == NULL)
+    {
+      packet->data= static_cast<const char *>(next);
+      packet->data_size= arg_size;
+    }
+    else
+    {
+      va_end(size_ap);
+      gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "too many arguments for command(%s)", info->name);
+      return GEARMAND_TOO_MANY_ARGS;
+    }
+  }
+  va_end(size_ap);
+
+  packet->args= packet->args_buffer;
+  if (args_size >= GEARMAND_ARGS_BUFFER_SIZE)
+  {
+    packet->args= static_cast<char *>(malloc(args_size));
+    if (packet->args == NULL)
+    {
+      return gearmand_perror(errno, "malloc");
+    }
+  }
+  packet->args_size= args_size;
+
+  for (uint8_t x= 0; x < argc; ++x)
+  {
+    packet->arg[x]= packet->args + offset;
+    memcpy(packet->arg[x], x ? va_arg(ap, void *) : arg, packet->arg_size[x]);
+    (void)va_arg(ap, size_t);
+    offset+= packet->arg_size[x];
+  }
+  packet->argc= argc;
+
+  return gearmand_packet_pack_header(packet);
+}
+
 gearmand_error_t gearman_server_io_packet_add(gearman_server_con_st *con,
                                               bool take_data,
                                               enum gearman_magic_t magic,
@@ -144,7 +233,6 @@ gearmand_error_t gearman_server_io_packet_add(gearman_server_con_st *con,
                                               const void *arg, ...)
 {
   gearman_server_packet_st *server_packet;
-  va_list ap;
 
   server_packet= gearman_server_packet_create(con->thread, false);
   if (server_packet == NULL)
@@ -154,37 +242,67 @@ gearmand_error_t gearman_server_io_packet_add(gearman_server_con_st *con,
 
   server_packet->packet.reset(magic, command);
 
-  va_start(ap, arg);
-
-  while (arg)
+  const char *preencoded= arg ? NULL : _packet_preencoded(magic, command);
+  if (preencoded)
   {
-    size_t arg_size= va_arg(ap, size_t);
+    server_packet->packet.args= const_cast<char *>(preencoded);
+    server_packet->packet.args_size= GEARMAND_PACKET_HEADER_SIZE;
+    server_packet->packet.options.args_view= true;
+    server_packet->packet.options.complete= true;
+  }
+  else
+  {
+    va_list ap;
+    va_start(ap, arg);
+    gearmand_error_t ret= _packet_encode(&(server_packet->packet), arg, ap);
+    va_end(ap);
 
-    gearmand_error_t ret= gearmand_packet_create(&(server_packet->packet), arg, arg_size);
     if (gearmand_failed(ret))
     {
-      va_end(ap);
       gearmand_packet_free(&(server_packet->packet));
       gearman_server_packet_free(server_packet, con->thread, false);
       return ret;
     }
+  }
 
-    arg= va_arg(ap, void *);
+  if (take_data)
+  {
+    server_packet->packet.options.free_data= true;
   }
 
+  gearman_server_io_packet_queue(con, server_packet);
+
+  return GEARMAND_SUCCESS;
+}
+
+gearmand_error_t gearman_server_packet_rewrite(gearman_server_packet_st *server_packet,
+                                               bool take_data,
+                                               enum gearman_magic_t magic,
+                                               gearman_command_t command,
+                                               const void *arg, ...)
+{
+  gearmand_packet_free(&(server_packet->packet));
+  server_packet->packet.reset(magic, command);
+
+  va_list ap;
+  va_start(ap, arg);
+  gearmand_error_t ret= _packet_encode(&(server_packet->packet), arg, ap);
   va_end(ap);
 
-  gearmand_error_t ret= gearmand_packet_pack_header(&(server_packet->packet));
-  if (gearmand_failed(ret))
+  if (gearmand_success(ret) and take_data)
   {
-    gearmand_packet_free(&(server_packet->packet));
-    gearman_server_packet_free(server_packet, con->thread, false);
-    return ret;
+    server_packet->packet.options.free_data= true;
   }
 
-  if (take_data)
+  return ret;
+}
+
+void gearman_server_io_packet_queue(gearman_server_con_st *con,
+                                    gearman_server_packet_st *server_packet)
+{
+  if (Server->queue_batch and Server->queue_batch->hold(con, server_packet))
   {
-    server_packet->packet.options.free_data= true;
+    return;
   }
 
   int error;
@@ -202,8 +320,6 @@ gearmand_error_t gearman_server_io_packet_add(gearman_server_con_st *con,
   }
 
   gearman_server_con_io_add(con);
-
-  return GEARMAND_SUCCESS;
 }
 
 void gearman_server_io_packet_remove(gearman_server_con_st *con)
@@ -232,6 +348,8 @@ void gearman_server_io_packet_remove(gearman_server_con_st *con)
 void gearman_server_proc_packet_add(gearman_server_con_st *con,
                                     gearman_server_packet_st *packet)
 {
+  GEARMAND_PROBE2(proc__enqueue, con->con.fd(), int(packet->packet.command));
+
   int error;
   if ((error= pthread_mutex_lock(&con->thread->lock)) == 0)
   {
@@ -269,6 +387,8 @@ gearman_server_proc_packet_remove(gearman_server_con_st *con)
     {
       gearmand_log_fatal_perror(GEARMAN_DEFAULT_LOG_PARAM, error, "pthread_mutex_lock");
     }
+
+    GEARMAND_PROBE2(proc__dequeue, con->con.fd(), int(server_packet->packet.command));
   }
 
   return server_packet;
@@ -308,6 +428,15 @@ inline static gearmand_error_t packet_create_arg(gearmand_packet_st *packet,
     return GEARMAND_SUCCESS;
   }
 
+  if (packet->options.args_view)
+  {
+    gearmand_error_t ret= gearmand_packet_own_args(packet);
+    if (gearmand_failed(ret))
+    {
+      return ret;
+    }
+  }
+
   if (packet->args_size == 0 and packet->magic != GEARMAN_MAGIC_TEXT)
   {
     packet->args_size= GEARMAND_PACKET_HEADER_SIZE;
@@ -319,7 +448,7 @@ inline static gearmand_error_t packet_create_arg(gearmand_packet_st *packet,
   }
   else
   {
-    gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "resizing packet buffer");
+    gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM, "resizing packet buffer");
     if (packet->args == packet->args_buffer)
     {
       packet->args= (char *)realloc(NULL, packet->args_size + arg_size);
@@ -371,6 +500,7 @@ void gearmand_packet_st::reset(enum gearman_magic_t magic_, gearman_command_t co
 {
   options.complete= false;
   options.free_data= false;
+  options.args_view= false;
 
   magic= magic_;
   command= command_;
@@ -388,9 +518,68 @@ gearmand_error_t gearmand_packet_create(gearmand_packet_st *packet,
   return packet_create_arg(packet, arg, arg_size);
 }
 
+gearmand_error_t gearmand_packet_view(gearmand_packet_st *packet,
+                                      const void *arg, size_t arg_size)
+{
+  if (packet->argc < gearman_command_info(packet->command)->argc)
+  {
+    if (packet->args_size == 0 and packet->magic == GEARMAN_MAGIC_TEXT)
+    {
+      packet->args= static_cast<char *>(const_cast<void *>(arg));
+      packet->options.args_view= true;
+    }
+
+    if (packet->options.args_view and packet->args + packet->args_size == arg)
+    {
+      packet->arg[packet->argc]= packet->args + packet->args_size;
+      packet->arg_size[packet->argc]= arg_size;
+      packet->args_size+= arg_size;
+      packet->argc++;
+
+      return GEARMAND_SUCCESS;
+    }
+  }
+
+  return packet_create_arg(packet, arg, arg_size);
+}
+
+gearmand_error_t gearmand_packet_own_args(gearmand_packet_st *packet)
+{
+  if (packet->options.args_view == false)
+  {
+    return GEARMAND_SUCCESS;
+  }
+
+  char *args= packet->args_buffer;
+  if (packet->args_size >= GEARMAND_ARGS_BUFFER_SIZE)
+  {
+    args= static_cast<char *>(malloc(packet->args_size));
+    if (args == NULL)
+    {
+      return gearmand_perror(errno, "malloc");
+    }
+  }
+
+  memcpy(args, packet->args, packet->args_size);
+  for (uint8_t x= 0; x < packet->argc; ++x)
+  {
+    packet->arg[x]= args + (packet->arg[x] - packet->args);
+  }
+
+  packet->args= args;
+  packet->options.args_view= false;
+
+  return GEARMAND_SUCCESS;
+}
+
 void gearmand_packet_free(gearmand_packet_st *packet)
 {
-  if (packet->args != packet->args_buffer && packet->args != NULL)
+  if (packet->options.args_view)
+  {
+    packet->args= NULL;
+    packet->options.args_view= false;
+  }
+  else if (packet->args != packet->args_buffer && packet->args != NULL)
   {
     free(packet->args);
     packet->args= NULL;
@@ -90,6 +90,24 @@ gearmand_error_t gearman_server_io_packet_add(gearman_server_con_st *con,
                                               gearman_command_t command,
                                               const void *arg, ...);
 
+/**
+ * Replace the contents of a packet that has not been sent yet, as
+ * gearman_server_io_packet_add() would have built them.
+ */
+gearmand_error_t gearman_server_packet_rewrite(gearman_server_packet_st *server_packet,
+                                               bool take_data,
+                                               enum gearman_magic_t magic,
+                                               gearman_command_t command,
+                                               const void *arg, ...);
+
+/**
+ * Queue an encoded server packet for sending to a connection, or hold it
+ * while a --queue-batch has adds waiting to be stored. Only for the
+ * thread running commands.
+ */
+void gearman_server_io_packet_queue(gearman_server_con_st *con,
+                                    gearman_server_packet_st *server_packet);
+
 /**
  * Remove the first server packet structure from io queue for a connection.
  */
@@ -139,6 +157,23 @@ GEARMAN_INTERNAL_API
   gearmand_error_t gearmand_packet_create(gearmand_packet_st *packet,
                                               const void *arg, size_t arg_size);
 
+/**
+ * Add an argument that stays in the caller's buffer. The argument must
+ * directly follow the previous one, otherwise it is copied as with
+ * gearmand_packet_create(). The buffer must outlive the packet, or
+ * gearmand_packet_own_args() must be called before it is reused.
+ */
+GEARMAN_INTERNAL_API
+  gearmand_error_t gearmand_packet_view(gearmand_packet_st *packet,
+                                        const void *arg, size_t arg_size);
+
+/**
+ * Copy viewed arguments into the packet so it no longer depends on the
+ * buffer they were read from.
+ */
+GEARMAN_INTERNAL_API
+  gearmand_error_t gearmand_packet_own_args(gearmand_packet_st *packet);
+
 /**
  * Pack header.
  */
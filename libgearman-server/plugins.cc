@@ -99,6 +99,8 @@ void initialize(boost::program_options::options_description &all)
   }
 #endif
 
+  queue::initialize_wal();
+
   gearmand::queue::load_options(all);
 }
 
@@ -108,6 +108,64 @@ gearmand_error_t Context::store(gearman_server_st *server,
   return GEARMAND_SUCCESS;
 }
 
+gearmand_error_t Context::store_batch(gearman_server_st *server,
+                                      const Job *jobs, size_t count)
+{
+  if (_store_on_shutdown == false)
+  {
+    return add_batch(server, jobs, count);
+  }
+
+  return GEARMAND_SUCCESS;
+}
+
+gearmand_error_t Context::add_batch(gearman_server_st *server,
+                                    const Job *jobs, size_t count)
+{
+  for (size_t x= 0; x < count; ++x)
+  {
+    gearmand_error_t ret= add(server,
+                              jobs[x].unique, jobs[x].unique_size,
+                              jobs[x].function_name, jobs[x].function_name_size,
+                              jobs[x].data, jobs[x].data_size,
+                              jobs[x].priority,
+                              jobs[x].when);
+    if (gearmand_failed(ret))
+    {
+      return ret;
+    }
+  }
+
+  return GEARMAND_SUCCESS;
+}
+
+gearmand_error_t Context::done_batch(gearman_server_st *server,
+                                     const Job *jobs, size_t count)
+{
+  for (size_t x= 0; x < count; ++x)
+  {
+    gearmand_error_t ret= done(server,
+                               jobs[x].unique, jobs[x].unique_size,
+                               jobs[x].function_name, jobs[x].function_name_size);
+    if (gearmand_failed(ret))
+    {
+      return ret;
+    }
+  }
+
+  return GEARMAND_SUCCESS;
+}
+
+gearmand_error_t Context::fetch(const char *, size_t,
+                                const char *, size_t,
+                                void*& data, size_t& data_size)
+{
+  data= NULL;
+  data_size= 0;
+
+  return GEARMAND_QUEUE_ERROR;
+}
+
 void Context::save_job(gearman_server_st& server,
                        const gearman_server_job_st* server_job)
 {
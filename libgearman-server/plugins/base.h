@@ -91,6 +91,20 @@ private:
 
 namespace queue {
 
+/*
+  One job of a batch. done_batch() only looks at unique and function_name.
+*/
+struct Job {
+  const char *unique;
+  size_t unique_size;
+  const char *function_name;
+  size_t function_name_size;
+  const void *data;
+  size_t data_size;
+  gearman_job_priority_t priority;
+  int64_t when;
+};
+
 class Context {
 public:
   Context():
@@ -110,6 +124,9 @@ public:
                          gearman_job_priority_t priority,
                          int64_t when);
 
+  gearmand_error_t store_batch(gearman_server_st *server,
+                               const Job *jobs, size_t count);
+
 protected:
   virtual gearmand_error_t add(gearman_server_st *server,
                                const char *unique,
@@ -120,6 +137,14 @@ protected:
                                size_t data_size,
                                gearman_job_priority_t priority,
                                int64_t when)= 0;
+
+  /*
+    Stores every job of a batch, which the server follows with a single
+    flush(). The default calls add() for each job, backends override it
+    to use one round trip or statement for the whole batch.
+  */
+  virtual gearmand_error_t add_batch(gearman_server_st *server,
+                                     const Job *jobs, size_t count);
 public:
 
   virtual gearmand_error_t flush(gearman_server_st *server)= 0;
@@ -130,6 +155,20 @@ public:
                                 const char *function_name,
                                 size_t function_name_size)= 0;
 
+  // Calls done() for each job unless overridden.
+  virtual gearmand_error_t done_batch(gearman_server_st *server,
+                                      const Job *jobs, size_t count);
+
+  /*
+    Drops what add_batch() and done_batch() stored since the last
+    flush(), after one of them failed. Returns false if the queue has
+    nothing to take back, the default, and those writes stand.
+  */
+  virtual bool rollback(gearman_server_st*)
+  {
+    return false;
+  }
+
   virtual gearmand_error_t replay(gearman_server_st *server)= 0;
 
   void save_job(gearman_server_st& server,
@@ -142,11 +181,34 @@ public:
                                      const void *data, size_t data_size,
                                      gearman_job_priority_t priority,
                                      int64_t when);
+
+  // Called by replay() with the number of jobs it is about to add, if known.
+  static void replay_expect(gearman_server_st *server, uint64_t count);
+
+  /*
+    Reads the data of one stored job back for --queue-lazy-data, on the
+    prefetch thread. Only called if can_fetch(). The data is malloc()ed
+    for the caller; GEARMAND_NO_JOBS if the queue does not hold the job.
+  */
+  virtual bool can_fetch()
+  {
+    return false;
+  }
+
+  virtual gearmand_error_t fetch(const char *unique, size_t unique_size,
+                                 const char *function_name, size_t function_name_size,
+                                 void*& data, size_t& data_size);
+
   void store_on_shutdown(bool store_on_shutdown_)
   {
     _store_on_shutdown= store_on_shutdown_;
   }
 
+  bool store_on_shutdown() const
+  {
+    return _store_on_shutdown;
+  }
+
   bool has_error()
   {
     return _error_string.size();
@@ -92,6 +92,21 @@ static gearmand_error_t gearmand_packet_unpack_header(gearmand_packet_st *packet
   return GEARMAND_SUCCESS;
 }
 
+/*
+  The consumed part of the receive buffer is reused before the rest of the
+  packet arrives, so a partial packet must hold its own copy.
+*/
+static gearmand_error_t _packet_wait(gearmand_packet_st *packet)
+{
+  gearmand_error_t ret= gearmand_packet_own_args(packet);
+  if (gearmand_failed(ret))
+  {
+    return ret;
+  }
+
+  return GEARMAND_IO_WAIT;
+}
+
 class Geartext : public gearmand::protocol::Context {
 
 public:
@@ -154,8 +169,8 @@ public:
             arg_size-= size_t(ptr - ((uint8_t *)data));
           }
 
-          ret_ptr= gearmand_packet_create(packet, data, ptr == NULL ? arg_size :
-                                          size_t(ptr - ((uint8_t *)data)));
+          ret_ptr= gearmand_packet_view(packet, data, ptr == NULL ? arg_size :
+                                        size_t(ptr - ((uint8_t *)data)));
           if (ret_ptr != GEARMAND_SUCCESS)
           {
             return used_size;
@@ -170,9 +185,13 @@ public:
         return 0;
       }
 
-      packet->args= packet->args_buffer;
+      /*
+        Arguments are left in the receive buffer and only copied if the
+        packet has to wait for more data, or outlives the read.
+      */
+      packet->args= (char *)data;
       packet->args_size= GEARMAND_PACKET_HEADER_SIZE;
-      memcpy(packet->args, data, GEARMAND_PACKET_HEADER_SIZE);
+      packet->options.args_view= true;
 
       if (gearmand_failed(ret_ptr= gearmand_packet_unpack_header(packet)))
       {
@@ -198,12 +217,12 @@ public:
           gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM,
                              "Possible protocol error for %s, received only %u args",
                              gearman_command_info(packet->command)->name, packet->argc);
-          ret_ptr= GEARMAND_IO_WAIT;
+          ret_ptr= _packet_wait(packet);
           return used_size;
         }
 
         size_t arg_size= size_t(ptr - (((uint8_t *)data) + used_size)) +1;
-        if (gearmand_failed((ret_ptr= gearmand_packet_create(packet, ((uint8_t *)data) + used_size, arg_size))))
+        if (gearmand_failed((ret_ptr= gearmand_packet_view(packet, ((uint8_t *)data) + used_size, arg_size))))
         {
           return used_size;
         }
@@ -215,11 +234,11 @@ public:
       {
         if ((data_size - used_size) < packet->data_size)
         {
-          ret_ptr= GEARMAND_IO_WAIT;
+          ret_ptr= _packet_wait(packet);
           return used_size;
         }
 
-        ret_ptr= gearmand_packet_create(packet, ((uint8_t *)data) + used_size, packet->data_size);
+        ret_ptr= gearmand_packet_view(packet, ((uint8_t *)data) + used_size, packet->data_size);
         if (gearmand_failed(ret_ptr))
         {
           return used_size;
@@ -74,11 +74,12 @@ class HTTPtext : public gearmand::protocol::Context
 {
 public:
 
-  HTTPtext() :
+  HTTPtext(bool metrics_) :
     _method(gearmand::protocol::httpd::TRACE),
     _sent_header(false),
     _background(false),
     _keep_alive(false),
+    _metrics(metrics_),
     _http_response(gearmand::protocol::httpd::HTTP_OK)
   {
   }
@@ -110,8 +111,32 @@ public:
         return 0;
       }
 
-    default:
     case GEARMAN_COMMAND_TEXT:
+      if (_metrics)
+      {
+        /* The body is the packet data, which is sent after the header. */
+        size_t pack_size= (size_t)snprintf((char *)send_buffer, send_buffer_size,
+                                           "HTTP/1.0 200 OK\r\n"
+                                           "Server: Gearman/" PACKAGE_VERSION "\r\n"
+                                           "Content-Type: text/plain; version=0.0.4\r\n"
+                                           "Content-Length: %" PRIu64 "\r\n"
+                                           "Connection: close\r\n"
+                                           "\r\n",
+                                           uint64_t(packet->data_size));
+        if (pack_size > send_buffer_size)
+        {
+          ret_ptr= GEARMAND_FLUSH_DATA;
+          return 0;
+        }
+
+        gearman_io_set_option(&connection->con, GEARMAND_CON_CLOSE_AFTER_FLUSH, true);
+        ret_ptr= GEARMAND_SUCCESS;
+        return pack_size;
+      }
+      /* Only the metrics listener sends text, to any other it is a bad packet. */
+      /* fall through */
+
+    default:
     case GEARMAN_COMMAND_CAN_DO:
     case GEARMAN_COMMAND_CANT_DO:
     case GEARMAN_COMMAND_RESET_ABILITIES:
@@ -149,6 +174,9 @@ public:
     case GEARMAN_COMMAND_JOB_ASSIGN_ALL:
     case GEARMAN_COMMAND_GET_STATUS_UNIQUE:
     case GEARMAN_COMMAND_STATUS_RES_UNIQUE:
+    case GEARMAN_COMMAND_SUBMIT_JOB_BATCH:
+    case GEARMAN_COMMAND_JOB_CREATED_BATCH:
+    case GEARMAN_COMMAND_GRAB_JOBS:
     case GEARMAN_COMMAND_MAX:
       gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM,
                          "Bad packet command: gearmand_command_t:%s", 
@@ -402,6 +430,11 @@ public:
       return 0;
     }
 
+    if (_metrics)
+    {
+      return unpack_metrics(packet, data, data_size, offset, uri, size_t(uri_size), ret_ptr);
+    }
+
     /* Loop through all the headers looking for ones of interest. */
     const char *header;
     size_t header_size;
@@ -556,6 +589,63 @@ public:
     return offset;
   }
 
+  /*
+    The metrics listener answers GET for / and /metrics with the "metrics"
+    text command, anything else is refused.
+  */
+  size_t unpack_metrics(gearmand_packet_st *packet,
+                        const void *data, const size_t data_size, size_t offset,
+                        const char *uri, const size_t uri_size,
+                        gearmand_error_t& ret_ptr)
+  {
+    const char *header;
+    size_t header_size;
+    while ((header= parse_line(data, data_size, header_size, offset)) != NULL)
+    {
+      if (header_size == 0)
+      {
+        break;
+      }
+    }
+
+    if (header == NULL)
+    {
+      ret_ptr= GEARMAND_IO_WAIT;
+      return 0;
+    }
+
+    if (method() != gearmand::protocol::httpd::GET
+        or (uri_size != 0 and (uri_size != 7 or strncmp(uri, "metrics", 7) != 0)))
+    {
+      set_response(method() == gearmand::protocol::httpd::GET
+                   ? gearmand::protocol::httpd::HTTP_NOT_FOUND
+                   : gearmand::protocol::httpd::HTTP_METHOD_NOT_ALLOWED);
+
+      packet->magic= GEARMAN_MAGIC_REQUEST;
+      packet->command= GEARMAN_COMMAND_ECHO_REQ;
+      if ((ret_ptr= gearmand_packet_pack_header(packet)) != GEARMAND_SUCCESS)
+      {
+        return 0;
+      }
+      packet->data_size= 0;
+      packet->data= NULL;
+
+      return offset;
+    }
+
+    set_response(gearmand::protocol::httpd::HTTP_OK);
+    packet->magic= GEARMAN_MAGIC_TEXT;
+    packet->command= GEARMAN_COMMAND_TEXT;
+    if ((ret_ptr= gearmand_packet_create(packet, "metrics", sizeof("metrics"))) != GEARMAND_SUCCESS
+        or (ret_ptr= gearmand_packet_create(packet, "prometheus", sizeof("prometheus"))) != GEARMAND_SUCCESS)
+    {
+      return 0;
+    }
+
+    ret_ptr= GEARMAND_SUCCESS;
+    return offset;
+  }
+
   bool background()
   {
     return _background;
@@ -634,6 +724,7 @@ private:
   bool _sent_header;
   bool _background;
   bool _keep_alive;
+  bool _metrics; // Connection came in on the metrics listener.
   std::string global_port;
   gearmand::protocol::httpd::response_t _http_response;
   std::vector<char> content;
@@ -648,7 +739,23 @@ static gearmand_error_t _http_con_add(gearman_server_con_st *connection)
 {
   gearmand_info("HTTP connection made");
 
-  HTTPtext *http= new (std::nothrow) HTTPtext;
+  HTTPtext *http= new (std::nothrow) HTTPtext(false);
+  if (http == NULL)
+  {
+    gearmand_error("new");
+    return GEARMAND_MEMORY_ALLOCATION_FAILURE;
+  }
+
+  connection->set_protocol(http);
+
+  return GEARMAND_SUCCESS;
+}
+
+static gearmand_error_t _http_metrics_con_add(gearman_server_con_st *connection)
+{
+  gearmand_info("HTTP metrics connection made");
+
+  HTTPtext *http= new (std::nothrow) HTTPtext(true);
   if (http == NULL)
   {
     gearmand_error("new");
@@ -667,7 +774,8 @@ HTTP::HTTP() :
   Plugin("HTTP")
 {
   command_line_options().add_options()
-    ("http-port", boost::program_options::value(&_port)->default_value(GEARMAND_PROTOCOL_HTTP_DEFAULT_PORT), "Port to listen on.");
+    ("http-port", boost::program_options::value(&_port)->default_value(GEARMAND_PROTOCOL_HTTP_DEFAULT_PORT), "Port to listen on.")
+    ("http-metrics-port", boost::program_options::value(&_metrics_port), "Port to serve Prometheus metrics on, disabled if not given.");
 }
 
 HTTP::~HTTP()
@@ -677,7 +785,14 @@ HTTP::~HTTP()
 gearmand_error_t HTTP::start(gearmand_st *gearmand)
 {
   gearmand_info("Initializing HTTP");
-  return gearmand_port_add(gearmand, _port.c_str(), _http_con_add, _http_con_remove);
+  gearmand_error_t ret= gearmand_port_add(gearmand, _port.c_str(), _http_con_add, _http_con_remove);
+  if (ret == GEARMAND_SUCCESS and _metrics_port.empty() == false)
+  {
+    gearmand_log_info(GEARMAN_DEFAULT_LOG_PARAM, "Serving metrics on port %s", _metrics_port.c_str());
+    ret= gearmand_port_add(gearmand, _metrics_port.c_str(), _http_metrics_con_add, _http_con_remove);
+  }
+
+  return ret;
 }
 
 } // namespace protocol
@@ -63,6 +63,7 @@ public:
 
 private:
   std::string _port;
+  std::string _metrics_port;
 };
 
 } // namespace protocol
@@ -52,3 +52,5 @@
 #include <libgearman-server/plugins/queue/redis/queue.h>
 
 #include <libgearman-server/plugins/queue/mysql/queue.h>
+
+#include <libgearman-server/plugins/queue/wal/queue.h>
@@ -54,6 +54,9 @@
  * Default values.
  */
 #define GEARMAND_QUEUE_MYSQL_DEFAULT_TABLE "gearman_queue"
+#define GEARMAND_QUEUE_MYSQL_DEFAULT_BATCH 64
+#define GEARMAND_QUEUE_MYSQL_MAX_BATCH 1024
+#define GEARMAND_QUEUE_MYSQL_BATCH_BYTES (1024 * 1024)
 
 namespace gearmand { namespace plugins { namespace queue { class MySQL; } } }
 
@@ -72,17 +75,30 @@ public:
   ~MySQL();
 
   gearmand_error_t initialize();
-  gearmand_error_t prepareAddStatement();
-  gearmand_error_t prepareDoneStatement();
+
+  /*
+    Adds and dones are held until flush and then written as multi-row
+    INSERTs and DELETE ... IN (...) lists. Only one kind is held at a time
+    so that a done and a later add of the same unique keep their order.
+    Everything written between two flushes is one transaction, committed
+    by flush() and dropped by rollback().
+  */
+  gearmand_error_t add(const char *unique, size_t unique_size,
+                       const char *function_name, size_t function_name_size,
+                       const void *data, size_t data_size,
+                       gearman_job_priority_t priority, int64_t when);
+  gearmand_error_t done(const char *unique, size_t unique_size,
+                        const char *function_name, size_t function_name_size);
+  gearmand_error_t flush();
+  bool rollback();
 
   MYSQL *con;
-  MYSQL_STMT *add_stmt;
-  MYSQL_STMT *done_stmt;
   std::string mysql_host;
   std::string mysql_user;
   std::string mysql_password;
   std::string mysql_db;
   std::string mysql_table;
+  uint32_t mysql_batch;
 
   in_port_t port() const
   {
@@ -90,14 +106,45 @@ public:
   }
 
 private:
+  enum kind_t {
+    ADD,
+    DONE
+  };
+
+  struct row_st {
+    std::string unique;
+    std::string function_name;
+    std::string data;
+    int priority;
+    long long when;
+  };
+
+  MYSQL_STMT *statement(kind_t kind, size_t rows);
+  void close_statements();
+  gearmand_error_t begin();
+  gearmand_error_t write();
+  gearmand_error_t execute(kind_t kind, const row_st *rows, size_t count);
+  gearmand_error_t insert_each(const row_st *rows, size_t count);
+
   in_port_t _port;
+  kind_t _kind;
+  std::vector<row_st> _pending;
+  bool _transaction;
+  bool _written; // a statement of the transaction has run
+
+  // Statements are prepared for power of two row counts, index is log2(rows).
+  std::vector<MYSQL_STMT*> _add_stmts;
+  std::vector<MYSQL_STMT*> _done_stmts;
 };
 
 MySQL::MySQL() :
   Queue("MySQL"),
   con(NULL),
-  add_stmt(NULL),
-  done_stmt(NULL)
+  mysql_batch(GEARMAND_QUEUE_MYSQL_DEFAULT_BATCH),
+  _port(3306),
+  _kind(ADD),
+  _transaction(false),
+  _written(false)
   {
     command_line_options().add_options()
       ("mysql-host", boost::program_options::value(&mysql_host)->default_value("localhost"), "MySQL host.")
@@ -105,15 +152,14 @@ MySQL::MySQL() :
       ("mysql-user", boost::program_options::value(&mysql_user)->default_value(""), "MySQL user.")
       ("mysql-password", boost::program_options::value(&mysql_password)->default_value(""), "MySQL user password.")
       ("mysql-db", boost::program_options::value(&mysql_db)->default_value(""), "MySQL database.")
-      ("mysql-table", boost::program_options::value(&mysql_table)->default_value(GEARMAND_QUEUE_MYSQL_DEFAULT_TABLE), "MySQL table name.");
+      ("mysql-table", boost::program_options::value(&mysql_table)->default_value(GEARMAND_QUEUE_MYSQL_DEFAULT_TABLE), "MySQL table name.")
+      ("mysql-batch", boost::program_options::value(&mysql_batch)->default_value(GEARMAND_QUEUE_MYSQL_DEFAULT_BATCH), "Most rows written by one INSERT or DELETE statement.");
   }
 
 MySQL::~MySQL()
 {
-  if (add_stmt)
-  {
-    mysql_stmt_close(add_stmt);
-  }
+  close_statements();
+
   if (con)
   {
     mysql_close(con);
@@ -122,52 +168,372 @@ MySQL::~MySQL()
 
 gearmand_error_t MySQL::initialize()
 {
+  if (mysql_batch == 0 or mysql_batch > GEARMAND_QUEUE_MYSQL_MAX_BATCH)
+  {
+    gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "--mysql-batch must be between 1 and %u", GEARMAND_QUEUE_MYSQL_MAX_BATCH);
+    return GEARMAND_QUEUE_ERROR;
+  }
+
   return _initialize(Gearmand()->server, this);
 }
 
-gearmand_error_t MySQL::prepareAddStatement()
+void MySQL::close_statements()
 {
-  char query_buffer[1024];
+  for (size_t x= 0; x < _add_stmts.size(); ++x)
+  {
+    if (_add_stmts[x])
+    {
+      mysql_stmt_close(_add_stmts[x]);
+      _add_stmts[x]= NULL;
+    }
+  }
 
-  if ((this->add_stmt= mysql_stmt_init(this->con)) == NULL)
+  for (size_t x= 0; x < _done_stmts.size(); ++x)
   {
-    gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "mysql_stmt_init failed: %s", mysql_error(this->con));
-    return GEARMAND_QUEUE_ERROR;
+    if (_done_stmts[x])
+    {
+      mysql_stmt_close(_done_stmts[x]);
+      _done_stmts[x]= NULL;
+    }
   }
+}
 
-  int query_buffer_length= snprintf(query_buffer, sizeof(query_buffer),
-                                    "INSERT INTO %s "
-                                    "(unique_key, function_name, priority, data, when_to_run) "
-                                    "VALUES(?, ?, ?, ?, ?)", this->mysql_table.c_str());
+MYSQL_STMT *MySQL::statement(kind_t kind, size_t rows)
+{
+  size_t slot= 0;
+  while ((size_t(1) << (slot + 1)) <= rows)
+  {
+    slot++;
+  }
+
+  std::vector<MYSQL_STMT*>& cache= kind == ADD ? _add_stmts : _done_stmts;
+  if (cache.size() <= slot)
+  {
+    cache.resize(slot + 1, NULL);
+  }
+
+  if (cache[slot])
+  {
+    return cache[slot];
+  }
 
-  if (mysql_stmt_prepare(this->add_stmt, query_buffer, query_buffer_length))
+  std::string query;
+  if (kind == ADD)
   {
-    gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "mysql_stmt_prepare failed: %s", mysql_error(this->con));
+    query.append("INSERT INTO ").append(mysql_table);
+    query.append(" (unique_key, function_name, priority, data, when_to_run) VALUES ");
+    for (size_t x= 0; x < rows; ++x)
+    {
+      query.append(x ? ",(?, ?, ?, ?, ?)" : "(?, ?, ?, ?, ?)");
+    }
+  }
+  else if (rows == 1)
+  {
+    query.append("DELETE FROM ").append(mysql_table);
+    query.append(" WHERE unique_key=? AND function_name=?");
+  }
+  else
+  {
+    query.append("DELETE FROM ").append(mysql_table);
+    query.append(" WHERE (unique_key, function_name) IN (");
+    for (size_t x= 0; x < rows; ++x)
+    {
+      query.append(x ? ",(?, ?)" : "(?, ?)");
+    }
+    query.append(")");
+  }
+
+  MYSQL_STMT *stmt;
+  if ((stmt= mysql_stmt_init(con)) == NULL)
+  {
+    gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "mysql_stmt_init failed: %s", mysql_error(con));
+    return NULL;
+  }
+
+  if (mysql_stmt_prepare(stmt, query.c_str(), query.size()))
+  {
+    gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "mysql_stmt_prepare failed: %s", mysql_stmt_error(stmt));
+    mysql_stmt_close(stmt);
+    return NULL;
+  }
+
+  cache[slot]= stmt;
+
+  return stmt;
+}
+
+/*
+  Runs a single statement for count rows, where count is a power of two.
+  A statement lost with the connection is prepared again once, as long as
+  nothing of the transaction went with it.
+*/
+gearmand_error_t MySQL::execute(kind_t kind, const row_st *rows, size_t count)
+{
+  const size_t columns= kind == ADD ? 5 : 2;
+  std::vector<MYSQL_BIND> bind(count * columns);
+  std::vector<unsigned long> lengths(count * 3);
+  memset(&bind[0], 0, sizeof(MYSQL_BIND) * bind.size());
+
+  for (size_t x= 0; x < count; ++x)
+  {
+    MYSQL_BIND *row= &bind[x * columns];
+    unsigned long *length= &lengths[x * 3];
+
+    length[0]= (unsigned long)rows[x].unique.size();
+    row[0].buffer_type= MYSQL_TYPE_STRING;
+    row[0].buffer= (char *)rows[x].unique.data();
+    row[0].buffer_length= length[0];
+    row[0].length= &length[0];
+
+    length[1]= (unsigned long)rows[x].function_name.size();
+    row[1].buffer_type= MYSQL_TYPE_STRING;
+    row[1].buffer= (char *)rows[x].function_name.data();
+    row[1].buffer_length= length[1];
+    row[1].length= &length[1];
+
+    if (kind == ADD)
+    {
+      row[2].buffer_type= MYSQL_TYPE_LONG;
+      row[2].buffer= (char *)&rows[x].priority;
+
+      length[2]= (unsigned long)rows[x].data.size();
+      row[3].buffer_type= MYSQL_TYPE_LONG_BLOB;
+      row[3].buffer= (char *)rows[x].data.data();
+      row[3].buffer_length= length[2];
+      row[3].length= &length[2];
+
+      row[4].buffer_type= MYSQL_TYPE_LONGLONG;
+      row[4].buffer= (char *)&rows[x].when;
+    }
+  }
+
+  for (uint32_t attempt= 0; ; ++attempt)
+  {
+    MYSQL_STMT *stmt;
+    if ((stmt= statement(kind, count)) == NULL)
+    {
+      return GEARMAND_QUEUE_ERROR;
+    }
+
+    if (mysql_stmt_bind_param(stmt, &bind[0]) == 0 and mysql_stmt_execute(stmt) == 0)
+    {
+      return GEARMAND_SUCCESS;
+    }
+
+    unsigned int error= mysql_stmt_errno(stmt);
+    if (attempt == 0 and (error == CR_NO_PREPARE_STMT or error == CR_SERVER_LOST or error == CR_SERVER_GONE_ERROR))
+    {
+      gearmand_log_warning(GEARMAN_DEFAULT_LOG_PARAM, "MySQL queue: %s, preparing statements again", mysql_stmt_error(stmt));
+      close_statements();
+
+      if (error != CR_NO_PREPARE_STMT and _transaction)
+      {
+        /* The reconnect starts without the transaction. */
+        _transaction= false;
+        if (_written)
+        {
+          return GEARMAND_QUEUE_ERROR;
+        }
+
+        gearmand_error_t ret;
+        if (gearmand_failed(ret= begin()))
+        {
+          return ret;
+        }
+      }
+      continue;
+    }
+
+    gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "mysql_stmt_execute failed: %s", mysql_stmt_error(stmt));
     return GEARMAND_QUEUE_ERROR;
   }
+}
+
+gearmand_error_t MySQL::begin()
+{
+  if (mysql_query(con, "START TRANSACTION"))
+  {
+    gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "MySQL queue: START TRANSACTION failed: %s", mysql_error(con));
+    return GEARMAND_QUEUE_ERROR;
+  }
+
+  _transaction= true;
+  _written= false;
 
   return GEARMAND_SUCCESS;
 }
 
-gearmand_error_t MySQL::prepareDoneStatement()
+gearmand_error_t MySQL::add(const char *unique, size_t unique_size,
+                            const char *function_name, size_t function_name_size,
+                            const void *data, size_t data_size,
+                            gearman_job_priority_t priority, int64_t when)
 {
-  char query_buffer[1024];
+  gearmand_error_t ret= GEARMAND_SUCCESS;
+  if (_kind != ADD)
+  {
+    ret= write();
+    _kind= ADD;
+  }
+
+  _pending.resize(_pending.size() + 1);
+  row_st& row= _pending.back();
+  row.unique.assign(unique, unique_size);
+  row.function_name.assign(function_name, function_name_size);
+  row.data.assign(static_cast<const char *>(data), data_size);
+  row.priority= int(priority);
+  row.when= (long long)when;
+
+  return ret;
+}
 
-  if ((this->done_stmt= mysql_stmt_init(this->con)) == NULL)
+gearmand_error_t MySQL::done(const char *unique, size_t unique_size,
+                             const char *function_name, size_t function_name_size)
+{
+  gearmand_error_t ret= GEARMAND_SUCCESS;
+  if (_kind != DONE)
   {
-    gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "mysql_stmt_init failed: %s", mysql_error(this->con));
-    return GEARMAND_QUEUE_ERROR;
+    ret= write();
+    _kind= DONE;
   }
 
-  int query_buffer_length= snprintf(query_buffer, sizeof(query_buffer),
-                                    "DELETE FROM %s "
-                                    "WHERE unique_key=? "
-                                    "AND function_name=?", this->mysql_table.c_str());
+  _pending.resize(_pending.size() + 1);
+  row_st& row= _pending.back();
+  row.unique.assign(unique, unique_size);
+  row.function_name.assign(function_name, function_name_size);
+  row.priority= 0;
+  row.when= 0;
 
-  if (mysql_stmt_prepare(this->done_stmt, query_buffer, query_buffer_length))
+  return ret;
+}
+
+gearmand_error_t MySQL::flush()
+{
+  /* One row is a statement of its own, as without --queue-batch. */
+  if (_transaction == false and _pending.size() == 1)
   {
-    gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "mysql_stmt_prepare failed: %s", mysql_error(this->con));
-    return GEARMAND_QUEUE_ERROR;
+    gearmand_error_t ret= execute(_kind, &_pending[0], 1);
+    _pending.clear();
+    return ret;
+  }
+
+  gearmand_error_t ret= write();
+  if (gearmand_failed(ret))
+  {
+    (void)rollback();
+    return ret;
+  }
+
+  if (_transaction)
+  {
+    _transaction= false;
+    if (mysql_query(con, "COMMIT"))
+    {
+      gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "MySQL queue: COMMIT failed: %s", mysql_error(con));
+      (void)rollback();
+      return GEARMAND_QUEUE_ERROR;
+    }
+  }
+
+  return GEARMAND_SUCCESS;
+}
+
+bool MySQL::rollback()
+{
+  _pending.clear();
+
+  if (_transaction)
+  {
+    _transaction= false;
+    if (mysql_query(con, "ROLLBACK"))
+    {
+      /* A transaction lost with the connection was rolled back by the server. */
+      gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "MySQL queue: ROLLBACK failed: %s", mysql_error(con));
+    }
+  }
+
+  return true;
+}
+
+/*
+  Pending rows go out in chunks of at most --mysql-batch rows, or about a
+  megabyte of payload so a chunk stays under max_allowed_packet. Chunk sizes
+  are rounded down to a power of two to bound the prepared statements held.
+  Stops at the first chunk that fails, which leaves the transaction to be
+  rolled back.
+*/
+gearmand_error_t MySQL::write()
+{
+  if (_pending.empty())
+  {
+    return GEARMAND_SUCCESS;
+  }
+
+  gearmand_error_t ret= GEARMAND_SUCCESS;
+  if (_transaction == false and gearmand_failed(ret= begin()))
+  {
+    _pending.clear();
+    return ret;
+  }
+
+  size_t x= 0;
+  while (x < _pending.size())
+  {
+    size_t rows= 0;
+    size_t bytes= 0;
+    while (x + rows < _pending.size() and rows < mysql_batch)
+    {
+      bytes+= _pending[x + rows].data.size();
+      if (rows and bytes > GEARMAND_QUEUE_MYSQL_BATCH_BYTES)
+      {
+        break;
+      }
+      rows++;
+    }
+
+    size_t count= 1;
+    while (count * 2 <= rows)
+    {
+      count*= 2;
+    }
+
+    gearmand_error_t rc= execute(_kind, &_pending[x], count);
+    if (gearmand_failed(rc) and _kind == ADD and count > 1 and _transaction)
+    {
+      rc= insert_each(&_pending[x], count);
+    }
+
+    if (gearmand_failed(rc))
+    {
+      ret= rc;
+      break;
+    }
+    _written= true;
+    x+= count;
+  }
+
+  _pending.clear();
+
+  return ret;
+}
+
+/*
+  A failed statement is undone on its own, leaving the rest of the
+  transaction. A multi-row INSERT the server will not take in one go (one
+  over max_allowed_packet) is tried again one row at a time; a row that
+  still fails fails the chunk, and with it the transaction.
+*/
+gearmand_error_t MySQL::insert_each(const row_st *rows, size_t count)
+{
+  gearmand_log_warning(GEARMAN_DEFAULT_LOG_PARAM, "MySQL queue: INSERT of %u rows failed, inserting them one at a time", uint32_t(count));
+
+  for (size_t x= 0; x < count; ++x)
+  {
+    gearmand_error_t ret;
+    if (gearmand_failed(ret= execute(ADD, &rows[x], 1)))
+    {
+      return ret;
+    }
+    _written= true;
   }
 
   return GEARMAND_SUCCESS;
@@ -193,6 +559,8 @@ static gearmand_error_t _mysql_queue_add(gearman_server_st *server, void *contex
 
 static gearmand_error_t _mysql_queue_flush(gearman_server_st *server, void *context);
 
+static bool _mysql_queue_rollback(gearman_server_st *server, void *context);
+
 static gearmand_error_t _mysql_queue_done(gearman_server_st *server, void *context,
         const char *unique,
         size_t unique_size,
@@ -212,7 +580,7 @@ gearmand_error_t _initialize(gearman_server_st& server, gearmand::plugins::queue
 
   gearmand_log_info(GEARMAN_DEFAULT_LOG_PARAM,"Initializing MySQL module");
 
-  gearman_server_set_queue(server, queue, _mysql_queue_add, _mysql_queue_flush, _mysql_queue_done, _mysql_queue_replay);
+  gearman_server_set_queue(server, queue, _mysql_queue_add, _mysql_queue_flush, _mysql_queue_done, _mysql_queue_replay, _mysql_queue_rollback);
 
   queue->con= mysql_init(queue->con);
 
@@ -264,16 +632,6 @@ gearmand_error_t _initialize(gearman_server_st& server, gearmand::plugins::queue
 
   mysql_free_result(result);
 
-  if (queue->prepareAddStatement() == GEARMAND_QUEUE_ERROR)
-  {
-    return GEARMAND_QUEUE_ERROR;
-  }
-
-  if (queue->prepareDoneStatement() == GEARMAND_QUEUE_ERROR)
-  {
-    return GEARMAND_QUEUE_ERROR;
-  }
-
   return GEARMAND_SUCCESS;
 }
 
@@ -290,152 +648,59 @@ static gearmand_error_t _mysql_queue_add(gearman_server_st *, void *context,
         gearman_job_priority_t priority,
         int64_t when)
 {
-  MYSQL_BIND    bind[5];
-
   gearmand::plugins::queue::MySQL *queue= (gearmand::plugins::queue::MySQL *)context;
 
   gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM,"MySQL queue add: %.*s %.*s", (uint32_t) unique_size, (char *) unique,
                      (uint32_t) function_name_size, (char *) function_name);
 
-  bind[0].buffer_type= MYSQL_TYPE_STRING;
-  bind[0].buffer= (char *)unique;
-  bind[0].buffer_length= unique_size;
-  bind[0].is_null= 0;
-  bind[0].length= (unsigned long*)&unique_size;
-
-  bind[1].buffer_type= MYSQL_TYPE_STRING;
-  bind[1].buffer= (char *)function_name;
-  bind[1].buffer_length= function_name_size;
-  bind[1].is_null= 0;
-  bind[1].length= (unsigned long*)&function_name_size;
-
-  bind[2].buffer_type= MYSQL_TYPE_LONG;
-  bind[2].buffer= (char *)&priority;
-  bind[2].is_null= 0;
-  bind[2].length= 0;
-
-  bind[3].buffer_type= MYSQL_TYPE_LONG_BLOB;
-  bind[3].buffer= (char *)data;
-  bind[3].buffer_length= data_size;
-  bind[3].is_null= 0;
-  bind[3].length= (unsigned long*)&data_size;
-
-  bind[4].buffer_type= MYSQL_TYPE_LONG;
-  bind[4].buffer= (char *)&when;
-  bind[4].is_null= 0;
-  bind[4].length= 0;
-
-  while(1)
-  {
-    if (mysql_stmt_bind_param(queue->add_stmt, bind))
-    {
-      if ( mysql_stmt_errno(queue->add_stmt) == CR_NO_PREPARE_STMT )
-      {
-        if (queue->prepareAddStatement() == GEARMAND_QUEUE_ERROR)
-        {
-          return GEARMAND_QUEUE_ERROR;
-        }
-        continue;
-      }
-      else
-      {
-        gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "mysql_stmt_bind_param failed: %s", mysql_error(queue->con));
-        return GEARMAND_QUEUE_ERROR;
-      }
-    }
+  return queue->add(unique, unique_size,
+                    function_name, function_name_size,
+                    data, data_size,
+                    priority, when);
+}
 
-    if (mysql_stmt_execute(queue->add_stmt))
-    {
-      if ( mysql_stmt_errno(queue->add_stmt) == CR_SERVER_LOST )
-      {
-        mysql_stmt_close(queue->add_stmt);
-        if (queue->prepareAddStatement() != GEARMAND_QUEUE_ERROR)
-        {
-          continue;
-        }
-      }
-      gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "mysql_stmt_execute failed: %s", mysql_error(queue->con));
-      return GEARMAND_QUEUE_ERROR;
-    }
+static gearmand_error_t _mysql_queue_flush(gearman_server_st*, void *context)
+{
+  gearmand::plugins::queue::MySQL *queue= (gearmand::plugins::queue::MySQL *)context;
 
-    break;
-  }
+  gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM,"MySQL queue flush");
 
-  return GEARMAND_SUCCESS;
+  return queue->flush();
 }
 
-static gearmand_error_t _mysql_queue_flush(gearman_server_st*, void*)
+static bool _mysql_queue_rollback(gearman_server_st*, void *context)
 {
+  gearmand::plugins::queue::MySQL *queue= (gearmand::plugins::queue::MySQL *)context;
 
-  gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM,"MySQL queue flush");
+  gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM,"MySQL queue rollback");
 
-  return GEARMAND_SUCCESS;
+  return queue->rollback();
 }
 
-static gearmand_error_t _mysql_queue_done(gearman_server_st*, void *context,
+static gearmand_error_t _mysql_queue_done(gearman_server_st* server, void *context,
                                           const char *unique,
                                           size_t unique_size,
                                           const char *function_name,
                                           size_t function_name_size)
 {
-
-  MYSQL_BIND    bind[2];
-
   gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM,"MySQL queue done: %.*s %.*s", (uint32_t) unique_size, (char *) unique,
                      (uint32_t) function_name_size, (char *) function_name);
 
   gearmand::plugins::queue::MySQL *queue= (gearmand::plugins::queue::MySQL *)context;
 
-  bind[0].buffer_type= MYSQL_TYPE_STRING;
-  bind[0].buffer= (char *)unique;
-  bind[0].buffer_length= unique_size;
-  bind[0].is_null= 0;
-  bind[0].length= (unsigned long*)&unique_size;
+  gearmand_error_t ret= queue->done(unique, unique_size, function_name, function_name_size);
 
-  bind[1].buffer_type= MYSQL_TYPE_STRING;
-  bind[1].buffer= (char *)function_name;
-  bind[1].buffer_length= function_name_size;
-  bind[1].is_null= 0;
-  bind[1].length= (unsigned long*)&function_name_size;
-
-  while(1)
+  // Only --queue-batch flushes after a done.
+  if (server->queue_batch == NULL)
   {
-    if (mysql_stmt_bind_param(queue->done_stmt, bind))
+    gearmand_error_t rc= queue->flush();
+    if (gearmand_failed(rc))
     {
-      if ( mysql_stmt_errno(queue->done_stmt) == CR_NO_PREPARE_STMT )
-      {
-        if (queue->prepareDoneStatement() == GEARMAND_QUEUE_ERROR)
-        {
-          return GEARMAND_QUEUE_ERROR;
-        }
-        continue;
-      }
-      else
-      {
-        gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "mysql_stmt_bind_param failed: %s", mysql_error(queue->con));
-        return GEARMAND_QUEUE_ERROR;
-      }
+      ret= rc;
     }
-
-    if (mysql_stmt_execute(queue->done_stmt))
-    {
-      if ( mysql_stmt_errno(queue->done_stmt) == CR_SERVER_LOST )
-      {
-        mysql_stmt_close(queue->done_stmt);
-        if (queue->prepareDoneStatement() != GEARMAND_QUEUE_ERROR)
-        {
-          continue;
-        }
-      }
-      gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "mysql_stmt_execute failed: %s", mysql_error(queue->con));
-
-      return GEARMAND_QUEUE_ERROR;
-    }
-
-    break;
   }
 
-  return GEARMAND_SUCCESS;
+  return ret;
 }
 
 static gearmand_error_t _mysql_queue_replay(gearman_server_st* server, void *context,
@@ -461,15 +726,17 @@ static gearmand_error_t _mysql_queue_replay(gearman_server_st* server, void *con
     return GEARMAND_QUEUE_ERROR;
   }
 
-  if (!(result= mysql_store_result(queue->con)))
+  // Rows are streamed from the server rather than buffered all at once.
+  if (!(result= mysql_use_result(queue->con)))
   {
-    gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "mysql_store_result failed: %s", mysql_error(queue->con));
+    gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "mysql_use_result failed: %s", mysql_error(queue->con));
     return GEARMAND_QUEUE_ERROR;
   }
 
   if (mysql_num_fields(result) < 5)
   {
     gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "MySQL queue: insufficient row fields in queue table");
+    mysql_free_result(result);
     return GEARMAND_QUEUE_ERROR;
   }
 
@@ -486,11 +753,15 @@ static gearmand_error_t _mysql_queue_replay(gearman_server_st* server, void *con
     /* need to make a copy here ... gearman_server_job_free will free it later */
     size_t data_size= lengths[2];
     char * data= (char *)malloc(data_size);
-    if (data == NULL)
+    if (data == NULL and data_size)
     {
+      mysql_free_result(result);
       return gearmand_perror(errno, "malloc failed");
     }
-    memcpy(data, row[2], data_size);
+    if (data_size)
+    {
+      memcpy(data, row[2], data_size);
+    }
 
     if (lengths[3])
     {
@@ -515,6 +786,12 @@ static gearmand_error_t _mysql_queue_replay(gearman_server_st* server, void *con
     }
   }
 
+  if (ret == GEARMAND_SUCCESS and mysql_errno(queue->con))
+  {
+    gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "mysql_fetch_row failed: %s", mysql_error(queue->con));
+    ret= GEARMAND_QUEUE_ERROR;
+  }
+
   mysql_free_result(result);
 
   return ret;
@@ -55,6 +55,7 @@
 # include <libpq-fe.h>
 #endif
 
+#include <arpa/inet.h>
 #include <cerrno>
 
 /**
@@ -68,6 +69,9 @@
  */
 #define GEARMAND_QUEUE_LIBPQ_DEFAULT_TABLE "queue"
 #define GEARMAND_QUEUE_QUERY_BUFFER 256
+#define GEARMAND_QUEUE_LIBPQ_DEFAULT_COPY_MIN 16
+#define GEARMAND_QUEUE_LIBPQ_DEFAULT_FETCH 10000
+#define GEARMAND_QUEUE_LIBPQ_COPY_CHUNK (1024 * 1024)
 
 namespace gearmand { namespace plugins { namespace  queue { class Postgres; }}}
 
@@ -99,15 +103,56 @@ public:
     return _create_query;
   }
 
+  /*
+    Adds and dones are held until flush. Only one kind is held at a time
+    so that a done and a later add of the same unique keep their order.
+    Everything written between two flushes is one transaction, committed
+    by flush() and dropped by rollback().
+  */
+  gearmand_error_t add(const char *unique, size_t unique_size,
+                       const char *function_name, size_t function_name_size,
+                       const void *data, size_t data_size,
+                       gearman_job_priority_t priority, int64_t when);
+  gearmand_error_t done(const char *unique, size_t unique_size,
+                        const char *function_name, size_t function_name_size);
+  gearmand_error_t flush();
+  bool rollback();
+
   PGconn *con;
   std::string postgres_connect_string;
   std::string table;
   std::vector<char> query_buffer;
+  uint32_t copy_min;
+  uint32_t fetch_count;
 
 public:
   std::string _insert_query;
   std::string _select_query;
   std::string _create_query;
+  std::string _copy_query;
+  std::string _delete_query;
+  std::string _delete_array_query;
+
+private:
+  struct row_st {
+    std::string unique;
+    std::string function_name;
+    std::string data;
+    int32_t priority;
+    int32_t when;
+  };
+
+  bool command(const char *query);
+  gearmand_error_t write();
+  gearmand_error_t insert(const row_st *rows, size_t count);
+  gearmand_error_t insert_each(const row_st *rows, size_t count);
+  bool insert_pipelined(const row_st *rows, size_t count);
+  bool copy(const row_st *rows, size_t count);
+  gearmand_error_t remove(const row_st *rows, size_t count);
+
+  bool _done_pending;
+  bool _transaction;
+  std::vector<row_st> _pending;
 };
 
 Postgres::Postgres() :
@@ -115,11 +160,17 @@ Postgres::Postgres() :
   con(NULL),
   postgres_connect_string(""),
   table(""),
-  query_buffer()
+  query_buffer(),
+  copy_min(GEARMAND_QUEUE_LIBPQ_DEFAULT_COPY_MIN),
+  fetch_count(GEARMAND_QUEUE_LIBPQ_DEFAULT_FETCH),
+  _done_pending(false),
+  _transaction(false)
 {
   command_line_options().add_options()
     ("libpq-conninfo", boost::program_options::value(&postgres_connect_string)->default_value(""), "PostgreSQL connection information string.")
-    ("libpq-table", boost::program_options::value(&table)->default_value(GEARMAND_QUEUE_LIBPQ_DEFAULT_TABLE), "Table to use.");
+    ("libpq-table", boost::program_options::value(&table)->default_value(GEARMAND_QUEUE_LIBPQ_DEFAULT_TABLE), "Table to use.")
+    ("libpq-copy-min", boost::program_options::value(&copy_min)->default_value(GEARMAND_QUEUE_LIBPQ_DEFAULT_COPY_MIN), "Smallest run of added jobs written with COPY instead of INSERT.")
+    ("libpq-fetch", boost::program_options::value(&fetch_count)->default_value(GEARMAND_QUEUE_LIBPQ_DEFAULT_FETCH), "Rows fetched per round trip during replay.");
 }
 
 Postgres::~Postgres ()
@@ -130,6 +181,11 @@ Postgres::~Postgres ()
 
 gearmand_error_t Postgres::initialize()
 {
+  if (fetch_count == 0)
+  {
+    return gearmand_log_gerror(GEARMAN_DEFAULT_LOG_PARAM, GEARMAND_QUEUE_ERROR, "--libpq-fetch must be greater than 0");
+  }
+
   _create_query+= "CREATE TABLE " +table +" (unique_key VARCHAR" +"(" + TOSTRING(GEARMAN_UNIQUE_SIZE) +"), ";
   _create_query+= "function_name VARCHAR(255), priority INTEGER, data BYTEA, when_to_run INTEGER, UNIQUE (unique_key, function_name))";
 
@@ -139,6 +195,13 @@ gearmand_error_t Postgres::initialize()
 
   _select_query+= "SELECT unique_key,function_name,priority,data,when_to_run FROM " +table;
 
+  _copy_query+= "COPY " +table +" (priority, unique_key, function_name, data, when_to_run) FROM STDIN BINARY";
+
+  _delete_query+= "DELETE FROM " +table +" WHERE unique_key=$1 AND function_name=$2";
+
+  _delete_array_query+= "DELETE FROM " +table +" WHERE (unique_key, function_name) IN "
+                        "(SELECT * FROM unnest($1::VARCHAR[], $2::VARCHAR[]))";
+
   return ret;
 }
 
@@ -167,6 +230,8 @@ static gearmand_error_t _libpq_add(gearman_server_st *server, void *context,
 
 static gearmand_error_t _libpq_flush(gearman_server_st *server, void *context);
 
+static bool _libpq_rollback(gearman_server_st *server, void *context);
+
 static gearmand_error_t _libpq_done(gearman_server_st *server, void *context,
                                     const char *unique,
                                     size_t unique_size,
@@ -191,7 +256,7 @@ gearmand_error_t _initialize(gearman_server_st& server,
 {
   gearmand_info("Initializing libpq module");
 
-  gearman_server_set_queue(server, queue, _libpq_add, _libpq_flush, _libpq_done, _libpq_replay);
+  gearman_server_set_queue(server, queue, _libpq_add, _libpq_flush, _libpq_done, _libpq_replay, _libpq_rollback);
 
   queue->con= PQconnectdb(queue->postgres_connect_string.c_str());
 
@@ -247,45 +312,462 @@ static void _libpq_notice_processor(void *arg, const char *message)
   gearmand_log_info(GEARMAN_DEFAULT_LOG_PARAM, "PostgreSQL %s", message);
 }
 
-static gearmand_error_t _libpq_add(gearman_server_st*, void *context,
-                                   const char *unique, size_t unique_size,
-                                   const char *function_name,
-                                   size_t function_name_size,
-                                   const void *data, size_t data_size,
-                                   gearman_job_priority_t priority,
-                                   int64_t when)
+static void _libpq_put16(std::string& buffer, int16_t value)
 {
-  gearmand::plugins::queue::Postgres *queue= (gearmand::plugins::queue::Postgres *)context;
+  uint16_t net= htons(uint16_t(value));
+  buffer.append((const char *)&net, sizeof(net));
+}
+
+static void _libpq_put32(std::string& buffer, int32_t value)
+{
+  uint32_t net= htonl(uint32_t(value));
+  buffer.append((const char *)&net, sizeof(net));
+}
 
-  char priority_buffer[GEARMAN_MAXIMUM_INTEGER_DISPLAY_LENGTH +1];
-  int priority_buffer_length= snprintf(priority_buffer, sizeof(priority_buffer), "%u", static_cast<uint32_t>(priority));
-  char when_buffer[GEARMAN_MAXIMUM_INTEGER_DISPLAY_LENGTH +1];
-  int when_buffer_length= snprintf(when_buffer, sizeof(when_buffer), "%" PRId64, when);
+static void _libpq_put_field(std::string& buffer, const std::string& value)
+{
+  _libpq_put32(buffer, int32_t(value.size()));
+  buffer.append(value);
+}
 
-  const char *param_values[]= {
-    (char *)priority_buffer,
-    (char *)unique,
-    (char *)function_name,
-    (char *)data,
-    (char *)when_buffer };
+// Quotes every element of a text array literal, for use as a VARCHAR[] parameter.
+static void _libpq_array_append(std::string& array, const std::string& value)
+{
+  array.push_back(array.empty() ? '{' : ',');
+  array.push_back('"');
+  for (std::string::const_iterator iter= value.begin(); iter != value.end(); ++iter)
+  {
+    if (*iter == '"' or *iter == '\\')
+    {
+      array.push_back('\\');
+    }
+    array.push_back(*iter);
+  }
+  array.push_back('"');
+}
 
-  int param_lengths[]= {
-    (int)priority_buffer_length,
-    (int)unique_size,
-    (int)function_name_size,
-    (int)data_size,
-    (int)when_buffer_length };
+// Integers are read in the binary result format, whatever their width.
+static int64_t _libpq_integer(const PGresult *result, int row, int column)
+{
+  if (PQgetisnull(result, row, column))
+  {
+    return 0;
+  }
 
-  int param_formats[] = { 0, 0, 0, 1, 0 };
+  const unsigned char *value= (const unsigned char *)PQgetvalue(result, row, column);
+  int length= PQgetlength(result, row, column);
+  if (length != 2 and length != 4 and length != 8)
+  {
+    return 0;
+  }
 
-  gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "libpq add: %.*s", (uint32_t)unique_size, (char *)unique);
+  uint64_t number= (value[0] & 0x80) ? UINT64_MAX : 0;
+  for (int x= 0; x < length; ++x)
+  {
+    number= (number << 8) | value[x];
+  }
+
+  return int64_t(number);
+}
+
+gearmand_error_t gearmand::plugins::queue::Postgres::add(const char *unique, size_t unique_size,
+                                                         const char *function_name, size_t function_name_size,
+                                                         const void *data, size_t data_size,
+                                                         gearman_job_priority_t priority, int64_t when)
+{
+  gearmand_error_t ret= GEARMAND_SUCCESS;
+  if (_done_pending)
+  {
+    ret= write();
+    _done_pending= false;
+  }
+
+  // when_to_run is an INTEGER column.
+  if (when < INT32_MIN or when > INT32_MAX)
+  {
+    gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "libpq: cannot store job %.*s to run at %" PRId64 ", out of range",
+                       int(unique_size), unique, when);
+    return GEARMAND_QUEUE_ERROR;
+  }
+
+  _pending.resize(_pending.size() + 1);
+  row_st& row= _pending.back();
+  row.unique.assign(unique, unique_size);
+  row.function_name.assign(function_name, function_name_size);
+  row.data.assign((const char *)data, data_size);
+  row.priority= int32_t(priority);
+  row.when= int32_t(when);
+
+  return ret;
+}
+
+gearmand_error_t gearmand::plugins::queue::Postgres::done(const char *unique, size_t unique_size,
+                                                          const char *function_name, size_t function_name_size)
+{
+  gearmand_error_t ret= GEARMAND_SUCCESS;
+  if (_done_pending == false)
+  {
+    ret= write();
+    _done_pending= true;
+  }
+
+  _pending.resize(_pending.size() + 1);
+  row_st& row= _pending.back();
+  row.unique.assign(unique, unique_size);
+  row.function_name.assign(function_name, function_name_size);
+  row.priority= 0;
+  row.when= 0;
+
+  return ret;
+}
+
+bool gearmand::plugins::queue::Postgres::command(const char *query)
+{
+  PGresult *result= PQexec(con, query);
+  if (result == NULL || PQresultStatus(result) != PGRES_COMMAND_OK)
+  {
+    gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "libpq %s:%s", query, PQerrorMessage(con));
+    PQclear(result);
+    return false;
+  }
+
+  PQclear(result);
+
+  return true;
+}
+
+gearmand_error_t gearmand::plugins::queue::Postgres::flush()
+{
+  /* One row is a statement of its own, as without --queue-batch. */
+  if (_transaction == false and _pending.size() == 1)
+  {
+    gearmand_error_t ret= _done_pending ? remove(&_pending[0], 1) : insert_each(&_pending[0], 1);
+    _pending.clear();
+    return ret;
+  }
+
+  gearmand_error_t ret= write();
+  if (gearmand_failed(ret))
+  {
+    (void)rollback();
+    return ret;
+  }
+
+  if (_transaction)
+  {
+    _transaction= false;
+    if (command("COMMIT") == false)
+    {
+      return GEARMAND_QUEUE_ERROR;
+    }
+  }
+
+  return GEARMAND_SUCCESS;
+}
+
+bool gearmand::plugins::queue::Postgres::rollback()
+{
+  _pending.clear();
+
+  if (_transaction)
+  {
+    _transaction= false;
+    /* A transaction lost with the connection was rolled back by the server. */
+    (void)command("ROLLBACK");
+  }
+
+  return true;
+}
+
+// Writes the held rows in the transaction flush() commits. A failure leaves it to be rolled back.
+gearmand_error_t gearmand::plugins::queue::Postgres::write()
+{
+  if (_pending.empty())
+  {
+    return GEARMAND_SUCCESS;
+  }
+
+  if (_transaction == false)
+  {
+    if (command("BEGIN") == false)
+    {
+      _pending.clear();
+      return GEARMAND_QUEUE_ERROR;
+    }
+    _transaction= true;
+  }
+
+  gearmand_error_t ret= _done_pending ? remove(&_pending[0], _pending.size()) : insert(&_pending[0], _pending.size());
+  _pending.clear();
+
+  return ret;
+}
+
+/*
+  Long runs of adds are sent with COPY, shorter ones as pipelined INSERTs
+  when libpq supports pipeline mode. Either fails as a whole, so under a
+  savepoint the rows are then inserted again one by one; a row that still
+  fails fails the transaction.
+*/
+gearmand_error_t gearmand::plugins::queue::Postgres::insert(const row_st *rows, size_t count)
+{
+#if defined(LIBPQ_HAS_PIPELINING)
+  bool use_copy= count > 1 and count >= copy_min;
+#else
+  bool use_copy= count > 1;
+#endif
+
+  if (command("SAVEPOINT gearmand_insert") == false)
+  {
+    return GEARMAND_QUEUE_ERROR;
+  }
+
+  if ((use_copy ? copy(rows, count) : insert_pipelined(rows, count)) == false)
+  {
+    if (command("ROLLBACK TO SAVEPOINT gearmand_insert") == false)
+    {
+      return GEARMAND_QUEUE_ERROR;
+    }
+
+    return insert_each(rows, count);
+  }
+
+  return GEARMAND_SUCCESS;
+}
+
+gearmand_error_t gearmand::plugins::queue::Postgres::insert_each(const row_st *rows, size_t count)
+{
+  for (size_t x= 0; x < count; ++x)
+  {
+    char priority_buffer[GEARMAN_MAXIMUM_INTEGER_DISPLAY_LENGTH +1];
+    int priority_buffer_length= snprintf(priority_buffer, sizeof(priority_buffer), "%d", rows[x].priority);
+    char when_buffer[GEARMAN_MAXIMUM_INTEGER_DISPLAY_LENGTH +1];
+    int when_buffer_length= snprintf(when_buffer, sizeof(when_buffer), "%d", rows[x].when);
+
+    const char *param_values[]= {
+      priority_buffer,
+      rows[x].unique.c_str(),
+      rows[x].function_name.c_str(),
+      rows[x].data.data(),
+      when_buffer };
+
+    int param_lengths[]= {
+      priority_buffer_length,
+      (int)rows[x].unique.size(),
+      (int)rows[x].function_name.size(),
+      (int)rows[x].data.size(),
+      when_buffer_length };
+
+    int param_formats[] = { 0, 0, 0, 1, 0 };
+
+    PGresult *result= PQexecParams(con, insert().c_str(),
+                                   gearmand_array_size(param_lengths),
+                                   NULL, param_values, param_lengths, param_formats, 0);
+    if (result == NULL || PQresultStatus(result) != PGRES_COMMAND_OK)
+    {
+      gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "PQexec:%s", PQerrorMessage(con));
+      PQclear(result);
+      return GEARMAND_QUEUE_ERROR;
+    }
+
+    PQclear(result);
+  }
+
+  return GEARMAND_SUCCESS;
+}
+
+bool gearmand::plugins::queue::Postgres::insert_pipelined(const row_st *rows, size_t count)
+{
+#if defined(LIBPQ_HAS_PIPELINING)
+  if (count < 2 or PQenterPipelineMode(con) == 0)
+  {
+    return false;
+  }
+
+  bool success= true;
+  size_t sent= 0;
+  for (; sent < count; ++sent)
+  {
+    char priority_buffer[GEARMAN_MAXIMUM_INTEGER_DISPLAY_LENGTH +1];
+    int priority_buffer_length= snprintf(priority_buffer, sizeof(priority_buffer), "%d", rows[sent].priority);
+    char when_buffer[GEARMAN_MAXIMUM_INTEGER_DISPLAY_LENGTH +1];
+    int when_buffer_length= snprintf(when_buffer, sizeof(when_buffer), "%d", rows[sent].when);
+
+    const char *param_values[]= {
+      priority_buffer,
+      rows[sent].unique.c_str(),
+      rows[sent].function_name.c_str(),
+      rows[sent].data.data(),
+      when_buffer };
+
+    int param_lengths[]= {
+      priority_buffer_length,
+      (int)rows[sent].unique.size(),
+      (int)rows[sent].function_name.size(),
+      (int)rows[sent].data.size(),
+      when_buffer_length };
+
+    int param_formats[] = { 0, 0, 0, 1, 0 };
+
+    if (PQsendQueryParams(con, insert().c_str(),
+                          gearmand_array_size(param_lengths),
+                          NULL, param_values, param_lengths, param_formats, 0) == 0)
+    {
+      gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "PQsendQueryParams:%s", PQerrorMessage(con));
+      success= false;
+      break;
+    }
+  }
+
+  if (PQpipelineSync(con) == 0)
+  {
+    gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "PQpipelineSync:%s", PQerrorMessage(con));
+    (void)PQexitPipelineMode(con);
+    return false;
+  }
+
+  // Each query ends with a NULL result, the batch with the sync.
+  size_t ended= 0;
+  while (true)
+  {
+    PGresult *result= PQgetResult(con);
+    if (result == NULL)
+    {
+      if (++ended > sent or PQstatus(con) != CONNECTION_OK)
+      {
+        success= false;
+        break;
+      }
+      continue;
+    }
+
+    ExecStatusType status= PQresultStatus(result);
+    PQclear(result);
+
+    if (status == PGRES_PIPELINE_SYNC)
+    {
+      break;
+    }
+
+    if (status != PGRES_COMMAND_OK)
+    {
+      success= false;
+    }
+  }
+
+  if (success == false)
+  {
+    gearmand_log_warning(GEARMAN_DEFAULT_LOG_PARAM, "libpq pipelined insert of %" PRIu64 " jobs failed: %s",
+                         uint64_t(count), PQerrorMessage(con));
+  }
+
+  (void)PQexitPipelineMode(con);
+
+  return success;
+#else
+  (void)rows;
+  (void)count;
+  return false;
+#endif
+}
+
+bool gearmand::plugins::queue::Postgres::copy(const row_st *rows, size_t count)
+{
+  PGresult *result= PQexec(con, _copy_query.c_str());
+  if (result == NULL || PQresultStatus(result) != PGRES_COPY_IN)
+  {
+    gearmand_log_warning(GEARMAN_DEFAULT_LOG_PARAM, "libpq COPY:%s", PQerrorMessage(con));
+    PQclear(result);
+    return false;
+  }
+  PQclear(result);
+
+  std::string buffer;
+  buffer.reserve(GEARMAND_QUEUE_LIBPQ_COPY_CHUNK);
+  buffer.append("PGCOPY\n\377\r\n\0", 11);
+  _libpq_put32(buffer, 0);
+  _libpq_put32(buffer, 0);
+
+  const char *error= NULL;
+  for (size_t x= 0; x < count and error == NULL; ++x)
+  {
+    _libpq_put16(buffer, 5);
+    _libpq_put32(buffer, 4);
+    _libpq_put32(buffer, rows[x].priority);
+    _libpq_put_field(buffer, rows[x].unique);
+    _libpq_put_field(buffer, rows[x].function_name);
+    _libpq_put_field(buffer, rows[x].data);
+    _libpq_put32(buffer, 4);
+    _libpq_put32(buffer, rows[x].when);
+
+    if (x + 1 == count)
+    {
+      _libpq_put16(buffer, -1);
+    }
+
+    if (buffer.size() >= GEARMAND_QUEUE_LIBPQ_COPY_CHUNK or x + 1 == count)
+    {
+      if (PQputCopyData(con, buffer.data(), int(buffer.size())) != 1)
+      {
+        error= "PQputCopyData failed";
+      }
+      buffer.clear();
+    }
+  }
+
+  bool success= true;
+  if (PQputCopyEnd(con, error) != 1)
+  {
+    success= false;
+  }
+
+  while ((result= PQgetResult(con)))
+  {
+    if (PQresultStatus(result) != PGRES_COMMAND_OK)
+    {
+      success= false;
+    }
+    PQclear(result);
+  }
+
+  if (success == false or error)
+  {
+    gearmand_log_warning(GEARMAN_DEFAULT_LOG_PARAM, "libpq COPY of %" PRIu64 " jobs failed: %s",
+                         uint64_t(count), PQerrorMessage(con));
+    return false;
+  }
+
+  return true;
+}
+
+gearmand_error_t gearmand::plugins::queue::Postgres::remove(const row_st *rows, size_t count)
+{
+  PGresult *result;
+
+  if (count == 1)
+  {
+    const char *param_values[]= { rows[0].unique.c_str(), rows[0].function_name.c_str() };
+    result= PQexecParams(con, _delete_query.c_str(), 2, NULL, param_values, NULL, NULL, 0);
+  }
+  else
+  {
+    std::string uniques;
+    std::string function_names;
+    for (size_t x= 0; x < count; ++x)
+    {
+      _libpq_array_append(uniques, rows[x].unique);
+      _libpq_array_append(function_names, rows[x].function_name);
+    }
+    uniques.push_back('}');
+    function_names.push_back('}');
+
+    const char *param_values[]= { uniques.c_str(), function_names.c_str() };
+    result= PQexecParams(con, _delete_array_query.c_str(), 2, NULL, param_values, NULL, NULL, 0);
+  }
 
-  PGresult *result= PQexecParams(queue->con, queue->insert().c_str(),
-                                 gearmand_array_size(param_lengths),
-                                 NULL, param_values, param_lengths, param_formats, 0);
   if (result == NULL || PQresultStatus(result) != PGRES_COMMAND_OK)
   {
-    gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "PQexec:%s", PQerrorMessage(queue->con));
+    gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "PQexec:%s", PQerrorMessage(con));
     PQclear(result);
     return GEARMAND_QUEUE_ERROR;
   }
@@ -295,48 +777,86 @@ static gearmand_error_t _libpq_add(gearman_server_st*, void *context,
   return GEARMAND_SUCCESS;
 }
 
-static gearmand_error_t _libpq_flush(gearman_server_st *, void *)
+static gearmand_error_t _libpq_add(gearman_server_st*, void *context,
+                                   const char *unique, size_t unique_size,
+                                   const char *function_name,
+                                   size_t function_name_size,
+                                   const void *data, size_t data_size,
+                                   gearman_job_priority_t priority,
+                                   int64_t when)
+{
+  gearmand::plugins::queue::Postgres *queue= (gearmand::plugins::queue::Postgres *)context;
+
+  gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "libpq add: %.*s", (uint32_t)unique_size, (char *)unique);
+
+  return queue->add(unique, unique_size,
+                    function_name, function_name_size,
+                    data, data_size,
+                    priority, when);
+}
+
+static gearmand_error_t _libpq_flush(gearman_server_st *, void *context)
 {
+  gearmand::plugins::queue::Postgres *queue= (gearmand::plugins::queue::Postgres *)context;
+
   gearmand_debug("libpq flush");
 
-  return GEARMAND_SUCCESS;
+  return queue->flush();
 }
 
-static gearmand_error_t _libpq_done(gearman_server_st*, void *context,
+static bool _libpq_rollback(gearman_server_st *, void *context)
+{
+  gearmand::plugins::queue::Postgres *queue= (gearmand::plugins::queue::Postgres *)context;
+
+  gearmand_debug("libpq rollback");
+
+  return queue->rollback();
+}
+
+static gearmand_error_t _libpq_done(gearman_server_st* server, void *context,
                                     const char *unique,
                                     size_t unique_size,
                                     const char *function_name,
                                     size_t function_name_size)
 {
-  (void)function_name_size;
   gearmand::plugins::queue::Postgres *queue= (gearmand::plugins::queue::Postgres *)context;
-  PGresult *result;
 
   gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "libpq done: %.*s", (uint32_t)unique_size, (char *)unique);
 
-  std::string query;
-  query.reserve(function_name_size +unique_size + 80);
-  query+= "DELETE FROM ";
-  query+= queue->table;
-  query+= " WHERE unique_key='";
-  query+= (const char *)unique;
-  query+= "' AND function_name='";
-  query+= (const char *)function_name;
-  query+= "'";
-
-  result= PQexec(queue->con, query.c_str());
+  gearmand_error_t ret= queue->done(unique, unique_size, function_name, function_name_size);
+
+  // Only --queue-batch flushes after a done.
+  if (server->queue_batch == NULL)
+  {
+    gearmand_error_t rc= queue->flush();
+    if (gearmand_failed(rc))
+    {
+      ret= rc;
+    }
+  }
+
+  return ret;
+}
+
+static bool _libpq_command(PGconn *con, const std::string& query)
+{
+  PGresult *result= PQexec(con, query.c_str());
   if (result == NULL || PQresultStatus(result) != PGRES_COMMAND_OK)
   {
-    gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "PQexec:%s", PQerrorMessage(queue->con));
+    gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "PQexec:%s", PQerrorMessage(con));
     PQclear(result);
-    return GEARMAND_QUEUE_ERROR;
+    return false;
   }
 
   PQclear(result);
 
-  return GEARMAND_SUCCESS;
+  return true;
 }
 
+/*
+  The table is read through a cursor, --libpq-fetch rows at a time, so the
+  whole queue is never held in one result.
+*/
 static gearmand_error_t _libpq_replay(gearman_server_st *server, void *context,
                                       gearman_queue_add_fn *add_fn,
                                       void *add_context)
@@ -345,61 +865,115 @@ static gearmand_error_t _libpq_replay(gearman_server_st *server, void *context,
 
   gearmand_info("libpq replay start");
 
-  std::string query("SELECT unique_key,function_name,priority,data,when_to_run FROM " + queue->table);
-
-  PGresult *result= PQexecParams(queue->con, query.c_str(), 0, NULL, NULL, NULL, NULL, 1);
-  if (result == NULL || PQresultStatus(result) != PGRES_TUPLES_OK)
   {
-    gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "PQexecParams:%s", PQerrorMessage(queue->con));
+    const char *param_values[]= { queue->table.c_str() };
+    PGresult *result= PQexecParams(queue->con, "SELECT reltuples::BIGINT FROM pg_class WHERE oid = to_regclass($1)",
+                                   1, NULL, param_values, NULL, NULL, 0);
+    if (result and PQresultStatus(result) == PGRES_TUPLES_OK and PQntuples(result) == 1)
+    {
+      long long estimate= atoll(PQgetvalue(result, 0, 0));
+      if (estimate > 0)
+      {
+        gearmand::queue::Context::replay_expect(server, uint64_t(estimate));
+      }
+    }
     PQclear(result);
+  }
+
+  if (_libpq_command(queue->con, "BEGIN") == false)
+  {
     return GEARMAND_QUEUE_ERROR;
   }
 
-  for (int row= 0; row < PQntuples(result); row++)
+  if (_libpq_command(queue->con, "DECLARE gearmand_replay NO SCROLL CURSOR FOR " +queue->select()) == false)
   {
-    gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM,
-                       "libpq replay: %.*s",
-                       PQgetlength(result, row, 0),
-                       PQgetvalue(result, row, 0));
+    (void)_libpq_command(queue->con, "ROLLBACK");
+    return GEARMAND_QUEUE_ERROR;
+  }
 
-    size_t data_length;
-    char *data;
-    if (PQgetlength(result, row, 3) == 0)
+  char fetch[GEARMAND_QUEUE_QUERY_BUFFER];
+  snprintf(fetch, sizeof(fetch), "FETCH FORWARD %u FROM gearmand_replay", queue->fetch_count);
+
+  gearmand_error_t ret= GEARMAND_SUCCESS;
+  uint64_t fetches= 0;
+  while (ret == GEARMAND_SUCCESS)
+  {
+    PGresult *result= PQexecParams(queue->con, fetch, 0, NULL, NULL, NULL, NULL, 1);
+    if (result == NULL || PQresultStatus(result) != PGRES_TUPLES_OK)
     {
-      data= NULL;
-      data_length= 0;
+      gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "PQexecParams:%s", PQerrorMessage(queue->con));
+      PQclear(result);
+      ret= GEARMAND_QUEUE_ERROR;
+      break;
     }
-    else
+    fetches++;
+
+    int rows= PQntuples(result);
+    for (int row= 0; row < rows; row++)
     {
-      data_length= size_t(PQgetlength(result, row, 3));
-      data= (char *)malloc(data_length);
-      if (data == NULL)
+      gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM,
+                         "libpq replay: %.*s",
+                         PQgetlength(result, row, 0),
+                         PQgetvalue(result, row, 0));
+
+      size_t data_length;
+      char *data;
+      if (PQgetlength(result, row, 3) == 0)
       {
-        PQclear(result);
-        return gearmand_perror(errno, "malloc");
+        data= NULL;
+        data_length= 0;
+      }
+      else
+      {
+        data_length= size_t(PQgetlength(result, row, 3));
+        data= (char *)malloc(data_length);
+        if (data == NULL)
+        {
+          ret= gearmand_perror(errno, "malloc");
+          break;
+        }
+
+        memcpy(data, PQgetvalue(result, row, 3), data_length);
       }
 
-      memcpy(data, PQgetvalue(result, row, 3), data_length);
+      ret= (*add_fn)(server, add_context, PQgetvalue(result, row, 0),
+                     (size_t)PQgetlength(result, row, 0),
+                     PQgetvalue(result, row, 1),
+                     (size_t)PQgetlength(result, row, 1),
+                     data, data_length,
+                     (gearman_job_priority_t)_libpq_integer(result, row, 2),
+                     _libpq_integer(result, row, 4));
+      if (gearmand_failed(ret))
+      {
+        break;
+      }
+      ret= GEARMAND_SUCCESS;
     }
 
-    gearmand_error_t ret;
-    ret= (*add_fn)(server, add_context, PQgetvalue(result, row, 0),
-                   (size_t)PQgetlength(result, row, 0),
-                   PQgetvalue(result, row, 1),
-                   (size_t)PQgetlength(result, row, 1),
-                   data, data_length,
-                   (gearman_job_priority_t)atoi(PQgetvalue(result, row, 2)),
-                   atoll(PQgetvalue(result, row, 4)));
-    if (gearmand_failed(ret))
+    PQclear(result);
+
+    if (rows == 0)
     {
-      PQclear(result);
-      return ret;
+      break;
     }
   }
 
-  PQclear(result);
+  if (ret == GEARMAND_SUCCESS)
+  {
+    if (_libpq_command(queue->con, "CLOSE gearmand_replay") == false or
+        _libpq_command(queue->con, "COMMIT") == false)
+    {
+      ret= GEARMAND_QUEUE_ERROR;
+    }
+  }
+  else
+  {
+    (void)_libpq_command(queue->con, "ROLLBACK");
+  }
 
-  return GEARMAND_SUCCESS;
+  gearmand_log_info(GEARMAN_DEFAULT_LOG_PARAM, "libpq replay end: %" PRIu64 " fetches", fetches);
+
+  return ret;
 }
 #pragma GCC diagnostic pop
 #pragma GCC diagnostic pop
@@ -77,13 +77,38 @@ redisContext* gearmand::plugins::queue::Hiredis::redis()
   return this->_redis;
 }
 
+/*
+ * gearmand::plugins::queue::Hiredis::append(int argc, const char **argv, const size_t *argvlen)
+ *
+ * appends a command to the transaction, opening it with MULTI first
+ *
+ * returns true on success
+ */
+bool gearmand::plugins::queue::Hiredis::append(int argc, const char **argv, const size_t *argvlen)
+{
+  if (_queued == 0)
+  {
+    if (redisAppendCommand(this->redis(), "MULTI") != REDIS_OK)
+    {
+      return false;
+    }
+  }
+
+  if (redisAppendCommandArgv(this->redis(), argc, argv, argvlen) != REDIS_OK)
+  {
+    return false;
+  }
+  _queued++;
+
+  return true;
+}
+
 /*
  * gearmand::plugins::queue::Hiredis::hmset(vchar_t key, const void *data, size_t data_size, uint32_t priority)
  *
- * returns true if hiredis HMSET succeeded
+ * returns true if HMSET was appended
  */
-bool gearmand::plugins::queue::Hiredis::hmset(vchar_t key, const void *data, size_t data_size, uint32_t priority) {
-  redisContext* context = this->redis();
+bool gearmand::plugins::queue::Hiredis::hmset(const vchar_t& key, const void *data, size_t data_size, uint32_t priority) {
   const size_t argc = 6;
   std::string _priority = std::to_string((uint32_t)priority);
 
@@ -96,22 +121,143 @@ bool gearmand::plugins::queue::Hiredis::hmset(vchar_t key, const void *data, siz
     _priority.size()
   };
 
-  std::vector<const char*> argv {"HMSET"};
-  argv.push_back( &key[0] );
-  argv.push_back( "data" );
-  argv.push_back( static_cast<const char*>(data) );
-  argv.push_back( "priority" );
-  argv.push_back( _priority.c_str() );
+  const char *argv[argc] = {
+    "HMSET",
+    &key[0],
+    "data",
+    static_cast<const char*>(data),
+    "priority",
+    _priority.c_str()
+  };
 
-  redisReply *reply = (redisReply *)redisCommandArgv(context, argv.size(), &(argv[0]), &(argvlen[0]) );
-  if (reply == nullptr)
-      return false;
+  return append(argc, argv, argvlen);
+}
 
-  bool res = (reply->type == REDIS_REPLY_STATUS);
+/*
+ * gearmand::plugins::queue::Hiredis::del(vchar_t key)
+ *
+ * returns true if DEL was appended
+ */
+bool gearmand::plugins::queue::Hiredis::del(const vchar_t& key) {
+  const size_t argc = 2;
+  const size_t argvlen[argc] = { (const size_t)3, (const size_t)key.size() };
+  const char *argv[argc] = { "DEL", &key[0] };
 
-  freeReplyObject(reply);
+  return append(argc, argv, argvlen);
+}
 
-  return res;
+/*
+ * gearmand_error_t gearmand::plugins::queue::Hiredis::exec()
+ *
+ * MULTI, every appended command and EXEC go out in one write, then all
+ * of their replies are read back so the connection stays in step even
+ * when a command failed.
+ */
+gearmand_error_t gearmand::plugins::queue::Hiredis::exec()
+{
+  if (_queued == 0)
+  {
+    return GEARMAND_SUCCESS;
+  }
+
+  const size_t queued= _queued;
+  _queued= 0;
+
+  redisContext *context = this->redis();
+  if (redisAppendCommand(context, "EXEC") != REDIS_OK)
+  {
+    return gearmand_log_gerror(GEARMAN_DEFAULT_LOG_PARAM, GEARMAND_QUEUE_ERROR,
+                               "Failed to append EXEC: %s", context->errstr);
+  }
+
+  gearmand_error_t ret= GEARMAND_SUCCESS;
+  // MULTI, one QUEUED per command, then EXEC.
+  for (size_t x= 0; x < queued + 2; ++x)
+  {
+    redisReply *reply= nullptr;
+    if (redisGetReply(context, (void **)&reply) != REDIS_OK or reply == nullptr)
+    {
+      return gearmand_log_gerror(GEARMAN_DEFAULT_LOG_PARAM, GEARMAND_QUEUE_ERROR,
+                                 "Failed to read redis reply: %s", context->errstr);
+    }
+
+    if (reply->type == REDIS_REPLY_ERROR)
+    {
+      gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "redis transaction of %" PRIu64 " commands: %s",
+                         uint64_t(queued), reply->str);
+      ret= GEARMAND_QUEUE_ERROR;
+    }
+    else if (x == queued + 1)
+    {
+      if (reply->type != REDIS_REPLY_ARRAY)
+      {
+        gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "redis transaction of %" PRIu64 " commands was aborted",
+                           uint64_t(queued));
+        ret= GEARMAND_QUEUE_ERROR;
+      }
+      else
+      {
+        for (size_t y= 0; y < reply->elements; ++y)
+        {
+          if (reply->element[y]->type == REDIS_REPLY_ERROR)
+          {
+            gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "redis command %" PRIu64 " of %" PRIu64 " failed: %s",
+                               uint64_t(y), uint64_t(queued), reply->element[y]->str);
+            ret= GEARMAND_QUEUE_ERROR;
+          }
+        }
+      }
+    }
+
+    freeReplyObject(reply);
+  }
+
+  return ret;
+}
+
+/*
+ * bool record(redisReply *reply, gearmand::plugins::queue::redis_record_t &req)
+ *
+ * reads the data and priority fields of a HGETALL reply
+ *
+ * returns true on success
+ */
+static bool _hiredis_record(const redisReply *reply, gearmand::plugins::queue::redis_record_t &req)
+{
+  if (reply->type != REDIS_REPLY_ARRAY)
+  {
+    return false;
+  }
+
+  bool has_data= false;
+  req.priority = GEARMAN_JOB_PRIORITY_NORMAL;
+  // field, value, field, value ...
+  for (size_t x= 0; x + 1 < reply->elements; x+= 2)
+  {
+    const redisReply *field= reply->element[x];
+    const redisReply *value= reply->element[x + 1];
+    if (field->type != REDIS_REPLY_STRING or value->type != REDIS_REPLY_STRING)
+    {
+      continue;
+    }
+
+    if (field->len == 4 and memcmp(field->str, "data", 4) == 0)
+    {
+      req.data.assign(value->str, value->len);
+      has_data= true;
+    }
+    else if (field->len == 8 and memcmp(field->str, "priority", 8) == 0)
+    {
+      req.priority = (uint32_t)strtoul(value->str, NULL, 10);
+    }
+  }
+
+  if (has_data == false)
+  {
+    gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "redis hash without a data field");
+  }
+
+  return has_data;
 }
 
 /*
@@ -121,7 +267,7 @@ bool gearmand::plugins::queue::Hiredis::hmset(vchar_t key, const void *data, siz
  *
  * returns true on success
  */
-bool gearmand::plugins::queue::Hiredis::fetch(char *key, gearmand::plugins::queue::redis_record_t &req)
+bool gearmand::plugins::queue::Hiredis::fetch(const char *key, gearmand::plugins::queue::redis_record_t &req)
 {
   redisContext * context = this->redis();
   redisReply * reply = (redisReply*)redisCommand(context, "HGETALL %s", key);
@@ -133,6 +279,7 @@ bool gearmand::plugins::queue::Hiredis::fetch(char *key, gearmand::plugins::queu
     // workaround to ensure gearmand upgrade.
     // gearmand <=1.1.15 stores data in string, not in hash.
     gearmand_log_info(GEARMAN_DEFAULT_LOG_PARAM, "redis replies for HGETALL: %s", reply->str);
+    freeReplyObject(reply);
 
     reply = (redisReply*)redisCommand(context, "TYPE %s", key);
     if (reply == nullptr)
@@ -140,32 +287,25 @@ bool gearmand::plugins::queue::Hiredis::fetch(char *key, gearmand::plugins::queu
 
     if(strcmp(reply->str, "string") != 0) {
       gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "unexpected type of the value stored in key: %s", reply->str);
+      freeReplyObject(reply);
       return false;
     }
+    freeReplyObject(reply);
 
     reply = (redisReply*)redisCommand(context, "GET %s", key);
     if (reply == nullptr)
       return false;
 
-    std::string s{reply->str};
-    req.data = s;
-    req.priority = GEARMAN_JOB_PRIORITY_NORMAL;
-  } else {
-    // 2 x (key + value)
-    assert(reply->elements == 4);
-    auto fk = reply->element[0]->str;
-    if(strcmp(fk, "data") == 0) {
-      std::string s{reply->element[1]->str};
-      req.data = s;
-      req.priority = (uint32_t)std::stoi(reply->element[3]->str);
-    } else if (strcmp(fk, "priority") == 0) {
-      std::string s{reply->element[3]->str};
-      req.data = s;
-      req.priority = (uint32_t)std::stoi(reply->element[1]->str);
-    } else {
-      gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "unexpected key %s", fk);
+    if (reply->type != REDIS_REPLY_STRING) {
+      freeReplyObject(reply);
       return false;
     }
+
+    req.data.assign(reply->str, reply->len);
+    req.priority = GEARMAN_JOB_PRIORITY_NORMAL;
+  } else if (_hiredis_record(reply, req) == false) {
+    freeReplyObject(reply);
+    return false;
   }
 
   freeReplyObject(reply);
@@ -182,13 +322,16 @@ bool gearmand::plugins::queue::Hiredis::fetch(char *key, gearmand::plugins::queu
 gearmand::plugins::queue::Hiredis::Hiredis() :
   Queue("redis"),
   _redis(nullptr),
+  _queued(0),
   server("127.0.0.1"),
-  service("6379")
+  service("6379"),
+  scan_count(1000)
 {
   command_line_options().add_options()
     ("redis-server", boost::program_options::value(&server), "Redis server")
     ("redis-port", boost::program_options::value(&service), "Redis server port/service")
-    ("redis-password", boost::program_options::value(&password), "Redis server password/service");
+    ("redis-password", boost::program_options::value(&password), "Redis server password/service")
+    ("redis-scan-count", boost::program_options::value(&scan_count)->default_value(1000), "Keys asked for per SCAN, and fetched per pipelined batch, during replay");
 }
 
 /**
@@ -239,6 +382,11 @@ gearmand_error_t gearmand::plugins::queue::Hiredis::initialize()
     gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "Auth success");
   }
 
+  if (scan_count == 0)
+  {
+    return gearmand_gerror("--redis-scan-count has to be greater than 0", GEARMAND_QUEUE_ERROR);
+  }
+
   gearmand_info("Initializing hiredis module");
 
   gearman_server_set_queue(Gearmand()->server, this, _hiredis_add, _hiredis_flush, _hiredis_done, _hiredis_replay);
@@ -332,6 +480,7 @@ static gearmand_error_t _hiredis_add(gearman_server_st *, void *context,
     GEARMAN_DEFAULT_LOG_PARAM,
     "hires key: %u", (uint32_t)key.size());
 
+  /* Sent with the rest of the transaction by _hiredis_flush(). */
   gearmand::plugins::queue::Hiredis *queue= (gearmand::plugins::queue::Hiredis *)context;
   if (queue->hmset(key, data, data_size, (uint32_t)priority))
     return GEARMAND_SUCCESS;
@@ -339,15 +488,17 @@ static gearmand_error_t _hiredis_add(gearman_server_st *, void *context,
   return gearmand_log_gerror(
     GEARMAN_DEFAULT_LOG_PARAM,
     GEARMAND_QUEUE_ERROR,
-    "failed to insert '%.*s' into redis", key.size(), &key[0]);
+    "failed to insert '%.*s' into redis: %s", int(key.size()), &key[0], queue->redis()->errstr);
 }
 
-static gearmand_error_t _hiredis_flush(gearman_server_st *, void *)
+static gearmand_error_t _hiredis_flush(gearman_server_st *, void *context)
 {
-  return GEARMAND_SUCCESS;
+  gearmand::plugins::queue::Hiredis *queue= (gearmand::plugins::queue::Hiredis *)context;
+
+  return queue->exec();
 }
 
-static gearmand_error_t _hiredis_done(gearman_server_st *, void *context,
+static gearmand_error_t _hiredis_done(gearman_server_st *server, void *context,
                                       const char *unique,
                                       size_t unique_size,
                                       const char *function_name,
@@ -362,15 +513,19 @@ static gearmand_error_t _hiredis_done(gearman_server_st *, void *context,
   vchar_t key;
   build_key(key, unique, unique_size, function_name, function_name_size);
 
-  redisReply *reply= (redisReply*)redisCommand(queue->redis(), "DEL %b", &key[0], key.size());
-  if (reply == nullptr)
+  if (queue->del(key) == false)
   {
     return gearmand_log_gerror(
       GEARMAN_DEFAULT_LOG_PARAM,
       GEARMAND_QUEUE_ERROR,
-      "Failed to call DEL for key %s: %s", &key[0], queue->redis()->errstr);
+      "Failed to call DEL for key %.*s: %s", int(key.size()), &key[0], queue->redis()->errstr);
+  }
+
+  /* Under --queue-batch the batch is flushed once stored, otherwise nothing follows a done. */
+  if (server->queue_batch == NULL)
+  {
+    return queue->exec();
   }
-  freeReplyObject(reply);
 
   return GEARMAND_SUCCESS;
 }
@@ -378,73 +533,181 @@ static gearmand_error_t _hiredis_done(gearman_server_st *, void *context,
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wformat-nonliteral"
-static gearmand_error_t _hiredis_replay(gearman_server_st *server, void *context,
-                                                gearman_queue_add_fn *add_fn,
-                                                void *add_context)
+/*
+  Fetches the jobs for one page of SCAN keys, sending every HGETALL
+  before reading the first reply.
+*/
+static gearmand_error_t _hiredis_replay_keys(gearman_server_st *server,
+                                             gearmand::plugins::queue::Hiredis *queue,
+                                             const redisReply *keys,
+                                             const char *fmt_str,
+                                             gearman_queue_add_fn *add_fn,
+                                             void *add_context)
 {
-  gearmand::plugins::queue::Hiredis *queue= (gearmand::plugins::queue::Hiredis *)context;
+  redisContext *context= queue->redis();
 
-  gearmand_info("hiredis replay start");
+  struct job_key_st {
+    const char *key;
+    char function_name[GEARMAN_FUNCTION_MAX_SIZE];
+    char unique[GEARMAN_MAX_UNIQUE_SIZE];
+  };
+  std::vector<job_key_st> jobs;
+  jobs.reserve(keys->elements);
 
-  redisReply *reply= (redisReply*)redisCommand(queue->redis(), "KEYS %s*", GEARMAND_QUEUE_GEARMAND_DEFAULT_PREFIX);
-  if (reply == nullptr)
+  for (size_t x= 0; x < keys->elements; x++)
   {
-    return gearmand_log_gerror(
-      GEARMAN_DEFAULT_LOG_PARAM,
-      GEARMAND_QUEUE_ERROR,
-      "Failed to call KEYS during QUEUE replay: %s", queue->redis()->errstr);
+    char prefix[GEARMAND_QUEUE_GEARMAND_DEFAULT_PREFIX_SIZE];
+    job_key_st job;
+    job.key= keys->element[x]->str;
+    int ret= sscanf(job.key,
+                    fmt_str,
+                    prefix,
+                    job.function_name,
+                    job.unique);
+    if (ret == 0)
+    {
+      continue;
+    }
+
+    if (redisAppendCommand(context, "HGETALL %s", job.key) != REDIS_OK)
+    {
+      return gearmand_log_gerror(GEARMAN_DEFAULT_LOG_PARAM, GEARMAND_QUEUE_ERROR,
+                                 "Failed to append HGETALL during QUEUE replay: %s", context->errstr);
+    }
+    jobs.push_back(job);
   }
 
-  for (size_t x= 0; x < reply->elements; x++)
+  // Every reply is read, even after a failure, to keep the connection in step.
+  std::vector<redisReply*> replies(jobs.size(), nullptr);
+  for (size_t x= 0; x < jobs.size(); x++)
   {
-    char prefix[GEARMAND_QUEUE_GEARMAND_DEFAULT_PREFIX_SIZE];
-    char function_name[GEARMAN_FUNCTION_MAX_SIZE];
-    char unique[GEARMAN_MAX_UNIQUE_SIZE];
+    if (redisGetReply(context, (void **)&replies[x]) != REDIS_OK)
+    {
+      for (size_t y= 0; y < x; y++)
+      {
+        freeReplyObject(replies[y]);
+      }
+      return gearmand_log_gerror(GEARMAN_DEFAULT_LOG_PARAM, GEARMAND_QUEUE_ERROR,
+                                 "Failed to read HGETALL during QUEUE replay: %s", context->errstr);
+    }
+  }
 
-    char fmt_str[100] = "";
-    int fmt_str_length= snprintf(fmt_str, sizeof(fmt_str), "%%%d[^-]-%%%d[^-]-%%%ds",
-                                 int(GEARMAND_QUEUE_GEARMAND_DEFAULT_PREFIX_SIZE),
-                                 int(GEARMAN_FUNCTION_MAX_SIZE),
-                                 int(GEARMAN_MAX_UNIQUE_SIZE));
-    if (fmt_str_length <= 0 or size_t(fmt_str_length) >= sizeof(fmt_str))
+  gearmand_error_t ret= GEARMAND_SUCCESS;
+  for (size_t x= 0; x < jobs.size(); x++)
+  {
+    gearmand::plugins::queue::redis_record_t record;
+    if (gearmand_success(ret))
     {
-      assert(fmt_str_length != 1);
-      return gearmand_gerror(
-        "snprintf() failed to produce a valud fmt_str for redis key",
-        GEARMAND_QUEUE_ERROR);
+      bool fetched;
+      if (replies[x]->type == REDIS_REPLY_ERROR)
+      {
+        // Not a hash, fetch() knows the older layouts.
+        fetched= queue->fetch(jobs[x].key, record);
+      }
+      else
+      {
+        fetched= _hiredis_record(replies[x], record);
+      }
+
+      if (fetched == false)
+      {
+        ret= gearmand_log_gerror(GEARMAN_DEFAULT_LOG_PARAM, GEARMAND_QUEUE_ERROR,
+                                 "Failed to fetch data for the key: %s", jobs[x].key);
+      }
     }
-    int ret= sscanf(reply->element[x]->str,
-                    fmt_str,
-                    prefix,
-                    function_name,
-                    unique);
-    if (ret == 0)
+    freeReplyObject(replies[x]);
+
+    if (gearmand_failed(ret))
     {
       continue;
     }
 
-    gearmand::plugins::queue::redis_record_t record;
-    if(!queue->fetch(reply->element[x]->str, record))
+    /* need to make a copy here ... gearman_server_job_free will free it later */
+    size_t data_size= record.data.size();
+    char *data= (char *)malloc(data_size ? data_size : 1);
+    if (data == NULL)
+    {
+      ret= gearmand_perror(errno, "malloc");
+      continue;
+    }
+    memcpy(data, record.data.data(), data_size);
+    gearman_job_priority_t priority = static_cast<gearman_job_priority_t>(record.priority);
+
+    gearmand_error_t add_ret= (add_fn)(server, add_context,
+                                       jobs[x].unique, strlen(jobs[x].unique),
+                                       jobs[x].function_name, strlen(jobs[x].function_name),
+                                       data, data_size,
+                                       priority, 0);
+    if (add_ret == GEARMAND_SHUTDOWN)
+    {
+      ret= add_ret;
+    }
+  }
+
+  return ret;
+}
+
+static gearmand_error_t _hiredis_replay(gearman_server_st *server, void *context,
+                                                gearman_queue_add_fn *add_fn,
+                                                void *add_context)
+{
+  gearmand::plugins::queue::Hiredis *queue= (gearmand::plugins::queue::Hiredis *)context;
+
+  gearmand_info("hiredis replay start");
+
+  char fmt_str[100] = "";
+  int fmt_str_length= snprintf(fmt_str, sizeof(fmt_str), "%%%d[^-]-%%%d[^-]-%%%ds",
+                               int(GEARMAND_QUEUE_GEARMAND_DEFAULT_PREFIX_SIZE),
+                               int(GEARMAN_FUNCTION_MAX_SIZE),
+                               int(GEARMAN_MAX_UNIQUE_SIZE));
+  if (fmt_str_length <= 0 or size_t(fmt_str_length) >= sizeof(fmt_str))
+  {
+    assert(fmt_str_length != 1);
+    return gearmand_gerror(
+      "snprintf() failed to produce a valud fmt_str for redis key",
+      GEARMAND_QUEUE_ERROR);
+  }
+
+  /* SCAN walks the keyspace a page at a time instead of blocking the server like KEYS. */
+  std::string cursor("0");
+  uint64_t pages= 0;
+  do
+  {
+    redisReply *reply= (redisReply*)redisCommand(queue->redis(), "SCAN %s MATCH %s* COUNT %u",
+                                                 cursor.c_str(), GEARMAND_QUEUE_GEARMAND_DEFAULT_PREFIX,
+                                                 queue->scan_count);
+    if (reply == nullptr)
     {
       return gearmand_log_gerror(
         GEARMAN_DEFAULT_LOG_PARAM,
         GEARMAND_QUEUE_ERROR,
-        "Failed to fetch data for the key: %s", reply->element[x]->str);
+        "Failed to call SCAN during QUEUE replay: %s", queue->redis()->errstr);
     }
 
-    /* need to make a copy here ... gearman_server_job_free will free it later */
-    char *data = strdup(record.data.c_str());
-    size_t data_size = record.data.size();
-    gearman_job_priority_t priority = static_cast<gearman_job_priority_t>(record.priority);
+    if (reply->type != REDIS_REPLY_ARRAY or reply->elements != 2 or
+        reply->element[0]->type != REDIS_REPLY_STRING or
+        reply->element[1]->type != REDIS_REPLY_ARRAY)
+    {
+      gearmand_error_t ret= gearmand_log_gerror(
+        GEARMAN_DEFAULT_LOG_PARAM,
+        GEARMAND_QUEUE_ERROR,
+        "Unexpected SCAN reply during QUEUE replay: %s", reply->type == REDIS_REPLY_ERROR ? reply->str : "");
+      freeReplyObject(reply);
+      return ret;
+    }
 
-    (void)(add_fn)(server, add_context,
-                   unique, strlen(unique),
-                   function_name, strlen(function_name),
-                   data, data_size,
-                   priority, 0);
-  }
+    cursor.assign(reply->element[0]->str, reply->element[0]->len);
+    pages++;
 
-  freeReplyObject(reply);
+    gearmand_error_t ret= _hiredis_replay_keys(server, queue, reply->element[1], fmt_str, add_fn, add_context);
+    freeReplyObject(reply);
+    if (gearmand_failed(ret))
+    {
+      return ret;
+    }
+  } while (cursor.compare("0") != 0);
+
+  gearmand_log_info(GEARMAN_DEFAULT_LOG_PARAM, "hiredis replay end: %" PRIu64 " SCAN pages", pages);
 
   return GEARMAND_SUCCESS;
 }
@@ -67,10 +67,12 @@ struct redis_record_t {
 class Hiredis : public Queue {
   private:
     redisContext *_redis;
+    size_t _queued; // Commands appended since MULTI, 0 when none is open.
   public:
     std::string server;
     std::string service;
     std::string password;
+    uint32_t scan_count;
 
     Hiredis();
     ~Hiredis();
@@ -82,9 +84,29 @@ class Hiredis : public Queue {
     /*
      * hmset(vchar_t key, const void *data, size_t data_size, uint32_t)
      *
-     * returns true if hiredis HMSET succeeded
+     * appends HMSET for the job to the open transaction,
+     * it is sent by exec()
+     *
+     * returns true if the command was appended
+     */
+    bool hmset(const vchar_t&, const void *, size_t, uint32_t);
+
+    /*
+     * del(vchar_t key)
+     *
+     * appends DEL for the job to the open transaction
+     *
+     * returns true if the command was appended
      */
-    bool hmset(vchar_t, const void *, size_t, uint32_t);
+    bool del(const vchar_t&);
+
+    /*
+     * gearmand_error_t exec()
+     *
+     * sends the commands appended since the last exec() as one
+     * MULTI/EXEC transaction in a single round trip
+     */
+    gearmand_error_t exec();
 
     /*
      * bool fetch(char *key, redis_record_t &req)
@@ -94,7 +116,10 @@ class Hiredis : public Queue {
      *
      * returns true on success
      */
-    bool fetch(char *, redis_record_t &);
+    bool fetch(const char *, redis_record_t &);
+
+  private:
+    bool append(int argc, const char **argv, const size_t *argvlen);
 }; // class Hiredis
 
 void initialize_redis();
@@ -43,11 +43,21 @@
 #include "libgearman-server/plugins/queue/sqlite/instance.hpp"
 
 #include <cerrno>
+#include <cstdio>
+#include <strings.h>
+
+/** Rows per multi-row INSERT or DELETE; kept under the 999 host parameters
+ * older SQLite builds allow.
+ */
+#define GEARMAND_QUEUE_SQLITE_BATCH_ROWS 128
 
 namespace gearmand {
 namespace queue {
 
-Instance::Instance(const std::string& schema_, const std::string& table_):
+Instance::Instance(const std::string& schema_, const std::string& table_,
+                   const std::string& journal_mode_,
+                   const std::string& synchronous_,
+                   int64_t mmap_size_):
   _epoch_support(true),
   _check_replay(false),
   _in_trans(0),
@@ -55,8 +65,15 @@ Instance::Instance(const std::string& schema_, const std::string& table_):
   delete_sth(NULL),
   insert_sth(NULL),
   replay_sth(NULL),
+  insert_batch_sth(NULL),
+  delete_batch_sth(NULL),
+  _fetch_db(NULL),
+  fetch_sth(NULL),
   _schema(schema_),
-  _table(table_)
+  _table(table_),
+  _journal_mode(journal_mode_),
+  _synchronous(synchronous_),
+  _mmap_size(mmap_size_)
   { 
     _delete_query+= "DELETE FROM ";
     _delete_query+= _table;
@@ -87,6 +104,20 @@ Instance::~Instance()
   _sqlite3_finalize(replay_sth);
   replay_sth= NULL;
 
+  _sqlite3_finalize(insert_batch_sth);
+  insert_batch_sth= NULL;
+
+  _sqlite3_finalize(delete_batch_sth);
+  delete_batch_sth= NULL;
+
+  if (_fetch_db)
+  {
+    sqlite3_finalize(fetch_sth);
+    fetch_sth= NULL;
+    sqlite3_close(_fetch_db);
+    _fetch_db= NULL;
+  }
+
   assert(_db);
   if (_db)
   {
@@ -193,6 +224,63 @@ bool Instance::_sqlite_dispatch(const std::string& arg)
   return _sqlite_count(arg.c_str(), count);
 }
 
+/*
+  journal_mode answers with the mode in effect, which stays the old one
+  when the database cannot switch (an in-memory database cannot use wal).
+*/
+bool Instance::_sqlite_pragmas()
+{
+  if (_journal_mode.empty() == false)
+  {
+    std::string query("PRAGMA journal_mode=");
+    query+= _journal_mode;
+
+    sqlite3_stmt* journal_sth= NULL;
+    if (_sqlite_prepare(query, &journal_sth) == false)
+    {
+      return false;
+    }
+
+    if (sqlite3_step(journal_sth) == SQLITE_ROW)
+    {
+      const char *mode= (const char *)sqlite3_column_text(journal_sth, 0);
+      if (mode and strcasecmp(mode, _journal_mode.c_str()))
+      {
+        gearmand_log_warning(GEARMAN_DEFAULT_LOG_PARAM, "sqlite journal_mode is %s, not %s", mode, _journal_mode.c_str());
+      }
+    }
+    else
+    {
+      _error_string= sqlite3_errmsg(_db);
+      _sqlite3_finalize(journal_sth);
+      return false;
+    }
+    _sqlite3_finalize(journal_sth);
+  }
+
+  if (_synchronous.empty() == false)
+  {
+    std::string query("PRAGMA synchronous=");
+    query+= _synchronous;
+    if (_sqlite_dispatch(query) == false)
+    {
+      return false;
+    }
+  }
+
+  if (_mmap_size)
+  {
+    char query[64];
+    snprintf(query, sizeof(query), "PRAGMA mmap_size=%lld", (long long)_mmap_size);
+    if (_sqlite_dispatch(query) == false)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
 bool Instance::_sqlite_commit()
 {
   /* not in transaction? */
@@ -235,6 +323,11 @@ gearmand_error_t Instance::init()
   // database which can cause a lock conflict.
   sqlite3_busy_timeout(_db, 6000);
 
+  if (_sqlite_pragmas() == false)
+  {
+    return gearmand_gerror(_error_string.c_str(), GEARMAND_QUEUE_ERROR);
+  }
+
   int rows;
   std::string check_table_str("SELECT 1 FROM sqlite_master WHERE type='table' AND name='");
   check_table_str+= _table;
@@ -299,6 +392,42 @@ gearmand_error_t Instance::init()
                                "INSERT PREPARE: %s",  _error_string.c_str());
   }
 
+  {
+    std::string query("INSERT OR REPLACE INTO ");
+    query+= _table;
+    query+= _epoch_support ?
+      " (priority, unique_key, function_name, data, when_to_run) VALUES " :
+      " (priority, unique_key, function_name, data) VALUES ";
+    for (size_t x= 0; x < GEARMAND_QUEUE_SQLITE_BATCH_ROWS; ++x)
+    {
+      query+= x ? "," : "";
+      query+= _epoch_support ? "(?,?,?,?,?)" : "(?,?,?,?)";
+    }
+
+    if (_sqlite_prepare(query, &insert_batch_sth) == false)
+    {
+      return gearmand_log_gerror(GEARMAN_DEFAULT_LOG_PARAM, GEARMAND_QUEUE_ERROR,
+                                 "INSERT batch PREPARE: %s", _error_string.c_str());
+    }
+  }
+
+  {
+    std::string query("DELETE FROM ");
+    query+= _table;
+    query+= " WHERE ";
+    for (size_t x= 0; x < GEARMAND_QUEUE_SQLITE_BATCH_ROWS; ++x)
+    {
+      query+= x ? " OR " : "";
+      query+= "(unique_key=? AND function_name=?)";
+    }
+
+    if (_sqlite_prepare(query, &delete_batch_sth) == false)
+    {
+      return gearmand_log_gerror(GEARMAN_DEFAULT_LOG_PARAM, GEARMAND_QUEUE_ERROR,
+                                 "DELETE batch PREPARE: %s", _error_string.c_str());
+    }
+  }
+
   {
     std::string query;
     if (_epoch_support)
@@ -412,6 +541,105 @@ gearmand_error_t Instance::add(gearman_server_st*,
   return GEARMAND_SUCCESS;
 }
 
+/*
+  Binds one job at column onwards. The batch outlives the step, so
+  nothing is copied.
+*/
+bool Instance::_bind_insert(sqlite3_stmt* sth, int column, const Job& job)
+{
+  if (sqlite3_bind_int(sth, column, job.priority) != SQLITE_OK or
+      sqlite3_bind_text(sth, column +1, job.unique, int(job.unique_size), SQLITE_STATIC) != SQLITE_OK or
+      sqlite3_bind_text(sth, column +2, job.function_name, int(job.function_name_size), SQLITE_STATIC) != SQLITE_OK or
+      sqlite3_bind_blob(sth, column +3, job.data, int(job.data_size), SQLITE_STATIC) != SQLITE_OK)
+  {
+    return false;
+  }
+
+  if (_epoch_support)
+  {
+    return sqlite3_bind_int64(sth, column +4, job.when) == SQLITE_OK;
+  }
+
+  return true;
+}
+
+bool Instance::_bind_delete(sqlite3_stmt* sth, int column, const Job& job)
+{
+  return sqlite3_bind_text(sth, column, job.unique, int(job.unique_size), SQLITE_STATIC) == SQLITE_OK and
+    sqlite3_bind_text(sth, column +1, job.function_name, int(job.function_name_size), SQLITE_STATIC) == SQLITE_OK;
+}
+
+/*
+  Full groups of GEARMAND_QUEUE_SQLITE_BATCH_ROWS go through the
+  multi-row INSERT, the rest through the single row one, all inside the
+  transaction flush() commits. On failure the transaction is rolled back.
+*/
+gearmand_error_t Instance::add_batch(gearman_server_st *server, const Job *jobs, size_t count)
+{
+  assert(_check_replay == false);
+  gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "sqlite add batch: %u", uint32_t(count));
+
+  gearmand_error_t ret= _insert_batch(jobs, count);
+  if (gearmand_failed(ret))
+  {
+    (void)rollback(server);
+  }
+
+  return ret;
+}
+
+gearmand_error_t Instance::_insert_batch(const Job *jobs, size_t count)
+{
+
+  if (_epoch_support == false)
+  {
+    for (size_t x= 0; x < count; ++x)
+    {
+      if (jobs[x].when)
+      {
+        return gearmand_gerror("Table lacks when_to_run field", GEARMAND_QUEUE_ERROR);
+      }
+    }
+  }
+
+  if (_sqlite_lock() == false)
+  {
+    return gearmand_gerror(_error_string.c_str(), GEARMAND_QUEUE_ERROR);
+  }
+
+  const int columns= _epoch_support ? 5 : 4;
+  size_t x= 0;
+  while (x < count)
+  {
+    size_t rows= count - x >= GEARMAND_QUEUE_SQLITE_BATCH_ROWS ? GEARMAND_QUEUE_SQLITE_BATCH_ROWS : 1;
+    sqlite3_stmt* sth= rows == 1 ? insert_sth : insert_batch_sth;
+
+    if (sqlite3_reset(sth) != SQLITE_OK)
+    {
+      return gearmand_log_gerror(GEARMAN_DEFAULT_LOG_PARAM, GEARMAND_QUEUE_ERROR,
+                                 "failed to reset INSERT prep statement: %s", sqlite3_errmsg(_db));
+    }
+
+    for (size_t row= 0; row < rows; ++row)
+    {
+      if (_bind_insert(sth, int(row) * columns +1, jobs[x + row]) == false)
+      {
+        return gearmand_log_gerror(GEARMAN_DEFAULT_LOG_PARAM, GEARMAND_QUEUE_ERROR,
+                                   "failed to bind INSERT: %s", sqlite3_errmsg(_db));
+      }
+    }
+
+    if (sqlite3_step(sth) != SQLITE_DONE)
+    {
+      return gearmand_log_gerror(GEARMAN_DEFAULT_LOG_PARAM, GEARMAND_QUEUE_ERROR,
+                                 "INSERT error: %s", sqlite3_errmsg(_db));
+    }
+    x+= rows;
+  }
+
+  return GEARMAND_SUCCESS;
+}
+
 gearmand_error_t Instance::flush(gearman_server_st*)
 {
   gearmand_debug("sqlite flush");
@@ -476,6 +704,81 @@ gearmand_error_t Instance::done(gearman_server_st*,
   return GEARMAND_SUCCESS;
 }
 
+// As add_batch(), left for flush() to commit.
+gearmand_error_t Instance::done_batch(gearman_server_st *server, const Job *jobs, size_t count)
+{
+  gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "sqlite done batch: %u", uint32_t(count));
+
+  gearmand_error_t ret= _delete_batch(jobs, count);
+  if (gearmand_failed(ret))
+  {
+    (void)rollback(server);
+  }
+
+  return ret;
+}
+
+gearmand_error_t Instance::_delete_batch(const Job *jobs, size_t count)
+{
+
+  if (_sqlite_lock() == false)
+  {
+    return gearmand_gerror(_error_string.c_str(), GEARMAND_QUEUE_ERROR);
+  }
+
+  size_t x= 0;
+  while (x < count)
+  {
+    size_t rows= count - x >= GEARMAND_QUEUE_SQLITE_BATCH_ROWS ? GEARMAND_QUEUE_SQLITE_BATCH_ROWS : 1;
+    sqlite3_stmt* sth= rows == 1 ? delete_sth : delete_batch_sth;
+
+    if (sqlite3_reset(sth) != SQLITE_OK)
+    {
+      return gearmand_log_gerror(GEARMAN_DEFAULT_LOG_PARAM, GEARMAND_QUEUE_ERROR,
+                                 "failed to reset DELETE prep statement: %s", sqlite3_errmsg(_db));
+    }
+
+    for (size_t row= 0; row < rows; ++row)
+    {
+      if (_bind_delete(sth, int(row) * 2 +1, jobs[x + row]) == false)
+      {
+        return gearmand_log_gerror(GEARMAN_DEFAULT_LOG_PARAM, GEARMAND_QUEUE_ERROR,
+                                   "failed to bind DELETE: %s", sqlite3_errmsg(_db));
+      }
+    }
+
+    if (sqlite3_step(sth) != SQLITE_DONE)
+    {
+      return gearmand_log_gerror(GEARMAN_DEFAULT_LOG_PARAM, GEARMAND_QUEUE_ERROR,
+                                 "DELETE error: %s", sqlite3_errmsg(_db));
+    }
+    x+= rows;
+  }
+
+  return GEARMAND_SUCCESS;
+}
+
+/*
+  A failed statement of a batch takes the rows already written in the
+  transaction with it, so none of them are committed by a later flush().
+*/
+bool Instance::rollback(gearman_server_st*)
+{
+  if (_sqlite_rollback() == false)
+  {
+    gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "ROLLBACK error: %s", _error_string.c_str());
+  }
+
+  // SQLite may have ended the transaction on its own when ROLLBACK failed.
+  if (sqlite3_get_autocommit(_db))
+  {
+    _in_trans= 0;
+    return true;
+  }
+
+  return false;
+}
+
 gearmand_error_t Instance::replay(gearman_server_st *server)
 {
   gearmand_error_t ret;
@@ -497,6 +800,22 @@ gearmand_error_t Instance::replay_loop(gearman_server_st *server)
 {
   gearmand_info("sqlite replay start");
 
+  {
+    sqlite3_stmt* count_sth;
+    if (_sqlite_prepare(std::string("SELECT count(*) FROM ") + _table, &count_sth))
+    {
+      if (sqlite3_step(count_sth) == SQLITE_ROW)
+      {
+        replay_expect(server, uint64_t(sqlite3_column_int64(count_sth, 0)));
+      }
+      _sqlite3_finalize(count_sth);
+    }
+    else
+    {
+      reset_error(); // Only a hint, the replay goes on without it.
+    }
+  }
+
   gearmand_error_t gret= GEARMAND_UNKNOWN_STATE;
   size_t row_count= 0;
   while (sqlite3_step(replay_sth) == SQLITE_ROW)
@@ -601,6 +920,114 @@ gearmand_error_t Instance::replay_loop(gearman_server_st *server)
   return gret;
 }
 
+/*
+  The data is read through a connection of its own, so the prefetch
+  thread never shares one with the thread storing jobs. A database in
+  memory cannot be opened twice.
+*/
+bool Instance::can_fetch()
+{
+  return _schema != ":memory:";
+}
+
+gearmand_error_t Instance::_fetch_open()
+{
+  if (sqlite3_open_v2(_schema.c_str(), &_fetch_db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK)
+  {
+    gearmand_error_t ret= gearmand_log_gerror(GEARMAN_DEFAULT_LOG_PARAM, GEARMAND_QUEUE_ERROR,
+                                              "sqlite3_open failed with: %s", sqlite3_errmsg(_fetch_db));
+    sqlite3_close(_fetch_db);
+    _fetch_db= NULL;
+    return ret;
+  }
+
+  sqlite3_busy_timeout(_fetch_db, 6000);
+
+  if (_mmap_size)
+  {
+    char query[64];
+    snprintf(query, sizeof(query), "PRAGMA mmap_size=%lld", (long long)_mmap_size);
+    (void)sqlite3_exec(_fetch_db, query, NULL, NULL, NULL);
+  }
+
+  std::string query("SELECT data FROM ");
+  query+= _table;
+  query+= " WHERE unique_key=? AND function_name=?";
+  if (sqlite3_prepare_v2(_fetch_db, query.c_str(), -1, &fetch_sth, NULL) != SQLITE_OK)
+  {
+    gearmand_error_t ret= gearmand_log_gerror(GEARMAN_DEFAULT_LOG_PARAM, GEARMAND_QUEUE_ERROR,
+                                              "FETCH PREPARE: %s", sqlite3_errmsg(_fetch_db));
+    sqlite3_close(_fetch_db);
+    _fetch_db= NULL;
+    fetch_sth= NULL;
+    return ret;
+  }
+
+  return GEARMAND_SUCCESS;
+}
+
+gearmand_error_t Instance::fetch(const char *unique, size_t unique_size,
+                                 const char *function_name, size_t function_name_size,
+                                 void*& data, size_t& data_size)
+{
+  data= NULL;
+  data_size= 0;
+
+  if (_fetch_db == NULL)
+  {
+    gearmand_error_t ret= _fetch_open();
+    if (gearmand_failed(ret))
+    {
+      return ret;
+    }
+  }
+
+  if (sqlite3_bind_text(fetch_sth, 1, unique, int(unique_size), SQLITE_STATIC) != SQLITE_OK or
+      sqlite3_bind_text(fetch_sth, 2, function_name, int(function_name_size), SQLITE_STATIC) != SQLITE_OK)
+  {
+    gearmand_error_t ret= gearmand_log_gerror(GEARMAN_DEFAULT_LOG_PARAM, GEARMAND_QUEUE_ERROR,
+                                              "failed to bind FETCH: %s", sqlite3_errmsg(_fetch_db));
+    (void)sqlite3_reset(fetch_sth);
+    return ret;
+  }
+
+  gearmand_error_t ret;
+  int rc= sqlite3_step(fetch_sth);
+  if (rc == SQLITE_ROW)
+  {
+    data_size= size_t(sqlite3_column_bytes(fetch_sth, 0));
+    data= malloc(data_size ? data_size : 1);
+    if (data == NULL)
+    {
+      data_size= 0;
+      ret= gearmand_perror(errno, "malloc");
+    }
+    else
+    {
+      if (data_size)
+      {
+        memcpy(data, sqlite3_column_blob(fetch_sth, 0), data_size);
+      }
+      ret= GEARMAND_SUCCESS;
+    }
+  }
+  else if (rc == SQLITE_DONE)
+  {
+    ret= GEARMAND_NO_JOBS;
+  }
+  else
+  {
+    ret= gearmand_log_gerror(GEARMAN_DEFAULT_LOG_PARAM, GEARMAND_QUEUE_ERROR,
+                             "FETCH error: %s", sqlite3_errmsg(_fetch_db));
+  }
+
+  /* Lets go of the read lock, and of the caller's strings. */
+  (void)sqlite3_reset(fetch_sth);
+  (void)sqlite3_clear_bindings(fetch_sth);
+
+  return ret;
+}
+
 } // namespace queue
 } // namespace gearmand
 
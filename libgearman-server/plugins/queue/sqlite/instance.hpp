@@ -49,7 +49,10 @@ namespace queue {
 class Instance : public gearmand::queue::Context 
 {
 public:
-  Instance(const std::string& schema_, const std::string& table_);
+  Instance(const std::string& schema_, const std::string& table_,
+           const std::string& journal_mode_,
+           const std::string& synchronous_,
+           int64_t mmap_size_);
 
   ~Instance();
 
@@ -62,14 +65,28 @@ public:
                        gearman_job_priority_t priority,
                        int64_t when);
 
+  gearmand_error_t add_batch(gearman_server_st *server,
+                             const Job *jobs, size_t count);
+
   gearmand_error_t flush(gearman_server_st *server);
 
   gearmand_error_t done(gearman_server_st *server,
                         const char *unique, size_t unique_size,
                         const char *function_name, size_t function_name_size);
 
+  gearmand_error_t done_batch(gearman_server_st *server,
+                              const Job *jobs, size_t count);
+
+  bool rollback(gearman_server_st *server);
+
   gearmand_error_t replay(gearman_server_st *server);
 
+  bool can_fetch();
+
+  gearmand_error_t fetch(const char *unique, size_t unique_size,
+                         const char *function_name, size_t function_name_size,
+                         void*& data, size_t& data_size);
+
   bool has_error()
   {
     return _error_string.size();
@@ -91,7 +108,13 @@ private:
   bool _sqlite_commit();
   bool _sqlite_rollback();
   bool _sqlite_lock();
+  bool _sqlite_pragmas();
+  bool _bind_insert(sqlite3_stmt* sth, int column, const Job& job);
+  bool _bind_delete(sqlite3_stmt* sth, int column, const Job& job);
+  gearmand_error_t _insert_batch(const Job *jobs, size_t count);
+  gearmand_error_t _delete_batch(const Job *jobs, size_t count);
   void _sqlite3_finalize(sqlite3_stmt*);
+  gearmand_error_t _fetch_open();
 
 private:
   bool _epoch_support;
@@ -101,9 +124,16 @@ private:
   sqlite3_stmt* delete_sth;
   sqlite3_stmt* insert_sth;
   sqlite3_stmt* replay_sth;
+  sqlite3_stmt* insert_batch_sth;
+  sqlite3_stmt* delete_batch_sth;
+  sqlite3 *_fetch_db; // Read only, used by the prefetch thread alone.
+  sqlite3_stmt* fetch_sth;
   std::string _error_string;
   std::string _schema;
   std::string _table;
+  std::string _journal_mode;
+  std::string _synchronous;
+  int64_t _mmap_size;
   std::string _insert_query;
   std::string _delete_query;
 };
@@ -47,11 +47,15 @@
 #include <libgearman-server/plugins/queue/sqlite/queue.h>
 #include <libgearman-server/plugins/queue/base.h>
 
+#include <strings.h>
+
 #include "libgearman-server/plugins/queue/sqlite/instance.hpp"
 
 /** Default values.
  */
 #define GEARMAND_QUEUE_SQLITE_DEFAULT_TABLE "gearman_queue"
+#define GEARMAND_QUEUE_SQLITE_DEFAULT_JOURNAL_MODE "wal"
+#define GEARMAND_QUEUE_SQLITE_DEFAULT_SYNCHRONOUS "full"
 
 namespace gearmand {
 namespace plugins {
@@ -67,6 +71,9 @@ public:
 
   std::string schema;
   std::string table;
+  std::string journal_mode;
+  std::string synchronous;
+  int64_t mmap_size;
 
 private:
   bool _store_on_shutdown;
@@ -79,6 +86,9 @@ Sqlite::Sqlite() :
     ("libsqlite3-db", boost::program_options::value(&schema), "Database file to use.")
     ("store-queue-on-shutdown", boost::program_options::bool_switch(&_store_on_shutdown)->default_value(false), "Store queue on shutdown.")
     ("libsqlite3-table", boost::program_options::value(&table)->default_value(GEARMAND_QUEUE_SQLITE_DEFAULT_TABLE), "Table to use.")
+    ("libsqlite3-journal-mode", boost::program_options::value(&journal_mode)->default_value(GEARMAND_QUEUE_SQLITE_DEFAULT_JOURNAL_MODE), "Journal mode: wal, delete, truncate or persist.")
+    ("libsqlite3-synchronous", boost::program_options::value(&synchronous)->default_value(GEARMAND_QUEUE_SQLITE_DEFAULT_SYNCHRONOUS), "Synchronous level: off, normal, full or extra.")
+    ("libsqlite3-mmap-size", boost::program_options::value(&mmap_size)->default_value(0), "Bytes of the database to memory map, 0 to not use mmap.")
     ;
 }
 
@@ -86,9 +96,36 @@ Sqlite::~Sqlite()
 {
 }
 
+static bool _valid_value(const std::string& value, const char * const *valid)
+{
+  for (; *valid; ++valid)
+  {
+    if (strcasecmp(value.c_str(), *valid) == 0)
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
 gearmand_error_t Sqlite::initialize()
 {
-  gearmand::queue::Instance* exec_queue= new gearmand::queue::Instance(schema, table);
+  static const char * const journal_modes[]= { "wal", "delete", "truncate", "persist", NULL };
+  static const char * const synchronous_levels[]= { "off", "normal", "full", "extra", NULL };
+
+  if (_valid_value(journal_mode, journal_modes) == false)
+  {
+    return gearmand_log_gerror(GEARMAN_DEFAULT_LOG_PARAM, GEARMAND_QUEUE_ERROR, "invalid --libsqlite3-journal-mode %s", journal_mode.c_str());
+  }
+
+  if (_valid_value(synchronous, synchronous_levels) == false)
+  {
+    return gearmand_log_gerror(GEARMAN_DEFAULT_LOG_PARAM, GEARMAND_QUEUE_ERROR, "invalid --libsqlite3-synchronous %s", synchronous.c_str());
+  }
+
+  gearmand::queue::Instance* exec_queue= new gearmand::queue::Instance(schema, table,
+                                                                       journal_mode, synchronous, mmap_size);
 
   if (exec_queue == NULL)
   {
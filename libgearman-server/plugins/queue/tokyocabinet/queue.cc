@@ -44,6 +44,11 @@
 
 #include <tcutil.h>
 #include <tcadb.h>
+#include <tchdb.h>
+#include <tcbdb.h>
+
+#include <map>
+#include <vector>
 
 namespace gearmand { namespace plugins { namespace queue { class TokyoCabinet;  }}}
 
@@ -52,6 +57,14 @@ namespace gearmand { namespace plugins { namespace queue { class TokyoCabinet;
  */
 
 #define GEARMAND_QUEUE_TOKYOCABINET_MAX_KEY_LEN 4096
+
+/**
+ * Keys are a NUL followed by a big endian sequence number, so a B+ tree
+ * database iterates in submission order. Older "function-unique" keys
+ * never begin with NUL and are still read and removed, or replaced by a
+ * sequence key when the job is stored again.
+ */
+#define GEARMAND_QUEUE_TOKYOCABINET_SEQUENCE_KEY_LEN 9
 gearmand_error_t _initialize(gearman_server_st *server,
                              gearmand::plugins::queue::TokyoCabinet *queue);
 
@@ -75,18 +88,51 @@ public:
     }
   }
 
+  /*
+    Updates between two flushes are made in one transaction, begun by the
+    first of them. abort() drops it, and the keys it remembered or forgot.
+  */
+  gearmand_error_t begin();
+  gearmand_error_t commit(bool sync);
+  void abort();
+
+  /*
+    Finds the key of the record for function and unique, as remembered
+    when the job was added or replayed: a sequence, or 0 for an old style
+    key. False when no record is known.
+  */
+  bool find(const std::string& name, uint64_t& sequence);
+  void remember(const std::string& name, uint64_t sequence);
+  void forget(const std::string& name);
+
   TCADB *db;
   std::string filename;
   bool optimize;
+  uint64_t sequence;
+
+private:
+  struct undo_st {
+    std::string name;
+    bool known;
+    uint64_t sequence;
+  };
+
+  void _change(const std::string& name);
+
+  bool _transaction;
+  std::map<std::string, uint64_t> _keys;
+  std::vector<undo_st> _undo; // _keys before each change of the transaction
 };
 
 TokyoCabinet::TokyoCabinet() :
   Queue("libtokyocabinet"),
   db(NULL),
-  optimize(false)
+  optimize(false),
+  sequence(0),
+  _transaction(false)
 {
   command_line_options().add_options()
-    ("libtokyocabinet-file", boost::program_options::value(&filename), "File name of the database. [see: man tcadb, tcadbopen() for name guidelines]")
+    ("libtokyocabinet-file", boost::program_options::value(&filename), "File name of the database. [see: man tcadb, tcadbopen() for name guidelines] The key of every queued job is also kept in memory, about 80 bytes plus its function name and unique.")
     ("libtokyocabinet-optimize", boost::program_options::bool_switch(&optimize)->default_value(true), "Optimize database on open. [default=true]");
 }
 
@@ -100,6 +146,44 @@ gearmand_error_t TokyoCabinet::initialize()
   return _initialize(&Gearmand()->server, this);
 }
 
+bool TokyoCabinet::find(const std::string& name, uint64_t& sequence_)
+{
+  std::map<std::string, uint64_t>::iterator iter= _keys.find(name);
+  if (iter == _keys.end())
+  {
+    return false;
+  }
+
+  sequence_= iter->second;
+  return true;
+}
+
+void TokyoCabinet::remember(const std::string& name, uint64_t sequence_)
+{
+  _change(name);
+  _keys[name]= sequence_;
+}
+
+void TokyoCabinet::forget(const std::string& name)
+{
+  _change(name);
+  _keys.erase(name);
+}
+
+void TokyoCabinet::_change(const std::string& name)
+{
+  if (_transaction == false)
+  {
+    return;
+  }
+
+  undo_st undo;
+  undo.name= name;
+  undo.sequence= 0;
+  undo.known= find(name, undo.sequence);
+  _undo.push_back(undo);
+}
+
 void initialize_tokyocabinet()
 {
   static TokyoCabinet local_instance;
@@ -132,6 +216,8 @@ static gearmand_error_t _libtokyocabinet_add(gearman_server_st *server, void *co
 
 static gearmand_error_t _libtokyocabinet_flush(gearman_server_st *server, void *context);
 
+static bool _libtokyocabinet_rollback(gearman_server_st *server, void *context);
+
 static gearmand_error_t _libtokyocabinet_done(gearman_server_st *server, void *context,
                                               const char *unique,
                                               size_t unique_size, 
@@ -205,7 +291,7 @@ gearmand_error_t _initialize(gearman_server_st *server,
     }
   }
 
-  gearman_server_set_queue(*server, queue, _libtokyocabinet_add, _libtokyocabinet_flush, _libtokyocabinet_done, _libtokyocabinet_replay);   
+  gearman_server_set_queue(*server, queue, _libtokyocabinet_add, _libtokyocabinet_flush, _libtokyocabinet_done, _libtokyocabinet_replay, _libtokyocabinet_rollback);   
    
   return GEARMAND_SUCCESS;
 }
@@ -214,7 +300,129 @@ gearmand_error_t _initialize(gearman_server_st *server,
  * Private definitions
  */
 
-static gearmand_error_t _libtokyocabinet_add(gearman_server_st*, void *context,
+gearmand_error_t gearmand::plugins::queue::TokyoCabinet::begin()
+{
+  if (_transaction == false)
+  {
+    if (tcadbtranbegin(db) == 0)
+    {
+      gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "tcadbtranbegin: %s", _libtokyocabinet_tcaerrmsg(db));
+      return GEARMAND_QUEUE_ERROR;
+    }
+    _transaction= true;
+  }
+
+  return GEARMAND_SUCCESS;
+}
+
+gearmand_error_t gearmand::plugins::queue::TokyoCabinet::commit(bool sync)
+{
+  if (_transaction)
+  {
+    if (tcadbtrancommit(db) == 0)
+    {
+      gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "tcadbtrancommit: %s", _libtokyocabinet_tcaerrmsg(db));
+      abort();
+      return GEARMAND_QUEUE_ERROR;
+    }
+    _transaction= false;
+    _undo.clear();
+  }
+
+  if (sync and tcadbsync(db) == 0)
+  {
+    gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "tcadbsync: %s", _libtokyocabinet_tcaerrmsg(db));
+    return GEARMAND_QUEUE_ERROR;
+  }
+
+  return GEARMAND_SUCCESS;
+}
+
+void gearmand::plugins::queue::TokyoCabinet::abort()
+{
+  if (_transaction == false)
+  {
+    return;
+  }
+
+  if (tcadbtranabort(db) == 0)
+  {
+    gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "tcadbtranabort: %s", _libtokyocabinet_tcaerrmsg(db));
+  }
+  _transaction= false;
+
+  for (std::vector<undo_st>::reverse_iterator iter= _undo.rbegin(); iter != _undo.rend(); ++iter)
+  {
+    if (iter->known)
+    {
+      _keys[iter->name]= iter->sequence;
+    }
+    else
+    {
+      _keys.erase(iter->name);
+    }
+  }
+  _undo.clear();
+}
+
+static std::string _libtokyocabinet_name(const char *function_name, size_t function_name_size,
+                                         const char *unique, size_t unique_size)
+{
+  std::string name(function_name, function_name_size);
+  name.push_back('\0');
+  name.append(unique, unique_size);
+
+  return name;
+}
+
+static int _libtokyocabinet_sequence_key(char *key, uint64_t sequence)
+{
+  key[0]= '\0';
+  for (int x= GEARMAND_QUEUE_TOKYOCABINET_SEQUENCE_KEY_LEN -1; x > 0; --x)
+  {
+    key[x]= char(sequence & 0xff);
+    sequence>>= 8;
+  }
+
+  return GEARMAND_QUEUE_TOKYOCABINET_SEQUENCE_KEY_LEN;
+}
+
+static int _libtokyocabinet_legacy_key(char *key,
+                                       const char *function_name, size_t function_name_size,
+                                       const char *unique, size_t unique_size)
+{
+  return snprintf(key, GEARMAND_QUEUE_TOKYOCABINET_MAX_KEY_LEN, "%.*s-%.*s",
+                  (int)function_name_size, function_name,
+                  (int)unique_size, unique);
+}
+
+// A record that is not there to remove is not an error.
+static bool _libtokyocabinet_out(TCADB *db, const char *key, int key_length)
+{
+  if (tcadbout(db, key, key_length))
+  {
+    return true;
+  }
+
+  switch (tcadbomode(db))
+  {
+  case ADBOHDB:
+    return tchdbecode((TCHDB *)tcadbreveal(db)) == TCENOREC;
+
+  case ADBOBDB:
+    return tcbdbecode((TCBDB *)tcadbreveal(db)) == TCENOREC;
+
+  default:
+    return false;
+  }
+}
+
+/*
+  A job queued again keeps its sequence key. One still stored under an
+  old style key by an earlier release moves to a sequence key, the old
+  record removed in the same transaction so it is not stored twice.
+*/
+static gearmand_error_t _libtokyocabinet_add(gearman_server_st *server, void *context,
                                              const char *unique,
                                              size_t unique_size,
                                              const char *function_name,
@@ -228,65 +436,91 @@ static gearmand_error_t _libtokyocabinet_add(gearman_server_st*, void *context,
   gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "libtokyocabinet add: %.*s at %" PRId64,
                      (uint32_t)unique_size, (char *)unique, when);
 
-  char key_str[GEARMAND_QUEUE_TOKYOCABINET_MAX_KEY_LEN];
-  size_t key_length= (size_t)snprintf(key_str, GEARMAND_QUEUE_TOKYOCABINET_MAX_KEY_LEN, "%.*s-%.*s",
-                               (int)function_name_size,
-                               (const char *)function_name, (int)unique_size,
-                               (const char *)unique);
+  gearmand_error_t ret;
+  if ((ret= queue->begin()) != GEARMAND_SUCCESS)
+  {
+    return ret;
+  }
 
-  gearmand_error_t ret= GEARMAND_QUEUE_ERROR;
-  TCXSTR* key;
-  if ((key= tcxstrnew()))
+  std::string name(_libtokyocabinet_name(function_name, function_name_size, unique, unique_size));
+  uint64_t sequence= 0;
+  if (queue->find(name, sequence) and sequence == 0)
   {
-    tcxstrcat(key, key_str, (int)key_length);
+    char legacy_key[GEARMAND_QUEUE_TOKYOCABINET_MAX_KEY_LEN];
+    int legacy_length= _libtokyocabinet_legacy_key(legacy_key, function_name, function_name_size, unique, unique_size);
+    if (_libtokyocabinet_out(queue->db, legacy_key, legacy_length) == false)
+    {
+      gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "tcadbout: %s", _libtokyocabinet_tcaerrmsg(queue->db));
+      if (server->queue_batch == NULL)
+      {
+        queue->abort();
+      }
+      return GEARMAND_QUEUE_ERROR;
+    }
+  }
 
-    gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "libtokyocabinet key: %.*s", (int)key_length, key_str);
+  if (sequence == 0)
+  {
+    sequence= ++queue->sequence;
+  }
 
-    TCXSTR* job_data;
-    if ((job_data= tcxstrnew()))
-    {
-      tcxstrcat(job_data, (const char *)function_name, (int)function_name_size);
-      tcxstrcat(job_data, "\0", 1);
-      tcxstrcat(job_data, (const char *)unique, (int)unique_size);
-      tcxstrcat(job_data, "\0", 1);
+  char key_str[GEARMAND_QUEUE_TOKYOCABINET_SEQUENCE_KEY_LEN];
+  int key_length= _libtokyocabinet_sequence_key(key_str, sequence);
 
-      switch (priority)
-      {
-      case GEARMAN_JOB_PRIORITY_HIGH:
-      case GEARMAN_JOB_PRIORITY_MAX:     
-        tcxstrcat2(job_data, "0");
-        break;
+  ret= GEARMAND_QUEUE_ERROR;
+  TCXSTR* job_data;
+  if ((job_data= tcxstrnew()))
+  {
+    tcxstrcat(job_data, (const char *)function_name, (int)function_name_size);
+    tcxstrcat(job_data, "\0", 1);
+    tcxstrcat(job_data, (const char *)unique, (int)unique_size);
+    tcxstrcat(job_data, "\0", 1);
 
-      case GEARMAN_JOB_PRIORITY_LOW:
-        tcxstrcat2(job_data, "2");
-        break;
+    switch (priority)
+    {
+    case GEARMAN_JOB_PRIORITY_HIGH:
+    case GEARMAN_JOB_PRIORITY_MAX:     
+      tcxstrcat2(job_data, "0");
+      break;
 
-      case GEARMAN_JOB_PRIORITY_NORMAL:
-      default:
-        tcxstrcat2(job_data, "1");
-      }
+    case GEARMAN_JOB_PRIORITY_LOW:
+      tcxstrcat2(job_data, "2");
+      break;
 
-      // get int64_t as string
-      char timestr[32];
-      snprintf(timestr, sizeof(timestr), "%" PRId64, when);
+    case GEARMAN_JOB_PRIORITY_NORMAL:
+    default:
+      tcxstrcat2(job_data, "1");
+    }
 
-      // append to job_data
-      tcxstrcat(job_data, (const char *)timestr, (int)strlen(timestr));
-      tcxstrcat(job_data, "\0", 1);
+    // get int64_t as string
+    char timestr[32];
+    snprintf(timestr, sizeof(timestr), "%" PRId64, when);
 
-      // add the rest...
-      tcxstrcat(job_data, (const char *)data, (int)data_size);
+    // append to job_data
+    tcxstrcat(job_data, (const char *)timestr, (int)strlen(timestr));
+    tcxstrcat(job_data, "\0", 1);
 
-      if (tcadbput(queue->db, tcxstrptr(key), tcxstrsize(key),
-                   tcxstrptr(job_data), tcxstrsize(job_data)))
-      {
-        ret= GEARMAND_SUCCESS;
-      }
+    // add the rest...
+    tcxstrcat(job_data, (const char *)data, (int)data_size);
 
-      tcxstrdel(job_data);
+    if (tcadbput(queue->db, key_str, key_length,
+                 tcxstrptr(job_data), tcxstrsize(job_data)))
+    {
+      queue->remember(name, sequence);
+      ret= GEARMAND_SUCCESS;
+    }
+    else
+    {
+      gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "tcadbput: %s", _libtokyocabinet_tcaerrmsg(queue->db));
     }
 
-    tcxstrdel(key);
+    tcxstrdel(job_data);
+  }
+
+  // --queue-batch rolls back the whole batch instead.
+  if (ret != GEARMAND_SUCCESS and server->queue_batch == NULL)
+  {
+    queue->abort();
   }
 
   return ret;
@@ -298,15 +532,21 @@ static gearmand_error_t _libtokyocabinet_flush(gearman_server_st *, void *contex
    
   gearmand_debug("libtokyocabinet flush");
 
-  if (tcadbsync(queue->db) == 0)
-  {
-    return GEARMAND_QUEUE_ERROR;
-  }
-   
-  return GEARMAND_SUCCESS;
+  return queue->commit(true);
 }
 
-static gearmand_error_t _libtokyocabinet_done(gearman_server_st *, void *context,
+static bool _libtokyocabinet_rollback(gearman_server_st *, void *context)
+{
+  gearmand::plugins::queue::TokyoCabinet *queue= (gearmand::plugins::queue::TokyoCabinet *)context;
+
+  gearmand_debug("libtokyocabinet rollback");
+
+  queue->abort();
+
+  return true;
+}
+
+static gearmand_error_t _libtokyocabinet_done(gearman_server_st *server, void *context,
                                               const char *unique,
                                               size_t unique_size, 
                                               const char *function_name,
@@ -314,34 +554,57 @@ static gearmand_error_t _libtokyocabinet_done(gearman_server_st *, void *context
 {
   gearmand::plugins::queue::TokyoCabinet *queue= (gearmand::plugins::queue::TokyoCabinet *)context;
 
-  gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "libtokyocabinet add: %.*s", (uint32_t)unique_size, (char *)unique);
-  
+  gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "libtokyocabinet done: %.*s", (uint32_t)unique_size, (char *)unique);
+
+  gearmand_error_t ret;
+  if ((ret= queue->begin()) != GEARMAND_SUCCESS)
+  {
+    return ret;
+  }
+
+  std::string name(_libtokyocabinet_name(function_name, function_name_size, unique, unique_size));
+  uint64_t sequence= 0;
+  (void)queue->find(name, sequence);
+
   char key_str[GEARMAND_QUEUE_TOKYOCABINET_MAX_KEY_LEN];
-  size_t key_length= (size_t)snprintf(key_str, GEARMAND_QUEUE_TOKYOCABINET_MAX_KEY_LEN, "%.*s-%.*s",
-                                      (int)function_name_size,
-                                      (const char *)function_name, (int)unique_size,
-                                      (const char *)unique);
+  int key_length;
+  if (sequence)
+  {
+    key_length= _libtokyocabinet_sequence_key(key_str, sequence);
+  }
+  else
+  {
+    key_length= _libtokyocabinet_legacy_key(key_str, function_name, function_name_size, unique, unique_size);
+  }
 
-  TCXSTR* key= tcxstrnew();
-  tcxstrcat(key, key_str, (int)key_length);
-  bool rc= tcadbout(queue->db, tcxstrptr(key), tcxstrsize(key));
-  tcxstrdel(key);
+  if (_libtokyocabinet_out(queue->db, key_str, key_length) == false)
+  {
+    gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "tcadbout: %s", _libtokyocabinet_tcaerrmsg(queue->db));
 
-  if (rc)
+    // --queue-batch rolls back the whole batch instead.
+    if (server->queue_batch == NULL)
+    {
+      queue->abort();
+    }
+    return GEARMAND_QUEUE_ERROR;
+  }
+  queue->forget(name);
+
+  // Only --queue-batch flushes after a done, which was never synced.
+  if (server->queue_batch == NULL)
   {
-    return GEARMAND_SUCCESS;
+    return queue->commit(false);
   }
 
-  return GEARMAND_QUEUE_ERROR;
+  return GEARMAND_SUCCESS;
 }
 
 static gearmand_error_t _callback_for_record(gearman_server_st *server,
+                                             gearmand::plugins::queue::TokyoCabinet *queue,
                                              TCXSTR *key, TCXSTR *data,
                                              gearman_queue_add_fn *add_fn,
                                              void *add_context)
 {
-  gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "replaying: %s", (char *) tcxstrptr(key));
-
   char* data_cstr= (char *)tcxstrptr(data);
   size_t data_cstr_size= (size_t)tcxstrsize(data);
 
@@ -351,6 +614,8 @@ static gearmand_error_t _callback_for_record(gearman_server_st *server,
   char* unique= data_cstr +function_len +1;
   size_t unique_len= strlen(unique); // strlen is only safe because tcxstrptr guarantees nul term
 
+  gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "replaying: %.*s", (int)unique_len, unique);
+
   // +2 for nulls
   data_cstr += unique_len +function_len +2;
   data_cstr_size -= unique_len +function_len +2;
@@ -360,6 +625,28 @@ static gearmand_error_t _callback_for_record(gearman_server_st *server,
   assert(function);
   assert(function_len);
 
+  // The record is found again through its sequence for done().
+  const unsigned char *key_ptr= (const unsigned char *)tcxstrptr(key);
+  if (tcxstrsize(key) == GEARMAND_QUEUE_TOKYOCABINET_SEQUENCE_KEY_LEN and key_ptr[0] == '\0')
+  {
+    uint64_t sequence= 0;
+    for (int x= 1; x < GEARMAND_QUEUE_TOKYOCABINET_SEQUENCE_KEY_LEN; ++x)
+    {
+      sequence= (sequence << 8) | key_ptr[x];
+    }
+
+    queue->remember(_libtokyocabinet_name(function, function_len, unique, unique_len), sequence);
+    if (sequence > queue->sequence)
+    {
+      queue->sequence= sequence;
+    }
+  }
+  else
+  {
+    // Moved to a sequence key if the job is stored again.
+    queue->remember(_libtokyocabinet_name(function, function_len, unique, unique_len), 0);
+  }
+
   // single char for priority
   gearman_job_priority_t priority;
   if (*data_cstr == '2')
@@ -404,7 +691,11 @@ static gearmand_error_t _callback_for_record(gearman_server_st *server,
                    priority, when);
 }
 
-
+/*
+  Hash and B+ tree databases are walked directly, reading key and value
+  together, instead of looking every key up again. A B+ tree walks in key
+  order, and so in submission order.
+*/
 static gearmand_error_t _libtokyocabinet_replay(gearman_server_st *server, void *context,
                                                 gearman_queue_add_fn *add_fn,
                                                 void *add_context)
@@ -412,45 +703,103 @@ static gearmand_error_t _libtokyocabinet_replay(gearman_server_st *server, void
   gearmand::plugins::queue::TokyoCabinet *queue= (gearmand::plugins::queue::TokyoCabinet *)context;
    
   gearmand_info("libtokyocabinet replay start");
-  
-  if (tcadbiterinit(queue->db) == 0)
-  {
-    return GEARMAND_QUEUE_ERROR;
-  }
+
+  gearmand::queue::Context::replay_expect(server, tcadbrnum(queue->db));
 
   TCXSTR* key= tcxstrnew();
   TCXSTR* data= tcxstrnew();
   gearmand_error_t gret= GEARMAND_SUCCESS;
-  void *iter= NULL;
   uint64_t x= 0;
-  int iter_size= 0;
-  while ((iter= tcadbiternext(queue->db, &iter_size)))
-  {     
-    tcxstrclear(key);
-    tcxstrclear(data);
-    tcxstrcat(key, iter, iter_size);
-    free(iter);
-    iter= tcadbget(queue->db, tcxstrptr(key), tcxstrsize(key), &iter_size);
-    if (iter == NULL)
+
+  switch (tcadbomode(queue->db))
+  {
+  case ADBOHDB:
     {
-      gearmand_log_info(GEARMAN_DEFAULT_LOG_PARAM, "libtokyocabinet replay key disappeared: %s", (char *)tcxstrptr(key));
-      continue;
+      TCHDB *hdb= (TCHDB *)tcadbreveal(queue->db);
+      if (tchdbiterinit(hdb) == 0)
+      {
+        gret= GEARMAND_QUEUE_ERROR;
+        break;
+      }
+
+      while (tchdbiternext3(hdb, key, data))
+      {
+        if (_callback_for_record(server, queue, key, data, add_fn, add_context) != GEARMAND_SUCCESS)
+        {
+          gret= GEARMAND_QUEUE_ERROR;
+          break;
+        }
+        ++x;
+      }
     }
-    tcxstrcat(data, iter, iter_size);
-    free(iter);
+    break;
 
-    if (_callback_for_record(server, key, data, add_fn, add_context) != GEARMAND_SUCCESS)
+  case ADBOBDB:
     {
-      gret= GEARMAND_QUEUE_ERROR;
-      break;
+      BDBCUR *cursor= tcbdbcurnew((TCBDB *)tcadbreveal(queue->db));
+      if (cursor == NULL)
+      {
+        gret= GEARMAND_QUEUE_ERROR;
+        break;
+      }
+
+      bool more= tcbdbcurfirst(cursor);
+      while (more and tcbdbcurrec(cursor, key, data))
+      {
+        if (_callback_for_record(server, queue, key, data, add_fn, add_context) != GEARMAND_SUCCESS)
+        {
+          gret= GEARMAND_QUEUE_ERROR;
+          break;
+        }
+        ++x;
+        more= tcbdbcurnext(cursor);
+      }
+
+      tcbdbcurdel(cursor);
     }
+    break;
+
+  default:
+    {
+      if (tcadbiterinit(queue->db) == 0)
+      {
+        gret= GEARMAND_QUEUE_ERROR;
+        break;
+      }
 
-    ++x;
+      void *iter= NULL;
+      int iter_size= 0;
+      while ((iter= tcadbiternext(queue->db, &iter_size)))
+      {     
+        tcxstrclear(key);
+        tcxstrclear(data);
+        tcxstrcat(key, iter, iter_size);
+        free(iter);
+        iter= tcadbget(queue->db, tcxstrptr(key), tcxstrsize(key), &iter_size);
+        if (iter == NULL)
+        {
+          gearmand_log_info(GEARMAN_DEFAULT_LOG_PARAM, "libtokyocabinet replay key disappeared: %s", (char *)tcxstrptr(key));
+          continue;
+        }
+        tcxstrcat(data, iter, iter_size);
+        free(iter);
+
+        if (_callback_for_record(server, queue, key, data, add_fn, add_context) != GEARMAND_SUCCESS)
+        {
+          gret= GEARMAND_QUEUE_ERROR;
+          break;
+        }
+
+        ++x;
+      }
+    }
+    break;
   }
+
   tcxstrdel(key);
   tcxstrdel(data);
 
-  gearmand_log_info(GEARMAN_DEFAULT_LOG_PARAM, "libtokyocabinet replayed %ld records", x);
+  gearmand_log_info(GEARMAN_DEFAULT_LOG_PARAM, "libtokyocabinet replayed %" PRIu64 " records", x);
 
   return gret;
 }
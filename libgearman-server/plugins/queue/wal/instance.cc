@@ -0,0 +1,993 @@
+/*  vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * 
+ *  Gearmand client and server library.
+ *
+ *  Copyright (C) 2012 Data Differential, http://datadifferential.com/
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *
+ *      * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following disclaimer
+ *  in the documentation and/or other materials provided with the
+ *  distribution.
+ *
+ *      * The names of its contributors may not be used to endorse or
+ *  promote products derived from this software without specific prior
+ *  written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * @file
+ * @brief Write-ahead log Queue Storage Definitions
+ */
+
+#include <gear_config.h>
+#include <libgearman-server/common.h>
+
+#include "libgearman-server/plugins/queue/wal/instance.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifndef __INTEL_COMPILER
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#endif
+
+/*
+  A segment is the magic followed by records:
+
+    crc32c(4) length(4) type(1) body(length - 1)
+
+  The CRC covers type and body. Integers are little endian.
+
+    add:  priority(1) when(8) unique_size(4) function_size(4) unique function data
+    done: unique_size(4) function_size(4) unique function
+
+  Segments are named <first>-<last>.wal, with the sequence numbers in hex.
+  A compacted segment covers every segment in its range, which lets a
+  crash between the rename and the unlinks be cleaned up on startup.
+*/
+#define GEARMAND_WAL_MAGIC "GEARWAL1"
+#define GEARMAND_WAL_MAGIC_SIZE 8
+#define GEARMAND_WAL_FRAME_SIZE 8
+#define GEARMAND_WAL_ADD 1
+#define GEARMAND_WAL_DONE 2
+#define GEARMAND_WAL_ADD_HEADER_SIZE (1 + 1 + 8 + 4 + 4)
+#define GEARMAND_WAL_DONE_HEADER_SIZE (1 + 4 + 4)
+#define GEARMAND_WAL_SUFFIX ".wal"
+#define GEARMAND_WAL_TMP_SUFFIX ".wal.tmp"
+
+namespace {
+
+struct crc32c_table_st
+{
+  uint32_t entry[256];
+
+  crc32c_table_st()
+  {
+    for (uint32_t x= 0; x < 256; ++x)
+    {
+      uint32_t crc= x;
+      for (int bit= 0; bit < 8; ++bit)
+      {
+        crc= (crc & 1) ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+      }
+      entry[x]= crc;
+    }
+  }
+};
+
+const crc32c_table_st crc32c_table;
+
+uint32_t crc32c(const char *data, size_t size)
+{
+  uint32_t crc= UINT32_MAX;
+  for (size_t x= 0; x < size; ++x)
+  {
+    crc= crc32c_table.entry[(crc ^ uint8_t(data[x])) & 0xff] ^ (crc >> 8);
+  }
+
+  return ~crc;
+}
+
+void put_uint32(std::vector<char>& buffer, uint32_t value)
+{
+  for (int x= 0; x < 4; ++x)
+  {
+    buffer.push_back(char(value >> (x * 8)));
+  }
+}
+
+void put_uint64(std::vector<char>& buffer, uint64_t value)
+{
+  for (int x= 0; x < 8; ++x)
+  {
+    buffer.push_back(char(value >> (x * 8)));
+  }
+}
+
+uint32_t get_uint32(const char *data)
+{
+  uint32_t value= 0;
+  for (int x= 3; x >= 0; --x)
+  {
+    value= (value << 8) | uint8_t(data[x]);
+  }
+
+  return value;
+}
+
+uint64_t get_uint64(const char *data)
+{
+  uint64_t value= 0;
+  for (int x= 7; x >= 0; --x)
+  {
+    value= (value << 8) | uint8_t(data[x]);
+  }
+
+  return value;
+}
+
+/*
+  Reserves the frame, lets the caller append type and body, then fills in
+  length and CRC.
+*/
+size_t frame_begin(std::vector<char>& buffer)
+{
+  size_t start= buffer.size();
+  buffer.resize(start + GEARMAND_WAL_FRAME_SIZE);
+
+  return start;
+}
+
+void frame_end(std::vector<char>& buffer, size_t start)
+{
+  const char *record= &buffer[start + GEARMAND_WAL_FRAME_SIZE];
+  size_t length= buffer.size() - start - GEARMAND_WAL_FRAME_SIZE;
+  uint32_t crc= crc32c(record, length);
+
+  for (int x= 0; x < 4; ++x)
+  {
+    buffer[start + x]= char(crc >> (x * 8));
+    buffer[start + 4 + x]= char(uint32_t(length) >> (x * 8));
+  }
+}
+
+bool write_all(int fd, const char *data, size_t size)
+{
+  while (size)
+  {
+    ssize_t written= write(fd, data, size);
+    if (written == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+
+      return false;
+    }
+
+    data+= written;
+    size-= size_t(written);
+  }
+
+  return true;
+}
+
+bool sync_directory(const std::string& directory)
+{
+  int fd= open(directory.c_str(), O_RDONLY);
+  if (fd == -1)
+  {
+    return false;
+  }
+
+  bool success= fsync(fd) == 0;
+  close(fd);
+
+  return success;
+}
+
+/*
+  The jobs still live after applying records in log order, kept in the
+  order they were added.
+*/
+class Live
+{
+public:
+  struct job_st {
+    std::string record; // framed add record
+    bool live;
+  };
+
+  std::vector<job_st> jobs;
+
+  // A record starts at its type byte, and has already been checked.
+  void apply(const char *frame, const char *record, size_t length)
+  {
+    std::string key;
+
+    if (record[0] == GEARMAND_WAL_ADD)
+    {
+      uint32_t unique_size= get_uint32(record + 10);
+      uint32_t function_size= get_uint32(record + 14);
+      _key(key,
+           record + GEARMAND_WAL_ADD_HEADER_SIZE, unique_size,
+           record + GEARMAND_WAL_ADD_HEADER_SIZE + unique_size, function_size);
+
+      _remove(key);
+      job_st job;
+      job.record.assign(frame, GEARMAND_WAL_FRAME_SIZE + length);
+      job.live= true;
+      jobs.push_back(job);
+      _index[key]= jobs.size() - 1;
+    }
+    else
+    {
+      uint32_t unique_size= get_uint32(record + 1);
+      uint32_t function_size= get_uint32(record + 5);
+      _key(key,
+           record + GEARMAND_WAL_DONE_HEADER_SIZE, unique_size,
+           record + GEARMAND_WAL_DONE_HEADER_SIZE + unique_size, function_size);
+
+      _remove(key);
+    }
+  }
+
+  size_t count() const
+  {
+    return _index.size();
+  }
+
+private:
+  static void _key(std::string& key,
+                   const char *unique, size_t unique_size,
+                   const char *function_name, size_t function_name_size)
+  {
+    uint32_t prefix= uint32_t(function_name_size);
+    key.reserve(sizeof(prefix) + function_name_size + unique_size);
+    key.append(reinterpret_cast<const char *>(&prefix), sizeof(prefix));
+    key.append(function_name, function_name_size);
+    key.append(unique, unique_size);
+  }
+
+  void _remove(const std::string& key)
+  {
+    std::map<std::string, size_t>::iterator iter= _index.find(key);
+    if (iter != _index.end())
+    {
+      job_st& job= jobs[iter->second];
+      job.live= false;
+      std::string().swap(job.record);
+      _index.erase(iter);
+    }
+  }
+
+  std::map<std::string, size_t> _index;
+};
+
+bool record_valid(const char *record, size_t length)
+{
+  if (length < 1)
+  {
+    return false;
+  }
+
+  if (record[0] == GEARMAND_WAL_ADD)
+  {
+    if (length < GEARMAND_WAL_ADD_HEADER_SIZE)
+    {
+      return false;
+    }
+
+    uint64_t names= uint64_t(get_uint32(record + 10)) + get_uint32(record + 14);
+    return names <= length - GEARMAND_WAL_ADD_HEADER_SIZE;
+  }
+
+  if (record[0] == GEARMAND_WAL_DONE)
+  {
+    if (length < GEARMAND_WAL_DONE_HEADER_SIZE)
+    {
+      return false;
+    }
+
+    uint64_t names= uint64_t(get_uint32(record + 1)) + get_uint32(record + 5);
+    return names == length - GEARMAND_WAL_DONE_HEADER_SIZE;
+  }
+
+  return false;
+}
+
+/*
+  Applies every intact record of the segment at path to live. Returns the
+  offset just past the last intact record in valid, and the size of the
+  file in size; they differ when the tail was torn by a crash.
+*/
+bool load_segment(const std::string& path, Live& live, size_t& valid, size_t& size)
+{
+  valid= size= 0;
+
+  int fd= open(path.c_str(), O_RDONLY);
+  if (fd == -1)
+  {
+    gearmand_perror(errno, path.c_str());
+    return false;
+  }
+
+  struct stat sb;
+  if (fstat(fd, &sb) == -1)
+  {
+    gearmand_perror(errno, path.c_str());
+    close(fd);
+    return false;
+  }
+
+  std::vector<char> contents(size_t(sb.st_size) + 1);
+  while (size < size_t(sb.st_size))
+  {
+    ssize_t nread= read(fd, &contents[size], size_t(sb.st_size) - size);
+    if (nread == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+
+      gearmand_perror(errno, path.c_str());
+      close(fd);
+      return false;
+    }
+
+    if (nread == 0)
+    {
+      break;
+    }
+    size+= size_t(nread);
+  }
+  close(fd);
+
+  if (size < GEARMAND_WAL_MAGIC_SIZE or memcmp(&contents[0], GEARMAND_WAL_MAGIC, GEARMAND_WAL_MAGIC_SIZE))
+  {
+    return true;
+  }
+  valid= GEARMAND_WAL_MAGIC_SIZE;
+
+  while (size - valid >= GEARMAND_WAL_FRAME_SIZE)
+  {
+    const char *frame= &contents[valid];
+    uint32_t crc= get_uint32(frame);
+    uint32_t length= get_uint32(frame + 4);
+    const char *record= frame + GEARMAND_WAL_FRAME_SIZE;
+
+    if (length > size - valid - GEARMAND_WAL_FRAME_SIZE or
+        crc32c(record, length) != crc or
+        record_valid(record, length) == false)
+    {
+      break;
+    }
+
+    live.apply(frame, record, length);
+    valid+= GEARMAND_WAL_FRAME_SIZE + length;
+  }
+
+  return true;
+}
+
+bool segment_order(const gearmand::queue::Wal::segment_st& a,
+                   const gearmand::queue::Wal::segment_st& b)
+{
+  return a.first < b.first;
+}
+
+} // namespace
+
+namespace gearmand {
+namespace queue {
+
+Wal::Wal(const std::string& directory_,
+         uint64_t segment_size_,
+         uint32_t fsync_batch_,
+         uint32_t fsync_interval_) :
+  _directory(directory_),
+  _segment_size(segment_size_),
+  _fsync_batch(fsync_batch_),
+  _fsync_interval(fsync_interval_),
+  _fd(-1),
+  _sequence(0),
+  _segment_bytes(0),
+  _pending(0),
+  _thread_running(false),
+  _shutdown(false),
+  _replayed(false),
+  _compact_failed(false),
+  _unsynced(0)
+{
+  pthread_mutex_init(&_lock, NULL);
+  pthread_cond_init(&_wakeup, NULL);
+}
+
+Wal::~Wal()
+{
+  if (_fd != -1 and _buffer.size())
+  {
+    flush(NULL);
+  }
+
+  if (_thread_running)
+  {
+    pthread_mutex_lock(&_lock);
+    _shutdown= true;
+    pthread_cond_signal(&_wakeup);
+    pthread_mutex_unlock(&_lock);
+    pthread_join(_thread, NULL);
+  }
+
+  if (_fd != -1)
+  {
+    if (fdatasync(_fd) == -1)
+    {
+      gearmand_perror(errno, "fdatasync");
+    }
+    close(_fd);
+  }
+
+  pthread_cond_destroy(&_wakeup);
+  pthread_mutex_destroy(&_lock);
+
+  gearmand_debug("wal shutdown");
+}
+
+std::string Wal::_segment_path(const segment_st& segment) const
+{
+  char name[64];
+  snprintf(name, sizeof(name), "/%016" PRIx64 "-%016" PRIx64 GEARMAND_WAL_SUFFIX, segment.first, segment.last);
+
+  return _directory + name;
+}
+
+gearmand_error_t Wal::init()
+{
+  if (_directory.empty())
+  {
+    return gearmand_gerror("missing required --wal-dir=<directory> argument", GEARMAND_QUEUE_ERROR);
+  }
+
+  if (mkdir(_directory.c_str(), 0755) == -1 and errno != EEXIST)
+  {
+    return gearmand_log_perror(GEARMAN_DEFAULT_LOG_PARAM, errno, "mkdir(%s)", _directory.c_str());
+  }
+
+  DIR *dir= opendir(_directory.c_str());
+  if (dir == NULL)
+  {
+    return gearmand_log_perror(GEARMAN_DEFAULT_LOG_PARAM, errno, "opendir(%s)", _directory.c_str());
+  }
+
+  std::vector<segment_st> found;
+  struct dirent *entry;
+  while ((entry= readdir(dir)))
+  {
+    const char *name= entry->d_name;
+    size_t name_length= strlen(name);
+    segment_st segment;
+    int consumed= 0;
+
+    if (name_length > sizeof(GEARMAND_WAL_TMP_SUFFIX) -1 and
+        strcmp(name + name_length - (sizeof(GEARMAND_WAL_TMP_SUFFIX) -1), GEARMAND_WAL_TMP_SUFFIX) == 0)
+    {
+      // Left behind by a compaction that did not finish.
+      unlink((_directory + "/" + name).c_str());
+      continue;
+    }
+
+    if (sscanf(name, "%16" SCNx64 "-%16" SCNx64 GEARMAND_WAL_SUFFIX "%n", &segment.first, &segment.last, &consumed) == 2 and
+        size_t(consumed) == name_length and segment.first and segment.first <= segment.last)
+    {
+      segment.compacted= segment.first != segment.last;
+      found.push_back(segment);
+    }
+  }
+  closedir(dir);
+
+  std::sort(found.begin(), found.end(), segment_order);
+
+  // A compacted segment supersedes every segment inside its range.
+  for (std::vector<segment_st>::iterator iter= found.begin(); iter != found.end(); ++iter)
+  {
+    bool covered= false;
+    for (std::vector<segment_st>::iterator other= found.begin(); other != found.end(); ++other)
+    {
+      if (other != iter and other->first <= iter->first and iter->last <= other->last and
+          (other->first != iter->first or other->last != iter->last))
+      {
+        covered= true;
+        break;
+      }
+    }
+
+    if (covered)
+    {
+      unlink(_segment_path(*iter).c_str());
+    }
+    else
+    {
+      _sealed.push_back(*iter);
+    }
+  }
+
+  gearmand_error_t ret;
+  if (gearmand_failed(ret= _open_segment(_sealed.empty() ? 1 : _sealed.back().last + 1)))
+  {
+    return ret;
+  }
+
+  int error;
+  if ((error= pthread_create(&_thread, NULL, _run, this)))
+  {
+    return gearmand_perror(error, "pthread_create");
+  }
+  _thread_running= true;
+
+  gearmand_log_info(GEARMAN_DEFAULT_LOG_PARAM, "wal opened %s with %u segments", _directory.c_str(), uint32_t(_sealed.size()));
+
+  return GEARMAND_SUCCESS;
+}
+
+gearmand_error_t Wal::_open_segment(uint64_t sequence)
+{
+  segment_st segment= { sequence, sequence, false };
+  std::string path= _segment_path(segment);
+
+  int fd= open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0644);
+  if (fd == -1)
+  {
+    return gearmand_log_perror(GEARMAN_DEFAULT_LOG_PARAM, errno, "open(%s)", path.c_str());
+  }
+
+  if (write_all(fd, GEARMAND_WAL_MAGIC, GEARMAND_WAL_MAGIC_SIZE) == false or
+      sync_directory(_directory) == false)
+  {
+    int local_errno= errno;
+    close(fd);
+    unlink(path.c_str());
+    return gearmand_log_perror(GEARMAN_DEFAULT_LOG_PARAM, local_errno, "write(%s)", path.c_str());
+  }
+
+  _fd= fd;
+  _sequence= sequence;
+  _segment_bytes= GEARMAND_WAL_MAGIC_SIZE;
+
+  return GEARMAND_SUCCESS;
+}
+
+gearmand_error_t Wal::_rotate()
+{
+  if (fdatasync(_fd) == -1)
+  {
+    return gearmand_perror(errno, "fdatasync");
+  }
+
+  int old_fd= _fd;
+  uint64_t old_sequence= _sequence;
+
+  pthread_mutex_lock(&_lock);
+  gearmand_error_t ret= _open_segment(_sequence + 1);
+  if (gearmand_success(ret))
+  {
+    segment_st segment= { old_sequence, old_sequence, false };
+    _sealed.push_back(segment);
+    _unsynced= 0;
+    _compact_failed= false;
+    pthread_cond_signal(&_wakeup);
+  }
+  pthread_mutex_unlock(&_lock);
+
+  if (gearmand_success(ret))
+  {
+    close(old_fd);
+  }
+
+  return ret;
+}
+
+gearmand_error_t Wal::add(gearman_server_st*,
+                          const char *unique, size_t unique_size,
+                          const char *function_name, size_t function_name_size,
+                          const void *data, size_t data_size,
+                          gearman_job_priority_t priority,
+                          int64_t when)
+{
+  gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM, "wal add: %.*s", (int)unique_size, (char *)unique);
+
+  size_t start= frame_begin(_buffer);
+  _buffer.push_back(char(GEARMAND_WAL_ADD));
+  _buffer.push_back(char(priority));
+  put_uint64(_buffer, uint64_t(when));
+  put_uint32(_buffer, uint32_t(unique_size));
+  put_uint32(_buffer, uint32_t(function_name_size));
+  _buffer.insert(_buffer.end(), unique, unique + unique_size);
+  _buffer.insert(_buffer.end(), function_name, function_name + function_name_size);
+  _buffer.insert(_buffer.end(), (const char *)data, (const char *)data + data_size);
+  frame_end(_buffer, start);
+  _pending++;
+
+  return GEARMAND_SUCCESS;
+}
+
+void Wal::_append_done(const char *unique, size_t unique_size,
+                       const char *function_name, size_t function_name_size)
+{
+  size_t start= frame_begin(_buffer);
+  _buffer.push_back(char(GEARMAND_WAL_DONE));
+  put_uint32(_buffer, uint32_t(unique_size));
+  put_uint32(_buffer, uint32_t(function_name_size));
+  _buffer.insert(_buffer.end(), unique, unique + unique_size);
+  _buffer.insert(_buffer.end(), function_name, function_name + function_name_size);
+  frame_end(_buffer, start);
+  _pending++;
+}
+
+gearmand_error_t Wal::done(gearman_server_st *server,
+                           const char *unique, size_t unique_size,
+                           const char *function_name, size_t function_name_size)
+{
+  gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM, "wal done: %.*s", (int)unique_size, (char *)unique);
+
+  _append_done(unique, unique_size, function_name, function_name_size);
+
+  // Only --queue-batch flushes after a done.
+  if (server->queue_batch == NULL)
+  {
+    return flush(server);
+  }
+
+  return GEARMAND_SUCCESS;
+}
+
+// Left in _buffer for the flush() that follows the batch.
+gearmand_error_t Wal::done_batch(gearman_server_st*, const Job *jobs, size_t count)
+{
+  gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM, "wal done batch: %u", uint32_t(count));
+
+  for (size_t x= 0; x < count; ++x)
+  {
+    _append_done(jobs[x].unique, jobs[x].unique_size,
+                 jobs[x].function_name, jobs[x].function_name_size);
+  }
+
+  return GEARMAND_SUCCESS;
+}
+
+/*
+  Group commit: every flush hands the records to the kernel, so they
+  survive the server crashing. They survive losing the machine once
+  fdatasync() runs, either here every --wal-fsync-batch records or from
+  the background thread every --wal-fsync-interval milliseconds.
+*/
+gearmand_error_t Wal::flush(gearman_server_st*)
+{
+  if (_buffer.empty())
+  {
+    return GEARMAND_SUCCESS;
+  }
+
+  if (write_all(_fd, &_buffer[0], _buffer.size()) == false)
+  {
+    int local_errno= errno;
+    // Never leave a partial record in front of the next one.
+    if (ftruncate(_fd, off_t(_segment_bytes)) == -1)
+    {
+      gearmand_perror(errno, "ftruncate");
+    }
+    _buffer.clear();
+    _pending= 0;
+
+    return gearmand_perror(local_errno, "write");
+  }
+  _segment_bytes+= _buffer.size();
+  _buffer.clear();
+
+  pthread_mutex_lock(&_lock);
+  _unsynced+= _pending;
+  bool sync= _fsync_batch and _unsynced >= _fsync_batch;
+  if (sync)
+  {
+    _unsynced= 0;
+  }
+  pthread_mutex_unlock(&_lock);
+  _pending= 0;
+
+  if (sync and fdatasync(_fd) == -1)
+  {
+    return gearmand_perror(errno, "fdatasync");
+  }
+
+  if (_segment_bytes >= _segment_size)
+  {
+    // The records are already in the log, a failed rotation is retried on the next flush.
+    (void)_rotate();
+  }
+
+  return GEARMAND_SUCCESS;
+}
+
+// Nothing reaches the log before flush(), the records are only dropped.
+bool Wal::rollback(gearman_server_st*)
+{
+  _buffer.clear();
+  _pending= 0;
+
+  return true;
+}
+
+gearmand_error_t Wal::replay(gearman_server_st *server)
+{
+  gearmand_info("wal replay start");
+
+  std::vector<segment_st> sealed;
+  pthread_mutex_lock(&_lock);
+  sealed= _sealed;
+  pthread_mutex_unlock(&_lock);
+
+  Live live;
+  for (std::vector<segment_st>::iterator iter= sealed.begin(); iter != sealed.end(); ++iter)
+  {
+    std::string path= _segment_path(*iter);
+    size_t valid, size;
+    if (load_segment(path, live, valid, size) == false)
+    {
+      return gearmand_log_gerror(GEARMAN_DEFAULT_LOG_PARAM, GEARMAND_QUEUE_ERROR, "failed to read %s", path.c_str());
+    }
+
+    if (valid < size)
+    {
+      gearmand_log_warning(GEARMAN_DEFAULT_LOG_PARAM, "wal %s: dropping %" PRIu64 " bytes after the last intact record",
+                           path.c_str(), uint64_t(size - valid));
+      if (truncate(path.c_str(), off_t(valid)) == -1)
+      {
+        return gearmand_log_perror(GEARMAN_DEFAULT_LOG_PARAM, errno, "truncate(%s)", path.c_str());
+      }
+    }
+  }
+
+  replay_expect(server, live.count());
+
+  for (std::vector<Live::job_st>::iterator iter= live.jobs.begin(); iter != live.jobs.end(); ++iter)
+  {
+    if (iter->live == false)
+    {
+      continue;
+    }
+
+    const char *record= iter->record.data() + GEARMAND_WAL_FRAME_SIZE;
+    size_t length= iter->record.size() - GEARMAND_WAL_FRAME_SIZE;
+    gearman_job_priority_t priority= gearman_job_priority_t(uint8_t(record[1]));
+    int64_t when= int64_t(get_uint64(record + 2));
+    uint32_t unique_size= get_uint32(record + 10);
+    uint32_t function_size= get_uint32(record + 14);
+    const char *unique= record + GEARMAND_WAL_ADD_HEADER_SIZE;
+    const char *function_name= unique + unique_size;
+    size_t data_size= length - GEARMAND_WAL_ADD_HEADER_SIZE - unique_size - function_size;
+
+    /* need to make a copy here ... gearman_server_job_free will free it later */
+    char *data= NULL;
+    if (data_size)
+    {
+      if ((data= (char *)malloc(data_size)) == NULL)
+      {
+        return gearmand_perror(errno, "malloc");
+      }
+      memcpy(data, function_name + function_size, data_size);
+    }
+
+    gearmand_error_t ret= replay_add(server, NULL,
+                                     unique, unique_size,
+                                     function_name, function_size,
+                                     data, data_size,
+                                     priority, when);
+    if (gearmand_failed(ret))
+    {
+      return ret;
+    }
+    std::string().swap(iter->record);
+  }
+
+  gearmand_log_info(GEARMAN_DEFAULT_LOG_PARAM, "wal replay end: %" PRIu64 " jobs", uint64_t(live.count()));
+
+  pthread_mutex_lock(&_lock);
+  _replayed= true;
+  pthread_cond_signal(&_wakeup);
+  pthread_mutex_unlock(&_lock);
+
+  return GEARMAND_SUCCESS;
+}
+
+void *Wal::_run(void *object)
+{
+  (void)gearmand_initialize_thread_logging("[  wal ]");
+
+  static_cast<Wal *>(object)->_background();
+
+  return NULL;
+}
+
+void Wal::_background()
+{
+  pthread_mutex_lock(&_lock);
+  while (_shutdown == false)
+  {
+    if (_replayed and _compact_failed == false and
+        (_sealed.size() > 1 or (_sealed.size() == 1 and _sealed.front().compacted == false)))
+    {
+      std::vector<segment_st> sealed(_sealed);
+      pthread_mutex_unlock(&_lock);
+
+      segment_st merged;
+      bool success= _compact(sealed, merged);
+
+      pthread_mutex_lock(&_lock);
+      if (success)
+      {
+        // Only ever appended to by the proc thread, so the front is what was compacted.
+        _sealed.erase(_sealed.begin(), _sealed.begin() + sealed.size());
+        if (merged.first)
+        {
+          _sealed.insert(_sealed.begin(), merged);
+        }
+      }
+      else
+      {
+        _compact_failed= true;
+      }
+      continue;
+    }
+
+    if (_fsync_interval)
+    {
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_sec+= _fsync_interval / 1000;
+      deadline.tv_nsec+= long(_fsync_interval % 1000) * 1000000;
+      if (deadline.tv_nsec >= 1000000000)
+      {
+        deadline.tv_sec++;
+        deadline.tv_nsec-= 1000000000;
+      }
+      pthread_cond_timedwait(&_wakeup, &_lock, &deadline);
+
+      if (_unsynced and _shutdown == false)
+      {
+        // dup() so the proc thread can rotate while we sync.
+        int fd= dup(_fd);
+        _unsynced= 0;
+        pthread_mutex_unlock(&_lock);
+        if (fd != -1)
+        {
+          if (fdatasync(fd) == -1)
+          {
+            gearmand_perror(errno, "fdatasync");
+          }
+          close(fd);
+        }
+        pthread_mutex_lock(&_lock);
+      }
+    }
+    else
+    {
+      pthread_cond_wait(&_wakeup, &_lock);
+    }
+  }
+  pthread_mutex_unlock(&_lock);
+}
+
+/*
+  Folds closed segments into a single one holding only the add records
+  that are still live, written to a temporary file and renamed over the
+  name covering the whole range. Jobs done in the open segment are
+  carried over, their done records come later in the log.
+*/
+bool Wal::_compact(const std::vector<segment_st>& sealed, segment_st& merged)
+{
+  Live live;
+  for (std::vector<segment_st>::const_iterator iter= sealed.begin(); iter != sealed.end(); ++iter)
+  {
+    size_t valid, size;
+    if (load_segment(_segment_path(*iter), live, valid, size) == false)
+    {
+      return false;
+    }
+  }
+
+  merged.first= 0;
+  merged.last= 0;
+  merged.compacted= true;
+
+  if (live.count())
+  {
+    merged.first= sealed.front().first;
+    merged.last= sealed.back().last;
+    std::string path= _segment_path(merged);
+    std::string tmp_path= path + ".tmp";
+
+    int fd= open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+    {
+      gearmand_perror(errno, tmp_path.c_str());
+      return false;
+    }
+
+    bool success= write_all(fd, GEARMAND_WAL_MAGIC, GEARMAND_WAL_MAGIC_SIZE);
+    for (std::vector<Live::job_st>::iterator iter= live.jobs.begin(); success and iter != live.jobs.end(); ++iter)
+    {
+      if (iter->live)
+      {
+        success= write_all(fd, iter->record.data(), iter->record.size());
+      }
+    }
+
+    if (success == false or fdatasync(fd) == -1)
+    {
+      gearmand_perror(errno, tmp_path.c_str());
+      close(fd);
+      unlink(tmp_path.c_str());
+      return false;
+    }
+    close(fd);
+
+    if (rename(tmp_path.c_str(), path.c_str()) == -1 or sync_directory(_directory) == false)
+    {
+      gearmand_perror(errno, path.c_str());
+      unlink(tmp_path.c_str());
+      return false;
+    }
+  }
+
+  // Oldest first, so a crash part way never leaves a done record without its add.
+  for (std::vector<segment_st>::const_iterator iter= sealed.begin(); iter != sealed.end(); ++iter)
+  {
+    if (merged.first and iter->first == merged.first and iter->last == merged.last)
+    {
+      continue;
+    }
+    unlink(_segment_path(*iter).c_str());
+  }
+
+  gearmand_log_info(GEARMAN_DEFAULT_LOG_PARAM, "wal compacted %u segments, %" PRIu64 " jobs live",
+                    uint32_t(sealed.size()), uint64_t(live.count()));
+
+  return true;
+}
+
+} // namespace queue
+} // namespace gearmand
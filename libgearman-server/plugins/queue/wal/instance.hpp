@@ -0,0 +1,130 @@
+/*  vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * 
+ *  Gearmand client and server library.
+ *
+ *  Copyright (C) 2012 Data Differential, http://datadifferential.com/
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *
+ *      * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following disclaimer
+ *  in the documentation and/or other materials provided with the
+ *  distribution.
+ *
+ *      * The names of its contributors may not be used to endorse or
+ *  promote products derived from this software without specific prior
+ *  written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#pragma once
+
+#include <libgearman-server/plugins/queue/base.h>
+
+#include <pthread.h>
+
+#include <string>
+#include <vector>
+
+namespace gearmand {
+namespace queue {
+
+/*
+  Jobs are appended as add and done records to numbered segment files in
+  one directory. Each record carries a CRC32C, so replay stops cleanly at
+  a torn write. A background thread syncs on --wal-fsync-interval and
+  folds closed segments into one that holds only the jobs still live.
+*/
+class Wal : public gearmand::queue::Context
+{
+public:
+  Wal(const std::string& directory_,
+      uint64_t segment_size_,
+      uint32_t fsync_batch_,
+      uint32_t fsync_interval_);
+
+  ~Wal();
+
+  gearmand_error_t init();
+
+  gearmand_error_t add(gearman_server_st *server,
+                       const char *unique, size_t unique_size,
+                       const char *function_name, size_t function_name_size,
+                       const void *data, size_t data_size,
+                       gearman_job_priority_t priority,
+                       int64_t when);
+
+  gearmand_error_t flush(gearman_server_st *server);
+
+  gearmand_error_t done(gearman_server_st *server,
+                        const char *unique, size_t unique_size,
+                        const char *function_name, size_t function_name_size);
+
+  gearmand_error_t done_batch(gearman_server_st *server,
+                              const Job *jobs, size_t count);
+
+  bool rollback(gearman_server_st *server);
+
+  gearmand_error_t replay(gearman_server_st *server);
+
+  struct segment_st {
+    uint64_t first;
+    uint64_t last;
+    bool compacted;
+  };
+
+private:
+  gearmand_error_t _open_segment(uint64_t sequence);
+  gearmand_error_t _rotate();
+  void _append_done(const char *unique, size_t unique_size,
+                    const char *function_name, size_t function_name_size);
+  std::string _segment_path(const segment_st&) const;
+
+  static void *_run(void *object);
+  void _background();
+  bool _compact(const std::vector<segment_st>& sealed, segment_st& merged);
+
+private:
+  std::string _directory;
+  uint64_t _segment_size;
+  uint32_t _fsync_batch;
+  uint32_t _fsync_interval;
+
+  int _fd;
+  uint64_t _sequence;
+  uint64_t _segment_bytes;
+  uint32_t _pending;
+  std::vector<char> _buffer;
+
+  // Shared with the background thread, under _lock.
+  pthread_t _thread;
+  pthread_mutex_t _lock;
+  pthread_cond_t _wakeup;
+  bool _thread_running;
+  bool _shutdown;
+  bool _replayed;
+  bool _compact_failed;
+  uint32_t _unsynced;
+  std::vector<segment_st> _sealed;
+};
+
+} // namespace queue
+} // namespace gearmand
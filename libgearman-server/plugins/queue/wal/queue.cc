@@ -0,0 +1,122 @@
+/*  vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * 
+ *  Gearmand client and server library.
+ *
+ *  Copyright (C) 2012 Data Differential, http://datadifferential.com/
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *
+ *      * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following disclaimer
+ *  in the documentation and/or other materials provided with the
+ *  distribution.
+ *
+ *      * The names of its contributors may not be used to endorse or
+ *  promote products derived from this software without specific prior
+ *  written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * @file
+ * @brief Write-ahead log Queue Storage Definitions
+ */
+
+#include <gear_config.h>
+#include <libgearman-server/common.h>
+
+#include <libgearman-server/plugins/queue/wal/queue.h>
+#include <libgearman-server/plugins/queue/base.h>
+
+#include "libgearman-server/plugins/queue/wal/instance.hpp"
+
+/** Default values.
+ */
+#define GEARMAND_QUEUE_WAL_DEFAULT_SEGMENT_SIZE 64
+
+namespace gearmand {
+namespace plugins {
+namespace queue {
+
+class Wal : public gearmand::plugins::Queue
+{
+public:
+  Wal();
+  ~Wal();
+
+  gearmand_error_t initialize();
+
+  std::string directory;
+  uint32_t segment_size;
+  uint32_t fsync_batch;
+  uint32_t fsync_interval;
+};
+
+Wal::Wal() :
+  Queue("wal")
+{
+  command_line_options().add_options()
+    ("wal-dir", boost::program_options::value(&directory), "Directory to keep the log segments in.")
+    ("wal-segment-size", boost::program_options::value(&segment_size)->default_value(GEARMAND_QUEUE_WAL_DEFAULT_SEGMENT_SIZE), "Size in megabytes at which a segment is closed and a new one started.")
+    ("wal-fsync-batch", boost::program_options::value(&fsync_batch)->default_value(1), "Call fdatasync() once this many records are waiting, 0 to leave it to --wal-fsync-interval.")
+    ("wal-fsync-interval", boost::program_options::value(&fsync_interval)->default_value(0), "Milliseconds after which waiting records are synced in the background, 0 to disable.")
+    ;
+}
+
+Wal::~Wal()
+{
+}
+
+gearmand_error_t Wal::initialize()
+{
+  if (segment_size == 0)
+  {
+    return gearmand_gerror("--wal-segment-size must be greater than 0", GEARMAND_QUEUE_ERROR);
+  }
+
+  gearmand::queue::Wal* exec_queue= new gearmand::queue::Wal(directory,
+                                                             uint64_t(segment_size) * 1024 * 1024,
+                                                             fsync_batch, fsync_interval);
+
+  if (exec_queue == NULL)
+  {
+    return GEARMAND_MEMORY_ALLOCATION_FAILURE;
+  }
+
+  gearmand_error_t rc;
+  if ((rc= exec_queue->init()) != GEARMAND_SUCCESS)
+  {
+    delete exec_queue;
+    return rc;
+  }
+  gearman_server_set_queue(Gearmand()->server, exec_queue);
+
+  return rc;
+}
+
+void initialize_wal()
+{
+  static Wal local_instance;
+}
+
+} // namespace queue
+} // namespace plugins
+} // namespace gearmand
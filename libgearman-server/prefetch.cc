@@ -0,0 +1,343 @@
+/*  vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * 
+ *  Gearmand client and server library.
+ *
+ *  Copyright (C) 2013 Data Differential, http://datadifferential.com/
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *
+ *      * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following disclaimer
+ *  in the documentation and/or other materials provided with the
+ *  distribution.
+ *
+ *      * The names of its contributors may not be used to endorse or
+ *  promote products derived from this software without specific prior
+ *  written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "gear_config.h"
+
+#include "libgearman-server/common.h"
+#include <libgearman-server/plugins/queue/base.h>
+#include <libgearman-server/prefetch.hpp>
+#include <libgearman-server/log.h>
+
+#include <cstdlib>
+#include <ctime>
+
+namespace gearmand {
+namespace queue {
+
+Prefetch::Prefetch(uint32_t min_size_, uint32_t depth_) :
+  _min_size(min_size_),
+  _depth(depth_),
+  _server(NULL),
+  _queue(NULL),
+  _running(false),
+  _shutdown(false)
+{
+}
+
+Prefetch::~Prefetch()
+{
+  if (_running)
+  {
+    (void)pthread_mutex_lock(&_lock);
+    _shutdown= true;
+    (void)pthread_cond_signal(&_work_cond);
+    (void)pthread_mutex_unlock(&_lock);
+
+    int error;
+    if ((error= pthread_join(_thread, NULL)))
+    {
+      gearmand_log_fatal_perror(GEARMAN_DEFAULT_LOG_PARAM, error, "pthread_join");
+    }
+
+    pthread_cond_destroy(&_work_cond);
+    pthread_mutex_destroy(&_lock);
+  }
+
+  for (std::map<std::string, result_st>::iterator iter= _results.begin(); iter != _results.end(); ++iter)
+  {
+    free(iter->second.data);
+  }
+}
+
+gearmand_error_t Prefetch::start(gearman_server_st *server, Context *queue)
+{
+  _server= server;
+  _queue= queue;
+
+  int error;
+  if ((error= pthread_mutex_init(&_lock, NULL)))
+  {
+    return gearmand_perror(error, "pthread_mutex_init");
+  }
+
+  if ((error= pthread_cond_init(&_work_cond, NULL)))
+  {
+    pthread_mutex_destroy(&_lock);
+    return gearmand_perror(error, "pthread_cond_init");
+  }
+
+  if ((error= pthread_create(&_thread, NULL, _run, this)))
+  {
+    pthread_cond_destroy(&_work_cond);
+    pthread_mutex_destroy(&_lock);
+    return gearmand_perror(error, "pthread_create");
+  }
+
+  _running= true;
+  gearmand_log_info(GEARMAN_DEFAULT_LOG_PARAM, "leaving the data of jobs of %u bytes or more in the queue, reading %u jobs ahead",
+                    _min_size, _depth);
+
+  return GEARMAND_SUCCESS;
+}
+
+/*
+  A unique of "-" is the data itself, and a job without a unique cannot
+  be told apart in the queue, so both keep their data.
+*/
+bool Prefetch::unload(gearman_server_job_st *job) const
+{
+  if (job->data == NULL or job->data_size < _min_size or job->worker)
+  {
+    return false;
+  }
+
+  if (job->unique_length == 0 or (job->unique_length == 1 and job->unique[0] == '-'))
+  {
+    return false;
+  }
+
+  free(const_cast<void *>(job->data));
+  job->data= NULL;
+  job->data_lazy= true;
+
+  return true;
+}
+
+gearmand_error_t Prefetch::load(gearman_server_job_st *job)
+{
+  (void)pthread_mutex_lock(&_lock);
+  std::map<std::string, result_st>::iterator iter= _results.find(job->job_handle);
+  if (iter == _results.end() or iter->second.state == QUEUED)
+  {
+    /* Not asked for, or still behind the jobs read ahead: go first. */
+    _request(job, true);
+    iter= _results.find(job->job_handle);
+  }
+
+  if (iter->second.state != READY)
+  {
+    iter->second.waited= true;
+    (void)pthread_mutex_unlock(&_lock);
+
+    job->data_waiting= true;
+    return GEARMAND_IO_WAIT;
+  }
+
+  gearmand_error_t ret= iter->second.ret;
+  void *data= iter->second.data;
+  size_t data_size= iter->second.data_size;
+  _results.erase(iter);
+  (void)pthread_mutex_unlock(&_lock);
+
+  job->data_prefetch= false;
+  if (gearmand_success(ret))
+  {
+    job->data= data;
+    job->data_size= data_size;
+    job->data_lazy= false;
+  }
+
+  return ret;
+}
+
+void Prefetch::loaded()
+{
+  std::vector<std::string> handles;
+
+  (void)pthread_mutex_lock(&_lock);
+  handles.swap(_loaded);
+  (void)pthread_mutex_unlock(&_lock);
+
+  for (std::vector<std::string>::iterator iter= handles.begin(); iter != handles.end(); ++iter)
+  {
+    /* Gone if it was freed in the meantime. */
+    gearman_server_job_st *job= gearman_server_job_get(_server, iter->c_str(), iter->size(), NULL);
+    if (job and job->data_waiting)
+    {
+      job->data_waiting= false;
+      gearman_server_job_wakeup(job);
+    }
+  }
+}
+
+void Prefetch::ahead(gearman_server_job_st *job)
+{
+  if (_depth == 0)
+  {
+    return;
+  }
+
+  gearman_server_function_st *function= job->function;
+  int64_t current_time= (int64_t)time(NULL);
+  uint32_t count= 0;
+
+  (void)pthread_mutex_lock(&_lock);
+  for (int priority= GEARMAN_JOB_PRIORITY_HIGH; priority < GEARMAN_JOB_PRIORITY_MAX and count < _depth; ++priority)
+  {
+    for (gearman_server_job_st *next= function->job_list[priority];
+         next and count < _depth;
+         next= next->function_next)
+    {
+      /* Taken in this order, except for jobs that are not due yet. */
+      if (next->when != 0 and next->when > current_time)
+      {
+        continue;
+      }
+
+      count++;
+      if (next->data_lazy and next->data_prefetch == false)
+      {
+        _request(next, false);
+      }
+    }
+  }
+  (void)pthread_mutex_unlock(&_lock);
+}
+
+void Prefetch::forget(gearman_server_job_st *job)
+{
+  (void)pthread_mutex_lock(&_lock);
+  /* Data still being read is freed by the prefetch thread when it finds no result to fill. */
+  std::map<std::string, result_st>::iterator iter= _results.find(job->job_handle);
+  if (iter != _results.end())
+  {
+    free(iter->second.data);
+    _results.erase(iter);
+  }
+  (void)pthread_mutex_unlock(&_lock);
+
+  job->data_prefetch= false;
+}
+
+// Called under _lock. A job asked for again only moves up the line.
+void Prefetch::_request(gearman_server_job_st *job, bool urgent)
+{
+  std::pair<std::map<std::string, result_st>::iterator, bool> inserted=
+    _results.insert(std::make_pair(std::string(job->job_handle), result_st()));
+  if (inserted.second)
+  {
+    inserted.first->second.state= QUEUED;
+    inserted.first->second.ret= GEARMAND_UNKNOWN_STATE;
+    inserted.first->second.data= NULL;
+    inserted.first->second.data_size= 0;
+    inserted.first->second.waited= false;
+  }
+
+  request_st request;
+  request.handle= job->job_handle;
+  request.unique.assign(job->unique, job->unique_length);
+  request.function_name.assign(job->function->function_name, job->function->function_name_size);
+
+  if (urgent)
+  {
+    _requests.push_front(request);
+  }
+  else
+  {
+    _requests.push_back(request);
+  }
+  job->data_prefetch= true;
+
+  (void)pthread_cond_signal(&_work_cond);
+}
+
+void *Prefetch::_run(void *object)
+{
+  (void)gearmand_initialize_thread_logging("[ fetch ]");
+
+  static_cast<Prefetch*>(object)->_fetch();
+
+  return NULL;
+}
+
+void Prefetch::_fetch()
+{
+  (void)pthread_mutex_lock(&_lock);
+  while (1)
+  {
+    while (_requests.empty() and _shutdown == false)
+    {
+      (void)pthread_cond_wait(&_work_cond, &_lock);
+    }
+
+    if (_shutdown)
+    {
+      break;
+    }
+
+    request_st request= _requests.front();
+    _requests.pop_front();
+
+    std::map<std::string, result_st>::iterator iter= _results.find(request.handle);
+    if (iter == _results.end() or iter->second.state != QUEUED)
+    {
+      continue;
+    }
+    iter->second.state= FETCHING;
+    (void)pthread_mutex_unlock(&_lock);
+
+    void *data= NULL;
+    size_t data_size= 0;
+    gearmand_error_t ret= _queue->fetch(request.unique.c_str(), request.unique.size(),
+                                        request.function_name.c_str(), request.function_name.size(),
+                                        data, data_size);
+
+    (void)pthread_mutex_lock(&_lock);
+    iter= _results.find(request.handle);
+    if (iter == _results.end())
+    {
+      free(data);
+    }
+    else
+    {
+      iter->second.state= READY;
+      iter->second.ret= ret;
+      iter->second.data= data;
+      iter->second.data_size= data_size;
+
+      if (iter->second.waited)
+      {
+        _loaded.push_back(request.handle);
+        gearman_server_proc_wakeup(_server);
+      }
+    }
+  }
+  (void)pthread_mutex_unlock(&_lock);
+}
+
+} // namespace queue
+} // namespace gearmand
@@ -0,0 +1,136 @@
+/*  vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * 
+ *  Gearmand client and server library.
+ *
+ *  Copyright (C) 2013 Data Differential, http://datadifferential.com/
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *
+ *      * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following disclaimer
+ *  in the documentation and/or other materials provided with the
+ *  distribution.
+ *
+ *      * The names of its contributors may not be used to endorse or
+ *  promote products derived from this software without specific prior
+ *  written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#pragma once
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+
+struct gearman_server_job_st;
+struct gearman_server_st;
+
+namespace gearmand {
+namespace queue {
+
+class Context;
+
+/*
+  Under --queue-lazy-data stored background jobs keep only their
+  metadata in memory. The data is read back from the queue when a worker
+  takes the job, and for the --queue-prefetch jobs queued after it ahead
+  of time, by a thread of its own so the proc thread never waits on the
+  queue.
+*/
+class Prefetch
+{
+public:
+  Prefetch(uint32_t min_size_, uint32_t depth_);
+  ~Prefetch();
+
+  gearmand_error_t start(gearman_server_st *server, Context *queue);
+
+  /*
+    Drops the data of a job that is stored and can be read back. Only
+    looks at the job, so the replay threads call it too.
+  */
+  bool unload(gearman_server_job_st *job) const;
+
+  /*
+    Gives a taken job its data back. GEARMAND_IO_WAIT if it has not been
+    read yet: the job is marked data_waiting and handed back to the
+    workers by loaded() once it has. GEARMAND_NO_JOBS if the queue no
+    longer has it.
+  */
+  gearmand_error_t load(gearman_server_job_st *job);
+
+  // Wakes the workers of the jobs load() had to turn down. Proc thread only.
+  void loaded();
+
+  // Asks for the data of the jobs queued after job for its function.
+  void ahead(gearman_server_job_st *job);
+
+  // Drops whatever was read for a job being freed.
+  void forget(gearman_server_job_st *job);
+
+private:
+  enum state_t {
+    QUEUED,
+    FETCHING,
+    READY
+  };
+
+  struct request_st {
+    std::string handle;
+    std::string unique;
+    std::string function_name;
+  };
+
+  struct result_st {
+    state_t state;
+    gearmand_error_t ret;
+    void *data;
+    size_t data_size;
+    bool waited; // load() turned the job down for it
+  };
+
+  void _request(gearman_server_job_st *job, bool urgent);
+
+  static void *_run(void *object);
+  void _fetch();
+
+  uint32_t _min_size;
+  uint32_t _depth;
+  gearman_server_st *_server;
+  Context *_queue;
+  bool _running;
+
+  // Shared with the prefetch thread under _lock, keyed by job handle.
+  bool _shutdown;
+  std::deque<request_st> _requests;
+  std::map<std::string, result_st> _results;
+  std::vector<std::string> _loaded; // handles of the waited for results read
+  pthread_t _thread;
+  pthread_mutex_t _lock;
+  pthread_cond_t _work_cond;
+};
+
+} // namespace queue
+} // namespace gearmand
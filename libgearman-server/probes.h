@@ -0,0 +1,99 @@
+/*  vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * 
+ *  Gearmand client and server library.
+ *
+ *  Copyright (C) 2011 Data Differential, http://datadifferential.com/
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *
+ *      * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following disclaimer
+ *  in the documentation and/or other materials provided with the
+ *  distribution.
+ *
+ *      * The names of its contributors may not be used to endorse or
+ *  promote products derived from this software without specific prior
+ *  written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+
+/**
+ * @file
+ * @brief Static tracepoints
+ *
+ * USDT probes for the job lifecycle, in provider "gearmand". When
+ * sys/sdt.h is not available they compile to nothing. When it is, each
+ * probe is a single nop until a tracer such as bpftrace, perf or
+ * SystemTap attaches to it, for example:
+ *
+ *   bpftrace -e 'usdt:/usr/sbin/gearmand:gearmand:job__take
+ *                { printf("%s %s\n", str(arg0), str(arg1, arg2)); }'
+ *
+ * Strings are not NUL terminated unless noted, use the size that follows
+ * them. Job handles are always NUL terminated.
+ *
+ * packet__read(fd, magic, command, data_size)
+ *   A complete packet was read and parsed by an I/O thread.
+ * packet__flush(fd, size)
+ *   size bytes of the send buffer were written to a connection.
+ * proc__enqueue(fd, command)
+ *   An I/O thread queued a packet for the processing thread.
+ * proc__dequeue(fd, command)
+ *   The processing thread took a packet off a connection's queue.
+ * job__add(job_handle, function, function_size, unique, unique_size, data_size, priority)
+ *   A new job was created by gearman_server_job_add_reducer().
+ * job__queue(job_handle, function, function_size, priority)
+ *   A job entered the queue of its function.
+ * job__take(job_handle, function, function_size, data_size, queue_usec)
+ *   A worker took a job after it waited queue_usec microseconds, or 0 if
+ *   the time it was queued is not known.
+ * job__free(job_handle, function, function_size)
+ *   A job was removed from the server.
+ * queue__add(unique, unique_size, function, function_size, data_size, priority)
+ *   A background job is being written to the persistent queue.
+ * queue__done(unique, unique_size, function, function_size)
+ *   A job is being removed from the persistent queue.
+ * queue__flush()
+ *   The persistent queue is being flushed.
+ */
+
+#pragma once
+
+#if defined(HAVE_SYS_SDT_H) && HAVE_SYS_SDT_H
+# include <sys/sdt.h>
+# define GEARMAND_PROBE0(__name) DTRACE_PROBE(gearmand, __name)
+# define GEARMAND_PROBE2(__name, __a, __b) DTRACE_PROBE2(gearmand, __name, __a, __b)
+# define GEARMAND_PROBE3(__name, __a, __b, __c) DTRACE_PROBE3(gearmand, __name, __a, __b, __c)
+# define GEARMAND_PROBE4(__name, __a, __b, __c, __d) DTRACE_PROBE4(gearmand, __name, __a, __b, __c, __d)
+# define GEARMAND_PROBE5(__name, __a, __b, __c, __d, __e) DTRACE_PROBE5(gearmand, __name, __a, __b, __c, __d, __e)
+# define GEARMAND_PROBE6(__name, __a, __b, __c, __d, __e, __f) DTRACE_PROBE6(gearmand, __name, __a, __b, __c, __d, __e, __f)
+# define GEARMAND_PROBE7(__name, __a, __b, __c, __d, __e, __f, __g) DTRACE_PROBE7(gearmand, __name, __a, __b, __c, __d, __e, __f, __g)
+#else
+# define GEARMAND_PROBE0(__name) do { } while (0)
+# define GEARMAND_PROBE2(__name, __a, __b) do { } while (0)
+# define GEARMAND_PROBE3(__name, __a, __b, __c) do { } while (0)
+# define GEARMAND_PROBE4(__name, __a, __b, __c, __d) do { } while (0)
+# define GEARMAND_PROBE5(__name, __a, __b, __c, __d, __e) do { } while (0)
+# define GEARMAND_PROBE6(__name, __a, __b, __c, __d, __e, __f) do { } while (0)
+# define GEARMAND_PROBE7(__name, __a, __b, __c, __d, __e, __f, __g) do { } while (0)
+#endif
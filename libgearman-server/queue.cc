@@ -38,6 +38,7 @@
 #include "gear_config.h"
 
 #include <iostream>
+#include <set>
 
 #include <boost/program_options.hpp>
 
@@ -47,6 +48,9 @@
 #include <libgearman-server/queue.hpp>
 #include <libgearman-server/log.h>
 
+#include "libgearman-1.0/return.h"
+#include "libgearman-1.0/strerror.h"
+
 #include <assert.h>
 
 gearmand_error_t gearman_queue_add(gearman_server_st *server,
@@ -65,7 +69,21 @@ gearmand_error_t gearman_queue_add(gearman_server_st *server,
   {
     return GEARMAND_SUCCESS;
   }
-  else if (server->queue_version == QUEUE_VERSION_FUNCTION)
+
+  GEARMAND_PROBE6(queue__add, unique, unique_size, function_name, function_name_size,
+                  data_size, int(priority));
+
+  if (server->queue_batch)
+  {
+    server->queue_batch->add(server,
+                             unique, unique_size,
+                             function_name, function_name_size,
+                             data, data_size, priority,
+                             when);
+    return GEARMAND_SUCCESS;
+  }
+
+  if (server->queue_version == QUEUE_VERSION_FUNCTION)
   {
     assert(server->queue.functions->_add_fn);
     ret= (*(server->queue.functions->_add_fn))(server,
@@ -99,6 +117,8 @@ gearmand_error_t gearman_queue_flush(gearman_server_st *server)
 {
   if (server->queue_version != QUEUE_VERSION_NONE)
   {
+    GEARMAND_PROBE0(queue__flush);
+
     if (server->queue_version == QUEUE_VERSION_FUNCTION)
     {
       assert(server->queue.functions->_flush_fn);
@@ -122,7 +142,18 @@ gearmand_error_t gearman_queue_done(gearman_server_st *server,
   {
     return GEARMAND_SUCCESS;
   }
-  else if (server->queue_version == QUEUE_VERSION_FUNCTION)
+
+  GEARMAND_PROBE4(queue__done, unique, unique_size, function_name, function_name_size);
+
+  if (server->queue_batch)
+  {
+    server->queue_batch->done(server,
+                              unique, unique_size,
+                              function_name, function_name_size);
+    return GEARMAND_SUCCESS;
+  }
+
+  if (server->queue_version == QUEUE_VERSION_FUNCTION)
   {
     assert(server->queue.functions->_done_fn);
     return (*(server->queue.functions->_done_fn))(server,
@@ -141,6 +172,24 @@ gearmand_error_t gearman_queue_done(gearman_server_st *server,
   }
 }
 
+uint32_t gearman_queue_batch_flush(gearman_server_st *server, bool force)
+{
+  if (server->queue_batch)
+  {
+    return server->queue_batch->flush(server, force);
+  }
+
+  return 0;
+}
+
+void gearman_queue_batch_drain(gearman_server_st *server)
+{
+  if (server->queue_batch)
+  {
+    server->queue_batch->drain(server);
+  }
+}
+
 void gearman_server_save_job(gearman_server_st& server,
                              const gearman_server_job_st* server_job)
 {
@@ -156,7 +205,8 @@ void gearman_server_set_queue(gearman_server_st& server,
                               gearman_queue_add_fn *add,
                               gearman_queue_flush_fn *flush,
                               gearman_queue_done_fn *done,
-                              gearman_queue_replay_fn *replay)
+                              gearman_queue_replay_fn *replay,
+                              gearman_queue_rollback_fn *rollback)
 {
   delete server.queue.functions;
   server.queue.functions= NULL;
@@ -174,6 +224,7 @@ void gearman_server_set_queue(gearman_server_st& server,
       server.queue.functions->_flush_fn= flush;
       server.queue.functions->_done_fn= done;
       server.queue.functions->_replay_fn= replay;
+      server.queue.functions->_rollback_fn= rollback;
     }
     assert(server.queue.functions);
   }
@@ -261,3 +312,893 @@ gearmand_error_t initialize(gearmand_st *, std::string name)
 
 } // namespace queue
 } // namespace gearmand
+
+/** Largest batch before it is stored regardless of --queue-batch-delay.
+ */
+#define GEARMAND_QUEUE_BATCH_MAX 1024
+
+/** Batches handed to the --queue-async thread before the proc thread waits.
+ */
+#define GEARMAND_QUEUE_ASYNC_DEPTH 16
+
+static inline uint64_t _batch_now(void)
+{
+  struct timespec now;
+  if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+  {
+    return 0;
+  }
+
+  return uint64_t(now.tv_sec) * 1000 + uint64_t(now.tv_nsec / 1000000);
+}
+
+static gearmand_error_t _queue_add_batch(gearman_server_st *server,
+                                         const gearmand::queue::Job *jobs, size_t count)
+{
+  if (server->queue_version == QUEUE_VERSION_FUNCTION)
+  {
+    for (size_t x= 0; x < count; ++x)
+    {
+      gearmand_error_t ret= (*(server->queue.functions->_add_fn))(server,
+                                                                 (void *)server->queue.functions->_context,
+                                                                 jobs[x].unique, jobs[x].unique_size,
+                                                                 jobs[x].function_name,
+                                                                 jobs[x].function_name_size,
+                                                                 jobs[x].data, jobs[x].data_size,
+                                                                 jobs[x].priority,
+                                                                 jobs[x].when);
+      if (gearmand_failed(ret))
+      {
+        return ret;
+      }
+    }
+
+    return GEARMAND_SUCCESS;
+  }
+
+  return server->queue.object->store_batch(server, jobs, count);
+}
+
+static gearmand_error_t _queue_done_batch(gearman_server_st *server,
+                                          const gearmand::queue::Job *jobs, size_t count)
+{
+  if (server->queue_version == QUEUE_VERSION_FUNCTION)
+  {
+    for (size_t x= 0; x < count; ++x)
+    {
+      gearmand_error_t ret= (*(server->queue.functions->_done_fn))(server,
+                                                                  (void *)server->queue.functions->_context,
+                                                                  jobs[x].unique, jobs[x].unique_size,
+                                                                  jobs[x].function_name,
+                                                                  jobs[x].function_name_size);
+      if (gearmand_failed(ret))
+      {
+        return ret;
+      }
+    }
+
+    return GEARMAND_SUCCESS;
+  }
+
+  return server->queue.object->done_batch(server, jobs, count);
+}
+
+static bool _queue_rollback(gearman_server_st *server)
+{
+  if (server->queue_version == QUEUE_VERSION_FUNCTION)
+  {
+    if (server->queue.functions->_rollback_fn == NULL)
+    {
+      return false;
+    }
+
+    return (*(server->queue.functions->_rollback_fn))(server, (void *)server->queue.functions->_context);
+  }
+
+  return server->queue.object->rollback(server);
+}
+
+namespace gearmand {
+namespace queue {
+
+Batch::Batch(uint32_t delay_, gearmand_queue_async_t async_) :
+  _delay(delay_),
+  _async(async_),
+  _opened(0),
+  _ids(1),
+  _open(new slot_st),
+  _stored_id(0),
+  _server(NULL),
+  _running(false),
+  _shutdown(false),
+  _paused(false),
+  _outstanding(0)
+{
+  _open->id= _ids;
+}
+
+Batch::~Batch()
+{
+  if (_running)
+  {
+    int error;
+    if ((error= pthread_mutex_lock(&_lock)) == 0)
+    {
+      _shutdown= true;
+      (void)pthread_cond_signal(&_work_cond);
+      (void)pthread_mutex_unlock(&_lock);
+    }
+    else
+    {
+      gearmand_log_fatal_perror(GEARMAN_DEFAULT_LOG_PARAM, error, "pthread_mutex_lock");
+    }
+
+    if ((error= pthread_join(_thread, NULL)))
+    {
+      gearmand_log_fatal_perror(GEARMAN_DEFAULT_LOG_PARAM, error, "pthread_join");
+    }
+
+    pthread_cond_destroy(&_done_cond);
+    pthread_cond_destroy(&_work_cond);
+    pthread_mutex_destroy(&_lock);
+  }
+
+  /* Anything left was never handed over, or drain() would have reaped it. */
+  _free.insert(_free.end(), _pending.begin(), _pending.end());
+  _free.insert(_free.end(), _completed.begin(), _completed.end());
+  for (std::vector<slot_st*>::iterator iter= _free.begin(); iter != _free.end(); ++iter)
+  {
+    delete *iter;
+  }
+  delete _open;
+}
+
+gearmand_error_t Batch::start(gearman_server_st *server)
+{
+  if (_async == GEARMAND_QUEUE_ASYNC_NONE)
+  {
+    return GEARMAND_SUCCESS;
+  }
+
+  _server= server;
+
+  int error;
+  if ((error= pthread_mutex_init(&_lock, NULL)))
+  {
+    return gearmand_perror(error, "pthread_mutex_init");
+  }
+
+  if ((error= pthread_cond_init(&_work_cond, NULL)))
+  {
+    pthread_mutex_destroy(&_lock);
+    return gearmand_perror(error, "pthread_cond_init");
+  }
+
+  if ((error= pthread_cond_init(&_done_cond, NULL)))
+  {
+    pthread_cond_destroy(&_work_cond);
+    pthread_mutex_destroy(&_lock);
+    return gearmand_perror(error, "pthread_cond_init");
+  }
+
+  if ((error= pthread_create(&_thread, NULL, _run, this)))
+  {
+    pthread_cond_destroy(&_done_cond);
+    pthread_cond_destroy(&_work_cond);
+    pthread_mutex_destroy(&_lock);
+    return gearmand_perror(error, "pthread_create");
+  }
+
+  _running= true;
+
+  return GEARMAND_SUCCESS;
+}
+
+Batch::item_st& Batch::_item(gearman_server_st *server, bool done_)
+{
+  if (_open->size == GEARMAND_QUEUE_BATCH_MAX)
+  {
+    (void)flush(server, true);
+  }
+
+  if (_open->size == 0)
+  {
+    _opened= _batch_now();
+  }
+
+  // Items are reused across batches to keep their buffers.
+  if (_open->size == _open->items.size())
+  {
+    _open->items.resize(_open->size + 1);
+  }
+
+  item_st& item= _open->items[_open->size++];
+  item.done= done_;
+  item.failed= false;
+  item.bytes.clear();
+
+  return item;
+}
+
+void Batch::add(gearman_server_st *server,
+                const char *unique, size_t unique_size,
+                const char *function_name, size_t function_name_size,
+                const void *data, size_t data_size,
+                gearman_job_priority_t priority,
+                int64_t when)
+{
+  item_st& item= _item(server, false);
+  item.unique_size= unique_size;
+  item.function_name_size= function_name_size;
+  item.bytes.reserve(unique_size + function_name_size + data_size);
+  item.bytes.append(unique, unique_size);
+  item.bytes.append(function_name, function_name_size);
+  item.bytes.append(static_cast<const char *>(data), data_size);
+  item.priority= priority;
+  item.when= when;
+  _open->adds++;
+}
+
+void Batch::done(gearman_server_st *server,
+                 const char *unique, size_t unique_size,
+                 const char *function_name, size_t function_name_size)
+{
+  item_st& item= _item(server, true);
+  item.unique_size= unique_size;
+  item.function_name_size= function_name_size;
+  item.bytes.reserve(unique_size + function_name_size);
+  item.bytes.append(unique, unique_size);
+  item.bytes.append(function_name, function_name_size);
+  item.priority= GEARMAN_JOB_PRIORITY_NORMAL;
+  item.when= 0;
+}
+
+/*
+  Only a JOB_CREATED for a job that is not stored yet waits, and then
+  everything queued for its connection after it so the connection keeps
+  its order. Other connections are answered as usual.
+*/
+bool Batch::hold(gearman_server_con_st *con, gearman_server_packet_st *packet)
+{
+  if (_async == GEARMAND_QUEUE_ASYNC_RELAXED)
+  {
+    return false;
+  }
+
+  if (con->batch_held == 0)
+  {
+    if (_open->adds == 0 and _stored_id +1 == _ids)
+    {
+      return false;
+    }
+
+    if (_waiting(packet->packet) == false)
+    {
+      return false;
+    }
+  }
+
+  /* Counted as pending so I/O threads do not answer text commands ahead of it. */
+  __atomic_add_fetch(&con->proc_pending, 1, __ATOMIC_RELAXED);
+  con->batch_held++;
+
+  held_st held= { con, packet };
+  _open->held.push_back(held);
+
+  return true;
+}
+
+bool Batch::_waiting(const gearmand_packet_st& packet) const
+{
+  if (packet.command == GEARMAN_COMMAND_JOB_CREATED and packet.argc == 1)
+  {
+    return _unstored(packet.arg[0], packet.arg_size[0]);
+  }
+
+  if (packet.command == GEARMAN_COMMAND_JOB_CREATED_BATCH)
+  {
+    const char *ptr= packet.data;
+    const char *end= packet.data + packet.data_size;
+    while (ptr < end)
+    {
+      size_t length= strnlen(ptr, size_t(end - ptr));
+      if (_unstored(ptr, length))
+      {
+        return true;
+      }
+      ptr+= length +1;
+    }
+  }
+
+  return false;
+}
+
+// The job was added to a batch that has not been stored yet.
+bool Batch::_unstored(const char *handle, size_t length) const
+{
+  if (length == 0 or length >= GEARMAND_JOB_HANDLE_SIZE)
+  {
+    return false;
+  }
+
+  char job_handle[GEARMAND_JOB_HANDLE_SIZE];
+  memcpy(job_handle, handle, length);
+  job_handle[length]= 0;
+
+  gearman_server_job_st *server_job= gearman_server_job_get(Server, job_handle, length, NULL);
+
+  return server_job and server_job->job_queued and server_job->queue_slot > _stored_id;
+}
+
+uint32_t Batch::flush(gearman_server_st *server, bool force)
+{
+  if (_running)
+  {
+    _reap();
+  }
+
+  if (_open->size == 0)
+  {
+    if (_open->held.empty() == false)
+    {
+      if (_running)
+      {
+        /* Only waiting on earlier batches, which keep their order. */
+        _submit();
+      }
+      else
+      {
+        _release(*_open);
+      }
+    }
+
+    return 0;
+  }
+
+  if (force == false and _delay)
+  {
+    uint64_t now= _batch_now();
+    if (now < _opened + _delay)
+    {
+      return uint32_t(_opened + _delay - now);
+    }
+  }
+
+  if (_running)
+  {
+    _submit();
+    return 0;
+  }
+
+  gearmand_error_t ret= _store(server, *_open);
+  if (gearmand_failed(ret))
+  {
+    gearmand_log_gerror(GEARMAN_DEFAULT_LOG_PARAM, ret, "failed to store a batch of %" PRIu64 " queue updates", uint64_t(_open->size));
+  }
+
+  _unload(server, *_open);
+  if (_open->stored == false)
+  {
+    _fail(server, *_open);
+  }
+
+  _stored_id= _open->id;
+  _open->id= ++_ids;
+  _open->size= 0;
+  _open->adds= 0;
+  _open->stored= false;
+  _release(*_open);
+
+  return 0;
+}
+
+uint64_t Batch::current() const
+{
+  return _open->id;
+}
+
+void Batch::drain(gearman_server_st *server)
+{
+  (void)flush(server, true);
+
+  if (_running)
+  {
+    int error;
+    if ((error= pthread_mutex_lock(&_lock)) == 0)
+    {
+      while (_outstanding)
+      {
+        (void)pthread_cond_wait(&_done_cond, &_lock);
+      }
+      (void)pthread_mutex_unlock(&_lock);
+    }
+    else
+    {
+      gearmand_log_fatal_perror(GEARMAN_DEFAULT_LOG_PARAM, error, "pthread_mutex_lock");
+    }
+
+    _reap();
+  }
+}
+
+void Batch::pause()
+{
+  if (_running)
+  {
+    (void)pthread_mutex_lock(&_lock);
+    _paused= true;
+    (void)pthread_mutex_unlock(&_lock);
+  }
+}
+
+void Batch::resume()
+{
+  if (_running)
+  {
+    (void)pthread_mutex_lock(&_lock);
+    _paused= false;
+    (void)pthread_cond_signal(&_work_cond);
+    (void)pthread_mutex_unlock(&_lock);
+  }
+}
+
+/*
+  A run that fails takes the writes of the whole batch with it in a queue
+  that can roll back, so the runs that went in are stored once more
+  before the flush. Otherwise they stand and only the failed runs are
+  lost.
+*/
+gearmand_error_t Batch::_store(gearman_server_st *server, slot_st& slot)
+{
+  gearmand_error_t ret= GEARMAND_SUCCESS;
+  slot.stored= true;
+  if (slot.size == 0)
+  {
+    return ret;
+  }
+
+  bool flush_queue= true;
+  ret= _store_runs(server, slot);
+  if (gearmand_failed(ret) and _queue_rollback(server))
+  {
+    if (gearmand_failed(_store_runs(server, slot)))
+    {
+      (void)_queue_rollback(server);
+      _fail_all(slot);
+      flush_queue= false;
+    }
+  }
+
+  if (flush_queue)
+  {
+    gearmand_error_t rc= gearman_queue_flush(server);
+    if (gearmand_failed(rc))
+    {
+      ret= rc;
+      (void)_queue_rollback(server);
+      _fail_all(slot);
+    }
+  }
+
+  for (size_t x= 0; x < slot.size; ++x)
+  {
+    if (slot.items[x].done == false and slot.items[x].failed)
+    {
+      slot.stored= false;
+      break;
+    }
+  }
+
+  return ret;
+}
+
+void Batch::_fail_all(slot_st& slot)
+{
+  for (size_t x= 0; x < slot.size; ++x)
+  {
+    slot.items[x].failed= true;
+  }
+}
+
+/*
+  Runs of adds and dones go to the queue in the order they were made, so
+  a unique done and submitted again in the same batch ends up stored.
+  Items of a run that failed are marked and left out from then on.
+*/
+gearmand_error_t Batch::_store_runs(gearman_server_st *server, slot_st& slot)
+{
+  gearmand_error_t ret= GEARMAND_SUCCESS;
+
+  std::vector<Job> jobs;
+  jobs.reserve(slot.size);
+
+  size_t x= 0;
+  while (x < slot.size)
+  {
+    if (slot.items[x].failed)
+    {
+      ++x;
+      continue;
+    }
+
+    bool done_run= slot.items[x].done;
+    size_t first= x;
+    jobs.clear();
+
+    for (; x < slot.size and (slot.items[x].failed or slot.items[x].done == done_run); ++x)
+    {
+      const item_st& item= slot.items[x];
+      if (item.failed)
+      {
+        continue;
+      }
+
+      Job job;
+      job.unique= item.bytes.data();
+      job.unique_size= item.unique_size;
+      job.function_name= item.bytes.data() + item.unique_size;
+      job.function_name_size= item.function_name_size;
+      job.data= item.bytes.data() + item.unique_size + item.function_name_size;
+      job.data_size= item.bytes.size() - item.unique_size - item.function_name_size;
+      job.priority= item.priority;
+      job.when= item.when;
+      jobs.push_back(job);
+    }
+
+    gearmand_error_t rc= done_run ?
+      _queue_done_batch(server, &jobs[0], jobs.size()) :
+      _queue_add_batch(server, &jobs[0], jobs.size());
+    if (gearmand_failed(rc))
+    {
+      ret= rc;
+      for (size_t y= first; y < x; ++y)
+      {
+        slot.items[y].failed= true;
+      }
+    }
+  }
+
+  return ret;
+}
+
+void Batch::_release(slot_st& slot)
+{
+  for (std::vector<held_st>::iterator iter= slot.held.begin(); iter != slot.held.end(); ++iter)
+  {
+    gearman_server_con_st *con= iter->con;
+
+    int error;
+    if ((error= pthread_mutex_lock(&con->thread->lock)) == 0)
+    {
+      GEARMAND_FIFO__ADD(con->io_packet, iter->packet);
+      if ((error= pthread_mutex_unlock(&con->thread->lock)))
+      {
+        gearmand_log_fatal_perror(GEARMAN_DEFAULT_LOG_PARAM, error, "pthread_mutex_unlock");
+      }
+    }
+    else
+    {
+      gearmand_log_fatal_perror(GEARMAN_DEFAULT_LOG_PARAM, error, "pthread_mutex_lock");
+    }
+
+    con->batch_held--;
+    __atomic_sub_fetch(&con->proc_pending, 1, __ATOMIC_RELEASE);
+
+    /* Draining at shutdown the I/O threads are gone; freeing the
+       connection frees the packet. */
+    if (Server->proc_shutdown == false)
+    {
+      gearman_server_con_io_add(con);
+    }
+  }
+  slot.held.clear();
+}
+
+/*
+  The jobs a stored batch added can be left in the queue under
+  --queue-lazy-data. Runs on the thread that owns the jobs.
+*/
+void Batch::_unload(gearman_server_st *server, const slot_st& slot)
+{
+  if (server->queue_prefetch == NULL or slot.adds == 0)
+  {
+    return;
+  }
+
+  for (size_t x= 0; x < slot.size; ++x)
+  {
+    const item_st& item= slot.items[x];
+    if (item.done == false and item.failed == false)
+    {
+      gearman_server_job_unload(server,
+                                item.bytes.data(), item.unique_size,
+                                item.bytes.data() + item.unique_size, item.function_name_size,
+                                slot.id);
+    }
+  }
+}
+
+/*
+  The jobs whose adds could not be stored are dropped, and
+  the JOB_CREATED held for them turns into an ERROR; a JOB_CREATED_BATCH
+  gets an empty handle for each, as for a job that could not be queued.
+*/
+void Batch::_fail(gearman_server_st *server, slot_st& slot)
+{
+  if (slot.adds == 0)
+  {
+    return;
+  }
+
+  std::set<std::string> handles;
+  for (size_t x= 0; x < slot.size; ++x)
+  {
+    const item_st& item= slot.items[x];
+    if (item.done == false and item.failed)
+    {
+      gearman_server_job_st *server_job= gearman_server_job_unstore(server,
+                                                                    item.bytes.data(), item.unique_size,
+                                                                    item.bytes.data() + item.unique_size, item.function_name_size,
+                                                                    slot.id);
+      if (server_job)
+      {
+        handles.insert(server_job->job_handle);
+      }
+    }
+  }
+
+  if (handles.empty())
+  {
+    return;
+  }
+
+  /* A JOB_CREATED for one of the jobs sent to another client, as for the
+     same unique, can be held by a later batch. */
+  _fail_held(slot, handles);
+  for (std::deque<slot_st*>::iterator iter= _in_flight.begin(); iter != _in_flight.end(); ++iter)
+  {
+    _fail_held(**iter, handles);
+  }
+  if (_open != &slot)
+  {
+    _fail_held(*_open, handles);
+  }
+}
+
+void Batch::_fail_held(slot_st& slot, const std::set<std::string>& handles)
+{
+  const char *error_code_string= gearman_strerror(GEARMAN_QUEUE_ERROR) +8;
+  for (std::vector<held_st>::iterator iter= slot.held.begin(); iter != slot.held.end(); ++iter)
+  {
+    gearmand_packet_st& packet= iter->packet->packet;
+    gearmand_error_t ret= GEARMAND_SUCCESS;
+
+    if (packet.command == GEARMAN_COMMAND_JOB_CREATED and packet.argc == 1)
+    {
+      if (handles.count(std::string(packet.arg[0], packet.arg_size[0])) == 0)
+      {
+        continue;
+      }
+
+      ret= gearman_server_packet_rewrite(iter->packet, false,
+                                         GEARMAN_MAGIC_RESPONSE, GEARMAN_COMMAND_ERROR,
+                                         error_code_string, strlen(error_code_string) +1,
+                                         gearman_literal_param("Job could not be stored"),
+                                         NULL);
+    }
+    else if (packet.command == GEARMAN_COMMAND_JOB_CREATED_BATCH)
+    {
+      std::string data;
+      bool changed= false;
+      const char *ptr= packet.data;
+      const char *end= packet.data + packet.data_size;
+      while (ptr < end)
+      {
+        size_t length= strnlen(ptr, size_t(end - ptr));
+        if (length and handles.count(std::string(ptr, length)))
+        {
+          changed= true;
+        }
+        else
+        {
+          data.append(ptr, length);
+        }
+        data.push_back(0);
+        ptr+= length +1;
+      }
+
+      if (changed == false)
+      {
+        continue;
+      }
+
+      char *buffer= (char *)malloc(data.size());
+      if (buffer == NULL)
+      {
+        ret= gearmand_merror("malloc", char, data.size());
+      }
+      else
+      {
+        memcpy(buffer, data.data(), data.size());
+        ret= gearman_server_packet_rewrite(iter->packet, true,
+                                           GEARMAN_MAGIC_RESPONSE, GEARMAN_COMMAND_JOB_CREATED_BATCH,
+                                           buffer, data.size(),
+                                           NULL);
+        if (gearmand_failed(ret))
+        {
+          free(buffer);
+        }
+      }
+    }
+    else
+    {
+      continue;
+    }
+
+    if (gearmand_failed(ret))
+    {
+      /* The short form fits the packet's own buffer. */
+      (void)gearman_server_packet_rewrite(iter->packet, false,
+                                          GEARMAN_MAGIC_RESPONSE, GEARMAN_COMMAND_ERROR,
+                                          error_code_string, strlen(error_code_string) +1,
+                                          "", size_t(0),
+                                          NULL);
+    }
+  }
+}
+
+/*
+  Under --queue-async=relaxed the clients were told about the jobs before
+  they were stored, so the ones that could not be stay queued in memory
+  and are lost only if the server stops before they run.
+*/
+void Batch::_keep(const slot_st& slot)
+{
+  uint64_t kept= 0;
+  for (size_t x= 0; x < slot.size; ++x)
+  {
+    if (slot.items[x].done == false and slot.items[x].failed)
+    {
+      kept++;
+    }
+  }
+
+  gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "%" PRIu64 " jobs could not be stored and are kept in memory only", kept);
+}
+
+/*
+  Hands the open batch to the persistence thread, waiting while
+  GEARMAND_QUEUE_ASYNC_DEPTH batches are ahead of it.
+*/
+void Batch::_submit()
+{
+  slot_st *slot= _open;
+
+  if (_free.empty())
+  {
+    _open= new slot_st;
+  }
+  else
+  {
+    _open= _free.back();
+    _free.pop_back();
+  }
+  _open->id= ++_ids;
+  _in_flight.push_back(slot);
+
+  int error;
+  if ((error= pthread_mutex_lock(&_lock)) == 0)
+  {
+    while (_outstanding >= GEARMAND_QUEUE_ASYNC_DEPTH)
+    {
+      (void)pthread_cond_wait(&_done_cond, &_lock);
+    }
+
+    _pending.push_back(slot);
+    _outstanding++;
+    (void)pthread_cond_signal(&_work_cond);
+    (void)pthread_mutex_unlock(&_lock);
+  }
+  else
+  {
+    gearmand_log_fatal_perror(GEARMAN_DEFAULT_LOG_PARAM, error, "pthread_mutex_lock");
+  }
+}
+
+void Batch::_reap()
+{
+  std::deque<slot_st*> completed;
+
+  int error;
+  if ((error= pthread_mutex_lock(&_lock)) == 0)
+  {
+    completed.swap(_completed);
+    (void)pthread_mutex_unlock(&_lock);
+  }
+  else
+  {
+    gearmand_log_fatal_perror(GEARMAN_DEFAULT_LOG_PARAM, error, "pthread_mutex_lock");
+  }
+
+  for (std::deque<slot_st*>::iterator iter= completed.begin(); iter != completed.end(); ++iter)
+  {
+    slot_st *slot= *iter;
+    _in_flight.pop_front();
+    _unload(_server, *slot);
+    if (slot->stored == false)
+    {
+      if (_async == GEARMAND_QUEUE_ASYNC_RELAXED)
+      {
+        _keep(*slot);
+      }
+      else
+      {
+        _fail(_server, *slot);
+      }
+    }
+    _stored_id= slot->id;
+    _release(*slot);
+    slot->size= 0;
+    slot->adds= 0;
+    slot->stored= false;
+    _free.push_back(slot);
+  }
+}
+
+void *Batch::_run(void *object)
+{
+  (void)gearmand_initialize_thread_logging("[ queue ]");
+
+  static_cast<Batch*>(object)->_persist();
+
+  return NULL;
+}
+
+void Batch::_persist()
+{
+  int error;
+  if ((error= pthread_mutex_lock(&_lock)))
+  {
+    gearmand_log_fatal_perror(GEARMAN_DEFAULT_LOG_PARAM, error, "pthread_mutex_lock");
+    return;
+  }
+
+  while (1)
+  {
+    while ((_pending.empty() or _paused) and _shutdown == false)
+    {
+      (void)pthread_cond_wait(&_work_cond, &_lock);
+    }
+
+    if (_pending.empty())
+    {
+      break;
+    }
+
+    slot_st *slot= _pending.front();
+    _pending.pop_front();
+    (void)pthread_mutex_unlock(&_lock);
+
+    gearmand_error_t ret= _store(_server, *slot);
+    if (gearmand_failed(ret))
+    {
+      gearmand_log_gerror(GEARMAN_DEFAULT_LOG_PARAM, ret, "failed to store a batch of %" PRIu64 " queue updates", uint64_t(slot->size));
+    }
+
+    (void)pthread_mutex_lock(&_lock);
+    _completed.push_back(slot);
+    _outstanding--;
+
+    /* Under _lock, so drain() cannot let the proc thread go before this. */
+    if (slot->held.empty() == false)
+    {
+      gearman_server_proc_wakeup(_server);
+    }
+    (void)pthread_cond_broadcast(&_done_cond);
+  }
+
+  (void)pthread_mutex_unlock(&_lock);
+}
+
+} // namespace queue
+} // namespace gearmand
@@ -61,6 +61,20 @@ gearmand_error_t gearman_queue_done(gearman_server_st *server,
                                     const char *function_name,
                                     size_t function_name_size);
 
+/*
+  Stores the batch gathered under --queue-batch and releases the responses
+  held for it. Unless force is set a batch younger than --queue-batch-delay
+  is left open; returns the milliseconds until it is due, 0 when nothing
+  is waiting.
+*/
+uint32_t gearman_queue_batch_flush(gearman_server_st *server, bool force);
+
+/*
+  Stores everything gathered so far, waiting for batches handed to the
+  --queue-async thread, and releases the responses held for them.
+*/
+void gearman_queue_batch_drain(gearman_server_st *server);
+
 #ifdef __cplusplus
 void gearman_server_save_job(gearman_server_st& server,
                              const gearman_server_job_st* server_job);
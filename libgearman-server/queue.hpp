@@ -37,9 +37,18 @@
 
 #pragma once
 
+#include <deque>
+#include <set>
 #include <string>
+#include <vector>
+
+#include <pthread.h>
 
 struct gearmand_st;
+struct gearman_server_con_st;
+struct gearman_server_st;
+struct gearman_server_packet_st;
+struct gearmand_packet_st;
 
 namespace boost { namespace program_options { class options_description; } }
 
@@ -53,6 +62,121 @@ void add(plugins::Queue* queue);
 void load_options(boost::program_options::options_description &all);
 gearmand_error_t initialize(gearmand_st *gearmand, std::string);
 
+/*
+  The adds and dones gathered for --queue-batch, stored in order by
+  gearman_queue_batch_flush(). A JOB_CREATED for a job whose batch is
+  not stored yet is held with it, together with what its connection is
+  sent after it, so no client is told about a job before it is stored.
+
+  Under --queue-async full batches are handed to a persistence thread
+  instead. Their responses are released by the proc thread once that
+  thread has stored them ('strict'), or not held at all ('relaxed').
+*/
+class Batch
+{
+public:
+  Batch(uint32_t delay_, gearmand_queue_async_t async_);
+  ~Batch();
+
+  gearmand_error_t start(gearman_server_st *server);
+
+  void add(gearman_server_st *server,
+           const char *unique, size_t unique_size,
+           const char *function_name, size_t function_name_size,
+           const void *data, size_t data_size,
+           gearman_job_priority_t priority,
+           int64_t when);
+
+  void done(gearman_server_st *server,
+            const char *unique, size_t unique_size,
+            const char *function_name, size_t function_name_size);
+
+  bool hold(gearman_server_con_st *con, gearman_server_packet_st *packet);
+
+  uint32_t flush(gearman_server_st *server, bool force);
+
+  // The batch the next add() goes to, see gearman_server_job_unload().
+  uint64_t current() const;
+
+  void drain(gearman_server_st *server);
+
+  // Holds the persistence thread off the queue while it is being replayed.
+  void pause();
+  void resume();
+
+private:
+  struct item_st {
+    bool done;
+    bool failed; // its run could not be stored
+    size_t unique_size;
+    size_t function_name_size;
+    std::string bytes; // unique, function name and data
+    gearman_job_priority_t priority;
+    int64_t when;
+  };
+
+  struct held_st {
+    gearman_server_con_st *con;
+    gearman_server_packet_st *packet;
+  };
+
+  // One batch, reused once it has been stored to keep its buffers.
+  struct slot_st {
+    uint64_t id;
+    size_t size;
+    size_t adds;
+    bool stored; // every add made it to the queue
+    std::vector<item_st> items;
+    std::vector<held_st> held;
+
+    slot_st() :
+      id(0),
+      size(0),
+      adds(0),
+      stored(false)
+    { }
+  };
+
+  item_st& _item(gearman_server_st *server, bool done);
+  bool _waiting(const gearmand_packet_st& packet) const;
+  bool _unstored(const char *handle, size_t length) const;
+  gearmand_error_t _store(gearman_server_st *server, slot_st& slot);
+  gearmand_error_t _store_runs(gearman_server_st *server, slot_st& slot);
+  void _fail_all(slot_st& slot);
+  void _release(slot_st& slot);
+  void _unload(gearman_server_st *server, const slot_st& slot);
+  void _fail(gearman_server_st *server, slot_st& slot);
+  void _fail_held(slot_st& slot, const std::set<std::string>& handles);
+  void _keep(const slot_st& slot);
+  void _submit();
+  void _reap();
+
+  static void *_run(void *object);
+  void _persist();
+
+  uint32_t _delay;
+  gearmand_queue_async_t _async;
+  uint64_t _opened;
+  uint64_t _ids;
+  slot_st *_open;
+  uint64_t _stored_id; // Every batch up to this one has been stored.
+  std::vector<slot_st*> _free;
+  std::deque<slot_st*> _in_flight; // Submitted and not reaped yet, oldest first.
+
+  // Shared with the persistence thread under _lock.
+  gearman_server_st *_server;
+  bool _running;
+  bool _shutdown;
+  bool _paused;
+  size_t _outstanding;
+  std::deque<slot_st*> _pending;
+  std::deque<slot_st*> _completed;
+  pthread_t _thread;
+  pthread_mutex_t _lock;
+  pthread_cond_t _work_cond;
+  pthread_cond_t _done_cond;
+};
+
 } // namespace queue
 } // namespace gearmand
 
@@ -60,14 +184,16 @@ namespace gearmand { namespace queue { class Context; } }
 
 /**
  * Set persistent queue context that will be passed back to all queue callback
- * functions.
+ * functions. rollback, when given, drops whatever was added or done since the
+ * last flush, see gearmand::queue::Context::rollback().
  */
 void gearman_server_set_queue(gearman_server_st& server,
                               void *context,
                               gearman_queue_add_fn *add,
                               gearman_queue_flush_fn *flush,
                               gearman_queue_done_fn *done,
-                              gearman_queue_replay_fn *replay);
+                              gearman_queue_replay_fn *replay,
+                              gearman_queue_rollback_fn *rollback= NULL);
 
 void gearman_server_set_queue(gearman_server_st& server,
                               gearmand::queue::Context* context);
@@ -0,0 +1,688 @@
+/*  vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * 
+ *  Gearmand client and server library.
+ *
+ *  Copyright (C) 2013 Data Differential, http://datadifferential.com/
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *
+ *      * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following disclaimer
+ *  in the documentation and/or other materials provided with the
+ *  distribution.
+ *
+ *      * The names of its contributors may not be used to endorse or
+ *  promote products derived from this software without specific prior
+ *  written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "gear_config.h"
+
+#include "libgearman-server/common.h"
+#include <libgearman-server/queue.h>
+#include <libgearman-server/queue.hpp>
+#include <libgearman-server/replay.hpp>
+#include <libgearman-server/prefetch.hpp>
+#include <libgearman-server/log.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+
+/* Rows per chunk handed to a worker thread. */
+#define GEARMAND_QUEUE_REPLAY_CHUNK 4096
+
+/* Chunks the proc thread adds per pass, so connections are served in between. */
+#define GEARMAND_QUEUE_REPLAY_LINK 4
+
+static uint64_t _replay_now()
+{
+  struct timespec now;
+  if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+  {
+    return 0;
+  }
+
+  return uint64_t(now.tv_sec) * 1000 + uint64_t(now.tv_nsec / 1000000);
+}
+
+namespace gearmand {
+namespace queue {
+
+Replay::Replay(uint32_t threads_, bool background_) :
+  _threads(threads_),
+  _background(background_),
+  _server(NULL),
+  _read(NULL),
+  _open(NULL),
+  _error(GEARMAND_SUCCESS),
+  _read_error(GEARMAND_SUCCESS),
+  _reader_running(false),
+  _reading(false),
+  _abort(false),
+  _dispatched(0),
+  _linked(0),
+  _state(IDLE),
+  _rows(0),
+  _loaded(0),
+  _skipped(0),
+  _expected(0),
+  _started(0),
+  _stopped(0)
+{
+  (void)pthread_mutex_init(&_lock, NULL);
+  (void)pthread_cond_init(&_work_cond, NULL);
+  (void)pthread_cond_init(&_ready_cond, NULL);
+}
+
+Replay::~Replay()
+{
+  stop();
+
+  delete _open;
+  for (std::deque<chunk_st*>::iterator iter= _todo.begin(); iter != _todo.end(); ++iter)
+  {
+    _free(*iter);
+  }
+  for (std::map<uint64_t, chunk_st*>::iterator iter= _ready.begin(); iter != _ready.end(); ++iter)
+  {
+    _free(iter->second);
+  }
+
+  pthread_cond_destroy(&_ready_cond);
+  pthread_cond_destroy(&_work_cond);
+  pthread_mutex_destroy(&_lock);
+}
+
+gearmand_error_t Replay::run(gearman_server_st *server, read_fn *read)
+{
+  _server= server;
+  _read= read;
+  _reading= true;
+  __atomic_store_n(&_started, _replay_now(), __ATOMIC_RELAXED);
+  __atomic_store_n(&_state, uint32_t(READING), __ATOMIC_RELEASE);
+
+  for (uint32_t x= 0; x < _threads; ++x)
+  {
+    pthread_t thread;
+    int error;
+    if ((error= pthread_create(&thread, NULL, _run_worker, this)))
+    {
+      /* The threads already started, or the reading thread, pick up the slack. */
+      gearmand_log_perror(GEARMAN_DEFAULT_LOG_PARAM, error, "pthread_create");
+      break;
+    }
+    _workers.push_back(thread);
+  }
+
+  if (_background)
+  {
+    /* Nothing may be stored until the queue has been read. */
+    if (server->queue_batch)
+    {
+      server->queue_batch->pause();
+    }
+
+    int error;
+    if ((error= pthread_create(&_reader, NULL, _run_reader, this)) == 0)
+    {
+      _reader_running= true;
+      gearmand_info("replaying queue in the background");
+      return GEARMAND_SUCCESS;
+    }
+
+    gearmand_log_perror(GEARMAN_DEFAULT_LOG_PARAM, error, "pthread_create");
+    if (server->queue_batch)
+    {
+      server->queue_batch->resume();
+    }
+    _background= false;
+  }
+
+  server->state.queue_startup= true;
+  gearmand_error_t ret= (*read)(*server);
+  assert(ret != GEARMAND_UNKNOWN_STATE);
+  _read_done(ret);
+
+  while (gearmand_success(ret))
+  {
+    (void)pthread_mutex_lock(&_lock);
+    while (_linked < _dispatched and _ready.count(_linked) == 0)
+    {
+      (void)pthread_cond_wait(&_ready_cond, &_lock);
+    }
+
+    chunk_st *chunk= NULL;
+    if (_linked < _dispatched)
+    {
+      chunk= _ready[_linked];
+      _ready.erase(_linked);
+      _linked++;
+    }
+    (void)pthread_mutex_unlock(&_lock);
+
+    if (chunk == NULL)
+    {
+      break;
+    }
+
+    _link(server, chunk);
+  }
+  server->state.queue_startup= false;
+
+  _join();
+  _finished();
+
+  if (gearmand_success(ret))
+  {
+    ret= _error;
+  }
+
+  return ret;
+}
+
+gearmand_error_t Replay::add(const char *unique, size_t unique_size,
+                             const char *function_name, size_t function_name_size,
+                             const void *data, size_t data_size,
+                             gearman_job_priority_t priority,
+                             int64_t when)
+{
+  if (__atomic_load_n(&_abort, __ATOMIC_ACQUIRE))
+  {
+    free((void *)data);
+    return GEARMAND_SHUTDOWN;
+  }
+
+  if (_open == NULL)
+  {
+    _open= new (std::nothrow) chunk_st;
+    if (_open == NULL)
+    {
+      free((void *)data);
+      return gearmand_merror("new", chunk_st, 1);
+    }
+    _open->rows.reserve(GEARMAND_QUEUE_REPLAY_CHUNK);
+  }
+
+  row_st row;
+  row.offset= _open->names.size();
+  row.unique_size= unique_size;
+  row.function_name_size= function_name_size;
+  row.data= data;
+  row.data_size= data_size;
+  row.priority= priority;
+  row.when= when;
+
+  _open->names.append(unique, unique_size);
+  _open->names.append(function_name, function_name_size);
+  _open->rows.push_back(row);
+  __atomic_add_fetch(&_rows, 1, __ATOMIC_RELAXED);
+
+  if (_open->rows.size() >= GEARMAND_QUEUE_REPLAY_CHUNK)
+  {
+    _dispatch();
+
+    /* Read on the thread that owns the jobs, add what is ready as we go. */
+    if (_background == false)
+    {
+      (void)pthread_mutex_lock(&_lock);
+      while (_ready.count(_linked))
+      {
+        chunk_st *chunk= _ready[_linked];
+        _ready.erase(_linked);
+        _linked++;
+        (void)pthread_mutex_unlock(&_lock);
+        _link(_server, chunk);
+        (void)pthread_mutex_lock(&_lock);
+      }
+      (void)pthread_mutex_unlock(&_lock);
+    }
+  }
+
+  return GEARMAND_SUCCESS;
+}
+
+void Replay::expect(uint64_t count)
+{
+  __atomic_store_n(&_expected, count, __ATOMIC_RELEASE);
+}
+
+bool Replay::link(gearman_server_st *server)
+{
+  if (_background == false)
+  {
+    return false;
+  }
+
+  uint32_t state= __atomic_load_n(&_state, __ATOMIC_ACQUIRE);
+  if (state != READING and state != LINKING)
+  {
+    return false;
+  }
+
+  chunk_st *chunks[GEARMAND_QUEUE_REPLAY_LINK];
+  size_t count= 0;
+
+  (void)pthread_mutex_lock(&_lock);
+  while (count < GEARMAND_QUEUE_REPLAY_LINK and _ready.count(_linked))
+  {
+    chunks[count++]= _ready[_linked];
+    _ready.erase(_linked);
+    _linked++;
+  }
+  (void)pthread_mutex_unlock(&_lock);
+
+  for (size_t x= 0; x < count; ++x)
+  {
+    _link(server, chunks[x]);
+  }
+
+  (void)pthread_mutex_lock(&_lock);
+  bool more= _ready.count(_linked);
+  bool finished= _reading == false and _linked == _dispatched;
+  (void)pthread_mutex_unlock(&_lock);
+
+  if (finished)
+  {
+    _finished();
+  }
+
+  return more;
+}
+
+void Replay::stop()
+{
+  (void)pthread_mutex_lock(&_lock);
+  _abort= true;
+  (void)pthread_cond_broadcast(&_work_cond);
+  (void)pthread_mutex_unlock(&_lock);
+
+  if (_reader_running)
+  {
+    int error;
+    if ((error= pthread_join(_reader, NULL)))
+    {
+      gearmand_log_fatal_perror(GEARMAN_DEFAULT_LOG_PARAM, error, "pthread_join");
+    }
+    _reader_running= false;
+  }
+
+  _join();
+
+  uint32_t state= __atomic_load_n(&_state, __ATOMIC_ACQUIRE);
+  if (state == READING or state == LINKING)
+  {
+    gearmand_log_warning(GEARMAN_DEFAULT_LOG_PARAM, "queue replay stopped after %" PRIu64 " of %" PRIu64 " jobs",
+                         __atomic_load_n(&_loaded, __ATOMIC_RELAXED),
+                         __atomic_load_n(&_rows, __ATOMIC_RELAXED));
+    __atomic_store_n(&_stopped, _replay_now(), __ATOMIC_RELAXED);
+    __atomic_store_n(&_state, uint32_t(FAILED), __ATOMIC_RELEASE);
+  }
+}
+
+Replay::progress_st Replay::progress() const
+{
+  progress_st snapshot;
+  snapshot.state= state_t(__atomic_load_n(&_state, __ATOMIC_ACQUIRE));
+  snapshot.read= __atomic_load_n(&_rows, __ATOMIC_RELAXED);
+  snapshot.loaded= __atomic_load_n(&_loaded, __ATOMIC_RELAXED);
+  snapshot.skipped= __atomic_load_n(&_skipped, __ATOMIC_RELAXED);
+  snapshot.expected= __atomic_load_n(&_expected, __ATOMIC_RELAXED);
+
+  uint64_t started= __atomic_load_n(&_started, __ATOMIC_RELAXED);
+  uint64_t stopped= __atomic_load_n(&_stopped, __ATOMIC_RELAXED);
+  if (snapshot.state == IDLE)
+  {
+    snapshot.elapsed= 0;
+  }
+  else
+  {
+    snapshot.elapsed= (stopped ? stopped : _replay_now()) - started;
+  }
+
+  return snapshot;
+}
+
+const char *Replay::state_name(state_t state)
+{
+  switch (state)
+  {
+  case IDLE:
+    return "idle";
+
+  case READING:
+    return "reading";
+
+  case LINKING:
+    return "linking";
+
+  case DONE:
+    return "done";
+
+  case FAILED:
+    return "failed";
+  }
+
+  return "unknown";
+}
+
+void Replay::_dispatch()
+{
+  chunk_st *chunk= _open;
+  _open= NULL;
+  if (chunk == NULL)
+  {
+    return;
+  }
+
+  (void)pthread_mutex_lock(&_lock);
+  chunk->sequence= _dispatched++;
+  bool inline_prepare= _workers.empty();
+  if (inline_prepare == false)
+  {
+    _todo.push_back(chunk);
+    (void)pthread_cond_signal(&_work_cond);
+  }
+  (void)pthread_mutex_unlock(&_lock);
+
+  if (inline_prepare)
+  {
+    _prepare(*chunk);
+
+    (void)pthread_mutex_lock(&_lock);
+    _ready[chunk->sequence]= chunk;
+    (void)pthread_cond_broadcast(&_ready_cond);
+    (void)pthread_mutex_unlock(&_lock);
+
+    if (_background)
+    {
+      gearman_server_proc_wakeup(_server);
+    }
+  }
+}
+
+/*
+  Builds the jobs of a chunk, everything add does before it looks at the
+  server, so this runs on any thread.
+*/
+void Replay::_prepare(chunk_st& chunk)
+{
+  chunk.jobs.resize(chunk.rows.size());
+  for (size_t x= 0; x < chunk.rows.size(); ++x)
+  {
+    const row_st& row= chunk.rows[x];
+    const char *unique= chunk.names.data() + row.offset;
+
+    gearman_server_job_st *server_job= new (std::nothrow) gearman_server_job_st;
+    chunk.jobs[x]= server_job;
+    if (server_job == NULL)
+    {
+      free((void *)row.data);
+      continue;
+    }
+    gearman_server_job_init(server_job);
+
+    server_job->priority= row.priority;
+    server_job->unique_length= row.unique_size;
+    int checked_length= snprintf(server_job->unique, GEARMAN_MAX_UNIQUE_SIZE, "%.*s",
+                                 (int)row.unique_size, unique);
+    if (checked_length >= GEARMAN_MAX_UNIQUE_SIZE || checked_length < 0)
+    {
+      gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "We received a unique beyond GEARMAN_MAX_UNIQUE_SIZE: %.*s", (int)row.unique_size, unique);
+    }
+
+    server_job->data= row.data;
+    server_job->data_size= row.data_size;
+    server_job->when= row.when;
+    server_job->reducer[0]= 0;
+
+    if (row.unique_size == 0)
+    {
+      server_job->unique_key= 0;
+    }
+    else if (row.unique_size == 1 && *unique == '-')
+    {
+      server_job->unique_key= row.data_size ? _server_job_hash((const char*)row.data, row.data_size) : 0;
+    }
+    else
+    {
+      server_job->unique_key= _server_job_hash(unique, row.unique_size);
+    }
+
+    /* The row is already stored, under --queue-lazy-data it is read again when taken. */
+    if (_server->queue_prefetch)
+    {
+      (void)_server->queue_prefetch->unload(server_job);
+    }
+  }
+}
+
+void Replay::_link(gearman_server_st *server, chunk_st *chunk)
+{
+  /* Grow the hashes once, before the first jobs go in. */
+  uint64_t expected= __atomic_load_n(&_expected, __ATOMIC_ACQUIRE);
+  if (expected / 2 > server->hashtable_buckets)
+  {
+    uint64_t buckets= (expected / 2) | 1;
+    if (buckets > UINT32_MAX)
+    {
+      buckets= UINT32_MAX;
+    }
+
+    uint32_t before= server->hashtable_buckets;
+    if (gearmand_success(gearman_server_job_hash_resize(server, uint32_t(buckets))))
+    {
+      gearmand_log_info(GEARMAN_DEFAULT_LOG_PARAM, "queue replay: %" PRIu64 " jobs expected, hash tables grown from %u to %u buckets",
+                        expected, before, server->hashtable_buckets);
+    }
+    else
+    {
+      /* Do not try again for every chunk. */
+      __atomic_store_n(&_expected, 0, __ATOMIC_RELEASE);
+    }
+  }
+
+  uint64_t loaded= 0;
+  uint64_t skipped= 0;
+  for (size_t x= 0; x < chunk->rows.size(); ++x)
+  {
+    const row_st& row= chunk->rows[x];
+    gearmand_error_t ret;
+    if (chunk->jobs[x] == NULL)
+    {
+      ret= GEARMAND_MEMORY_ALLOCATION_FAILURE;
+    }
+    else
+    {
+      ret= gearman_server_job_replay(server, chunk->jobs[x],
+                                     chunk->names.data() + row.offset + row.unique_size,
+                                     row.function_name_size);
+    }
+    chunk->jobs[x]= NULL;
+
+    if (gearmand_success(ret))
+    {
+      loaded++;
+    }
+    else if (ret == GEARMAND_JOB_EXISTS)
+    {
+      skipped++;
+    }
+    else
+    {
+      if (gearmand_success(_error))
+      {
+        gearmand_log_gerror(GEARMAN_DEFAULT_LOG_PARAM, ret, "queue replay failed to add %.*s",
+                            int(row.unique_size), chunk->names.data() + row.offset);
+        _error= ret;
+      }
+    }
+  }
+
+  __atomic_add_fetch(&_loaded, loaded, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&_skipped, skipped, __ATOMIC_RELAXED);
+
+  _free(chunk);
+}
+
+void Replay::_read_done(gearmand_error_t ret)
+{
+  _dispatch();
+
+  if (gearmand_failed(ret) and ret != GEARMAND_SHUTDOWN)
+  {
+    gearmand_gerror("failed to read the queue", ret);
+  }
+
+  /* Published by _lock to the thread adding the jobs. */
+  _read_error= ret;
+
+  (void)pthread_mutex_lock(&_lock);
+  _reading= false;
+  (void)pthread_cond_broadcast(&_work_cond);
+  (void)pthread_mutex_unlock(&_lock);
+
+  uint32_t reading= READING;
+  (void)__atomic_compare_exchange_n(&_state, &reading, uint32_t(LINKING), false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+void Replay::_finished()
+{
+  uint32_t state= __atomic_load_n(&_state, __ATOMIC_ACQUIRE);
+  if (state == DONE or state == FAILED)
+  {
+    return;
+  }
+
+  __atomic_store_n(&_stopped, _replay_now(), __ATOMIC_RELAXED);
+  bool ok= gearmand_success(_read_error) and gearmand_success(_error);
+  __atomic_store_n(&_state, uint32_t(ok ? DONE : FAILED), __ATOMIC_RELEASE);
+
+  progress_st done= progress();
+  gearmand_log_info(GEARMAN_DEFAULT_LOG_PARAM, "queue replay %s: %" PRIu64 " jobs loaded, %" PRIu64 " already queued, in %" PRIu64 " ms",
+                    state_name(done.state), done.loaded, done.skipped, done.elapsed);
+}
+
+void Replay::_join()
+{
+  for (std::vector<pthread_t>::iterator iter= _workers.begin(); iter != _workers.end(); ++iter)
+  {
+    int error;
+    if ((error= pthread_join(*iter, NULL)))
+    {
+      gearmand_log_fatal_perror(GEARMAN_DEFAULT_LOG_PARAM, error, "pthread_join");
+    }
+  }
+  _workers.clear();
+}
+
+void Replay::_free(chunk_st *chunk)
+{
+  for (size_t x= 0; x < chunk->rows.size(); ++x)
+  {
+    if (x < chunk->jobs.size())
+    {
+      if (chunk->jobs[x])
+      {
+        free((void *)chunk->jobs[x]->data);
+        delete chunk->jobs[x];
+      }
+    }
+    else
+    {
+      free((void *)chunk->rows[x].data);
+    }
+  }
+
+  delete chunk;
+}
+
+void *Replay::_run_reader(void *object)
+{
+  (void)gearmand_initialize_thread_logging("[replay ]");
+
+  Replay *replay= static_cast<Replay*>(object);
+  gearmand_error_t ret= (*replay->_read)(*replay->_server);
+  replay->_read_done(ret);
+
+  if (replay->_server->queue_batch)
+  {
+    replay->_server->queue_batch->resume();
+  }
+  gearman_server_proc_wakeup(replay->_server);
+
+  return NULL;
+}
+
+void *Replay::_run_worker(void *object)
+{
+  (void)gearmand_initialize_thread_logging("[replay ]");
+
+  static_cast<Replay*>(object)->_work();
+
+  return NULL;
+}
+
+void Replay::_work()
+{
+  (void)pthread_mutex_lock(&_lock);
+  while (1)
+  {
+    while (_todo.empty() and _reading and _abort == false)
+    {
+      (void)pthread_cond_wait(&_work_cond, &_lock);
+    }
+
+    if (_todo.empty() or _abort)
+    {
+      break;
+    }
+
+    chunk_st *chunk= _todo.front();
+    _todo.pop_front();
+    (void)pthread_mutex_unlock(&_lock);
+
+    _prepare(*chunk);
+
+    (void)pthread_mutex_lock(&_lock);
+    _ready[chunk->sequence]= chunk;
+    (void)pthread_cond_broadcast(&_ready_cond);
+
+    if (_background)
+    {
+      (void)pthread_mutex_unlock(&_lock);
+      gearman_server_proc_wakeup(_server);
+      (void)pthread_mutex_lock(&_lock);
+    }
+  }
+  (void)pthread_mutex_unlock(&_lock);
+}
+
+} // namespace queue
+} // namespace gearmand
+
+#pragma GCC diagnostic pop
@@ -0,0 +1,179 @@
+/*  vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * 
+ *  Gearmand client and server library.
+ *
+ *  Copyright (C) 2013 Data Differential, http://datadifferential.com/
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *
+ *      * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following disclaimer
+ *  in the documentation and/or other materials provided with the
+ *  distribution.
+ *
+ *      * The names of its contributors may not be used to endorse or
+ *  promote products derived from this software without specific prior
+ *  written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#pragma once
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+
+struct gearman_server_st;
+struct gearman_server_job_st;
+
+namespace gearmand {
+namespace queue {
+
+/*
+  Loads the persistent queue at startup. Rows handed to
+  Context::replay_add() are gathered into chunks, the jobs of a chunk are
+  built by --queue-replay-threads threads, and the chunks are added to
+  the server in the order they were read by the thread that owns the
+  jobs: the reading thread, or under --queue-replay-background the proc
+  thread while connections are already being served.
+*/
+class Replay
+{
+public:
+  typedef gearmand_error_t (read_fn)(gearman_server_st& server);
+
+  enum state_t {
+    IDLE,
+    READING,
+    LINKING,
+    DONE,
+    FAILED
+  };
+
+  struct progress_st {
+    state_t state;
+    uint64_t read;
+    uint64_t loaded;
+    uint64_t skipped;
+    uint64_t expected;
+    uint64_t elapsed; // milliseconds
+  };
+
+  Replay(uint32_t threads_, bool background_);
+  ~Replay();
+
+  /*
+    Reads the queue with read. In the background this returns once the
+    reading thread has been started.
+  */
+  gearmand_error_t run(gearman_server_st *server, read_fn *read);
+
+  // Takes ownership of data.
+  gearmand_error_t add(const char *unique, size_t unique_size,
+                       const char *function_name, size_t function_name_size,
+                       const void *data, size_t data_size,
+                       gearman_job_priority_t priority,
+                       int64_t when);
+
+  // How many rows the queue is about to hand over, to size the hashes.
+  void expect(uint64_t count);
+
+  /*
+    Adds the chunks that are ready to the server from the proc thread.
+    Returns true if more are ready, so the caller comes back without
+    waiting.
+  */
+  bool link(gearman_server_st *server);
+
+  // Stops a background replay; the jobs not yet added are dropped.
+  void stop();
+
+  progress_st progress() const;
+
+  static const char *state_name(state_t state);
+
+private:
+  struct row_st {
+    size_t offset; // unique, then function name, in chunk_st::names
+    size_t unique_size;
+    size_t function_name_size;
+    const void *data;
+    size_t data_size;
+    gearman_job_priority_t priority;
+    int64_t when;
+  };
+
+  struct chunk_st {
+    uint64_t sequence;
+    std::string names;
+    std::vector<row_st> rows;
+    std::vector<gearman_server_job_st*> jobs;
+  };
+
+  void _dispatch();
+  void _prepare(chunk_st& chunk);
+  void _link(gearman_server_st *server, chunk_st *chunk);
+  void _read_done(gearmand_error_t ret);
+  void _finished();
+  void _join();
+  void _free(chunk_st *chunk);
+
+  static void *_run_reader(void *object);
+  static void *_run_worker(void *object);
+  void _work();
+
+  uint32_t _threads;
+  bool _background;
+  gearman_server_st *_server;
+  read_fn *_read;
+  chunk_st *_open;
+  gearmand_error_t _error; // First job that could not be added.
+  gearmand_error_t _read_error;
+  bool _reader_running;
+  pthread_t _reader;
+  std::vector<pthread_t> _workers;
+
+  // Shared with the workers under _lock.
+  bool _reading;
+  bool _abort;
+  uint64_t _dispatched;
+  uint64_t _linked;
+  std::deque<chunk_st*> _todo;
+  std::map<uint64_t, chunk_st*> _ready;
+  pthread_mutex_t _lock;
+  pthread_cond_t _work_cond;
+  pthread_cond_t _ready_cond;
+
+  // Read by the "replay" admin command from any thread.
+  uint32_t _state;
+  uint64_t _rows;
+  uint64_t _loaded;
+  uint64_t _skipped;
+  uint64_t _expected;
+  uint64_t _started;
+  uint64_t _stopped;
+};
+
+} // namespace queue
+} // namespace gearmand
@@ -0,0 +1,287 @@
+/*  vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * 
+ *  Gearmand client and server library.
+ *
+ *  Copyright (C) 2011 Data Differential, http://datadifferential.com/
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *
+ *      * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following disclaimer
+ *  in the documentation and/or other materials provided with the
+ *  distribution.
+ *
+ *      * The names of its contributors may not be used to endorse or
+ *  promote products derived from this software without specific prior
+ *  written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * @file
+ * @brief Result cache definitions
+ */
+
+#include "gear_config.h"
+#include "libgearman-server/common.h"
+
+#include <cstring>
+#include <ctime>
+#include <memory>
+
+#pragma GCC diagnostic push
+#ifndef __INTEL_COMPILER
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#endif
+
+/*
+ * Private definitions
+ */
+
+static inline size_t _result_size(size_t data_size)
+{
+  return sizeof(gearman_server_result_st) + data_size;
+}
+
+static void _result_lru_unlink(gearman_server_st *server,
+                               gearman_server_result_st *result)
+{
+  if (server->result_lru_list == result)
+  {
+    server->result_lru_list= result->lru_next;
+  }
+
+  if (server->result_lru_end == result)
+  {
+    server->result_lru_end= result->lru_prev;
+  }
+
+  if (result->lru_prev != NULL)
+  {
+    result->lru_prev->lru_next= result->lru_next;
+  }
+
+  if (result->lru_next != NULL)
+  {
+    result->lru_next->lru_prev= result->lru_prev;
+  }
+
+  result->lru_next= NULL;
+  result->lru_prev= NULL;
+}
+
+static void _result_lru_push(gearman_server_st *server,
+                             gearman_server_result_st *result)
+{
+  result->lru_prev= NULL;
+  result->lru_next= server->result_lru_list;
+
+  if (server->result_lru_list != NULL)
+  {
+    server->result_lru_list->lru_prev= result;
+  }
+  else
+  {
+    server->result_lru_end= result;
+  }
+
+  server->result_lru_list= result;
+}
+
+static void _result_free(gearman_server_st *server,
+                         gearman_server_result_st *result)
+{
+  uint32_t key= result->unique_key % server->hashtable_buckets;
+  GEARMAND_HASH__DEL(server->result, key, result);
+  _result_lru_unlink(server, result);
+
+  server->result_cache_size-= _result_size(result->data_size);
+
+  free(result->data);
+  delete result;
+}
+
+static gearman_server_result_st *_result_find(gearman_server_st *server,
+                                              gearman_server_function_st *function,
+                                              uint32_t unique_key,
+                                              const char *unique, size_t unique_length)
+{
+  for (gearman_server_result_st *result= server->result_hash[unique_key % server->hashtable_buckets];
+       result != NULL; result= result->next)
+  {
+    if (result->function == function and
+        result->unique_key == unique_key and
+        result->unique_length == unique_length and
+        memcmp(result->unique, unique, unique_length) == 0)
+    {
+      return result;
+    }
+  }
+
+  return NULL;
+}
+
+static inline bool _result_cacheable(const char *unique, size_t unique_length)
+{
+  if (unique_length == 0 or unique_length >= GEARMAN_MAX_UNIQUE_SIZE)
+  {
+    return false;
+  }
+
+  // "-" means the unique value is the workload itself, which we do not keep.
+  if (unique_length == 1 and unique[0] == '-')
+  {
+    return false;
+  }
+
+  return true;
+}
+
+/*
+ * Public definitions
+ */
+
+gearman_server_result_st *gearman_server_result_cache_get(gearman_server_st *server,
+                                                          gearman_server_function_st *function,
+                                                          const char *unique, size_t unique_length)
+{
+  if (function->result_cache_ttl == 0 or server->result_count == 0)
+  {
+    return NULL;
+  }
+
+  if (_result_cacheable(unique, unique_length) == false)
+  {
+    return NULL;
+  }
+
+  uint32_t unique_key= _server_job_hash(unique, unique_length);
+  gearman_server_result_st *result= _result_find(server, function, unique_key, unique, unique_length);
+  if (result == NULL)
+  {
+    return NULL;
+  }
+
+  if (result->expires <= time(NULL))
+  {
+    _result_free(server, result);
+    return NULL;
+  }
+
+  _result_lru_unlink(server, result);
+  _result_lru_push(server, result);
+
+  return result;
+}
+
+gearmand_error_t gearman_server_result_cache_add(gearman_server_st *server,
+                                                 gearman_server_job_st *server_job,
+                                                 const void *data, size_t data_size)
+{
+  gearman_server_function_st *function= server_job->function;
+
+  if (function->result_cache_ttl == 0 or server->result_cache_max_size == 0)
+  {
+    return GEARMAND_SUCCESS;
+  }
+
+  if (_result_cacheable(server_job->unique, server_job->unique_length) == false)
+  {
+    return GEARMAND_SUCCESS;
+  }
+
+  size_t entry_size= _result_size(data_size);
+  if (entry_size > server->result_cache_max_size)
+  {
+    return GEARMAND_SUCCESS;
+  }
+
+  gearman_server_result_st *result= _result_find(server, function, server_job->unique_key,
+                                                 server_job->unique, server_job->unique_length);
+  if (result != NULL)
+  {
+    _result_free(server, result);
+  }
+
+  while (server->result_lru_end != NULL and
+         server->result_cache_size + entry_size > server->result_cache_max_size)
+  {
+    _result_free(server, server->result_lru_end);
+  }
+
+  result= new (std::nothrow) gearman_server_result_st;
+  if (result == NULL)
+  {
+    return gearmand_merror("new", gearman_server_result_st, 1);
+  }
+
+  result->data= NULL;
+  if (data_size > 0)
+  {
+    result->data= (char *)malloc(data_size);
+    if (result->data == NULL)
+    {
+      delete result;
+      return gearmand_merror("malloc", char, data_size);
+    }
+    memcpy(result->data, data, data_size);
+  }
+
+  result->data_size= data_size;
+  result->function= function;
+  result->unique_key= server_job->unique_key;
+  result->unique_length= server_job->unique_length;
+  memcpy(result->unique, server_job->unique, server_job->unique_length);
+  result->unique[server_job->unique_length]= 0;
+  result->expires= time(NULL) + function->result_cache_ttl;
+
+  uint32_t key= result->unique_key % server->hashtable_buckets;
+  GEARMAND_HASH__ADD(server->result, key, result);
+  _result_lru_push(server, result);
+  server->result_cache_size+= entry_size;
+
+  return GEARMAND_SUCCESS;
+}
+
+void gearman_server_result_cache_flush(gearman_server_st *server,
+                                       gearman_server_function_st *function)
+{
+  if (server->result_count == 0)
+  {
+    return;
+  }
+
+  for (uint32_t key= 0; key < server->hashtable_buckets; key++)
+  {
+    gearman_server_result_st *result= server->result_hash[key];
+    while (result != NULL)
+    {
+      gearman_server_result_st *next= result->next;
+      if (function == NULL or result->function == function)
+      {
+        _result_free(server, result);
+      }
+      result= next;
+    }
+  }
+}
+
+#pragma GCC diagnostic pop
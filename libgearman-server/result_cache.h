@@ -0,0 +1,93 @@
+/*  vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * 
+ *  Gearmand client and server library.
+ *
+ *  Copyright (C) 2011 Data Differential, http://datadifferential.com/
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *
+ *      * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following disclaimer
+ *  in the documentation and/or other materials provided with the
+ *  distribution.
+ *
+ *      * The names of its contributors may not be used to endorse or
+ *  promote products derived from this software without specific prior
+ *  written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * @file
+ * @brief Result cache declarations
+ */
+
+#pragma once
+
+#include <libgearman-server/struct/result_cache.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @addtogroup gearman_server_result_cache Result Cache Declarations
+ * @ingroup gearman_server
+ *
+ * Functions that have been marked idempotent (see the "resultcache" text
+ * command) keep the data of each WORK_COMPLETE keyed by function and unique
+ * value. A later foreground submission for the same function and unique is
+ * answered from the cache without ever reaching a worker.
+ *
+ * @{
+ */
+
+/**
+ * Look up a cached result. Expired entries are removed as they are found.
+ * A hit moves the entry to the front of the LRU list.
+ */
+GEARMAN_API
+gearman_server_result_st *gearman_server_result_cache_get(gearman_server_st *server,
+                                                          gearman_server_function_st *function,
+                                                          const char *unique, size_t unique_length);
+
+/**
+ * Store the result of a completed job. Jobs without a unique value, or
+ * whose unique value is "-", are not cached.
+ */
+GEARMAN_API
+gearmand_error_t gearman_server_result_cache_add(gearman_server_st *server,
+                                                 gearman_server_job_st *server_job,
+                                                 const void *data, size_t data_size);
+
+/**
+ * Remove all cached results for a function, or every cached result if
+ * function is NULL.
+ */
+GEARMAN_API
+void gearman_server_result_cache_flush(gearman_server_st *server,
+                                       gearman_server_function_st *function);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
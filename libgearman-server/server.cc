@@ -46,6 +46,7 @@
 #include "libgearman-server/common.h"
 #include "libgearman-server/queue.h"
 #include "libgearman-server/plugins/base.h"
+#include "libgearman-server/replay.hpp"
 
 #include <cerrno>
 #include <climits>
@@ -94,6 +95,28 @@ static gearmand_error_t
 _server_queue_work_data(gearman_server_job_st *server_job,
                         gearmand_packet_st *packet, gearman_command_t command);
 
+/**
+ * Answer a foreground submission from the result cache.
+ */
+static gearmand_error_t
+_server_result_cache_reply(gearman_server_con_st *server_con,
+                           gearman_server_result_st *result);
+
+/**
+ * Queue a JOB_ASSIGN_UNIQ, or JOB_ASSIGN_ALL if the job has a reducer.
+ */
+static gearmand_error_t
+_server_job_assign_all(gearman_server_con_st *server_con,
+                       gearman_server_job_st *server_job);
+
+/**
+ * Answer a WORK_COMPLETE from an assign_on_complete connection with its
+ * next job, or NO_JOB. The worker waits for it whether or not the
+ * WORK_COMPLETE itself succeeded.
+ */
+static gearmand_error_t
+_server_assign_on_complete(gearman_server_con_st *server_con);
+
 /** @} */
 
 /*
@@ -116,8 +139,8 @@ gearmand_error_t gearman_server_run_command(gearman_server_con_st *server_con,
     return _server_error_packet(GEARMAN_DEFAULT_LOG_PARAM, server_con, GEARMAN_INVALID_COMMAND, gearman_literal_param("Invalid command expected"));
   }
 
-  gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM,
-                     "PACKET COMMAND: %s", gearmand_strcommand(packet));
+  gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM,
+                         "PACKET COMMAND: %s", gearmand_strcommand(packet));
 
   switch (packet->command)
   {
@@ -144,12 +167,12 @@ gearmand_error_t gearman_server_run_command(gearman_server_con_st *server_con,
 
   case GEARMAN_COMMAND_SUBMIT_REDUCE_JOB_BACKGROUND:
     {
-      gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM,
-                         "Received reduce submission, Partitioner: %.*s(%lu) Reducer: %.*s(%lu) Unique: %.*s(%lu) with %d arguments",
-                         packet->arg_size[0] -1, packet->arg[0], packet->arg_size[0] -1,
-                         packet->arg_size[2] -1, packet->arg[2], packet->arg_size[2] -1, // reducer
-                         packet->arg_size[1] -1, packet->arg[1], packet->arg_size[1] -1,
-                         (int)packet->argc);
+      gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM,
+                             "Received reduce submission, Partitioner: %.*s(%lu) Reducer: %.*s(%lu) Unique: %.*s(%lu) with %d arguments",
+                             packet->arg_size[0] -1, packet->arg[0], packet->arg_size[0] -1,
+                             packet->arg_size[2] -1, packet->arg[2], packet->arg_size[2] -1, // reducer
+                             packet->arg_size[1] -1, packet->arg[1], packet->arg_size[1] -1,
+                             (int)packet->argc);
       if (packet->arg_size[2] -1 > GEARMAN_UNIQUE_SIZE)
       {
         gearman_server_client_free(server_client);
@@ -238,6 +261,19 @@ gearmand_error_t gearman_server_run_command(gearman_server_con_st *server_con,
       }
       else
       {
+        /* A function the server has never seen has nothing cached. */
+        gearman_server_function_st *server_function;
+        if (Server->result_count > 0 and
+            (server_function= gearman_server_function_find(Server, (char *)(packet->arg[0]), packet->arg_size[0] -1)))
+        {
+          gearman_server_result_st *result= gearman_server_result_cache_get(Server, server_function,
+                                                                            (char *)(packet->arg[1]), packet->arg_size[1] -1);
+          if (result)
+          {
+            return _server_result_cache_reply(server_con, result);
+          }
+        }
+
         server_client= gearman_server_client_add(server_con);
         if (server_client == NULL)
         {
@@ -245,11 +281,11 @@ gearmand_error_t gearman_server_run_command(gearman_server_con_st *server_con,
         }
       }
 
-      gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM,
-                         "Received submission, function:%.*s unique:%.*s with %d arguments",
-                         packet->arg_size[0], packet->arg[0],
-                         packet->arg_size[1], packet->arg[1],
-                         (int)packet->argc);
+      gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM,
+                             "Received submission, function:%.*s unique:%.*s with %d arguments",
+                             packet->arg_size[0], packet->arg[0],
+                             packet->arg_size[1], packet->arg[1],
+                             (int)packet->argc);
       int64_t when= 0;
       if (packet->command == GEARMAN_COMMAND_SUBMIT_JOB_EPOCH)
       {
@@ -263,12 +299,12 @@ gearmand_error_t gearman_server_run_command(gearman_server_con_st *server_con,
         {
           return gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "strtoul(%ul)", when);
         }
-        gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, 
-                           "Received EPOCH job submission, function:%.*s unique:%.*s with data for %jd at %jd, args %d",
-                           packet->arg_size[0], packet->arg[0],
-                           packet->arg_size[1], packet->arg[1],
-                           when, time(NULL),
-                           (int)packet->argc);
+        gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM, 
+                               "Received EPOCH job submission, function:%.*s unique:%.*s with data for %jd at %jd, args %d",
+                               packet->arg_size[0], packet->arg[0],
+                               packet->arg_size[1], packet->arg[1],
+                               when, time(NULL),
+                               (int)packet->argc);
       }
 
       if (packet->arg_size[1] -1 > GEARMAN_UNIQUE_SIZE)
@@ -321,6 +357,110 @@ gearmand_error_t gearman_server_run_command(gearman_server_con_st *server_con,
     }
     break;
 
+  case GEARMAN_COMMAND_SUBMIT_JOB_BATCH:
+    {
+      /* Walk the entries once so a malformed packet queues nothing. */
+      uint32_t job_count= 0;
+      size_t handles_size= 0;
+      for (size_t offset= 0; offset < packet->data_size; job_count++)
+      {
+        const char *unique= packet->data +offset;
+        const char *unique_end= (const char *)memchr(unique, 0, packet->data_size -offset);
+        if (unique_end == NULL or size_t(unique_end -unique) > GEARMAN_UNIQUE_SIZE or
+            packet->data_size -(size_t(unique_end -packet->data) +1) < sizeof(uint32_t))
+        {
+          return _server_error_packet(GEARMAN_DEFAULT_LOG_PARAM, server_con, GEARMAN_INVALID_ARGUMENT, gearman_literal_param("Malformed job batch"));
+        }
+        offset= size_t(unique_end -packet->data) +1;
+
+        uint32_t workload_size;
+        memcpy(&workload_size, packet->data +offset, sizeof(uint32_t));
+        workload_size= ntohl(workload_size);
+        offset+= sizeof(uint32_t);
+
+        if (workload_size > packet->data_size -offset)
+        {
+          return _server_error_packet(GEARMAN_DEFAULT_LOG_PARAM, server_con, GEARMAN_INVALID_ARGUMENT, gearman_literal_param("Malformed job batch"));
+        }
+        offset+= workload_size;
+      }
+
+      char *handles= NULL;
+      if (job_count)
+      {
+        handles= (char *)malloc(job_count *GEARMAND_JOB_HANDLE_SIZE);
+        if (handles == NULL)
+        {
+          return gearmand_perror(errno, "malloc");
+        }
+      }
+
+      for (size_t offset= 0; offset < packet->data_size; )
+      {
+        const char *unique= packet->data +offset;
+        size_t unique_size= strlen(unique);
+        offset+= unique_size +1;
+
+        uint32_t workload_size;
+        memcpy(&workload_size, packet->data +offset, sizeof(uint32_t));
+        workload_size= ntohl(workload_size);
+        offset+= sizeof(uint32_t);
+
+        /* Each job owns its workload, as it would own the packet data of a single SUBMIT_JOB_BG. */
+        void *workload= NULL;
+        if (workload_size)
+        {
+          workload= malloc(workload_size);
+          if (workload == NULL)
+          {
+            free(handles);
+            return gearmand_perror(errno, "malloc");
+          }
+          memcpy(workload, packet->data +offset, workload_size);
+        }
+        offset+= workload_size;
+
+        gearman_server_job_st *server_job= gearman_server_job_add(Server,
+                                                                  (char *)(packet->arg[0]), packet->arg_size[0] -1, // Function
+                                                                  unique, unique_size,
+                                                                  workload, workload_size,
+                                                                  GEARMAN_JOB_PRIORITY_NORMAL,
+                                                                  NULL, &ret, 0);
+        if (gearmand_failed(ret))
+        {
+          free(workload);
+        }
+
+        /* A job that could not be queued gets an empty handle. */
+        if (server_job and (gearmand_success(ret) or ret == GEARMAND_JOB_EXISTS))
+        {
+          size_t handle_length= strlen(server_job->job_handle);
+          memcpy(handles +handles_size, server_job->job_handle, handle_length +1);
+          handles_size+= handle_length +1;
+        }
+        else
+        {
+          gearmand_gerror_warn("gearman_server_job_add", ret);
+          handles[handles_size++]= 0;
+        }
+      }
+
+      ret= gearman_server_io_packet_add(server_con, true, GEARMAN_MAGIC_RESPONSE,
+                                        GEARMAN_COMMAND_JOB_CREATED_BATCH,
+                                        handles, handles_size,
+                                        NULL);
+      if (gearmand_failed(ret))
+      {
+        free(handles);
+        return gearmand_gerror("gearman_server_io_packet_add", ret);
+      }
+
+      gearmand_log_notice(GEARMAN_DEFAULT_LOG_PARAM,"accepted,%.*s,batch,%u",
+                          packet->arg_size[0], packet->arg[0], // Function
+                          job_count);
+    }
+    break;
+
   case GEARMAN_COMMAND_GET_STATUS_UNIQUE:
     {
       char unique_handle[GEARMAN_MAX_UNIQUE_SIZE];
@@ -339,9 +479,9 @@ gearmand_error_t gearman_server_run_command(gearman_server_con_st *server_con,
                                                                           unique_handle, (size_t)unique_handle_length,
                                                                           NULL);
 
-      gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "Searching for unique job: \"%s\" found: %s clients:%d", unique_handle,
-                         server_job ? "yes" : "no",
-                         server_job ? server_job->client_count : 0);
+      gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM, "Searching for unique job: \"%s\" found: %s clients:%d", unique_handle,
+                             server_job ? "yes" : "no",
+                             server_job ? server_job->client_count : 0);
       /* Queue status result packet. */
       if (server_job == NULL)
       {
@@ -422,8 +562,8 @@ gearmand_error_t gearman_server_run_command(gearman_server_con_st *server_con,
       /* Queue status result packet. */
       if (server_job == NULL)
       {
-        gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM,"status,%.*s,unknown,unknown,unknown,unknown",
-                           int(job_handle_length), job_handle);
+        gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM,"status,%.*s,unknown,unknown,unknown,unknown",
+                               int(job_handle_length), job_handle);
 
         ret= gearman_server_io_packet_add(server_con, false,
                                           GEARMAN_MAGIC_RESPONSE,
@@ -453,11 +593,11 @@ gearmand_error_t gearman_server_run_command(gearman_server_con_st *server_con,
           return GEARMAND_MEMORY_ALLOCATION_FAILURE;
         }
 
-        gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM,"status,%.*s,known,%s,%.*s,%.*s",
-                           int(job_handle_length), job_handle,
-                           server_job->worker == NULL ? "quiet" : "running",
-                           int(numerator_buffer_length), numerator_buffer,
-                           int(denominator_buffer_length), denominator_buffer);
+        gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM,"status,%.*s,known,%s,%.*s,%.*s",
+                               int(job_handle_length), job_handle,
+                               server_job->worker == NULL ? "quiet" : "running",
+                               int(numerator_buffer_length), numerator_buffer,
+                               int(denominator_buffer_length), denominator_buffer);
 
 
         ret= gearman_server_io_packet_add(server_con, false,
@@ -496,9 +636,14 @@ gearmand_error_t gearman_server_run_command(gearman_server_con_st *server_con,
 
       if (strcasecmp(option, "exceptions") == 0)
       {
-        gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "'exceptions'");
+        gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM, "'exceptions'");
         server_con->is_exceptions= true;
       }
+      else if (strcasecmp(option, "assign_on_complete") == 0)
+      {
+        gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM, "'assign_on_complete'");
+        server_con->is_assign_on_complete= true;
+      }
       else
       {
         return _server_error_packet(GEARMAN_DEFAULT_LOG_PARAM, server_con, GEARMAN_UNKNOWN_OPTION,
@@ -519,7 +664,7 @@ gearmand_error_t gearman_server_run_command(gearman_server_con_st *server_con,
 
   /* Worker requests. */
   case GEARMAN_COMMAND_CAN_DO:
-    gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "Registering function: %.*s", packet->arg_size[0], packet->arg[0]);
+    gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM, "Registering function: %.*s", packet->arg_size[0], packet->arg[0]);
     if (gearman_server_worker_add(server_con, (char *)(packet->arg[0]),
                                   packet->arg_size[0], 0) == NULL)
     {
@@ -546,8 +691,8 @@ gearmand_error_t gearman_server_run_command(gearman_server_con_st *server_con,
         return gearmand_log_perror(GEARMAN_DEFAULT_LOG_PARAM, errno, "GEARMAN_COMMAND_CAN_DO_TIMEOUT:strtol: %s", strtol_buffer);
       }
 
-      gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "Registering function: %.*s with timeout %dl",
-                         packet->arg_size[0], packet->arg[0], timeout);
+      gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM, "Registering function: %.*s with timeout %dl",
+                             packet->arg_size[0], packet->arg[0], timeout);
 
       if (gearman_server_worker_add(server_con, (char *)(packet->arg[0]),
                                     packet->arg_size[0] - 1,
@@ -560,7 +705,7 @@ gearmand_error_t gearman_server_run_command(gearman_server_con_st *server_con,
     break;
 
   case GEARMAN_COMMAND_CANT_DO:
-    gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "Removing function: %.*s", packet->arg_size[0], packet->arg[0]);
+    gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM, "Removing function: %.*s", packet->arg_size[0], packet->arg[0]);
     gearman_server_con_free_worker(server_con, (char *)(packet->arg[0]),
                                    packet->arg_size[0]);
     break;
@@ -575,8 +720,6 @@ gearmand_error_t gearman_server_run_command(gearman_server_con_st *server_con,
       if (server_job == NULL)
       {
         server_con->is_sleeping= true;
-        /* Remove any timeouts while sleeping */
-        gearman_server_con_delete_timeout(server_con);
       }
       else
       {
@@ -625,12 +768,12 @@ gearmand_error_t gearman_server_run_command(gearman_server_con_st *server_con,
       }
       else if (packet->command == GEARMAN_COMMAND_GRAB_JOB_ALL and *server_job->reducer != '\0')
       {
-        gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM,
-                           "Sending reduce submission, Partitioner: %.*s(%lu) Reducer: %.*s(%lu) Unique: %.*s(%lu) with data sized (%lu)" ,
-                           server_job->function->function_name_size, server_job->function->function_name, server_job->function->function_name_size,
-                           strlen(server_job->reducer), server_job->reducer, strlen(server_job->reducer),
-                           server_job->unique_length, server_job->unique, server_job->unique_length,
-                           (unsigned long)server_job->data_size);
+        gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM,
+                               "Sending reduce submission, Partitioner: %.*s(%lu) Reducer: %.*s(%lu) Unique: %.*s(%lu) with data sized (%lu)" ,
+                               server_job->function->function_name_size, server_job->function->function_name, server_job->function->function_name_size,
+                               strlen(server_job->reducer), server_job->reducer, strlen(server_job->reducer),
+                               server_job->unique_length, server_job->unique, server_job->unique_length,
+                               (unsigned long)server_job->data_size);
         /* 
           We found a runnable job, queue job assigned packet and take the job off the queue. 
         */
@@ -660,10 +803,10 @@ gearmand_error_t gearman_server_run_command(gearman_server_con_st *server_con,
       }
       else
       {
-        gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM,
-                           "Sending GEARMAN_COMMAND_JOB_ASSIGN Function: %.*s(%lu) with data sized (%lu)" ,
-                           server_job->function->function_name_size, server_job->function->function_name, server_job->function->function_name_size,
-                           (unsigned long)server_job->data_size);
+        gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM,
+                               "Sending GEARMAN_COMMAND_JOB_ASSIGN Function: %.*s(%lu) with data sized (%lu)" ,
+                               server_job->function->function_name_size, server_job->function->function_name, server_job->function->function_name_size,
+                               (unsigned long)server_job->data_size);
         /* Same, but without unique ID. */
         ret= gearman_server_io_packet_add(server_con, false,
                                           GEARMAN_MAGIC_RESPONSE,
@@ -695,6 +838,76 @@ gearmand_error_t gearman_server_run_command(gearman_server_con_st *server_con,
 
     break;
 
+  case GEARMAN_COMMAND_GRAB_JOBS:
+    {
+      if (packet->arg_size[0] == 0 or packet->arg_size[0] > GEARMAN_MAXIMUM_INTEGER_DISPLAY_LENGTH)
+      {
+        return _server_error_packet(GEARMAN_DEFAULT_LOG_PARAM, server_con, GEARMAN_INVALID_ARGUMENT,
+                                    gearman_literal_param("Invalid job count"));
+      }
+
+      char strtol_buffer[GEARMAN_MAXIMUM_INTEGER_DISPLAY_LENGTH +1];
+      memcpy(strtol_buffer, packet->arg[0], packet->arg_size[0]);
+      strtol_buffer[packet->arg_size[0]]= 0;
+      char *endptr;
+      errno= 0;
+      long requested= strtol(strtol_buffer, &endptr, 10);
+      if (errno != 0 or *endptr != 0 or requested < 1)
+      {
+        return _server_error_packet(GEARMAN_DEFAULT_LOG_PARAM, server_con, GEARMAN_INVALID_ARGUMENT,
+                                    gearman_literal_param("Invalid job count"));
+      }
+
+      uint32_t limit= GEARMAND_MAX_GRAB_JOBS;
+      if (requested < GEARMAND_MAX_GRAB_JOBS)
+      {
+        limit= uint32_t(requested);
+      }
+
+      server_con->is_sleeping= false;
+      server_con->is_noop_sent= false;
+
+      /* Take every job up front so that the batch is assigned in one pass. */
+      gearman_server_job_st *jobs[GEARMAND_MAX_GRAB_JOBS];
+      uint32_t job_count= gearman_server_job_take_many(server_con, jobs, limit);
+
+      gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM, "Assigning %u of %ld requested jobs",
+                             job_count, requested);
+
+      for (uint32_t x= 0; x < job_count; ++x)
+      {
+        ret= _server_job_assign_all(server_con, jobs[x]);
+        if (gearmand_failed(ret))
+        {
+          gearmand_gerror("gearman_server_io_packet_add", ret);
+
+          /* Jobs that never made it to the worker go back on the queue. */
+          for (uint32_t y= x; y < job_count; ++y)
+          {
+            (void)gearman_server_job_queue(jobs[y]);
+          }
+
+          return ret;
+        }
+
+        gearman_server_con_add_job_timeout(server_con, jobs[x]);
+      }
+
+      /* A short batch is terminated with NO_JOB so the worker stops waiting. */
+      if (job_count < requested)
+      {
+        ret= gearman_server_io_packet_add(server_con, false,
+                                          GEARMAN_MAGIC_RESPONSE,
+                                          GEARMAN_COMMAND_NO_JOB, NULL);
+        if (gearmand_failed(ret))
+        {
+          return gearmand_gerror("gearman_server_io_packet_add", ret);
+        }
+      }
+    }
+
+    break;
+
   case GEARMAN_COMMAND_WORK_DATA:
   case GEARMAN_COMMAND_WORK_WARNING:
     {
@@ -745,6 +958,12 @@ gearmand_error_t gearman_server_run_command(gearman_server_con_st *server_con,
 
       server_job->denominator= (uint32_t)atoi(denominator_buffer);
 
+      /* Rate limited, only the latest status is sent once the interval passes. */
+      if (Server->status_interval)
+      {
+        return gearman_server_work_status_send(Server, server_job);
+      }
+
       /* Queue the status packet for all clients. */
       for (server_client= server_job->client_list; server_client;
            server_client= server_client->job_next)
@@ -772,7 +991,18 @@ gearmand_error_t gearman_server_run_command(gearman_server_con_st *server_con,
                                                                 server_con);
       if (server_job == NULL)
       {
-        return _server_error_packet(GEARMAN_DEFAULT_LOG_PARAM, server_con, GEARMAN_JOB_NOT_FOUND, gearman_literal_param("Job given in work result not found"));
+        ret= _server_error_packet(GEARMAN_DEFAULT_LOG_PARAM, server_con, GEARMAN_JOB_NOT_FOUND, gearman_literal_param("Job given in work result not found"));
+        (void)_server_assign_on_complete(server_con);
+        return ret;
+      }
+
+      /* Keep the result for idempotent functions, this must happen before
+         the data is handed off to the client packets below. */
+      ret= gearman_server_result_cache_add(Server, server_job,
+                                           packet->data, packet->data_size);
+      if (gearmand_failed(ret))
+      {
+        gearmand_gerror_warn("gearman_server_result_cache_add", ret);
       }
 
       /* Queue the complete packet for all clients. */
@@ -780,6 +1010,7 @@ gearmand_error_t gearman_server_run_command(gearman_server_con_st *server_con,
                                    GEARMAN_COMMAND_WORK_COMPLETE);
       if (gearmand_failed(ret))
       {
+        (void)_server_assign_on_complete(server_con);
         return gearmand_gerror("_server_queue_work_data", ret);
       }
 
@@ -793,12 +1024,23 @@ gearmand_error_t gearman_server_run_command(gearman_server_con_st *server_con,
                                 server_job->function->function_name_size);
         if (gearmand_failed(ret))
         {
+          (void)_server_assign_on_complete(server_con);
           return gearmand_gerror("Remove from persistent queue", ret);
         }
       }
 
       /* Job is done, remove it. */
+      server_job->function->job_completed++;
+      gearman_server_latency_record(&server_job->function->run_latency,
+                                    server_job->taken_usec, gearman_server_latency_now());
       gearman_server_job_free(server_job);
+
+      /* Save the worker a GRAB_JOB round trip by answering with its next job. */
+      ret= _server_assign_on_complete(server_con);
+      if (gearmand_failed(ret))
+      {
+        return ret;
+      }
     }
     break;
 
@@ -807,9 +1049,9 @@ gearmand_error_t gearman_server_run_command(gearman_server_con_st *server_con,
       gearman_server_job_st *server_job= gearman_server_job_get(Server,
                                                                 (char *)(packet->arg[0]), (size_t)strlen(packet->arg[0]),
                                                                 server_con);
-      gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM,
-                         "Exception being sent from: %.*s(%lu)",
-                         server_job->function->function_name_size, server_job->function->function_name, server_job->function->function_name_size);
+      gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM,
+                             "Exception being sent from: %.*s(%lu)",
+                             server_job->function->function_name_size, server_job->function->function_name, server_job->function->function_name_size);
       if (server_job == NULL)
       {
         return _server_error_packet(GEARMAN_DEFAULT_LOG_PARAM, server_con, GEARMAN_JOB_NOT_FOUND, 
@@ -838,6 +1080,9 @@ gearmand_error_t gearman_server_run_command(gearman_server_con_st *server_con,
       }
 
       /* Job is done, remove it. */
+      server_job->function->job_failed++;
+      gearman_server_latency_record(&server_job->function->run_latency,
+                                    server_job->taken_usec, gearman_server_latency_now());
       gearman_server_job_free(server_job);
     }
 
@@ -865,6 +1110,9 @@ gearmand_error_t gearman_server_run_command(gearman_server_con_st *server_con,
                                     gearman_literal_param("Job given in work result not found"));
       }
 
+      /* Clients see the final status before the fail. */
+      gearman_server_work_status_flush_job(Server, server_job);
+
       /* Queue the fail packet for all clients. */
       for (server_client= server_job->client_list; server_client;
            server_client= server_client->job_next)
@@ -895,6 +1143,9 @@ gearmand_error_t gearman_server_run_command(gearman_server_con_st *server_con,
       }
 
       /* Job is done, remove it. */
+      server_job->function->job_failed++;
+      gearman_server_latency_record(&server_job->function->run_latency,
+                                    server_job->taken_usec, gearman_server_latency_now());
       gearman_server_job_free(server_job);
     }
 
@@ -923,6 +1174,7 @@ gearmand_error_t gearman_server_run_command(gearman_server_con_st *server_con,
   case GEARMAN_COMMAND_JOB_ASSIGN_ALL:
   case GEARMAN_COMMAND_MAX:
   case GEARMAN_COMMAND_STATUS_RES_UNIQUE:
+  case GEARMAN_COMMAND_JOB_CREATED_BATCH:
   default:
     return _server_error_packet(GEARMAN_DEFAULT_LOG_PARAM, server_con, GEARMAN_INVALID_COMMAND, gearman_literal_param("Command not expected"));
   }
@@ -944,7 +1196,6 @@ gearmand_error_t gearman_server_shutdown_graceful(gearman_server_st *server)
 
 static gearmand_error_t gearman_queue_replay(gearman_server_st& server)
 {
-  assert(server.state.queue_startup == true);
   if (server.queue_version == QUEUE_VERSION_FUNCTION)
   {
     assert(server.queue.functions->_replay_fn);
@@ -961,6 +1212,11 @@ static gearmand_error_t gearman_queue_replay(gearman_server_st& server)
 
 gearmand_error_t gearman_server_queue_replay(gearman_server_st& server)
 {
+  if (server.queue_replay)
+  {
+    return server.queue_replay->run(&server, gearman_queue_replay);
+  }
+
   server.state.queue_startup= true;
 
   gearmand_error_t ret= gearman_queue_replay(server);
@@ -992,6 +1248,13 @@ gearmand_error_t Context::replay_add(gearman_server_st *server,
                                      gearman_job_priority_t priority,
                                      int64_t when)
 {
+  if (server->queue_replay)
+  {
+    return server->queue_replay->add(unique, unique_size,
+                                     function_name, function_name_size,
+                                     data, data_size, priority, when);
+  }
+
   assert(server->state.queue_startup == true);
   gearmand_error_t ret= GEARMAND_UNKNOWN_STATE;
 
@@ -1008,6 +1271,14 @@ gearmand_error_t Context::replay_add(gearman_server_st *server,
   return ret;
 }
 
+void Context::replay_expect(gearman_server_st *server, uint64_t count)
+{
+  if (server->queue_replay)
+  {
+    server->queue_replay->expect(count);
+  }
+}
+
 } // namespace queue
 } // namespace gearmand
 
@@ -1019,6 +1290,9 @@ static gearmand_error_t
 _server_queue_work_data(gearman_server_job_st *server_job,
                         gearmand_packet_st *packet, const gearman_command_t command)
 {
+  /* Clients see the final status before anything that follows it. */
+  gearman_server_work_status_flush_job(Server, server_job);
+
   for (gearman_server_client_st* server_client= server_job->client_list; server_client;
        server_client= server_client->job_next)
   {
@@ -1071,3 +1345,120 @@ _server_queue_work_data(gearman_server_job_st *server_job,
 
   return GEARMAND_SUCCESS;
 }
+
+static gearmand_error_t
+_server_job_assign_all(gearman_server_con_st *server_con,
+                       gearman_server_job_st *server_job)
+{
+  if (*server_job->reducer != '\0')
+  {
+    return gearman_server_io_packet_add(server_con, false,
+                                        GEARMAN_MAGIC_RESPONSE,
+                                        GEARMAN_COMMAND_JOB_ASSIGN_ALL,
+                                        server_job->job_handle, (size_t)(strlen(server_job->job_handle) +1),
+                                        server_job->function->function_name, server_job->function->function_name_size +1,
+                                        server_job->unique, server_job->unique_length +1,
+                                        server_job->reducer, (size_t)(strlen(server_job->reducer) +1),
+                                        server_job->data, server_job->data_size,
+                                        NULL);
+  }
+
+  return gearman_server_io_packet_add(server_con, false,
+                                      GEARMAN_MAGIC_RESPONSE,
+                                      GEARMAN_COMMAND_JOB_ASSIGN_UNIQ,
+                                      server_job->job_handle, (size_t)(strlen(server_job->job_handle) +1),
+                                      server_job->function->function_name, server_job->function->function_name_size +1,
+                                      server_job->unique, server_job->unique_length +1,
+                                      server_job->data, server_job->data_size,
+                                      NULL);
+}
+
+static gearmand_error_t
+_server_assign_on_complete(gearman_server_con_st *server_con)
+{
+  if (server_con->is_assign_on_complete == false)
+  {
+    return GEARMAND_SUCCESS;
+  }
+
+  server_con->is_sleeping= false;
+  server_con->is_noop_sent= false;
+
+  gearman_server_job_st *next_job= gearman_server_job_take(server_con);
+  if (next_job == NULL)
+  {
+    gearmand_error_t ret= gearman_server_io_packet_add(server_con, false,
+                                                       GEARMAN_MAGIC_RESPONSE,
+                                                       GEARMAN_COMMAND_NO_JOB, NULL);
+    if (gearmand_failed(ret))
+    {
+      return gearmand_gerror("gearman_server_io_packet_add", ret);
+    }
+
+    return GEARMAND_SUCCESS;
+  }
+
+  gearmand_error_t ret= _server_job_assign_all(server_con, next_job);
+  if (gearmand_failed(ret))
+  {
+    gearmand_gerror("gearman_server_io_packet_add", ret);
+    return gearman_server_job_queue(next_job);
+  }
+
+  gearman_server_con_add_job_timeout(server_con, next_job);
+
+  return GEARMAND_SUCCESS;
+}
+
+static gearmand_error_t
+_server_result_cache_reply(gearman_server_con_st *server_con,
+                           gearman_server_result_st *result)
+{
+  char job_handle[GEARMAND_JOB_HANDLE_SIZE];
+  int job_handle_length= snprintf(job_handle, GEARMAND_JOB_HANDLE_SIZE, "%s:%u",
+                                  Server->job_handle_prefix, Server->job_handle_count);
+  if (job_handle_length >= GEARMAND_JOB_HANDLE_SIZE || job_handle_length < 0)
+  {
+    return gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM, "Job handle plus handle count beyond GEARMAND_JOB_HANDLE_SIZE: %s:%u",
+                              Server->job_handle_prefix, Server->job_handle_count);
+  }
+  Server->job_handle_count++;
+
+  gearmand_error_t ret= gearman_server_io_packet_add(server_con, false, GEARMAN_MAGIC_RESPONSE,
+                                                     GEARMAN_COMMAND_JOB_CREATED,
+                                                     job_handle, (size_t)job_handle_length,
+                                                     NULL);
+  if (gearmand_failed(ret))
+  {
+    return gearmand_gerror("gearman_server_io_packet_add", ret);
+  }
+
+  uint8_t *data= NULL;
+  if (result->data_size > 0)
+  {
+    data= (uint8_t *)realloc(NULL, result->data_size);
+    if (data == NULL)
+    {
+      return gearmand_perror(errno, "realloc");
+    }
+
+    memcpy(data, result->data, result->data_size);
+  }
+
+  ret= gearman_server_io_packet_add(server_con, true, GEARMAN_MAGIC_RESPONSE,
+                                    GEARMAN_COMMAND_WORK_COMPLETE,
+                                    job_handle, (size_t)job_handle_length +1,
+                                    data, result->data_size,
+                                    NULL);
+  if (gearmand_failed(ret))
+  {
+    free(data);
+    return gearmand_gerror("gearman_server_io_packet_add", ret);
+  }
+
+  gearmand_log_notice(GEARMAN_DEFAULT_LOG_PARAM,"cached,%.*s,%s",
+                      (int)result->function->function_name_size, result->function->function_name,
+                      result->unique);
+
+  return GEARMAND_SUCCESS;
+}
@@ -0,0 +1,396 @@
+/*  vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * 
+ *  Gearmand client and server library.
+ *
+ *  Copyright (C) 2011 Data Differential, http://datadifferential.com/
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *
+ *      * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following disclaimer
+ *  in the documentation and/or other materials provided with the
+ *  distribution.
+ *
+ *      * The names of its contributors may not be used to endorse or
+ *  promote products derived from this software without specific prior
+ *  written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+
+/**
+ * @file
+ * @brief Snapshot counter definitions
+ */
+
+#include "gear_config.h"
+#include "libgearman-server/common.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include <sched.h>
+
+#pragma GCC diagnostic push
+#ifndef __INTEL_COMPILER
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#endif
+
+/*
+ * Private definitions
+ */
+
+template <class T>
+struct _stats_slot_st
+{
+  uint32_t seq; // Odd while the owner is writing.
+  bool active;
+  T value;
+};
+
+template <class T>
+struct _stats_table_st
+{
+  pthread_mutex_t lock;
+  uint32_t count;
+  uint32_t generation;
+  std::vector<uint32_t> free_slots;
+  _stats_slot_st<T> *chunks[GEARMAND_STATS_MAX_CHUNKS];
+
+  _stats_table_st() :
+    count(0),
+    generation(0)
+  {
+    pthread_mutex_init(&lock, NULL);
+    memset(chunks, 0, sizeof(chunks));
+  }
+
+  ~_stats_table_st()
+  {
+    for (uint32_t x= 0; x < GEARMAND_STATS_MAX_CHUNKS; x++)
+    {
+      delete [] chunks[x];
+    }
+    pthread_mutex_destroy(&lock);
+  }
+};
+
+struct gearman_server_stats_st
+{
+  _stats_table_st<gearman_server_function_snapshot_st> functions;
+  _stats_table_st<gearman_server_con_snapshot_st> cons;
+  _stats_table_st<gearman_server_worker_snapshot_st> workers;
+};
+
+template <class T>
+static inline _stats_slot_st<T> *_stats_slot(_stats_table_st<T>& table, uint32_t slot)
+{
+  _stats_slot_st<T> *chunk= __atomic_load_n(&table.chunks[slot / GEARMAND_STATS_CHUNK_SIZE], __ATOMIC_ACQUIRE);
+  return &chunk[slot % GEARMAND_STATS_CHUNK_SIZE];
+}
+
+static inline void _stats_write_begin(uint32_t *seq)
+{
+  __atomic_store_n(seq, __atomic_load_n(seq, __ATOMIC_RELAXED) +1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void _stats_write_end(uint32_t *seq)
+{
+  __atomic_store_n(seq, __atomic_load_n(seq, __ATOMIC_RELAXED) +1, __ATOMIC_RELEASE);
+}
+
+/* Hands out a slot and publishes value in it, value.generation is filled in. */
+template <class T>
+static uint32_t _stats_add(_stats_table_st<T>& table, T& value)
+{
+  if (pthread_mutex_lock(&table.lock))
+  {
+    return GEARMAND_STATS_NONE;
+  }
+
+  uint32_t slot= GEARMAND_STATS_NONE;
+  bool grown= false;
+  if (table.free_slots.empty() == false)
+  {
+    slot= table.free_slots.back();
+    table.free_slots.pop_back();
+  }
+  else if (table.count < GEARMAND_STATS_MAX_CHUNKS * GEARMAND_STATS_CHUNK_SIZE)
+  {
+    uint32_t chunk= table.count / GEARMAND_STATS_CHUNK_SIZE;
+    if (table.chunks[chunk] == NULL)
+    {
+      _stats_slot_st<T> *slots= new (std::nothrow) _stats_slot_st<T>[GEARMAND_STATS_CHUNK_SIZE]();
+      if (slots)
+      {
+        __atomic_store_n(&table.chunks[chunk], slots, __ATOMIC_RELEASE);
+      }
+    }
+
+    if (table.chunks[chunk])
+    {
+      slot= table.count;
+      grown= true;
+    }
+  }
+
+  if (slot != GEARMAND_STATS_NONE)
+  {
+    value.generation= ++table.generation;
+
+    _stats_slot_st<T> *entry= _stats_slot(table, slot);
+    _stats_write_begin(&entry->seq);
+    entry->value= value;
+    entry->active= true;
+    _stats_write_end(&entry->seq);
+
+    if (grown)
+    {
+      __atomic_store_n(&table.count, slot +1, __ATOMIC_RELEASE);
+    }
+  }
+
+  (void)pthread_mutex_unlock(&table.lock);
+
+  return slot;
+}
+
+template <class T>
+static void _stats_remove(_stats_table_st<T>& table, uint32_t slot)
+{
+  if (slot == GEARMAND_STATS_NONE)
+  {
+    return;
+  }
+
+  _stats_slot_st<T> *entry= _stats_slot(table, slot);
+  _stats_write_begin(&entry->seq);
+  entry->active= false;
+  _stats_write_end(&entry->seq);
+
+  if (pthread_mutex_lock(&table.lock) == 0)
+  {
+    table.free_slots.push_back(slot);
+    (void)pthread_mutex_unlock(&table.lock);
+  }
+}
+
+/*
+  A writer holds the sequence odd only for a few stores, but it can be
+  preempted there. Past GEARMAND_STATS_READ_SPINS tries the reader yields
+  so the writer gets to finish, and after GEARMAND_STATS_READ_YIELDS yields
+  it gives up and the slot is left out of this report.
+*/
+template <class T>
+static bool _stats_read(_stats_table_st<T>& table, uint32_t slot, T *snapshot)
+{
+  if (slot >= __atomic_load_n(&table.count, __ATOMIC_ACQUIRE))
+  {
+    return false;
+  }
+
+  _stats_slot_st<T> *entry= _stats_slot(table, slot);
+  for (uint32_t tries= 0; tries < GEARMAND_STATS_READ_SPINS + GEARMAND_STATS_READ_YIELDS; tries++)
+  {
+    if (tries >= GEARMAND_STATS_READ_SPINS)
+    {
+      sched_yield();
+    }
+
+    uint32_t seq= __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1)
+    {
+      continue;
+    }
+
+    bool active= entry->active;
+    memcpy(snapshot, &entry->value, sizeof(T));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    if (__atomic_load_n(&entry->seq, __ATOMIC_RELAXED) == seq)
+    {
+      return active;
+    }
+  }
+
+  return false;
+}
+
+/*
+ * Public definitions
+ */
+
+gearman_server_stats_st *gearman_server_stats_create(void)
+{
+  return new (std::nothrow) gearman_server_stats_st;
+}
+
+void gearman_server_stats_free(gearman_server_stats_st *stats)
+{
+  delete stats;
+}
+
+uint32_t gearman_server_stats_function_add(gearman_server_stats_st *stats,
+                                           const char *function_name,
+                                           size_t function_name_size)
+{
+  gearman_server_function_snapshot_st value;
+  value.job_total= 0;
+  value.job_running= 0;
+  value.worker_count= 0;
+  memset(value.job_queued, 0, sizeof(value.job_queued));
+  value.job_submitted= 0;
+  value.job_completed= 0;
+  value.job_failed= 0;
+  value.job_retried= 0;
+  value.function_name_size= std::min(function_name_size, size_t(GEARMAN_FUNCTION_MAX_SIZE));
+  memcpy(value.function_name, function_name, value.function_name_size);
+
+  return _stats_add(stats->functions, value);
+}
+
+void gearman_server_stats_function_update(gearman_server_stats_st *stats,
+                                          const gearman_server_function_st *function)
+{
+  if (function->stats_slot == GEARMAND_STATS_NONE)
+  {
+    return;
+  }
+
+  _stats_slot_st<gearman_server_function_snapshot_st> *entry= _stats_slot(stats->functions, function->stats_slot);
+  _stats_write_begin(&entry->seq);
+  __atomic_store_n(&entry->value.job_total, function->job_total, __ATOMIC_RELAXED);
+  __atomic_store_n(&entry->value.job_running, function->job_running, __ATOMIC_RELAXED);
+  __atomic_store_n(&entry->value.worker_count, function->worker_count, __ATOMIC_RELAXED);
+  for (uint32_t x= 0; x < GEARMAN_JOB_PRIORITY_MAX; x++)
+  {
+    __atomic_store_n(&entry->value.job_queued[x], function->job_queued[x], __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&entry->value.job_submitted, function->job_submitted, __ATOMIC_RELAXED);
+  __atomic_store_n(&entry->value.job_completed, function->job_completed, __ATOMIC_RELAXED);
+  __atomic_store_n(&entry->value.job_failed, function->job_failed, __ATOMIC_RELAXED);
+  __atomic_store_n(&entry->value.job_retried, function->job_retried, __ATOMIC_RELAXED);
+  _stats_write_end(&entry->seq);
+}
+
+void gearman_server_stats_function_remove(gearman_server_stats_st *stats,
+                                          uint32_t slot)
+{
+  _stats_remove(stats->functions, slot);
+}
+
+uint32_t gearman_server_stats_con_add(gearman_server_stats_st *stats,
+                                      int fd, const char *host)
+{
+  gearman_server_con_snapshot_st value;
+  value.fd= fd;
+  snprintf(value.host, sizeof(value.host), "%s", host ? host : "");
+  strcpy(value.id, "-");
+
+  return _stats_add(stats->cons, value);
+}
+
+void gearman_server_stats_con_set_id(gearman_server_stats_st *stats,
+                                     uint32_t slot, const char *id)
+{
+  if (slot == GEARMAND_STATS_NONE)
+  {
+    return;
+  }
+
+  _stats_slot_st<gearman_server_con_snapshot_st> *entry= _stats_slot(stats->cons, slot);
+  _stats_write_begin(&entry->seq);
+  snprintf(entry->value.id, sizeof(entry->value.id), "%s", id);
+  _stats_write_end(&entry->seq);
+}
+
+void gearman_server_stats_con_remove(gearman_server_stats_st *stats,
+                                     uint32_t slot)
+{
+  _stats_remove(stats->cons, slot);
+}
+
+uint32_t gearman_server_stats_worker_add(gearman_server_stats_st *stats,
+                                         uint32_t con_slot,
+                                         uint32_t function_slot)
+{
+  if (con_slot == GEARMAND_STATS_NONE or function_slot == GEARMAND_STATS_NONE)
+  {
+    return GEARMAND_STATS_NONE;
+  }
+
+  gearman_server_worker_snapshot_st value;
+  value.con= con_slot;
+  value.con_generation= _stats_slot(stats->cons, con_slot)->value.generation;
+  value.function= function_slot;
+  value.function_generation= _stats_slot(stats->functions, function_slot)->value.generation;
+
+  return _stats_add(stats->workers, value);
+}
+
+void gearman_server_stats_worker_remove(gearman_server_stats_st *stats,
+                                        uint32_t slot)
+{
+  _stats_remove(stats->workers, slot);
+}
+
+uint32_t gearman_server_stats_function_count(gearman_server_stats_st *stats)
+{
+  return __atomic_load_n(&stats->functions.count, __ATOMIC_ACQUIRE);
+}
+
+uint32_t gearman_server_stats_con_count(gearman_server_stats_st *stats)
+{
+  return __atomic_load_n(&stats->cons.count, __ATOMIC_ACQUIRE);
+}
+
+uint32_t gearman_server_stats_worker_count(gearman_server_stats_st *stats)
+{
+  return __atomic_load_n(&stats->workers.count, __ATOMIC_ACQUIRE);
+}
+
+bool gearman_server_stats_function_read(gearman_server_stats_st *stats,
+                                        uint32_t slot,
+                                        gearman_server_function_snapshot_st *snapshot)
+{
+  return _stats_read(stats->functions, slot, snapshot);
+}
+
+bool gearman_server_stats_con_read(gearman_server_stats_st *stats,
+                                   uint32_t slot,
+                                   gearman_server_con_snapshot_st *snapshot)
+{
+  return _stats_read(stats->cons, slot, snapshot);
+}
+
+bool gearman_server_stats_worker_read(gearman_server_stats_st *stats,
+                                      uint32_t slot,
+                                      gearman_server_worker_snapshot_st *snapshot)
+{
+  return _stats_read(stats->workers, slot, snapshot);
+}
+
+#pragma GCC diagnostic pop
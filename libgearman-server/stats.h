@@ -0,0 +1,155 @@
+/*  vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * 
+ *  Gearmand client and server library.
+ *
+ *  Copyright (C) 2011 Data Differential, http://datadifferential.com/
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *
+ *      * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following disclaimer
+ *  in the documentation and/or other materials provided with the
+ *  distribution.
+ *
+ *      * The names of its contributors may not be used to endorse or
+ *  promote products derived from this software without specific prior
+ *  written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+
+/**
+ * @file
+ * @brief Snapshot counter declarations
+ */
+
+#pragma once
+
+#include <libgearman-server/struct/stats.h>
+
+struct gearman_server_function_st;
+struct gearman_server_stats_st;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @addtogroup gearman_server_stats Snapshot Counter Declarations
+ * @ingroup gearman_server
+ *
+ * Functions, connections and workers each own a slot in a sequence locked
+ * table. Only the thread that owns the object writes its slot, using
+ * relaxed stores between two bumps of the slot's sequence number. Readers
+ * copy a slot and retry if the sequence number was odd or changed, so the
+ * "status" and "workers" text commands never take a lock used by the
+ * threads moving jobs. Slots live in chunks that are only released with
+ * the server, so a reader can never touch freed memory.
+ *
+ * Adding and removing a slot takes a lock, updating one does not. If a
+ * table is full, GEARMAND_STATS_NONE is handed out and the object is left
+ * out of the snapshot.
+ *
+ * @{
+ */
+
+GEARMAN_API
+gearman_server_stats_st *gearman_server_stats_create(void);
+
+GEARMAN_API
+void gearman_server_stats_free(gearman_server_stats_st *stats);
+
+/**
+ * Publish a new function, its counters all start at 0.
+ */
+GEARMAN_API
+uint32_t gearman_server_stats_function_add(gearman_server_stats_st *stats,
+                                           const char *function_name,
+                                           size_t function_name_size);
+
+/**
+ * Publish the current counters of a function.
+ */
+GEARMAN_API
+void gearman_server_stats_function_update(gearman_server_stats_st *stats,
+                                          const gearman_server_function_st *function);
+
+GEARMAN_API
+void gearman_server_stats_function_remove(gearman_server_stats_st *stats,
+                                          uint32_t slot);
+
+GEARMAN_API
+uint32_t gearman_server_stats_con_add(gearman_server_stats_st *stats,
+                                      int fd, const char *host);
+
+GEARMAN_API
+void gearman_server_stats_con_set_id(gearman_server_stats_st *stats,
+                                     uint32_t slot, const char *id);
+
+GEARMAN_API
+void gearman_server_stats_con_remove(gearman_server_stats_st *stats,
+                                     uint32_t slot);
+
+GEARMAN_API
+uint32_t gearman_server_stats_worker_add(gearman_server_stats_st *stats,
+                                         uint32_t con_slot,
+                                         uint32_t function_slot);
+
+GEARMAN_API
+void gearman_server_stats_worker_remove(gearman_server_stats_st *stats,
+                                        uint32_t slot);
+
+/**
+ * Number of slots ever handed out, readers walk 0 to count -1.
+ */
+GEARMAN_API
+uint32_t gearman_server_stats_function_count(gearman_server_stats_st *stats);
+
+GEARMAN_API
+uint32_t gearman_server_stats_con_count(gearman_server_stats_st *stats);
+
+GEARMAN_API
+uint32_t gearman_server_stats_worker_count(gearman_server_stats_st *stats);
+
+/**
+ * Copy a slot, returns false if the slot is not in use.
+ */
+GEARMAN_API
+bool gearman_server_stats_function_read(gearman_server_stats_st *stats,
+                                        uint32_t slot,
+                                        gearman_server_function_snapshot_st *snapshot);
+
+GEARMAN_API
+bool gearman_server_stats_con_read(gearman_server_stats_st *stats,
+                                   uint32_t slot,
+                                   gearman_server_con_snapshot_st *snapshot);
+
+GEARMAN_API
+bool gearman_server_stats_worker_read(gearman_server_stats_st *stats,
+                                      uint32_t slot,
+                                      gearman_server_worker_snapshot_st *snapshot);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
@@ -45,6 +45,9 @@ struct gearman_server_client_st
   gearman_server_job_st *job;
   gearman_server_client_st *job_next;
   gearman_server_client_st *job_prev;
+  bool status_pending; // A coalesced WORK_STATUS is waiting to be sent.
+  gearman_server_client_st *status_next;
+  gearman_server_client_st *status_prev;
 
   gearman_server_client_st():
     con(NULL),
@@ -52,7 +55,10 @@ struct gearman_server_client_st
     con_prev(NULL),
     job(NULL),
     job_next(NULL),
-    job_prev(NULL)
+    job_prev(NULL),
+    status_pending(false),
+    status_next(NULL),
+    status_prev(NULL)
   {
   }
 
@@ -64,5 +70,8 @@ struct gearman_server_client_st
     job= NULL;
     job_next= NULL;
     job_prev= NULL;
+    status_pending= false;
+    status_next= NULL;
+    status_prev= NULL;
   }
 };
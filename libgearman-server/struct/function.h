@@ -37,13 +37,24 @@
 
 #pragma once
 
+#include "libgearman-server/struct/latency.h"
+
 struct gearman_server_function_st
 {
   uint32_t worker_count;
   uint32_t job_count;
   uint32_t job_total;
   uint32_t job_running;
+  uint32_t job_queued[GEARMAN_JOB_PRIORITY_MAX]; // Queue depth by priority, ignored jobs included.
+  uint64_t job_submitted;
+  uint64_t job_completed;
+  uint64_t job_failed; // WORK_FAIL, WORK_EXCEPTION and jobs dropped after too many retries.
+  uint64_t job_retried;
+  gearman_server_latency_st queue_latency; // Queued until taken by a worker.
+  gearman_server_latency_st run_latency; // Taken until WORK_COMPLETE, WORK_FAIL or WORK_EXCEPTION.
   uint32_t max_queue_size[GEARMAN_JOB_PRIORITY_MAX];
+  uint32_t result_cache_ttl; // Seconds to keep results, 0 disables the result cache.
+  uint32_t stats_slot;
   size_t function_name_size;
   gearman_server_function_st *next;
   gearman_server_function_st *prev;
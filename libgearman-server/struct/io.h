@@ -141,6 +141,7 @@ struct gearman_server_con_st
   gearmand_io_st con;
   bool is_sleeping;
   bool is_exceptions;
+  bool is_assign_on_complete;
   bool is_dead;
   bool is_noop_sent;
   bool is_cleaned_up;
@@ -153,6 +154,10 @@ struct gearman_server_con_st
   uint32_t proc_packet_count;
   uint32_t worker_count;
   uint32_t client_count;
+  uint32_t stats_slot;
+  uint32_t proc_pending; // Packets handed to the proc thread that have not been run yet.
+  uint32_t batch_held; // Responses held for --queue-batch, see Batch::hold().
+  uint64_t status_time; // When the last WORK_STATUS was sent, in milliseconds.
   gearman_server_thread_st *thread;
   gearman_server_con_st *next;
   gearman_server_con_st *prev;
@@ -173,7 +178,6 @@ struct gearman_server_con_st
   const char *_port; // client port
   char id[GEARMAND_SERVER_CON_ID_SIZE];
   gearmand::protocol::Context* protocol;
-  struct event *timeout_event;
   SSL* _ssl;
 
   gearman_server_con_st()
@@ -42,9 +42,14 @@ struct gearman_server_client_st;
 struct gearman_server_job_st
 {
   uint8_t retries;
+  uint8_t load_failures; // Times the --queue-lazy-data data could not be read.
   gearman_job_priority_t priority;
   bool ignore_job;
   bool job_queued;
+  bool timeout_armed;
+  bool data_lazy; // The data was left in the persistent queue, see --queue-lazy-data.
+  bool data_prefetch; // The data has been asked of the prefetch thread.
+  bool data_waiting; // Taken before its data was read, see Prefetch::load().
   uint32_t job_handle_key;
   uint32_t unique_key;
   uint32_t client_count;
@@ -52,12 +57,18 @@ struct gearman_server_job_st
   uint32_t denominator;
   size_t data_size;
   int64_t when;
+  uint64_t timeout_tick;
+  uint64_t queued_usec; // Monotonic time the job last entered the queue.
+  uint64_t taken_usec; // Monotonic time a worker last took the job.
+  uint64_t queue_slot; // The --queue-batch batch that stores the job.
   gearman_server_job_st *next;
   gearman_server_job_st *prev;
   gearman_server_job_st *unique_next;
   gearman_server_job_st *unique_prev;
   gearman_server_job_st *worker_next;
   gearman_server_job_st *worker_prev;
+  gearman_server_job_st *timeout_next;
+  gearman_server_job_st *timeout_prev;
   gearman_server_function_st *function;
   gearman_server_job_st *function_next;
   const void *data;
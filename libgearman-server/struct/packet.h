@@ -48,10 +48,12 @@ struct gearmand_packet_st
   struct Options {
     bool complete;
     bool free_data;
+    bool args_view;
 
     Options() :
       complete(false),
-      free_data(false)
+      free_data(false),
+      args_view(false)
     { }
   } options;
   enum gearman_magic_t magic;
@@ -43,13 +43,15 @@ struct queue_st {
   gearman_queue_flush_fn *_flush_fn;
   gearman_queue_done_fn *_done_fn;
   gearman_queue_replay_fn *_replay_fn;
+  gearman_queue_rollback_fn *_rollback_fn;
 
   queue_st() :
     _context(NULL),
     _add_fn(NULL),
     _flush_fn(NULL),
     _done_fn(NULL),
-    _replay_fn(NULL)
+    _replay_fn(NULL),
+    _rollback_fn(NULL)
   {
   }
 };
@@ -60,7 +62,7 @@ enum queue_version_t {
   QUEUE_VERSION_CLASS
 };
 
-namespace gearmand { namespace queue { class Context; } }
+namespace gearmand { namespace queue { class Context; class Batch; class Replay; class Prefetch; } }
 
 struct Queue_st {
   struct queue_st* functions;
@@ -104,6 +106,9 @@ struct gearman_server_st
   gearman_server_worker_st *free_worker_list;
   enum queue_version_t queue_version;
   struct Queue_st queue;
+  gearmand::queue::Batch *queue_batch; // NULL unless --queue-batch.
+  gearmand::queue::Replay *queue_replay; // Loads the queue at startup.
+  gearmand::queue::Prefetch *queue_prefetch; // NULL unless --queue-lazy-data.
   pthread_mutex_t proc_lock;
   pthread_cond_t proc_cond;
   pthread_t proc_id;
@@ -111,6 +116,22 @@ struct gearman_server_st
   uint32_t hashtable_buckets;
   gearman_server_job_st **job_hash;
   gearman_server_job_st **unique_hash;
+  uint32_t result_count;
+  size_t result_cache_size; // Bytes held by cached results.
+  size_t result_cache_max_size;
+  gearman_server_result_st **result_hash;
+  gearman_server_result_st *result_lru_list; // Most recently used first.
+  gearman_server_result_st *result_lru_end;
+  uint32_t status_interval; // Milliseconds between WORK_STATUS packets per client connection.
+  uint32_t status_pending_count;
+  gearman_server_client_st *status_pending_list;
+  struct event *status_event; // Flushes held statuses when not threaded.
+  uint32_t timeout_count; // Jobs with a running worker timeout.
+  uint64_t timeout_tick; // Last tick the timeout wheel was expired up to.
+  gearman_server_job_st **timeout_wheel;
+  struct event *timeout_event; // Drives the wheel when not threaded.
+  uint32_t worker_timeout_min; // Seconds, the least CAN_DO_TIMEOUT is raised to.
+  gearman_server_stats_st *stats;
 
   gearman_server_st()
   {
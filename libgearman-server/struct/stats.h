@@ -0,0 +1,78 @@
+/*  vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * 
+ *  Gearmand client and server library.
+ *
+ *  Copyright (C) 2011 Data Differential, http://datadifferential.com/
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *
+ *      * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following disclaimer
+ *  in the documentation and/or other materials provided with the
+ *  distribution.
+ *
+ *      * The names of its contributors may not be used to endorse or
+ *  promote products derived from this software without specific prior
+ *  written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#pragma once
+
+/*
+  Copies of the counters behind the "status" and "workers" text commands.
+  Each function, connection and worker publishes its copy into a slot of
+  gearman_server_stats_st, which readers on any thread can take without
+  locking. Slots are reused, generation tells one user of a slot from the
+  next.
+*/
+struct gearman_server_function_snapshot_st
+{
+  uint32_t generation;
+  uint32_t job_total;
+  uint32_t job_running;
+  uint32_t worker_count;
+  uint32_t job_queued[GEARMAN_JOB_PRIORITY_MAX];
+  uint64_t job_submitted;
+  uint64_t job_completed;
+  uint64_t job_failed;
+  uint64_t job_retried;
+  size_t function_name_size;
+  char function_name[GEARMAN_FUNCTION_MAX_SIZE];
+};
+
+struct gearman_server_con_snapshot_st
+{
+  uint32_t generation;
+  int fd;
+  char host[NI_MAXHOST];
+  char id[GEARMAND_SERVER_CON_ID_SIZE];
+};
+
+struct gearman_server_worker_snapshot_st
+{
+  uint32_t generation;
+  uint32_t con; // Slot of the connection.
+  uint32_t con_generation;
+  uint32_t function; // Slot of the function.
+  uint32_t function_generation;
+};
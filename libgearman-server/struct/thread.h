@@ -47,6 +47,8 @@ struct gearman_server_thread_st
   uint32_t to_be_freed_count;
   uint32_t free_con_count;
   uint32_t free_packet_count;
+  uint64_t bytes_in; // Only the thread itself writes these.
+  uint64_t bytes_out;
   gearmand_connection_list_st *gearman;
   gearman_server_thread_st *next;
   gearman_server_thread_st *prev;
@@ -42,6 +42,7 @@ struct gearman_server_function_st;
 struct gearman_server_worker_st
 {
   uint32_t job_count;
+  uint32_t stats_slot;
   long timeout; // struct timeval.tv_sec
   gearman_server_con_st *con;
   gearman_server_worker_st *con_next;
@@ -39,12 +39,26 @@
 
 #include "libgearman-server/common.h"
 #include "libgearman-server/log.h"
-#include "libgearman/command.h"
 #include "libgearman/vector.hpp"
+#include "libgearman-server/replay.hpp"
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-register"
+#pragma clang diagnostic ignored "-Wshorten-64-to-32"
+#endif
+#include "libgearman-server/text.hpp"
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
 
+#include <algorithm>
 #include <cassert>
+#include <cctype>
 #include <cerrno>
+#include <cstdlib>
 #include <cstring>
+#include <string>
+#include <vector>
 
 #define TEXT_SUCCESS "OK\r\n"
 #define TEXT_ERROR_ARGS "ERR INVALID_ARGUMENTS An+incomplete+set+of+arguments+was+sent+to+this+command+%.*s\r\n"
@@ -53,107 +67,303 @@
 #define TEXT_ERROR_INTERNAL_ERROR "ERR UNKNOWN_ERROR\r\n"
 #define TEXT_ERROR_UNKNOWN_SHOW_ARGUMENTS "ERR UNKNOWN_SHOW_ARGUMENTS\r\n"
 #define TEXT_ERROR_UNKNOWN_JOB "ERR UNKNOWN_JOB\r\n"
+#define TEXT_ERROR_INVALID_TTL "ERR INVALID_TTL The+ttl+must+be+a+number+of+seconds+from+0+to+%u\r\n"
 
-gearmand_error_t server_run_text(gearman_server_con_st *server_con,
-                                 gearmand_packet_st *packet)
+static bool _worker_snapshot_by_con(const gearman_server_worker_snapshot_st& a,
+                                    const gearman_server_worker_snapshot_st& b)
 {
-  gearman_vector_st data(GEARMAND_TEXT_RESPONSE_SIZE);
+  return a.con < b.con;
+}
 
+/* arg_size[0] may count the separator, so measure the name itself. */
+static gearmand_text_command_t _text_command(const gearmand_packet_st *packet)
+{
   if (packet->argc)
   {
-    gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "text command %.*s %d arguments",
-                       packet->arg_size[0],  packet->arg[0],
-                       int(packet->argc));
+    const char *name= (const char *)(packet->arg[0]);
+    const struct gearmand_text_command_string_st *command=
+      String2gearmand_text_command_t::in_word_set(name, strlen(name));
+
+    if (command)
+    {
+      return command->code;
+    }
   }
 
-#if 0
-  const struct gearman_command_info_st *command= NULL;
-#endif
+  return GEARMAND_TEXT_COMMAND_UNKNOWN;
+}
+
+bool server_text_is_snapshot(const gearmand_packet_st *packet)
+{
+  const gearmand_text_command_t command= _text_command(packet);
+
+  return command == GEARMAND_TEXT_COMMAND_STATUS
+    or command == GEARMAND_TEXT_COMMAND_WORKERS
+    or command == GEARMAND_TEXT_COMMAND_METRICS
+    or command == GEARMAND_TEXT_COMMAND_REPLAY;
+}
+
+struct _metrics_function_st
+{
+  size_t label_offset;
+  size_t label_size;
+  uint32_t job_total;
+  uint32_t job_running;
+  uint32_t worker_count;
+  uint32_t job_queued[GEARMAN_JOB_PRIORITY_MAX];
+  uint64_t job_submitted;
+  uint64_t job_completed;
+  uint64_t job_failed;
+  uint64_t job_retried;
+};
+
+/* Function names are escaped once per scrape, then reused by every family. */
+static void _metrics_label(std::string& labels, const char *name, size_t size)
+{
+  for (size_t x= 0; x < size; x++)
+  {
+    switch (name[x])
+    {
+    case '\\':
+      labels.append("\\\\");
+      break;
+
+    case '"':
+      labels.append("\\\"");
+      break;
+
+    case '\n':
+      labels.append("\\n");
+      break;
+
+    default:
+      labels.push_back(name[x]);
+    }
+  }
+}
+
+#define METRICS_FUNCTION_FAMILY(__name, __type, __help, __field) \
+  data.vec_append_printf("# HELP " __name " " __help "\n# TYPE " __name " " __type "\n"); \
+  for (std::vector<_metrics_function_st>::const_iterator iter= functions.begin(); iter != functions.end(); ++iter) \
+  { \
+    data.vec_append_printf(__name "{function=\"%.*s\"} %" PRIu64 "\n", \
+                           int(iter->label_size), labels.c_str() + iter->label_offset, \
+                           uint64_t(iter->__field)); \
+  }
+
+/*
+  Prometheus text exposition of the stats snapshot and the per thread I/O
+  counters. Nothing here takes a lock used by the threads moving jobs.
+*/
+static void _text_metrics(gearman_vector_st& data)
+{
+  static size_t last_size= 0;
+  (void)data.reserve(__atomic_load_n(&last_size, __ATOMIC_RELAXED));
+
+  uint32_t function_count= gearman_server_stats_function_count(Server->stats);
+  std::vector<_metrics_function_st> functions;
+  std::string labels;
+  functions.reserve(function_count);
+
+  gearman_server_function_snapshot_st function;
+  for (uint32_t x= 0; x < function_count; x++)
+  {
+    if (gearman_server_stats_function_read(Server->stats, x, &function))
+    {
+      _metrics_function_st entry;
+      entry.label_offset= labels.size();
+      _metrics_label(labels, function.function_name, function.function_name_size);
+      entry.label_size= labels.size() - entry.label_offset;
+      entry.job_total= function.job_total;
+      entry.job_running= function.job_running;
+      entry.worker_count= function.worker_count;
+      memcpy(entry.job_queued, function.job_queued, sizeof(entry.job_queued));
+      entry.job_submitted= function.job_submitted;
+      entry.job_completed= function.job_completed;
+      entry.job_failed= function.job_failed;
+      entry.job_retried= function.job_retried;
+      functions.push_back(entry);
+    }
+  }
+
+  METRICS_FUNCTION_FAMILY("gearmand_jobs_submitted_total", "counter", "Jobs created.", job_submitted);
+  METRICS_FUNCTION_FAMILY("gearmand_jobs_completed_total", "counter", "Jobs finished with WORK_COMPLETE.", job_completed);
+  METRICS_FUNCTION_FAMILY("gearmand_jobs_failed_total", "counter", "Jobs finished with WORK_FAIL or WORK_EXCEPTION, or dropped after too many retries.", job_failed);
+  METRICS_FUNCTION_FAMILY("gearmand_jobs_retried_total", "counter", "Jobs requeued after being assigned to a worker.", job_retried);
+  METRICS_FUNCTION_FAMILY("gearmand_jobs", "gauge", "Jobs known to the server.", job_total);
+  METRICS_FUNCTION_FAMILY("gearmand_jobs_running", "gauge", "Jobs assigned to a worker.", job_running);
+  METRICS_FUNCTION_FAMILY("gearmand_workers", "gauge", "Workers registered for the function.", worker_count);
+
+  data.vec_append_printf("# HELP gearmand_jobs_queued Jobs waiting for a worker.\n# TYPE gearmand_jobs_queued gauge\n");
+  const char *priorities[GEARMAN_JOB_PRIORITY_MAX]= { "high", "normal", "low" };
+  for (std::vector<_metrics_function_st>::const_iterator iter= functions.begin(); iter != functions.end(); ++iter)
+  {
+    for (uint32_t priority= 0; priority < GEARMAN_JOB_PRIORITY_MAX; priority++)
+    {
+      data.vec_append_printf("gearmand_jobs_queued{function=\"%.*s\",priority=\"%s\"} %u\n",
+                             int(iter->label_size), labels.c_str() + iter->label_offset,
+                             priorities[priority], iter->job_queued[priority]);
+    }
+  }
+
+  data.vec_append_printf("# HELP gearmand_connections Open connections.\n# TYPE gearmand_connections gauge\n");
+  uint32_t thread_number= 0;
+  for (gearman_server_thread_st *thread= Server->thread_list; thread; thread= thread->next, thread_number++)
+  {
+    data.vec_append_printf("gearmand_connections{thread=\"%u\"} %u\n",
+                           thread_number, __atomic_load_n(&thread->con_count, __ATOMIC_RELAXED));
+  }
+
+  data.vec_append_printf("# HELP gearmand_proc_queue_length Connections waiting for the processing thread.\n# TYPE gearmand_proc_queue_length gauge\n");
+  thread_number= 0;
+  for (gearman_server_thread_st *thread= Server->thread_list; thread; thread= thread->next, thread_number++)
+  {
+    data.vec_append_printf("gearmand_proc_queue_length{thread=\"%u\"} %u\n",
+                           thread_number, __atomic_load_n(&thread->proc_count, __ATOMIC_RELAXED));
+  }
+
+  data.vec_append_printf("# HELP gearmand_received_bytes_total Bytes read from clients and workers.\n# TYPE gearmand_received_bytes_total counter\n");
+  thread_number= 0;
+  for (gearman_server_thread_st *thread= Server->thread_list; thread; thread= thread->next, thread_number++)
+  {
+    data.vec_append_printf("gearmand_received_bytes_total{thread=\"%u\"} %" PRIu64 "\n",
+                           thread_number, __atomic_load_n(&thread->bytes_in, __ATOMIC_RELAXED));
+  }
+
+  data.vec_append_printf("# HELP gearmand_sent_bytes_total Bytes written to clients and workers.\n# TYPE gearmand_sent_bytes_total counter\n");
+  thread_number= 0;
+  for (gearman_server_thread_st *thread= Server->thread_list; thread; thread= thread->next, thread_number++)
+  {
+    data.vec_append_printf("gearmand_sent_bytes_total{thread=\"%u\"} %" PRIu64 "\n",
+                           thread_number, __atomic_load_n(&thread->bytes_out, __ATOMIC_RELAXED));
+  }
+
+  /* The next scrape starts out with room for this much. */
+  __atomic_store_n(&last_size, data.size(), __ATOMIC_RELAXED);
+}
+
+static void _text_unknown_command(gearman_vector_st& data, const gearmand_packet_st *packet)
+{
   if (packet->argc == 0)
   {
     data.vec_printf(TEXT_ERROR_UNKNOWN_COMMAND, 4, "NULL");
+    return;
   }
-#if 0
-  else if ((command= gearman_command_lookup((char *)(packet->arg[0]), packet->arg_size[0])))
+
+  gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "Failed to find command %.*s(%" PRIu64 ")",
+                     packet->arg_size[0], packet->arg[0],
+                     packet->arg_size[0]);
+  data.vec_printf(TEXT_ERROR_UNKNOWN_COMMAND, (int)packet->arg_size[0], (char *)(packet->arg[0]));
+}
+
+static gearmand_error_t _server_run_text(gearman_server_con_st *server_con,
+                                         gearmand_packet_st *packet,
+                                         bool from_thread)
+{
+  gearman_vector_st data(GEARMAND_TEXT_RESPONSE_SIZE);
+
+  if (packet->argc)
   {
+    gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "text command %.*s %d arguments",
+                       packet->arg_size[0],  packet->arg[0],
+                       int(packet->argc));
   }
-#endif
-  else if (strcasecmp("workers", (char *)(packet->arg[0])) == 0)
+
+  switch (_text_command(packet))
   {
-    for (gearman_server_thread_st *thread= Server->thread_list;
-         thread != NULL;
-         thread= thread->next)
+  case GEARMAND_TEXT_COMMAND_WORKERS:
     {
-      int error;
-      if ((error= pthread_mutex_lock(&thread->lock)) == 0)
+      /* Group the workers by connection slot, then list them per connection. */
+      std::vector<gearman_server_worker_snapshot_st> workers;
+      uint32_t worker_count= gearman_server_stats_worker_count(Server->stats);
+      for (uint32_t x= 0; x < worker_count; x++)
       {
-        for (gearman_server_con_st *con= thread->con_list; con != NULL; con= con->next)
+        gearman_server_worker_snapshot_st worker;
+        if (gearman_server_stats_worker_read(Server->stats, x, &worker))
         {
-          if (con->_host == NULL)
-          {
-            continue;
-          }
+          workers.push_back(worker);
+        }
+      }
+      std::stable_sort(workers.begin(), workers.end(), _worker_snapshot_by_con);
+
+      std::vector<gearman_server_worker_snapshot_st>::const_iterator worker= workers.begin();
+      uint32_t con_count= gearman_server_stats_con_count(Server->stats);
+      for (uint32_t x= 0; x < con_count; x++)
+      {
+        gearman_server_con_snapshot_st con;
+        if (gearman_server_stats_con_read(Server->stats, x, &con) == false or con.host[0] == 0)
+        {
+          continue;
+        }
 
-          data.vec_append_printf("%d %s %s :", con->con.fd(), con->_host, con->id);
+        data.vec_append_printf("%d %s %s :", con.fd, con.host, con.id);
 
-          for (gearman_server_worker_st *worker= con->worker_list; worker != NULL; worker= worker->con_next)
+        for (; worker != workers.end() and worker->con <= x; ++worker)
+        {
+          gearman_server_function_snapshot_st function;
+          if (worker->con == x and worker->con_generation == con.generation
+              and gearman_server_stats_function_read(Server->stats, worker->function, &function)
+              and worker->function_generation == function.generation)
           {
             data.vec_append_printf(" %.*s",
-                                   (int)(worker->function->function_name_size),
-                                   worker->function->function_name);
+                                   int(function.function_name_size),
+                                   function.function_name);
           }
-
-          data.vec_append_printf("\n");
         }
 
-        if ((error= (pthread_mutex_unlock(&(thread->lock)))) != 0)
-        {
-          gearmand_log_fatal_perror(GEARMAN_DEFAULT_LOG_PARAM, error, "pthread_mutex_unlock");
-        }
-      }
-      else
-      {
-        gearmand_log_fatal_perror(GEARMAN_DEFAULT_LOG_PARAM, error, "pthread_mutex_lock");
+        data.vec_append_printf("\n");
       }
+
+      data.vec_append_printf(".\n");
     }
+    break;
 
-    data.vec_append_printf(".\n");
-  }
-  else if (strcasecmp("prioritystatus", (char *)(packet->arg[0])) == 0)
-  {
-    uint32_t job_queued[GEARMAN_JOB_PRIORITY_MAX];
+  case GEARMAND_TEXT_COMMAND_METRICS:
+    _text_metrics(data);
 
-    for (uint32_t function_key= 0;
-         function_key < GEARMAND_DEFAULT_HASH_SIZE;
-         function_key++)
+    // The HTTP metrics listener asks for the bare exposition format.
+    if (packet->argc < 2 or strcasecmp("prometheus", (char *)(packet->arg[1])) != 0)
     {
-      for (gearman_server_function_st *function= Server->function_hash[function_key];
-           function != NULL;
-           function= function->next)
+      data.vec_append_printf(".\n");
+    }
+    break;
+
+  case GEARMAND_TEXT_COMMAND_PRIORITYSTATUS:
+    {
+      uint32_t job_queued[GEARMAN_JOB_PRIORITY_MAX];
+
+      for (uint32_t function_key= 0;
+           function_key < GEARMAND_DEFAULT_HASH_SIZE;
+           function_key++)
       {
-        for (size_t priority = 0; priority < GEARMAN_JOB_PRIORITY_MAX; priority++)
+        for (gearman_server_function_st *function= Server->function_hash[function_key];
+             function != NULL;
+             function= function->next)
         {
-          job_queued[priority] = 0;
-          for (gearman_server_job_st *server_job= function->job_list[priority];
-               server_job != NULL;
-               server_job= server_job->next)
+          for (size_t priority = 0; priority < GEARMAN_JOB_PRIORITY_MAX; priority++)
           {
-            job_queued[priority]++;
+            job_queued[priority] = 0;
+            for (gearman_server_job_st *server_job= function->job_list[priority];
+                 server_job != NULL;
+                 server_job= server_job->next)
+            {
+              job_queued[priority]++;
+            }
           }
-        }
 
-        data.vec_append_printf("%.*s\t%u\t%u\t%u\t%u\n",
-                               int(function->function_name_size), function->function_name,
-                               job_queued[GEARMAN_JOB_PRIORITY_HIGH],
-                               job_queued[GEARMAN_JOB_PRIORITY_NORMAL],
-                               job_queued[GEARMAN_JOB_PRIORITY_LOW],
-                               function->worker_count);
+          data.vec_append_printf("%.*s\t%u\t%u\t%u\t%u\n",
+                                 int(function->function_name_size), function->function_name,
+                                 job_queued[GEARMAN_JOB_PRIORITY_HIGH],
+                                 job_queued[GEARMAN_JOB_PRIORITY_NORMAL],
+                                 job_queued[GEARMAN_JOB_PRIORITY_LOW],
+                                 function->worker_count);
+        }
       }
+      data.vec_append_printf(".\n");
     }
-    data.vec_append_printf(".\n");
-  }
-  else if (strcasecmp("status", (char *)(packet->arg[0])) == 0)
-  {
+    break;
+
+  case GEARMAND_TEXT_COMMAND_LATENCY:
     for (uint32_t function_key= 0;
          function_key < GEARMAND_DEFAULT_HASH_SIZE;
          function_key++)
@@ -162,19 +372,50 @@ gearmand_error_t server_run_text(gearman_server_con_st *server_con,
            function != NULL;
            function= function->next)
       {
-        data.vec_append_printf("%.*s\t%u\t%u\t%u\n",
-                               int(function->function_name_size),
-                               function->function_name, function->job_total,
-                               function->job_running, function->worker_count);
+        const gearman_server_latency_st *queue= &function->queue_latency;
+        const gearman_server_latency_st *run= &function->run_latency;
+
+        data.vec_append_printf("%.*s\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64
+                               "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\n",
+                               int(function->function_name_size), function->function_name,
+                               queue->count,
+                               gearman_server_latency_percentile(queue, 50),
+                               gearman_server_latency_percentile(queue, 99),
+                               gearman_server_latency_percentile(queue, 99.9),
+                               run->count,
+                               gearman_server_latency_percentile(run, 50),
+                               gearman_server_latency_percentile(run, 99),
+                               gearman_server_latency_percentile(run, 99.9));
       }
     }
     data.vec_append_printf(".\n");
-  }
-  else if (packet->argc >= 3 
-           and strcasecmp("cancel", (char *)(packet->arg[0])) == 0)
-  {
-    if (packet->argc == 3
-        and strcasecmp("job", (char *)(packet->arg[1])) == 0)
+    break;
+
+  case GEARMAND_TEXT_COMMAND_STATUS:
+    {
+      uint32_t function_count= gearman_server_stats_function_count(Server->stats);
+      for (uint32_t x= 0; x < function_count; x++)
+      {
+        gearman_server_function_snapshot_st function;
+        if (gearman_server_stats_function_read(Server->stats, x, &function))
+        {
+          data.vec_append_printf("%.*s\t%u\t%u\t%u\n",
+                                 int(function.function_name_size),
+                                 function.function_name, function.job_total,
+                                 function.job_running, function.worker_count);
+        }
+      }
+      data.vec_append_printf(".\n");
+    }
+    break;
+
+  case GEARMAND_TEXT_COMMAND_CANCEL:
+    if (packet->argc < 3)
+    {
+      _text_unknown_command(data, packet);
+    }
+    else if (packet->argc == 3
+             and strcasecmp("job", (char *)(packet->arg[1])) == 0)
     {
       gearmand_error_t ret= gearman_server_job_cancel(Gearmand()->server, packet->arg[2], strlen(packet->arg[2]));
 
@@ -191,12 +432,16 @@ gearmand_error_t server_run_text(gearman_server_con_st *server_con,
         data.vec_printf(TEXT_ERROR_UNKNOWN_JOB);
       }
     }
-  }
-  else if (packet->argc >= 2 and strcasecmp("show", (char *)(packet->arg[0])) == 0)
-  {
-    if (packet->argc == 3
-        and strcasecmp("unique", (char *)(packet->arg[1])) == 0
-        and strcasecmp("jobs", (char *)(packet->arg[2])) == 0)
+    break;
+
+  case GEARMAND_TEXT_COMMAND_SHOW:
+    if (packet->argc < 2)
+    {
+      _text_unknown_command(data, packet);
+    }
+    else if (packet->argc == 3
+             and strcasecmp("unique", (char *)(packet->arg[1])) == 0
+             and strcasecmp("jobs", (char *)(packet->arg[2])) == 0)
     {
       for (size_t x= 0; x < Server->hashtable_buckets; x++)
       {
@@ -230,9 +475,9 @@ gearmand_error_t server_run_text(gearman_server_con_st *server_con,
     {
       data.vec_printf(TEXT_ERROR_UNKNOWN_SHOW_ARGUMENTS);
     }
-  }
-  else if (strcasecmp("create", (char *)(packet->arg[0])) == 0)
-  {
+    break;
+
+  case GEARMAND_TEXT_COMMAND_CREATE:
     if (packet->argc == 3 and strcasecmp("function", (char *)(packet->arg[1])) == 0)
     {
       gearman_server_function_st* function= gearman_server_function_get(Server, (char *)(packet->arg[2]), packet->arg_size[2] -2);
@@ -252,9 +497,9 @@ gearmand_error_t server_run_text(gearman_server_con_st *server_con,
       // create
       data.vec_printf(TEXT_ERROR_ARGS, (int)packet->arg_size[0], (char *)(packet->arg[0]));
     }
-  }
-  else if (strcasecmp("drop", (char *)(packet->arg[0])) == 0)
-  {
+    break;
+
+  case GEARMAND_TEXT_COMMAND_DROP:
     if (packet->argc == 3 and strcasecmp("function", (char *)(packet->arg[1])) == 0)
     {
       bool success= false;
@@ -293,9 +538,9 @@ gearmand_error_t server_run_text(gearman_server_con_st *server_con,
       // drop
       data.vec_printf(TEXT_ERROR_ARGS, (int)packet->arg_size[0], (char *)(packet->arg[0]));
     }
-  }
-  else if (strcasecmp("maxqueue", (char *)(packet->arg[0])) == 0)
-  {
+    break;
+
+  case GEARMAND_TEXT_COMMAND_MAXQUEUE:
     if (packet->argc == 1)
     {
       data.vec_append_printf(TEXT_ERROR_ARGS, (int)packet->arg_size[0], (char *)(packet->arg[0]));
@@ -355,28 +600,80 @@ gearmand_error_t server_run_text(gearman_server_con_st *server_con,
 
       data.vec_append_printf(TEXT_SUCCESS);
     }
-  }
-  else if (strcasecmp("getpid", (char *)(packet->arg[0])) == 0)
-  {
+    break;
+
+  case GEARMAND_TEXT_COMMAND_RESULTCACHE:
+    if (packet->argc < 3)
+    {
+      data.vec_append_printf(TEXT_ERROR_ARGS, (int)packet->arg_size[0], (char *)(packet->arg[0]));
+    }
+    else
+    {
+      /* Only plain digits, strtoul() would take a sign or leading spaces. */
+      const char *ttl_string= (char *)(packet->arg[2]);
+      char *end= NULL;
+      errno= 0;
+      unsigned long ttl= isdigit((unsigned char)ttl_string[0]) ? strtoul(ttl_string, &end, 10) : 0;
+      if (end == NULL or *end != 0 or errno == ERANGE or ttl > UINT32_MAX)
+      {
+        data.vec_append_printf(TEXT_ERROR_INVALID_TTL, UINT32_MAX);
+        break;
+      }
+
+      gearman_server_function_st *function= gearman_server_function_get(Server,
+                                                                         (char *)(packet->arg[1]),
+                                                                         strlen((char *)(packet->arg[1])));
+      if (function == NULL)
+      {
+        data.vec_append_printf(TEXT_ERROR_INTERNAL_ERROR);
+      }
+      else
+      {
+        function->result_cache_ttl= uint32_t(ttl);
+        if (function->result_cache_ttl == 0)
+        {
+          gearman_server_result_cache_flush(Server, function);
+        }
+
+        gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "Result cache ttl for %s set to %u", function->function_name, function->result_cache_ttl);
+        data.vec_append_printf(TEXT_SUCCESS);
+      }
+    }
+    break;
+
+  case GEARMAND_TEXT_COMMAND_REPLAY:
+    if (Server->queue_replay)
+    {
+      gearmand::queue::Replay::progress_st progress= Server->queue_replay->progress();
+      data.vec_printf("OK %s read=%" PRIu64 " loaded=%" PRIu64 " skipped=%" PRIu64 " expected=%" PRIu64 " ms=%" PRIu64 "\n",
+                      gearmand::queue::Replay::state_name(progress.state),
+                      progress.read, progress.loaded, progress.skipped,
+                      progress.expected, progress.elapsed);
+    }
+    else
+    {
+      data.vec_printf("OK idle read=0 loaded=0 skipped=0 expected=0 ms=0\n");
+    }
+    break;
+
+  case GEARMAND_TEXT_COMMAND_GETPID:
     data.vec_printf("OK %d\n", (int)getpid());
-  }
-  else if (strcasecmp("verbose", (char *)(packet->arg[0])) == 0)
-  {
+    break;
+
+  case GEARMAND_TEXT_COMMAND_VERBOSE:
     data.vec_printf("OK %s\n", gearmand_verbose_name(Gearmand()->verbose));
-  }
-  else if (strcasecmp("version", (char *)(packet->arg[0])) == 0)
-  {
+    break;
+
+  case GEARMAND_TEXT_COMMAND_VERSION:
     data.vec_printf("OK %s\n", PACKAGE_VERSION);
-  }
-  else
-  {
-    gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, "Failed to find command %.*s(%" PRIu64 ")",
-                       packet->arg_size[0], packet->arg[0], 
-                       packet->arg_size[0]);
-    data.vec_printf(TEXT_ERROR_UNKNOWN_COMMAND, (int)packet->arg_size[0], (char *)(packet->arg[0]));
+    break;
+
+  case GEARMAND_TEXT_COMMAND_UNKNOWN:
+    _text_unknown_command(data, packet);
+    break;
   }
 
-  gearman_server_packet_st *server_packet= gearman_server_packet_create(server_con->thread, false);
+  gearman_server_packet_st *server_packet= gearman_server_packet_create(server_con->thread, from_thread);
   if (server_packet == NULL)
   {
     return gearmand_gerror("calling gearman_server_packet_create()", GEARMAND_MEMORY_ALLOCATION_FAILURE);
@@ -396,6 +693,12 @@ gearmand_error_t server_run_text(gearman_server_con_st *server_con,
   server_packet->packet.data= gearman_c_str(taken);
   server_packet->packet.data_size= gearman_size(taken);
 
+  if (from_thread == false)
+  {
+    gearman_server_io_packet_queue(server_con, server_packet);
+    return GEARMAND_SUCCESS;
+  }
+
   int error;
   if ((error= pthread_mutex_lock(&server_con->thread->lock)) == 0)
   {
@@ -414,3 +717,15 @@ gearmand_error_t server_run_text(gearman_server_con_st *server_con,
 
   return GEARMAND_SUCCESS;
 }
+
+gearmand_error_t server_run_text(gearman_server_con_st *server_con,
+                                 gearmand_packet_st *packet)
+{
+  return _server_run_text(server_con, packet, false);
+}
+
+gearmand_error_t server_run_text_snapshot(gearman_server_con_st *server_con,
+                                          gearmand_packet_st *packet)
+{
+  return _server_run_text(server_con, packet, true);
+}
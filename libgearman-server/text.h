@@ -41,9 +41,48 @@
 extern "C" {
 #endif
 
+/*
+  Admin commands, looked up through the perfect hash in text.gperf.
+*/
+enum gearmand_text_command_t
+{
+  GEARMAND_TEXT_COMMAND_UNKNOWN,
+  GEARMAND_TEXT_COMMAND_CANCEL,
+  GEARMAND_TEXT_COMMAND_CREATE,
+  GEARMAND_TEXT_COMMAND_DROP,
+  GEARMAND_TEXT_COMMAND_GETPID,
+  GEARMAND_TEXT_COMMAND_LATENCY,
+  GEARMAND_TEXT_COMMAND_MAXQUEUE,
+  GEARMAND_TEXT_COMMAND_METRICS,
+  GEARMAND_TEXT_COMMAND_PRIORITYSTATUS,
+  GEARMAND_TEXT_COMMAND_REPLAY,
+  GEARMAND_TEXT_COMMAND_RESULTCACHE,
+  GEARMAND_TEXT_COMMAND_SHOW,
+  GEARMAND_TEXT_COMMAND_STATUS,
+  GEARMAND_TEXT_COMMAND_VERBOSE,
+  GEARMAND_TEXT_COMMAND_VERSION,
+  GEARMAND_TEXT_COMMAND_WORKERS
+};
+
+#ifndef __cplusplus
+typedef enum gearmand_text_command_t gearmand_text_command_t;
+#endif
+
 gearmand_error_t server_run_text(gearman_server_con_st *server_con,
                                  gearmand_packet_st *packet);
 
+/*
+  True for text commands that only read the stats snapshot, which I/O
+  threads can answer without handing the packet to the proc thread.
+*/
+bool server_text_is_snapshot(const gearmand_packet_st *packet);
+
+/*
+  server_run_text() for the I/O thread that read the packet.
+*/
+gearmand_error_t server_run_text_snapshot(gearman_server_con_st *server_con,
+                                          gearmand_packet_st *packet);
+
 #ifdef __cplusplus
 }
 #endif
@@ -43,6 +43,7 @@
 
 #include "gear_config.h"
 #include "libgearman-server/common.h"
+#include "libgearman-server/queue.h"
 
 #include <libgearman/command.h>
 #include "libgearman/strcommand.h"
@@ -75,6 +76,11 @@ static gearmand_error_t _thread_packet_read(gearman_server_con_st *con);
  */
 static gearmand_error_t _thread_packet_flush(gearman_server_con_st *con);
 
+/**
+ * Flush held statuses after wait milliseconds, when not threaded.
+ */
+static gearmand_error_t _thread_work_status_watch(gearman_server_con_st *con, uint32_t wait);
+
 /**
  * Start processing thread for the server.
  */
@@ -114,6 +120,8 @@ bool gearman_server_thread_init(gearman_server_st *server,
   thread->to_be_freed_count= 0;
   thread->free_con_count= 0;
   thread->free_packet_count= 0;
+  thread->bytes_in= 0;
+  thread->bytes_out= 0;
   thread->log_fn= log_function;
   thread->log_context= context;
   thread->run_fn= NULL;
@@ -225,6 +233,11 @@ gearman_server_thread_run(gearman_server_thread_st *thread,
       if (server_con->con.revents & POLLIN)
       {
         *ret_ptr= _thread_packet_read(server_con);
+        if (Server->flags.threaded == false)
+        {
+          /* Store what the commands queued before the connection can go away. */
+          (void)gearman_queue_batch_flush(Server, true);
+        }
         if (*ret_ptr != GEARMAND_SUCCESS && *ret_ptr != GEARMAND_IO_WAIT)
           return gearman_server_con_data(server_con);
       }
@@ -308,14 +321,41 @@ static gearmand_error_t _thread_packet_read(gearman_server_con_st *con)
       return ret;
     }
 
-    gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM,
-                       "Received %s",
-                       gearmand_strcommand(&con->packet->packet));
+    gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM,
+                           "Received %s",
+                           gearmand_strcommand(&con->packet->packet));
+    GEARMAND_PROBE4(packet__read, con->con.fd(), int(con->packet->packet.magic),
+                    int(con->packet->packet.command), con->packet->packet.data_size);
 
     /* We read a complete packet. */
-    if (Server->flags.threaded)
+    if (Server->flags.threaded
+        and con->packet->packet.command == GEARMAN_COMMAND_TEXT
+        and server_text_is_snapshot(&(con->packet->packet))
+        and __atomic_load_n(&con->proc_pending, __ATOMIC_ACQUIRE) == 0)
+    {
+      /* Answered from the stats snapshot, the proc thread is not involved. */
+      gearmand_error_t rc= server_run_text_snapshot(con, &(con->packet->packet));
+      gearmand_packet_free(&(con->packet->packet));
+      gearman_server_packet_free(con->packet, con->thread, true);
+      con->packet= NULL;
+      if (gearmand_failed(rc))
+      {
+        return rc;
+      }
+    }
+    else if (Server->flags.threaded)
     {
+      /* The proc thread runs it after we have read into the buffer again. */
+      if (gearmand_failed(ret= gearmand_packet_own_args(&(con->packet->packet))))
+      {
+        gearmand_packet_free(&(con->packet->packet));
+        gearman_server_packet_free(con->packet, con->thread, true);
+        con->packet= NULL;
+        return ret;
+      }
+
       /* Multi-threaded, queue for the processing thread to run. */
+      __atomic_add_fetch(&con->proc_pending, 1, __ATOMIC_RELAXED);
       gearman_server_proc_packet_add(con, con->packet);
       con->packet= NULL;
     }
@@ -323,6 +363,11 @@ static gearmand_error_t _thread_packet_read(gearman_server_con_st *con)
     {
       /* Single threaded, run the command here. */
       gearmand_error_t rc= gearman_server_run_command(con, &(con->packet->packet));
+      uint32_t status_wait= gearman_server_work_status_flush(Server);
+      if (status_wait)
+      {
+        (void)_thread_work_status_watch(con, status_wait);
+      }
       gearmand_packet_free(&(con->packet->packet));
       gearman_server_packet_free(con->packet, con->thread, true);
       con->packet= NULL;
@@ -353,9 +398,9 @@ static gearmand_error_t _thread_packet_flush(gearman_server_con_st *con)
       return ret;
     }
 
-    gearmand_log_debug(GEARMAN_DEFAULT_LOG_PARAM, 
-                       "Sent %s",
-                       gearman_strcommand(con->io_packet_list->packet.command));
+    gearmand_log_debug_hot(GEARMAN_DEFAULT_LOG_PARAM, 
+                           "Sent %s",
+                           gearman_strcommand(con->io_packet_list->packet.command));
 
     gearman_server_io_packet_remove(con);
   }
@@ -364,6 +409,59 @@ static gearmand_error_t _thread_packet_flush(gearman_server_con_st *con)
   return gearmand_io_set_events(con, POLLIN);
 }
 
+static void _thread_work_status_add_event(gearman_server_st *server, uint32_t wait)
+{
+  struct timeval status_tv= { 0 , 0 };
+  status_tv.tv_sec= wait / 1000;
+  status_tv.tv_usec= suseconds_t(wait % 1000) * 1000;
+  if (timeout_add(server->status_event, &status_tv) == -1)
+  {
+    gearmand_perror(errno, "timeout_add");
+  }
+}
+
+static void _thread_work_status_event(int fd, short event, void *arg)
+{
+  (void)fd;
+  (void)event;
+  gearmand_thread_st *thread= (gearmand_thread_st *)arg;
+
+  uint32_t wait= gearman_server_work_status_flush(Server);
+  if (wait)
+  {
+    _thread_work_status_add_event(Server, wait);
+  }
+
+  /* Nothing wakes a single thread for the packets queued, send them now. */
+  gearmand_thread_run(thread);
+}
+
+static gearmand_error_t _thread_work_status_watch(gearman_server_con_st *con, uint32_t wait)
+{
+  /*
+    The proc thread flushes on its own wakeups, a single threaded server
+    needs an event on its base or a held status waits for the next packet.
+  */
+  if (Server->status_event == NULL)
+  {
+    gearmand_con_st *dcon= con->con.context;
+    Server->status_event= (struct event *)malloc(sizeof(struct event)); // libevent POD
+    if (Server->status_event == NULL)
+    {
+      return gearmand_merror("malloc(sizeof(struct event)", struct event, 1);
+    }
+    timeout_set(Server->status_event, _thread_work_status_event, dcon->thread);
+    if (event_base_set(dcon->thread->base, Server->status_event) == -1)
+    {
+      gearmand_perror(errno, "event_base_set");
+    }
+  }
+
+  _thread_work_status_add_event(Server, wait);
+
+  return GEARMAND_SUCCESS;
+}
+
 static gearmand_error_t _proc_thread_start(gearman_server_st *server)
 {
   int error;
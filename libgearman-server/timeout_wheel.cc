@@ -0,0 +1,205 @@
+/*  vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * 
+ *  Gearmand client and server library.
+ *
+ *  Copyright (C) 2011 Data Differential, http://datadifferential.com/
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *
+ *      * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following disclaimer
+ *  in the documentation and/or other materials provided with the
+ *  distribution.
+ *
+ *      * The names of its contributors may not be used to endorse or
+ *  promote products derived from this software without specific prior
+ *  written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+
+/**
+ * @file
+ * @brief Job timeout wheel definitions
+ */
+
+#include "gear_config.h"
+#include "libgearman-server/common.h"
+
+#include <ctime>
+
+#pragma GCC diagnostic push
+#ifndef __INTEL_COMPILER
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#endif
+
+/*
+ * Private definitions
+ */
+
+static inline uint64_t _timeout_now(void)
+{
+  struct timespec now;
+  if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+  {
+    return 0;
+  }
+
+  return uint64_t(now.tv_sec) * 1000 + uint64_t(now.tv_nsec / 1000000);
+}
+
+static inline gearman_server_job_st **_timeout_slot(gearman_server_st *server, uint64_t tick)
+{
+  return &(server->timeout_wheel[tick % GEARMAND_TIMEOUT_WHEEL_SIZE]);
+}
+
+static void _timeout_unlink(gearman_server_st *server,
+                            gearman_server_job_st *server_job)
+{
+  if (server_job->timeout_prev)
+  {
+    server_job->timeout_prev->timeout_next= server_job->timeout_next;
+  }
+  else
+  {
+    *_timeout_slot(server, server_job->timeout_tick)= server_job->timeout_next;
+  }
+
+  if (server_job->timeout_next)
+  {
+    server_job->timeout_next->timeout_prev= server_job->timeout_prev;
+  }
+
+  server_job->timeout_armed= false;
+  server_job->timeout_next= NULL;
+  server_job->timeout_prev= NULL;
+  server->timeout_count--;
+}
+
+/*
+ * Public definitions
+ */
+
+void gearman_server_timeout_wheel_add(gearman_server_st *server,
+                                      gearman_server_job_st *server_job,
+                                      uint64_t timeout)
+{
+  gearman_server_timeout_wheel_remove(server, server_job);
+
+  uint64_t now_tick= _timeout_now() / GEARMAND_TIMEOUT_WHEEL_TICK;
+  if (server->timeout_count == 0)
+  {
+    server->timeout_tick= now_tick;
+  }
+
+  /* Round up, a job never times out early. */
+  uint64_t ticks= (timeout + GEARMAND_TIMEOUT_WHEEL_TICK -1) / GEARMAND_TIMEOUT_WHEEL_TICK;
+  server_job->timeout_tick= now_tick + (ticks ? ticks : 1);
+
+  gearman_server_job_st **slot= _timeout_slot(server, server_job->timeout_tick);
+  server_job->timeout_prev= NULL;
+  server_job->timeout_next= *slot;
+  if (*slot)
+  {
+    (*slot)->timeout_prev= server_job;
+  }
+  *slot= server_job;
+
+  server_job->timeout_armed= true;
+  server->timeout_count++;
+}
+
+void gearman_server_timeout_wheel_remove(gearman_server_st *server,
+                                         gearman_server_job_st *server_job)
+{
+  if (server_job->timeout_armed)
+  {
+    _timeout_unlink(server, server_job);
+  }
+}
+
+uint32_t gearman_server_timeout_wheel_expire(gearman_server_st *server)
+{
+  if (server->timeout_count == 0)
+  {
+    return 0;
+  }
+
+  uint64_t now= _timeout_now();
+  uint64_t now_tick= now / GEARMAND_TIMEOUT_WHEEL_TICK;
+
+  /* Each slot only needs to be visited once, however far behind we are. */
+  uint64_t steps= now_tick - server->timeout_tick;
+  if (steps > GEARMAND_TIMEOUT_WHEEL_SIZE)
+  {
+    steps= GEARMAND_TIMEOUT_WHEEL_SIZE;
+  }
+
+  gearman_server_job_st *expired= NULL;
+  for (uint64_t x= 1; x <= steps; x++)
+  {
+    gearman_server_job_st *server_job= *_timeout_slot(server, server->timeout_tick + x);
+    while (server_job)
+    {
+      gearman_server_job_st *next= server_job->timeout_next;
+      if (server_job->timeout_tick <= now_tick)
+      {
+        _timeout_unlink(server, server_job);
+        server_job->timeout_next= expired;
+        expired= server_job;
+      }
+
+      server_job= next;
+    }
+  }
+  server->timeout_tick= now_tick;
+
+  /* The wheel is settled before any job is requeued. */
+  while (expired)
+  {
+    gearman_server_job_st *server_job= expired;
+    expired= server_job->timeout_next;
+    server_job->timeout_next= NULL;
+
+    gearmand_log_warning(GEARMAN_DEFAULT_LOG_PARAM,
+                         "Worker timeout reached on job, requeueing: %s %s",
+                         server_job->job_handle, server_job->unique);
+
+    gearmand_error_t ret= gearman_server_job_queue(server_job);
+    if (ret != GEARMAND_SUCCESS)
+    {
+      gearmand_log_error(GEARMAN_DEFAULT_LOG_PARAM,
+                         "Failed trying to requeue job after timeout, job lost: %s %s",
+                         server_job->job_handle, server_job->unique);
+      gearman_server_job_free(server_job);
+    }
+  }
+
+  if (server->timeout_count == 0)
+  {
+    return 0;
+  }
+
+  return uint32_t((now_tick +1) * GEARMAND_TIMEOUT_WHEEL_TICK - now);
+}
+
+#pragma GCC diagnostic pop
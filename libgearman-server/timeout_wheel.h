@@ -0,0 +1,91 @@
+/*  vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * 
+ *  Gearmand client and server library.
+ *
+ *  Copyright (C) 2011 Data Differential, http://datadifferential.com/
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *
+ *      * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following disclaimer
+ *  in the documentation and/or other materials provided with the
+ *  distribution.
+ *
+ *      * The names of its contributors may not be used to endorse or
+ *  promote products derived from this software without specific prior
+ *  written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+
+/**
+ * @file
+ * @brief Job timeout wheel declarations
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @addtogroup gearman_server_timeout_wheel Job Timeout Wheel Declarations
+ * @ingroup gearman_server
+ *
+ * Jobs assigned to a worker that registered with CAN_DO_TIMEOUT are kept in
+ * a hashed timing wheel owned by the thread running commands. Each slot
+ * covers GEARMAND_TIMEOUT_WHEEL_TICK milliseconds, so adding and removing a
+ * job is constant time no matter how many jobs are running. Expired jobs
+ * are collected from the wheel first and then requeued together.
+ *
+ * @{
+ */
+
+/**
+ * Start the timeout, in milliseconds, for a job, replacing any timeout
+ * already running.
+ */
+GEARMAN_API
+void gearman_server_timeout_wheel_add(gearman_server_st *server,
+                                      gearman_server_job_st *server_job,
+                                      uint64_t timeout);
+
+/**
+ * Stop the timeout for a job, if it has one.
+ */
+GEARMAN_API
+void gearman_server_timeout_wheel_remove(gearman_server_st *server,
+                                         gearman_server_job_st *server_job);
+
+/**
+ * Requeue jobs whose timeout has passed. Returns the number of milliseconds
+ * until the next tick, or 0 if no timeouts are running.
+ */
+GEARMAN_API
+uint32_t gearman_server_timeout_wheel_expire(gearman_server_st *server);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
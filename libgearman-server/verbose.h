@@ -61,7 +61,7 @@ enum gearmand_verbose_t
   // Info is used for state of the system (i.e. startup, shutdown, etc)
   GEARMAND_VERBOSE_INFO= LOG_INFO, // syslog:LOG_INFO
 
-  // @todo Fix it so that these will not be compiled in by default
+  // Compiled out of the job processing paths with --disable-debug-log
   GEARMAND_VERBOSE_DEBUG= LOG_DEBUG // syslog:LOG_DEBUG
 };
 
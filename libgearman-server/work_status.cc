@@ -0,0 +1,214 @@
+/*  vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * 
+ *  Gearmand client and server library.
+ *
+ *  Copyright (C) 2011 Data Differential, http://datadifferential.com/
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *
+ *      * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following disclaimer
+ *  in the documentation and/or other materials provided with the
+ *  distribution.
+ *
+ *      * The names of its contributors may not be used to endorse or
+ *  promote products derived from this software without specific prior
+ *  written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+/**
+ * @file
+ * @brief WORK_STATUS coalescing definitions
+ */
+
+#include "gear_config.h"
+#include "libgearman-server/common.h"
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#pragma GCC diagnostic push
+#ifndef __INTEL_COMPILER
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#endif
+
+/*
+ * Private definitions
+ */
+
+static inline uint64_t _status_now(void)
+{
+  struct timespec now;
+  if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+  {
+    return 0;
+  }
+
+  return uint64_t(now.tv_sec) * 1000 + uint64_t(now.tv_nsec / 1000000);
+}
+
+static void _status_release(gearman_server_st *server,
+                            gearman_server_client_st *client)
+{
+  if (client->status_pending)
+  {
+    GEARMAND_LIST_DEL(server->status_pending, client, status_);
+    client->status_pending= false;
+    client->status_next= NULL;
+    client->status_prev= NULL;
+  }
+}
+
+static void _status_packet(gearman_server_client_st *client, uint64_t now)
+{
+  gearman_server_job_st *server_job= client->job;
+
+  char numerator[GEARMAN_MAXIMUM_INTEGER_DISPLAY_LENGTH];
+  int numerator_length= snprintf(numerator, sizeof(numerator), "%u", server_job->numerator);
+
+  char denominator[GEARMAN_MAXIMUM_INTEGER_DISPLAY_LENGTH];
+  int denominator_length= snprintf(denominator, sizeof(denominator), "%u", server_job->denominator);
+
+  client->con->status_time= now;
+
+  gearmand_error_t ret= gearman_server_io_packet_add(client->con, false,
+                                                     GEARMAN_MAGIC_RESPONSE,
+                                                     GEARMAN_COMMAND_WORK_STATUS,
+                                                     server_job->job_handle, (size_t)(strlen(server_job->job_handle) +1),
+                                                     numerator, (size_t)(numerator_length +1),
+                                                     denominator, (size_t)denominator_length,
+                                                     NULL);
+  if (gearmand_failed(ret))
+  {
+    gearmand_log_gerror_warn(GEARMAN_DEFAULT_LOG_PARAM, ret, "Failed to send WORK_STATUS packet to %s:%s",
+                             client->con->host(), client->con->port());
+  }
+}
+
+/*
+ * Public definitions
+ */
+
+gearmand_error_t gearman_server_work_status_send(gearman_server_st *server,
+                                                 gearman_server_job_st *server_job)
+{
+  uint64_t now= _status_now();
+
+  for (gearman_server_client_st *client= server_job->client_list; client;
+       client= client->job_next)
+  {
+    if (now - client->con->status_time >= server->status_interval)
+    {
+      _status_release(server, client);
+      _status_packet(client, now);
+    }
+    else if (client->status_pending == false)
+    {
+      GEARMAND_LIST_ADD(server->status_pending, client, status_);
+      client->status_pending= true;
+    }
+  }
+
+  return GEARMAND_SUCCESS;
+}
+
+void gearman_server_work_status_flush_job(gearman_server_st *server,
+                                          gearman_server_job_st *server_job)
+{
+  if (server->status_pending_count == 0)
+  {
+    return;
+  }
+
+  uint64_t now= _status_now();
+
+  for (gearman_server_client_st *client= server_job->client_list; client;
+       client= client->job_next)
+  {
+    if (client->status_pending)
+    {
+      _status_release(server, client);
+      _status_packet(client, now);
+    }
+  }
+}
+
+uint32_t gearman_server_work_status_flush(gearman_server_st *server)
+{
+  if (server->status_pending_count == 0)
+  {
+    return 0;
+  }
+
+  uint64_t now= _status_now();
+  uint64_t next_due= UINT64_MAX;
+
+  /*
+    Everything due is picked before any is sent, sending moves the
+    connection's status time and would hold back the rest of its round.
+  */
+  gearman_server_client_st *due_list= NULL;
+  gearman_server_client_st *client= server->status_pending_list;
+  while (client)
+  {
+    gearman_server_client_st *next= client->status_next;
+
+    uint64_t due= client->con->status_time + server->status_interval;
+    if (due <= now)
+    {
+      _status_release(server, client);
+      client->status_next= due_list;
+      due_list= client;
+    }
+    else if (due - now < next_due)
+    {
+      next_due= due - now;
+    }
+
+    client= next;
+  }
+
+  while (due_list)
+  {
+    client= due_list;
+    due_list= client->status_next;
+    client->status_next= NULL;
+    _status_packet(client, now);
+  }
+
+  if (server->status_pending_count == 0)
+  {
+    return 0;
+  }
+
+  return uint32_t(next_due);
+}
+
+void gearman_server_work_status_cancel(gearman_server_st *server,
+                                       gearman_server_client_st *client)
+{
+  _status_release(server, client);
+}
+
+#pragma GCC diagnostic pop
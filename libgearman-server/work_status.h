@@ -0,0 +1,97 @@
+/*  vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * 
+ *  Gearmand client and server library.
+ *
+ *  Copyright (C) 2011 Data Differential, http://datadifferential.com/
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *
+ *      * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following disclaimer
+ *  in the documentation and/or other materials provided with the
+ *  distribution.
+ *
+ *      * The names of its contributors may not be used to endorse or
+ *  promote products derived from this software without specific prior
+ *  written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+/**
+ * @file
+ * @brief WORK_STATUS coalescing declarations
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @addtogroup gearman_server_work_status WORK_STATUS Coalescing Declarations
+ * @ingroup gearman_server
+ *
+ * With a status interval set (see --status-interval), a client connection
+ * is sent at most one WORK_STATUS per interval. Updates that arrive in
+ * between only change the job's numerator and denominator, and the latest
+ * values are sent once the interval has passed. Any status still held for
+ * a job is sent before its next WORK_DATA, WORK_WARNING, WORK_COMPLETE,
+ * WORK_FAIL or WORK_EXCEPTION, so clients never miss the final status.
+ *
+ * @{
+ */
+
+/**
+ * Send the job's current status to all of its clients, holding it back for
+ * connections that were sent a status less than one interval ago.
+ */
+GEARMAN_API
+gearmand_error_t gearman_server_work_status_send(gearman_server_st *server,
+                                                 gearman_server_job_st *server_job);
+
+/**
+ * Send any held status for the job right away.
+ */
+GEARMAN_API
+void gearman_server_work_status_flush_job(gearman_server_st *server,
+                                          gearman_server_job_st *server_job);
+
+/**
+ * Send held statuses whose interval has passed. Returns the number of
+ * milliseconds until the next held status is due, or 0 if none are held.
+ */
+GEARMAN_API
+uint32_t gearman_server_work_status_flush(gearman_server_st *server);
+
+/**
+ * Forget a held status, used when the client is released.
+ */
+GEARMAN_API
+void gearman_server_work_status_cancel(gearman_server_st *server,
+                                       gearman_server_client_st *client);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
@@ -86,7 +86,9 @@ static gearman_server_worker_st* gearman_server_worker_create(gearman_server_con
     worker->function_prev->function_next= worker;
   }
   function->worker_count++;
+  gearman_server_stats_function_update(Server->stats, function);
 
+  worker->stats_slot= gearman_server_stats_worker_add(Server->stats, con->stats_slot, function->stats_slot);
   worker->job_list= NULL;
 
   return worker;
@@ -147,6 +149,8 @@ void gearman_server_worker_free(gearman_server_worker_st *worker)
     }
   }
   worker->function->worker_count--;
+  gearman_server_stats_function_update(Server->stats, worker->function);
+  gearman_server_stats_worker_remove(Server->stats, worker->stats_slot);
 
   if (Server->free_worker_count < GEARMAND_MAX_FREE_SERVER_WORKER)
   {
@@ -68,6 +68,7 @@ namespace {
     case GEARMAN_COMMAND_SUBMIT_JOB_LOW_BG:
     case GEARMAN_COMMAND_SUBMIT_JOB_HIGH_BG:
     case GEARMAN_COMMAND_SUBMIT_REDUCE_JOB_BACKGROUND:
+    case GEARMAN_COMMAND_SUBMIT_JOB_BATCH:
       return true;
 
     case GEARMAN_COMMAND_SUBMIT_REDUCE_JOB:
@@ -110,6 +111,8 @@ namespace {
     case GEARMAN_COMMAND_WORK_WARNING:
     case GEARMAN_COMMAND_GET_STATUS_UNIQUE:
     case GEARMAN_COMMAND_STATUS_RES_UNIQUE:
+    case GEARMAN_COMMAND_JOB_CREATED_BATCH:
+    case GEARMAN_COMMAND_GRAB_JOBS:
       assert(0);
       break;
     }
@@ -317,6 +320,9 @@ gearman_task_st *add_task(Client& client,
   case GEARMAN_COMMAND_WORK_WARNING:
   case GEARMAN_COMMAND_GET_STATUS_UNIQUE:
   case GEARMAN_COMMAND_STATUS_RES_UNIQUE:
+  case GEARMAN_COMMAND_SUBMIT_JOB_BATCH:
+  case GEARMAN_COMMAND_JOB_CREATED_BATCH:
+  case GEARMAN_COMMAND_GRAB_JOBS:
     rc= GEARMAN_INVALID_ARGUMENT;
     assert(rc != GEARMAN_INVALID_ARGUMENT);
     break;
@@ -336,6 +342,128 @@ gearman_task_st *add_task(Client& client,
   return NULL;
 }
 
+gearman_task_st *add_batch_task(Client& client,
+                                gearman_task_st *task_shell,
+                                void *context,
+                                const gearman_string_t &function,
+                                size_t count,
+                                const char * const *unique,
+                                const void * const *workload,
+                                const size_t *workload_size,
+                                const gearman_actions_t &actions)
+{
+  if (gearman_size(function) == 0 or gearman_c_str(function) == NULL or gearman_size(function) > GEARMAN_FUNCTION_MAX_SIZE)
+  {
+    gearman_error(client.universal, GEARMAN_INVALID_ARGUMENT, "invalid function");
+    return NULL;
+  }
+
+  if (count == 0 or workload == NULL or workload_size == NULL)
+  {
+    gearman_error(client.universal, GEARMAN_INVALID_ARGUMENT, "empty batch");
+    return NULL;
+  }
+
+  /*
+    Each entry is sent as UNIQUE[0], a 4 byte big-endian workload size, and
+    then the workload. Entries without a unique get a generated one, so
+    leave room for a UUID.
+  */
+  size_t batch_size= 0;
+  for (size_t x= 0; x < count; ++x)
+  {
+    if (unique and unique[x])
+    {
+      size_t unique_length= strlen(unique[x]);
+      if (unique_length >= GEARMAN_MAX_UNIQUE_SIZE)
+      {
+        gearman_error(client.universal, GEARMAN_INVALID_ARGUMENT, "unique name longer then GEARMAN_MAX_UNIQUE_SIZE");
+        return NULL;
+      }
+      batch_size+= unique_length +1;
+    }
+    else
+    {
+      batch_size+= GEARMAN_MAX_UUID_SIZE +1;
+    }
+
+    if ((workload_size[x] and workload[x] == NULL) or workload_size[x] > UINT32_MAX)
+    {
+      gearman_error(client.universal, GEARMAN_INVALID_ARGUMENT, "invalid workload");
+      return NULL;
+    }
+    batch_size+= sizeof(uint32_t) +workload_size[x];
+  }
+
+  task_shell= gearman_task_internal_create(&client, task_shell);
+  if (task_shell == NULL or task_shell->impl() == NULL)
+  {
+    assert(client.universal.error());
+    return NULL;
+  }
+
+  Task* task= task_shell->impl();
+
+  task->context= context;
+  task->func= actions;
+  task->batch_count= uint32_t(count);
+
+  char *batch= static_cast<char *>(gearman_malloc(client.universal, batch_size));
+  if (batch == NULL)
+  {
+    gearman_perror(client.universal, errno, "gearman_malloc");
+    gearman_task_free(task->shell());
+    return NULL;
+  }
+
+  char *ptr= batch;
+  for (size_t x= 0; x < count; ++x)
+  {
+    if (unique and unique[x])
+    {
+      size_t unique_length= strlen(unique[x]);
+      memcpy(ptr, unique[x], unique_length +1);
+      ptr+= unique_length +1;
+    }
+    else
+    {
+      size_t unique_length;
+      if (safe_uuid_generate(ptr, unique_length) == -1)
+      {
+        gearman_log_debug(client.universal, "uuid_generate_time_safe() failed or does not exist on this platform");
+      }
+      ptr+= unique_length +1;
+    }
+
+    uint32_t size= htonl(uint32_t(workload_size[x]));
+    memcpy(ptr, &size, sizeof(uint32_t));
+    ptr+= sizeof(uint32_t);
+
+    if (workload_size[x])
+    {
+      memcpy(ptr, workload[x], workload_size[x]);
+      ptr+= workload_size[x];
+    }
+  }
+
+  gearman_return_t rc= libgearman::protocol::submit_batch(client.universal,
+                                                          task->send,
+                                                          function,
+                                                          batch, size_t(ptr -batch));
+  if (gearman_success(rc))
+  {
+    client.new_tasks++;
+    client.running_tasks++;
+    task->options.send_in_use= true;
+
+    return task->shell();
+  }
+
+  gearman_task_free(task->shell());
+
+  return NULL;
+}
+
 gearman_task_st *add_reducer_task(Client* client,
                                   gearman_command_t command,
                                   const gearman_job_priority_t,
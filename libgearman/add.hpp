@@ -72,6 +72,16 @@ gearman_task_st *add_task(Client& client,
                           time_t when,
                           const gearman_actions_t &actions);
 
+gearman_task_st *add_batch_task(Client& client,
+                                gearman_task_st *task,
+                                void *context,
+                                const gearman_string_t &function,
+                                size_t count,
+                                const char * const *unique,
+                                const void * const *workload,
+                                const size_t *workload_size,
+                                const gearman_actions_t &actions);
+
 gearman_task_st *add_reducer_task(Client *client,
                                   gearman_command_t command,
                                   const gearman_job_priority_t priority,
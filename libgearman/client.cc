@@ -1155,6 +1155,44 @@ gearman_task_st *gearman_client_add_task_background(gearman_client_st *client,
                       client->impl()->actions);
 }
 
+gearman_task_st *gearman_client_add_task_background_batch(gearman_client_st *client,
+                                                          gearman_task_st *task,
+                                                          void *context,
+                                                          const char *function,
+                                                          size_t count,
+                                                          const char * const *unique,
+                                                          const void * const *workload,
+                                                          const size_t *workload_size,
+                                                          gearman_return_t *ret_ptr)
+{
+  gearman_return_t unused;
+  if (ret_ptr == NULL)
+  {
+    ret_ptr= &unused;
+  }
+
+  if (client == NULL or client->impl() == NULL)
+  {
+    *ret_ptr= GEARMAN_INVALID_ARGUMENT;
+    return NULL;
+  }
+
+  gearman_string_t function_str= { gearman_string_param_cstr(function) };
+  task= add_batch_task(*(client->impl()), task, context,
+                       function_str,
+                       count, unique, workload, workload_size,
+                       client->impl()->actions);
+  if (task == NULL)
+  {
+    *ret_ptr= client->impl()->universal.error_code();
+    return NULL;
+  }
+
+  *ret_ptr= GEARMAN_SUCCESS;
+
+  return task;
+}
+
 gearman_task_st *
 gearman_client_add_task_high_background(gearman_client_st *client,
                                         gearman_task_st *task,
@@ -1572,7 +1610,8 @@ static inline gearman_return_t _client_run_tasks(gearman_client_st *client_shell
                 continue;
               }
 
-              if (client->con->_packet.command == GEARMAN_COMMAND_JOB_CREATED)
+              if (client->con->_packet.command == GEARMAN_COMMAND_JOB_CREATED or
+                  client->con->_packet.command == GEARMAN_COMMAND_JOB_CREATED_BATCH)
               {
                 if (client->task->impl()->created_id != client->con->created_id)
                 {
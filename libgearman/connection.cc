@@ -99,6 +99,8 @@ gearman_connection_st::gearman_connection_st(gearman_universal_st &universal_arg
   cached_errno(0),
   created_id(0),
   created_id_next(0),
+  grab_pending(0),
+  assign_pending(0),
   send_buffer_size(0),
   send_data_size(0),
   send_data_offset(0),
@@ -322,6 +324,11 @@ void gearman_connection_st::close_socket()
     // 'closed'.
     created_id= 0;
     created_id_next= 0;
+
+    // Any job the server was going to hand us for a GRAB_JOBS or with a
+    // WORK_COMPLETE reply is requeued by the server once the connection goes away.
+    grab_pending= 0;
+    assign_pending= 0;
   }
 }
 
@@ -105,6 +105,8 @@ private:
 public:
   uint32_t created_id;
   uint32_t created_id_next;
+  uint32_t grab_pending; // Assignments still to come for our GRAB_JOBS.
+  uint32_t assign_pending; // Assignments still to come for our WORK_COMPLETEs.
   size_t send_buffer_size;
   size_t send_data_size;
   size_t send_data_offset;
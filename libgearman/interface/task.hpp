@@ -71,6 +71,7 @@ struct Task
   uint32_t numerator;
   uint32_t denominator;
   uint32_t client_count;
+  uint32_t batch_count;
   Client *client;
   gearman_task_st *next;
   gearman_task_st *prev;
@@ -83,6 +84,7 @@ struct Task
   struct gearman_result_st *_result_ptr;
   char job_handle[GEARMAN_JOB_HANDLE_SIZE];
   gearman_vector_st exception;
+  gearman_vector_st batch_job_handles;
   size_t unique_length;
   char unique[GEARMAN_MAX_UNIQUE_SIZE];
 
@@ -99,6 +101,7 @@ struct Task
     numerator(0),
     denominator(0),
     client_count(0),
+    batch_count(0),
     client(client_),
     next(NULL),
     prev(NULL),
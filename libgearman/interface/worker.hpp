@@ -49,6 +49,7 @@ struct Worker
     bool grab_uniq;
     bool grab_all;
     bool timeout_return;
+    bool assign_on_complete;
     bool _in_work;
 
     Options() :
@@ -58,6 +59,7 @@ struct Worker
       grab_uniq(true),
       grab_all(true),
       timeout_return(false),
+      assign_on_complete(false),
       _in_work(false)
     { }
   } options;
@@ -65,6 +67,7 @@ struct Worker
   enum gearman_worker_universal_t work_state;
   uint32_t function_count;
   uint32_t job_count;
+  uint32_t grab_count;
   size_t work_result_size;
   void *context;
   gearman_connection_st *con;
@@ -84,6 +87,7 @@ struct Worker
     work_state(GEARMAN_WORKER_WORK_UNIVERSAL_GRAB_JOB),
     function_count(0),
     job_count(0),
+    grab_count(1),
     work_result_size(0),
     context(NULL),
     con(NULL),
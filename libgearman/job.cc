@@ -538,6 +538,12 @@ gearman_return_t gearman_job_send_complete_fin(Job* job,
       return ret;
     }
     job->finished(true);
+
+    /* The server answers with our next job (or NO_JOB), which the next grab reads. */
+    if (job->_worker.options.assign_on_complete)
+    {
+      job->con->assign_pending++;
+    }
   }
 
   return GEARMAN_SUCCESS;
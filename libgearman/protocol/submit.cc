@@ -160,6 +160,50 @@ gearman_return_t submit_epoch(gearman_universal_st& universal,
                                     4);
 }
 
+gearman_return_t submit_batch(gearman_universal_st& universal,
+                              gearman_packet_st& message,
+                              const gearman_string_t &function,
+                              void *batch, size_t batch_size)
+{
+  const void *args[1];
+  size_t args_size[1];
+
+  char function_buffer[1024];
+  if (universal._namespace)
+  {
+    char *ptr= function_buffer;
+    memcpy(ptr, gearman_string_value(universal._namespace), gearman_string_length(universal._namespace)); 
+    ptr+= gearman_string_length(universal._namespace);
+
+    memcpy(ptr, gearman_c_str(function), gearman_size(function) +1);
+    ptr+= gearman_size(function);
+
+    args[0]= function_buffer;
+    args_size[0]= ptr -function_buffer +1;
+  }
+  else
+  {
+    args[0]= gearman_c_str(function);
+    args_size[0]= gearman_size(function) +1;
+  }
+
+  gearman_return_t ret= gearman_packet_create_args(universal, message,
+                                                   GEARMAN_MAGIC_REQUEST,
+                                                   GEARMAN_COMMAND_SUBMIT_JOB_BATCH,
+                                                   args, args_size,
+                                                   1);
+  if (gearman_failed(ret))
+  {
+    gearman_free(universal, batch);
+    return ret;
+  }
+
+  // The encoded batch is handed to the packet as is, instead of being copied.
+  gearman_packet_give_data(message, batch, batch_size);
+
+  return gearman_packet_pack_header(&message);
+}
+
 } // namespace protocol
 } // namespace libgearman
 
@@ -62,5 +62,14 @@ gearman_return_t submit_epoch(gearman_universal_st&,
                               const gearman_string_t &workload,
                               time_t when);
 
+/*
+  batch must have been allocated with gearman_malloc(), the packet takes
+  ownership of it.
+*/
+gearman_return_t submit_batch(gearman_universal_st&,
+                              gearman_packet_st& message,
+                              const gearman_string_t &function,
+                              void *batch, size_t batch_size);
+
 } // namespace protocol
 } // namespace libgearman
@@ -177,12 +177,24 @@ gearman_return_t _client_run_task(Task *task)
     return GEARMAN_SUCCESS;
 
   case GEARMAN_TASK_STATE_WORK:
-    if (task->recv->command == GEARMAN_COMMAND_JOB_CREATED)
+    if (task->recv->command == GEARMAN_COMMAND_JOB_CREATED or
+        task->recv->command == GEARMAN_COMMAND_JOB_CREATED_BATCH)
     {
       task->options.is_known= true;
-      snprintf(task->job_handle, GEARMAN_JOB_HANDLE_SIZE, "%.*s",
-               int(task->recv->arg_size[0]),
-               static_cast<char *>(task->recv->arg[0]));
+      if (task->recv->command == GEARMAN_COMMAND_JOB_CREATED_BATCH)
+      {
+        // The first handle of the batch doubles as the task's job handle.
+        task->batch_job_handles.store(static_cast<const char *>(task->recv->data), task->recv->data_size);
+        snprintf(task->job_handle, GEARMAN_JOB_HANDLE_SIZE, "%.*s",
+                 int(task->recv->data_size),
+                 static_cast<const char *>(task->recv->data));
+      }
+      else
+      {
+        snprintf(task->job_handle, GEARMAN_JOB_HANDLE_SIZE, "%.*s",
+                 int(task->recv->arg_size[0]),
+                 static_cast<char *>(task->recv->arg[0]));
+      }
 
   case GEARMAN_TASK_STATE_CREATED:
       if (task->func.created_fn)
@@ -199,7 +211,8 @@ gearman_return_t _client_run_task(Task *task)
           task->send.command == GEARMAN_COMMAND_SUBMIT_JOB_HIGH_BG ||
           task->send.command == GEARMAN_COMMAND_SUBMIT_JOB_LOW_BG ||
           task->send.command == GEARMAN_COMMAND_SUBMIT_JOB_EPOCH ||
-          task->send.command == GEARMAN_COMMAND_SUBMIT_REDUCE_JOB_BACKGROUND)
+          task->send.command == GEARMAN_COMMAND_SUBMIT_REDUCE_JOB_BACKGROUND ||
+          task->send.command == GEARMAN_COMMAND_SUBMIT_JOB_BATCH)
       {
         task->error_code(GEARMAN_SUCCESS);
         break;
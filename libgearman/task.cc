@@ -484,6 +484,31 @@ gearman_string_t gearman_task_exception(const gearman_task_st* task_shell)
   return ret;
 }
 
+size_t gearman_task_batch_count(const gearman_task_st *task_shell)
+{
+  if (task_shell and task_shell->impl())
+  {
+    return task_shell->impl()->batch_count;
+  }
+
+  return 0;
+}
+
+gearman_string_t gearman_task_batch_job_handles(const gearman_task_st *task_shell)
+{
+  if (task_shell and task_shell->impl())
+  {
+    if (task_shell->impl()->batch_job_handles.empty() == false)
+    {
+      gearman_string_t ret= { task_shell->impl()->batch_job_handles.value(), task_shell->impl()->batch_job_handles.size() };
+      return ret;
+    }
+  }
+
+  static gearman_string_t ret= {0, 0};
+  return ret;
+}
+
 bool gearman_task_is_finished(const gearman_task_st *task_shell)
 {
   if (task_shell and task_shell->impl())
@@ -90,6 +90,11 @@ static gearman_worker_st *_worker_allocate(gearman_worker_st *worker, bool is_cl
  */
 static gearman_return_t _worker_packet_init(Worker*);
 
+/**
+ * Create the grab packet for the current options and grab count.
+ */
+static gearman_return_t _worker_grab_packet_create(Worker*);
+
 /**
  * Callback function used when parsing server lists.
  */
@@ -155,6 +160,7 @@ gearman_worker_st *gearman_worker_clone(gearman_worker_st *worker_shell,
     worker->options.grab_uniq= source->options.grab_uniq;
     worker->options.grab_all= source->options.grab_all;
     worker->options.timeout_return= source->options.timeout_return;
+    worker->grab_count= source->grab_count;
     worker->ssl(source->ssl());
 
     gearman_universal_clone(worker->universal, source->universal);
@@ -269,6 +275,8 @@ gearman_worker_options_t gearman_worker_options(const gearman_worker_st *worker_
       options|= int(GEARMAN_WORKER_SSL);
     if (worker->has_identifier())
       options|= int(GEARMAN_WORKER_IDENTIFIER);
+    if (worker->options.assign_on_complete)
+      options|= int(GEARMAN_WORKER_ASSIGN_ON_COMPLETE);
 
     return gearman_worker_options_t(options);
   }
@@ -288,6 +296,7 @@ void gearman_worker_set_options(gearman_worker_st *worker,
       GEARMAN_WORKER_TIMEOUT_RETURN,
       GEARMAN_WORKER_SSL,
       GEARMAN_WORKER_IDENTIFIER,
+      GEARMAN_WORKER_ASSIGN_ON_COMPLETE,
       GEARMAN_WORKER_MAX
     };
 
@@ -320,19 +329,25 @@ void gearman_worker_add_options(gearman_worker_st *worker_shell,
 
     if (options & GEARMAN_WORKER_GRAB_UNIQ)
     {
-      worker->grab_job.command= GEARMAN_COMMAND_GRAB_JOB_UNIQ;
-      gearman_return_t rc= gearman_packet_pack_header(&(worker->grab_job));
-      (void)(rc);
-      assert(gearman_success(rc));
+      if (worker->grab_count <= 1)
+      {
+        worker->grab_job.command= GEARMAN_COMMAND_GRAB_JOB_UNIQ;
+        gearman_return_t rc= gearman_packet_pack_header(&(worker->grab_job));
+        (void)(rc);
+        assert(gearman_success(rc));
+      }
       worker->options.grab_uniq= true;
     }
 
     if (options & GEARMAN_WORKER_GRAB_ALL)
     {
-      worker->grab_job.command= GEARMAN_COMMAND_GRAB_JOB_ALL;
-      gearman_return_t rc= gearman_packet_pack_header(&(worker->grab_job));
-      (void)(rc);
-      assert(gearman_success(rc));
+      if (worker->grab_count <= 1)
+      {
+        worker->grab_job.command= GEARMAN_COMMAND_GRAB_JOB_ALL;
+        gearman_return_t rc= gearman_packet_pack_header(&(worker->grab_job));
+        (void)(rc);
+        assert(gearman_success(rc));
+      }
       worker->options.grab_all= true;
     }
 
@@ -353,6 +368,11 @@ void gearman_worker_add_options(gearman_worker_st *worker_shell,
       safe_uuid_generate(uuid_buffer, length);
       worker->universal.identifier(uuid_buffer, length);
     }
+
+    if (options & GEARMAN_WORKER_ASSIGN_ON_COMPLETE)
+    {
+      worker->options.assign_on_complete= gearman_worker_set_server_option(worker_shell, gearman_literal_param("assign_on_complete"));
+    }
   }
 }
 
@@ -377,15 +397,21 @@ void gearman_worker_remove_options(gearman_worker_st *worker_shell,
 
     if (options & GEARMAN_WORKER_GRAB_UNIQ)
     {
-      worker->grab_job.command= GEARMAN_COMMAND_GRAB_JOB;
-      (void)gearman_packet_pack_header(&(worker->grab_job));
+      if (worker->grab_count <= 1)
+      {
+        worker->grab_job.command= GEARMAN_COMMAND_GRAB_JOB;
+        (void)gearman_packet_pack_header(&(worker->grab_job));
+      }
       worker->options.grab_uniq= false;
     }
 
     if (options & GEARMAN_WORKER_GRAB_ALL)
     {
-      worker->grab_job.command= GEARMAN_COMMAND_GRAB_JOB;
-      (void)gearman_packet_pack_header(&(worker->grab_job));
+      if (worker->grab_count <= 1)
+      {
+        worker->grab_job.command= GEARMAN_COMMAND_GRAB_JOB;
+        (void)gearman_packet_pack_header(&(worker->grab_job));
+      }
       worker->options.grab_all= false;
     }
 
@@ -415,6 +441,44 @@ void gearman_worker_set_timeout(gearman_worker_st *worker, int timeout)
   }
 }
 
+uint32_t gearman_worker_grab_count(const gearman_worker_st *worker)
+{
+  if (worker and worker->impl())
+  {
+    return worker->impl()->grab_count;
+  }
+
+  return 0;
+}
+
+gearman_return_t gearman_worker_set_grab_count(gearman_worker_st *worker_shell, uint32_t count)
+{
+  if (worker_shell and worker_shell->impl())
+  {
+    Worker* worker= worker_shell->impl();
+
+    if (count == 0)
+    {
+      return gearman_error(worker->universal, GEARMAN_INVALID_ARGUMENT, "grab count must be at least one");
+    }
+
+    uint32_t old_count= worker->grab_count;
+    worker->grab_count= count;
+
+    gearman_packet_free(&(worker->grab_job));
+    gearman_return_t ret= _worker_grab_packet_create(worker);
+    if (gearman_failed(ret))
+    {
+      worker->grab_count= old_count;
+      (void)_worker_grab_packet_create(worker);
+    }
+
+    return ret;
+  }
+
+  return GEARMAN_INVALID_ARGUMENT;
+}
+
 void *gearman_worker_context(const gearman_worker_st *worker)
 {
   if (worker and worker->impl())
@@ -789,23 +853,34 @@ gearman_job_st *gearman_worker_grab_job(gearman_worker_st *worker_shell,
             case GEARMAN_WORKER_STATE_GRAB_JOB_SEND:
             if (worker->con->socket_descriptor_is_valid() == false)
             {
+              worker->con->grab_pending= 0;
               continue;
             }
 
-            *ret_ptr= worker->con->send_packet(worker->grab_job, true);
-            if (gearman_failed(*ret_ptr))
+            /* Assignments left over from a GRAB_JOBS or sent in reply to a
+               WORK_COMPLETE are read before asking again. */
+            if (worker->con->grab_pending == 0 and worker->con->assign_pending == 0)
             {
-              if (*ret_ptr == GEARMAN_IO_WAIT)
+              *ret_ptr= worker->con->send_packet(worker->grab_job, true);
+              if (gearman_failed(*ret_ptr))
               {
-                worker->state= GEARMAN_WORKER_STATE_GRAB_JOB_SEND;
+                if (*ret_ptr == GEARMAN_IO_WAIT)
+                {
+                  worker->state= GEARMAN_WORKER_STATE_GRAB_JOB_SEND;
+                }
+                else if (*ret_ptr == GEARMAN_LOST_CONNECTION)
+                {
+                  continue;
+                }
+
+                assert(*ret_ptr != GEARMAN_MAX_RETURN);
+                return NULL;
               }
-              else if (*ret_ptr == GEARMAN_LOST_CONNECTION)
+
+              if (worker->grab_job.command == GEARMAN_COMMAND_GRAB_JOBS)
               {
-                continue;
+                worker->con->grab_pending= worker->grab_count;
               }
-
-              assert(*ret_ptr != GEARMAN_MAX_RETURN);
-              return NULL;
             }
 
             if (worker->job() == NULL)
@@ -837,6 +912,7 @@ gearman_job_st *gearman_worker_grab_job(gearman_worker_st *worker_shell,
                   else
                   {
                     worker->job(NULL);
+                    worker->con->grab_pending= 0;
 
                     if (*ret_ptr == GEARMAN_LOST_CONNECTION)
                     {
@@ -860,6 +936,14 @@ gearman_job_st *gearman_worker_grab_job(gearman_worker_st *worker_shell,
                   worker->job()->impl()->options.assigned_in_use= true;
                   worker->job()->impl()->con= worker->con;
                   worker->state= GEARMAN_WORKER_STATE_GRAB_JOB_SEND;
+                  if (worker->con->grab_pending)
+                  {
+                    --worker->con->grab_pending;
+                  }
+                  else if (worker->con->assign_pending)
+                  {
+                    --worker->con->assign_pending;
+                  }
                   job= worker->take_job();
 
                   assert(*ret_ptr != GEARMAN_MAX_RETURN);
@@ -870,6 +954,14 @@ gearman_job_st *gearman_worker_grab_job(gearman_worker_st *worker_shell,
                     worker->job()->impl()->assigned.command == GEARMAN_COMMAND_OPTION_RES)
                 {
                   no_job= true;
+                  if (worker->con->grab_pending)
+                  {
+                    worker->con->grab_pending= 0;
+                  }
+                  else if (worker->con->assign_pending)
+                  {
+                    --worker->con->assign_pending;
+                  }
                   gearman_packet_free(&(worker->job()->impl()->assigned));
                   break;
                 }
@@ -881,6 +973,7 @@ gearman_job_st *gearman_worker_grab_job(gearman_worker_st *worker_shell,
                                               gearman_command_info(worker->job()->impl()->assigned.command)->name);
                   gearman_packet_free(&(worker->job()->impl()->assigned));
                   worker->job(NULL);
+                  worker->con->grab_pending= 0;
                   *ret_ptr= GEARMAN_UNEXPECTED_PACKET;
                   return NULL;
                 }
@@ -1267,11 +1360,41 @@ static gearman_worker_st *_worker_allocate(gearman_worker_st *worker_shell, bool
   return NULL;
 }
 
+static gearman_return_t _worker_grab_packet_create(Worker* worker)
+{
+  if (worker->grab_count > 1)
+  {
+    char count_buffer[GEARMAN_MAXIMUM_INTEGER_DISPLAY_LENGTH +1];
+    int length= snprintf(count_buffer, sizeof(count_buffer), "%u", worker->grab_count);
+
+    const void *args[1];
+    size_t args_size[1];
+    args[0]= count_buffer;
+    args_size[0]= size_t(length);
+
+    return gearman_packet_create_args(worker->universal, worker->grab_job,
+                                      GEARMAN_MAGIC_REQUEST, GEARMAN_COMMAND_GRAB_JOBS,
+                                      args, args_size, 1);
+  }
+
+  gearman_command_t command= GEARMAN_COMMAND_GRAB_JOB;
+  if (worker->options.grab_all)
+  {
+    command= GEARMAN_COMMAND_GRAB_JOB_ALL;
+  }
+  else if (worker->options.grab_uniq)
+  {
+    command= GEARMAN_COMMAND_GRAB_JOB_UNIQ;
+  }
+
+  return gearman_packet_create_args(worker->universal, worker->grab_job,
+                                    GEARMAN_MAGIC_REQUEST, command,
+                                    NULL, NULL, 0);
+}
+
 static gearman_return_t _worker_packet_init(Worker* worker)
 {
-  gearman_return_t ret= gearman_packet_create_args(worker->universal, worker->grab_job,
-                                                   GEARMAN_MAGIC_REQUEST, GEARMAN_COMMAND_GRAB_JOB_ALL,
-                                                   NULL, NULL, 0);
+  gearman_return_t ret= _worker_grab_packet_create(worker);
   if (gearman_failed(ret))
   {
     return ret;
@@ -57,6 +57,12 @@ using namespace libtest;
 
 #include <tests/start_worker.h>
 
+#include <algorithm>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
 #include "tests/workers/v2/echo_or_react.h"
 
 #define WORKER_FUNCTION_NAME "echo_function"
@@ -273,6 +279,167 @@ static test_return_t gearadmin_priority_status_TEST(void* object)
   return TEST_SUCCESS;
 }
 
+// Lines gearadmin prints for option, without the closing ".".
+static bool gearadmin_output(cli::Context *context, const char *option, std::vector<std::string>& lines)
+{
+  lines.clear();
+
+  char buffer[1024];
+  snprintf(buffer, sizeof(buffer), "--port=%d", int(context->port()));
+
+  Application gearadmin("bin/gearadmin", true);
+  gearadmin.add_option(buffer);
+  gearadmin.add_option(option);
+  if (gearadmin.run() != Application::SUCCESS or gearadmin.join() != Application::SUCCESS)
+  {
+    return false;
+  }
+
+  std::istringstream output(gearadmin.stdout_c_str());
+  std::string line;
+  while (std::getline(output, line))
+  {
+    if (line != ".")
+    {
+      lines.push_back(line);
+    }
+  }
+
+  return true;
+}
+
+static bool held_jobs_release= false;
+
+// Holds its job until held_jobs_release is set.
+static gearman_return_t held_job_worker(gearman_job_st*, void *)
+{
+  while (__atomic_load_n(&held_jobs_release, __ATOMIC_ACQUIRE) == false)
+  {
+    libtest::dream(0, 10000000);
+  }
+
+  return GEARMAN_SUCCESS;
+}
+
+static test_return_t gearadmin_status_running_TEST(void* object)
+{
+  cli::Context *context= (cli::Context*)object;
+
+  const size_t worker_count= 3;
+  __atomic_store_n(&held_jobs_release, false, __ATOMIC_RELEASE);
+  std::vector<worker_handle_st*> workers;
+  gearman_function_t held_job_fn= gearman_function_create(held_job_worker);
+  for (size_t x= 0; x < worker_count; ++x)
+  {
+    workers.push_back(test_worker_start(context->port(), NULL, __func__, held_job_fn, NULL, gearman_worker_options_t()));
+  }
+
+  {
+    libgearman::Client client(context->port());
+    for (size_t x= 0; x < worker_count; ++x)
+    {
+      gearman_job_handle_t job_handle;
+      ASSERT_EQ(GEARMAN_SUCCESS, gearman_client_do_background(&client, __func__, NULL, NULL, 0, job_handle));
+    }
+  }
+
+  // Every job is held by a worker: queued, running and available all match.
+  char running[1024];
+  snprintf(running, sizeof(running), "%s\t%u\t%u\t%u", __func__, unsigned(worker_count), unsigned(worker_count), unsigned(worker_count));
+
+  std::vector<std::string> lines;
+  bool found= false;
+  for (size_t x= 0; x < 100 and found == false; ++x)
+  {
+    ASSERT_TRUE(gearadmin_output(context, "--status", lines));
+    found= std::find(lines.begin(), lines.end(), std::string(running)) != lines.end();
+    if (found == false)
+    {
+      libtest::dream(0, 50000000);
+    }
+  }
+  ASSERT_TRUE(found);
+
+  // Each busy worker still shows up with its function.
+  ASSERT_TRUE(gearadmin_output(context, "--workers", lines));
+  size_t listed= 0;
+  for (std::vector<std::string>::iterator iter= lines.begin(); iter != lines.end(); ++iter)
+  {
+    if (iter->find(std::string(" : ") + __func__) != std::string::npos)
+    {
+      listed++;
+    }
+  }
+  ASSERT_EQ(worker_count, listed);
+
+  __atomic_store_n(&held_jobs_release, true, __ATOMIC_RELEASE);
+  for (std::vector<worker_handle_st*>::iterator iter= workers.begin(); iter != workers.end(); ++iter)
+  {
+    delete *iter;
+  }
+
+  return TEST_SUCCESS;
+}
+
+// Takes about 20ms per job.
+static gearman_return_t sleeping_job_worker(gearman_job_st*, void *)
+{
+  libtest::dream(0, 20000000);
+
+  return GEARMAN_SUCCESS;
+}
+
+static test_return_t gearadmin_latency_TEST(void* object)
+{
+  cli::Context *context= (cli::Context*)object;
+
+  const size_t job_count= 10;
+  std::unique_ptr<worker_handle_st> worker(test_worker_start(context->port(), NULL, __func__,
+                                                             gearman_function_create(sleeping_job_worker),
+                                                             NULL, gearman_worker_options_t()));
+
+  {
+    libgearman::Client client(context->port());
+    for (size_t x= 0; x < job_count; ++x)
+    {
+      size_t result_size;
+      gearman_return_t rc;
+      void *result= gearman_client_do(&client, __func__, NULL, NULL, 0, &result_size, &rc);
+      ASSERT_EQ(GEARMAN_SUCCESS, rc);
+      free(result);
+    }
+  }
+
+  std::vector<std::string> lines;
+  ASSERT_TRUE(gearadmin_output(context, "--latency", lines));
+
+  std::string prefix= std::string(__func__) + "\t";
+  std::vector<std::string>::iterator iter= lines.begin();
+  while (iter != lines.end() and iter->compare(0, prefix.size(), prefix) != 0)
+  {
+    ++iter;
+  }
+  ASSERT_TRUE(iter != lines.end());
+
+  // count, p50, p99 and p99.9 of the time queued, then of the time run.
+  unsigned long long queue_count, queue_p50, queue_p99, queue_p999;
+  unsigned long long run_count, run_p50, run_p99, run_p999;
+  ASSERT_EQ(8, sscanf(iter->c_str() + prefix.size(), "%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu",
+                      &queue_count, &queue_p50, &queue_p99, &queue_p999,
+                      &run_count, &run_p50, &run_p99, &run_p999));
+
+  ASSERT_EQ(job_count, queue_count);
+  ASSERT_TRUE(queue_p50 <= queue_p99 and queue_p99 <= queue_p999);
+  ASSERT_TRUE(queue_p999 < 5000000);
+
+  ASSERT_EQ(job_count, run_count);
+  ASSERT_TRUE(run_p50 <= run_p99 and run_p99 <= run_p999);
+  ASSERT_TRUE(run_p50 >= 20000);
+  ASSERT_TRUE(run_p999 < 5000000);
+
+  return TEST_SUCCESS;
+}
+
 static test_return_t gearadmin_show_unique_jobs_TEST(void* object)
 {
   cli::Context *context= (cli::Context*)object;
@@ -443,7 +610,9 @@ test_st gearadmin_tests[] ={
   {"--show-unique-jobs", 0, gearadmin_show_unique_jobs_TEST},
   {"--status", 0, gearadmin_status_TEST},
   {"--priority-status", 0, gearadmin_priority_status_TEST},
+  {"--latency", 0, gearadmin_latency_TEST},
   {"gearman_client_do_background(100) --status", 0, gearadmin_status_with_jobs_TEST},
+  {"--status and --workers with running jobs", 0, gearadmin_status_running_TEST},
   {"--getpid", 0, gearadmin_getpid_test},
   {"--workers", 0, gearadmin_workers_test},
   {"--create-function and --drop-function", 0, gearadmin_create_drop_test},
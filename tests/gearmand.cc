@@ -285,6 +285,22 @@ static test_return_t short_pid_file_test(void *)
   return TEST_SUCCESS;
 }
 
+static test_return_t long_result_cache_size_TEST(void *)
+{
+  const char *args[]= { "--check-args", "--result-cache-size=1048576", 0 };
+
+  ASSERT_EQ(EXIT_SUCCESS, exec_cmdline(gearmand_binary(), args, true));
+  return TEST_SUCCESS;
+}
+
+static test_return_t long_status_interval_TEST(void *)
+{
+  const char *args[]= { "--check-args", "--status-interval=100", 0 };
+
+  ASSERT_EQ(EXIT_SUCCESS, exec_cmdline(gearmand_binary(), args, true));
+  return TEST_SUCCESS;
+}
+
 static test_return_t long_round_robin_test(void *)
 {
   const char *args[]= { "--check-args", "--round-robin", 0 };
@@ -518,6 +534,14 @@ static test_return_t http_port_test(void *)
   return TEST_SUCCESS;
 }
 
+static test_return_t http_metrics_port_test(void *)
+{
+  const char *args[]= { "--check-args", "--protocol=http", "--http-metrics-port=8091",  0 };
+
+  ASSERT_EQ(EXIT_SUCCESS, exec_cmdline(gearmand_binary(), args, true));
+  return TEST_SUCCESS;
+}
+
 static test_return_t config_file_TEST(void *)
 {
   ASSERT_EQ(-1, access("etc/gearmand.conf", R_OK));
@@ -636,9 +660,11 @@ test_st gearmand_option_tests[] ={
   {"-p", 0, short_port_test},
   {"--pid-file=", 0, long_pid_file_test},
   {"-P", 0, short_pid_file_test},
+  {"--result-cache-size=", 0, long_result_cache_size_TEST},
   {"--round-robin", 0, long_round_robin_test},
   {"-R", 0, short_round_robin_test},
   {"--ssl", 0, SSL_TEST},
+  {"--status-interval=", 0, long_status_interval_TEST},
   {"--syslog=", 0, long_syslog_test},
   {"--threads=", 0, long_threads_test},
   {"-T", 0, short_threads_test},
@@ -676,6 +702,7 @@ test_st gearmand_option_tests[] ={
 
 test_st gearmand_httpd_option_tests[] ={
   {"--http-port=", 0, http_port_test},
+  {"--http-metrics-port=", 0, http_metrics_port_test},
   {0, 0, 0}
 };
 
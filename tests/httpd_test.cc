@@ -48,6 +48,9 @@ using namespace libtest;
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -57,12 +60,17 @@ using namespace libtest;
 
 #include "tests/workers/v2/echo_or_react.h"
 
+#include "libgearman/client.hpp"
+
+using namespace org::gearmand;
+
 // Prototypes
 #ifndef __INTEL_COMPILER
 #pragma GCC diagnostic ignored "-Wold-style-cast"
 #endif
 
 static char host_url[1024]= { 0 };
+static char metrics_url[1024]= { 0 };
 #define WORKER_FUNCTION_NAME "httpd_worker"
 
 static test_return_t curl_no_function_TEST(void *)
@@ -138,6 +146,79 @@ static test_return_t HEAD_TEST(void *)
 }
 
 
+static bool metrics_fetch(std::string& metrics)
+{
+  unlink("var/tmp/metrics_TEST.out");
+
+  Application curl("/usr/bin/curl");
+  curl.add_option("--silent");
+  curl.add_option("--show-error");
+  curl.add_option("--output", "var/tmp/metrics_TEST.out");
+  curl.add_option("--connect-timeout", "1");
+  curl.add_option(metrics_url);
+
+  if (curl.run() != Application::SUCCESS or curl.join() != Application::SUCCESS)
+  {
+    return false;
+  }
+
+  std::ifstream file("var/tmp/metrics_TEST.out");
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+  metrics= buffer.str();
+  unlink("var/tmp/metrics_TEST.out");
+
+  return true;
+}
+
+// Value of the sample name{function="WORKER_FUNCTION_NAME"}, or -1 if it is missing.
+static int64_t metrics_value(const std::string& metrics, const char *name)
+{
+  std::string sample(name);
+  sample+= "{function=\"" WORKER_FUNCTION_NAME "\"} ";
+
+  size_t position= metrics.find(sample);
+  if (position == std::string::npos)
+  {
+    return -1;
+  }
+
+  return int64_t(strtoll(metrics.c_str() + position + sample.size(), NULL, 10));
+}
+
+static test_return_t metrics_TEST(void *)
+{
+  libgearman::Client client(libtest::default_port());
+  // Makes sure the function is known before the first scrape.
+  ASSERT_EQ(GEARMAN_SUCCESS, gearman_client_echo(&client, test_literal_param("metrics")));
+
+  std::string before;
+  ASSERT_TRUE(metrics_fetch(before));
+  ASSERT_TRUE(before.find("# TYPE gearmand_jobs_completed_total counter") != std::string::npos);
+
+  size_t result_length;
+  gearman_return_t rc;
+  void *job_result= gearman_client_do(&client, WORKER_FUNCTION_NAME, NULL,
+                                      test_literal_param("metrics"),
+                                      &result_length, &rc);
+  ASSERT_EQ(GEARMAN_SUCCESS, rc);
+  ASSERT_TRUE(job_result);
+  free(job_result);
+
+  std::string after;
+  ASSERT_TRUE(metrics_fetch(after));
+  test_false(after.find("\n.\n") != std::string::npos);
+
+  int64_t submitted= metrics_value(before, "gearmand_jobs_submitted_total");
+  int64_t completed= metrics_value(before, "gearmand_jobs_completed_total");
+  ASSERT_EQ(submitted < 0 ? 1 : submitted + 1, metrics_value(after, "gearmand_jobs_submitted_total"));
+  ASSERT_EQ(completed < 0 ? 1 : completed + 1, metrics_value(after, "gearmand_jobs_completed_total"));
+  ASSERT_EQ(0, metrics_value(after, "gearmand_jobs_running"));
+  ASSERT_EQ(1, metrics_value(after, "gearmand_workers"));
+
+  return TEST_SUCCESS;
+}
+
 static void *world_create(server_startup_st& servers, test_return_t& error)
 {
   if (valgrind_is_caller())
@@ -153,7 +234,15 @@ static void *world_create(server_startup_st& servers, test_return_t& error)
   char buffer[1024];
   length= snprintf(buffer, sizeof(buffer), "--http-port=%d", int(http_port));
   fatal_assert(length > 0 and sizeof(length) < sizeof(buffer));
-  const char *argv[]= { "--protocol=http", buffer, 0 };
+
+  in_port_t metrics_port= libtest::get_free_port();
+  length= snprintf(metrics_url, sizeof(metrics_url), "http://localhost:%d/metrics", int(metrics_port));
+  fatal_assert(length > 0 and sizeof(length) < sizeof(metrics_url));
+
+  char metrics_buffer[1024];
+  length= snprintf(metrics_buffer, sizeof(metrics_buffer), "--http-metrics-port=%d", int(metrics_port));
+  fatal_assert(length > 0 and sizeof(length) < sizeof(metrics_buffer));
+  const char *argv[]= { "--protocol=http", buffer, metrics_buffer, 0 };
   if (server_startup(servers, "gearmand", libtest::default_port(), argv) == false)
   {
     error= TEST_SKIPPED;
@@ -206,6 +295,11 @@ test_st HEAD_TESTS[] ={
   { 0, 0, 0 }
 };
 
+test_st metrics_TESTS[] ={
+  { "GET /metrics", 0, metrics_TEST },
+  { 0, 0, 0 }
+};
+
 test_st regression_TESTS[] ={
   { 0, 0, 0 }
 };
@@ -213,6 +307,7 @@ test_st regression_TESTS[] ={
 collection_st collection[] ={
   { "curl", check_for_curl, 0, curl_TESTS },
   { "GET", check_for_libcurl, 0, GET_TESTS },
+  { "metrics", check_for_curl, 0, metrics_TESTS },
   { "regression", 0, 0, regression_TESTS },
   { 0, 0, 0, 0 }
 };
@@ -1718,6 +1718,15 @@ static test_return_t gearman_client_add_task_background_GEARMAN_INVALID_ARGUMENT
   return TEST_SUCCESS;
 }
 
+static test_return_t gearman_client_add_task_background_batch_GEARMAN_INVALID_ARGUMENT_TEST(void*)
+{
+  gearman_return_t ret;
+  ASSERT_EQ(NULL, gearman_client_add_task_background_batch(NULL, NULL, NULL, NULL, 0, NULL, NULL, NULL, &ret));
+  ASSERT_EQ(GEARMAN_INVALID_ARGUMENT, ret);
+
+  return TEST_SUCCESS;
+}
+
 static test_return_t gearman_client_add_task_high_background_GEARMAN_INVALID_ARGUMENT_TEST(void*)
 {
   gearman_return_t ret;
@@ -2189,6 +2198,7 @@ test_st gearman_client_st_GEARMAN_INVALID_ARGUMENT_TESTS[] ={
   {"gearman_client_add_task_high()", 0, gearman_client_add_task_high_GEARMAN_INVALID_ARGUMENT_TEST },
   {"gearman_client_add_task_low()", 0, gearman_client_add_task_low_GEARMAN_INVALID_ARGUMENT_TEST },
   {"gearman_client_add_task_background()", 0, gearman_client_add_task_background_GEARMAN_INVALID_ARGUMENT_TEST },
+  {"gearman_client_add_task_background_batch()", 0, gearman_client_add_task_background_batch_GEARMAN_INVALID_ARGUMENT_TEST },
   {"gearman_client_add_task_high_background()", 0, gearman_client_add_task_high_background_GEARMAN_INVALID_ARGUMENT_TEST },
   {"gearman_client_add_task_low_background()", 0, gearman_client_add_task_low_background_GEARMAN_INVALID_ARGUMENT_TEST },
   {"gearman_client_add_task_status()", 0, gearman_client_add_task_status_GEARMAN_INVALID_ARGUMENT_TEST },
@@ -2422,6 +2432,7 @@ test_st gearman_task_tests[] ={
   {"gearman_client_add_task() ", 0, gearman_client_add_task_test},
   {"gearman_client_add_task() bad workload", 0, gearman_client_add_task_test_bad_workload},
   {"gearman_client_add_task_background()", 0, gearman_client_add_task_background_test},
+  {"gearman_client_add_task_background_batch()", 0, gearman_client_add_task_background_batch_test},
   {"gearman_client_add_task_low_background()", 0, gearman_client_add_task_low_background_test},
   {"gearman_client_add_task_high_background()", 0, gearman_client_add_task_high_background_test},
   {"gearman_client_add_task() exception", 0, gearman_client_add_task_exception},
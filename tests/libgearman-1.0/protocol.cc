@@ -92,6 +92,11 @@ test_return_t check_gearman_command_t(void *)
   ASSERT_EQ(38, int(GEARMAN_COMMAND_SUBMIT_REDUCE_JOB_BACKGROUND));
   ASSERT_EQ(39, int(GEARMAN_COMMAND_GRAB_JOB_ALL));
   ASSERT_EQ(40, int(GEARMAN_COMMAND_JOB_ASSIGN_ALL));
+  ASSERT_EQ(41, int(GEARMAN_COMMAND_GET_STATUS_UNIQUE));
+  ASSERT_EQ(42, int(GEARMAN_COMMAND_STATUS_RES_UNIQUE));
+  ASSERT_EQ(43, int(GEARMAN_COMMAND_SUBMIT_JOB_BATCH));
+  ASSERT_EQ(44, int(GEARMAN_COMMAND_JOB_CREATED_BATCH));
+  ASSERT_EQ(45, int(GEARMAN_COMMAND_GRAB_JOBS));
 
   return TEST_SUCCESS;
 }
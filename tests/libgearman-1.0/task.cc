@@ -426,6 +426,59 @@ test_return_t gearman_client_add_task_background_test(void *object)
   return TEST_SUCCESS;
 }
 
+test_return_t gearman_client_add_task_background_batch_test(void *object)
+{
+  gearman_client_st *client= (gearman_client_st *)object;
+  const char *worker_function= (const char *)gearman_client_context(client);
+
+  fatal_assert(worker_function);
+
+  const char *unique[]= { NULL, "batch-unique-2", "batch-unique-3" };
+  const void *workload[]= { "dog", "cat", NULL };
+  const size_t workload_size[]= { 3, 3, 0 };
+
+  gearman_return_t ret;
+  gearman_task_st *task= gearman_client_add_task_background_batch(client, NULL, NULL,
+                                                                  worker_function, 3,
+                                                                  unique, workload, workload_size,
+                                                                  &ret);
+  ASSERT_EQ(ret, GEARMAN_SUCCESS);
+  ASSERT_TRUE(task);
+
+  do {
+    ret= gearman_client_run_tasks(client);
+  } while (gearman_continue(ret));
+
+  ASSERT_EQ(ret, GEARMAN_SUCCESS);
+
+  // If the task has been built to be freed, we won't have it to test
+  if (gearman_client_has_option(client, GEARMAN_CLIENT_FREE_TASKS))
+  {
+    return TEST_SUCCESS;
+  }
+
+  ASSERT_EQ(GEARMAN_SUCCESS, gearman_task_return(task));
+  ASSERT_EQ(size_t(3), gearman_task_batch_count(task));
+
+  gearman_string_t handles= gearman_task_batch_job_handles(task);
+  ASSERT_TRUE(gearman_c_str(handles));
+
+  size_t handle_count= 0;
+  for (const char *ptr= gearman_c_str(handles);
+       ptr < gearman_c_str(handles) +gearman_size(handles);
+       ptr+= strlen(ptr) +1)
+  {
+    ASSERT_TRUE(strlen(ptr));
+    handle_count++;
+  }
+  ASSERT_EQ(size_t(3), handle_count);
+  ASSERT_STREQ(gearman_c_str(handles), gearman_task_job_handle(task));
+
+  gearman_task_free(task);
+
+  return TEST_SUCCESS;
+}
+
 test_return_t gearman_client_add_task_high_background_test(void *object)
 {
   gearman_client_st *client= (gearman_client_st *)object;
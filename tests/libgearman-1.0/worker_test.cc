@@ -46,7 +46,11 @@ using namespace libtest;
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <sys/time.h>
 #include <unistd.h>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include <libgearman-1.0/gearman.h>
 #include <libgearman/connection.hpp>
@@ -195,6 +199,48 @@ static test_return_t gearman_worker_grab_job_TEST(void *)
   return TEST_SUCCESS;
 }
 
+static test_return_t gearman_worker_grab_job_timeout_TEST(void *)
+{
+  libgearman::Client client(libtest::default_port());
+  gearman_job_handle_t job_handle;
+  ASSERT_EQ(GEARMAN_SUCCESS, gearman_client_do_background(&client, __func__, NULL,
+                                                         test_literal_param(__func__),
+                                                         job_handle));
+
+  // CAN_DO_TIMEOUT of one second, allowed by --worker-timeout-min=1.
+  libgearman::Worker worker(libtest::default_port());
+  ASSERT_EQ(GEARMAN_SUCCESS, gearman_worker_register(&worker, __func__, 1));
+
+  gearman_return_t ret;
+  gearman_job_st* job= gearman_worker_grab_job(&worker, NULL, &ret);
+  ASSERT_EQ(GEARMAN_SUCCESS, ret);
+  ASSERT_TRUE(job);
+  ASSERT_STREQ(job_handle, gearman_job_handle(job));
+
+  libgearman::Worker other(libtest::default_port());
+  ASSERT_EQ(GEARMAN_SUCCESS, gearman_worker_register(&other, __func__, 0));
+
+  gearman_job_st* again= gearman_worker_grab_job(&other, NULL, &ret);
+  ASSERT_NULL(again);
+  ASSERT_EQ(GEARMAN_NO_JOBS, ret);
+
+  // Held past its timeout the job goes back to the queue for another worker.
+  for (uint32_t x= 0; x < 50 and again == NULL; ++x)
+  {
+    libtest::dream(0, 100000000);
+    again= gearman_worker_grab_job(&other, NULL, &ret);
+  }
+  ASSERT_EQ(GEARMAN_SUCCESS, ret);
+  ASSERT_TRUE(again);
+  ASSERT_STREQ(job_handle, gearman_job_handle(again));
+
+  ASSERT_EQ(GEARMAN_SUCCESS, gearman_job_send_complete(again, NULL, 0));
+  gearman_job_free(again);
+  gearman_job_free(job);
+
+  return TEST_SUCCESS;
+}
+
 static test_return_t gearman_worker_grab_job_GEARMAN_NO_SERVERS_NO_FUNCTIONS_TEST(void *)
 {
   libgearman::Worker worker;
@@ -678,6 +724,187 @@ static test_return_t job_order_background_TEST(void *)
 }
 #pragma GCC diagnostic pop
 
+static test_return_t gearman_worker_set_grab_count_TEST(void *)
+{
+  libgearman::Client client(libtest::default_port());
+
+  libgearman::Worker worker(libtest::default_port());
+  ASSERT_EQ(1U, gearman_worker_grab_count(&worker));
+  ASSERT_EQ(GEARMAN_INVALID_ARGUMENT, gearman_worker_set_grab_count(&worker, 0));
+  ASSERT_EQ(GEARMAN_SUCCESS, gearman_worker_set_grab_count(&worker, 4));
+  ASSERT_EQ(4U, gearman_worker_grab_count(&worker));
+  ASSERT_EQ(gearman_worker_register(&worker, __func__, 0), GEARMAN_SUCCESS);
+
+  for (uint32_t x= 0; x < 10; ++x)
+  {
+    ASSERT_EQ(GEARMAN_SUCCESS,
+              gearman_client_do_background(&client, __func__, NULL, test_literal_param("grab"), NULL));
+  }
+
+  for (uint32_t x= 0; x < 10; ++x)
+  {
+    gearman_return_t ret;
+    gearman_job_st* job= gearman_worker_grab_job(&worker, NULL, &ret);
+    ASSERT_EQ(GEARMAN_SUCCESS, ret);
+    ASSERT_TRUE(job);
+    ASSERT_EQ(test_literal_param_size("grab"), gearman_job_workload_size(job));
+    ASSERT_EQ(GEARMAN_SUCCESS, gearman_job_send_complete(job, NULL, 0));
+    gearman_job_free(job);
+  }
+
+  return TEST_SUCCESS;
+}
+
+static test_return_t gearman_worker_set_grab_count_multiple_server_TEST(void *object)
+{
+  server_startup_st *servers= (server_startup_st*)object;
+
+  // Batches from one server must not be counted against the other.
+  in_port_t extra_port= libtest::get_free_port();
+  ASSERT_TRUE(server_startup(*servers, "gearmand", extra_port, NULL));
+
+  libgearman::Client first(libtest::default_port());
+  libgearman::Client second(extra_port);
+
+  libgearman::Worker worker(libtest::default_port());
+  ASSERT_EQ(GEARMAN_SUCCESS, gearman_worker_add_server(&worker, "localhost", extra_port));
+  ASSERT_EQ(GEARMAN_SUCCESS, gearman_worker_set_grab_count(&worker, 4));
+  gearman_worker_add_options(&worker, GEARMAN_WORKER_ASSIGN_ON_COMPLETE);
+  gearman_worker_set_timeout(&worker, 5000);
+  ASSERT_EQ(gearman_worker_register(&worker, __func__, 0), GEARMAN_SUCCESS);
+
+  for (uint32_t x= 0; x < 5; ++x)
+  {
+    ASSERT_EQ(GEARMAN_SUCCESS,
+              gearman_client_do_background(&first, __func__, NULL, test_literal_param("first"), NULL));
+  }
+
+  for (uint32_t x= 0; x < 3; ++x)
+  {
+    ASSERT_EQ(GEARMAN_SUCCESS,
+              gearman_client_do_background(&second, __func__, NULL, test_literal_param("second"), NULL));
+  }
+
+  size_t from_first= 0;
+  size_t from_second= 0;
+  for (uint32_t x= 0; x < 8; ++x)
+  {
+    gearman_return_t ret;
+    gearman_job_st* job= gearman_worker_grab_job(&worker, NULL, &ret);
+    ASSERT_EQ(GEARMAN_SUCCESS, ret);
+    ASSERT_TRUE(job);
+    if (gearman_job_workload_size(job) == test_literal_param_size("first"))
+    {
+      from_first++;
+    }
+    else
+    {
+      from_second++;
+    }
+    ASSERT_EQ(GEARMAN_SUCCESS, gearman_job_send_complete(job, NULL, 0));
+    gearman_job_free(job);
+  }
+  ASSERT_EQ(5, from_first);
+  ASSERT_EQ(3, from_second);
+
+  gearman_worker_add_options(&worker, GEARMAN_WORKER_NON_BLOCKING);
+  gearman_return_t ret;
+  gearman_job_st* job;
+  do
+  {
+    job= gearman_worker_grab_job(&worker, NULL, &ret);
+  } while (ret == GEARMAN_IO_WAIT);
+  ASSERT_NULL(job);
+  ASSERT_EQ(GEARMAN_NO_JOBS, ret);
+
+  return TEST_SUCCESS;
+}
+
+static test_return_t gearman_worker_add_options_GEARMAN_WORKER_ASSIGN_ON_COMPLETE_TEST(void *)
+{
+  libgearman::Client client(libtest::default_port());
+
+  libgearman::Worker worker(libtest::default_port());
+  gearman_worker_add_options(&worker, GEARMAN_WORKER_ASSIGN_ON_COMPLETE);
+  ASSERT_TRUE(gearman_worker_options(&worker) & GEARMAN_WORKER_ASSIGN_ON_COMPLETE);
+  ASSERT_EQ(gearman_worker_register(&worker, __func__, 0), GEARMAN_SUCCESS);
+
+  for (uint32_t x= 0; x < 5; ++x)
+  {
+    ASSERT_EQ(GEARMAN_SUCCESS,
+              gearman_client_do_background(&client, __func__, NULL, test_literal_param("assign"), NULL));
+  }
+
+  for (uint32_t x= 0; x < 5; ++x)
+  {
+    gearman_return_t ret;
+    gearman_job_st* job= gearman_worker_grab_job(&worker, NULL, &ret);
+    ASSERT_EQ(GEARMAN_SUCCESS, ret);
+    ASSERT_TRUE(job);
+    ASSERT_EQ(GEARMAN_SUCCESS, gearman_job_send_complete(job, NULL, 0));
+    gearman_job_free(job);
+  }
+
+  gearman_worker_add_options(&worker, GEARMAN_WORKER_NON_BLOCKING);
+  gearman_return_t ret;
+  gearman_job_st* job;
+  do
+  {
+    job= gearman_worker_grab_job(&worker, NULL, &ret);
+  } while (ret == GEARMAN_IO_WAIT);
+  ASSERT_NULL(job);
+  ASSERT_EQ(GEARMAN_NO_JOBS, ret);
+
+  return TEST_SUCCESS;
+}
+
+static test_return_t gearman_worker_add_options_GEARMAN_WORKER_ASSIGN_ON_COMPLETE_error_TEST(void *)
+{
+  libgearman::Client client(libtest::default_port());
+  gearman_job_handle_t job_handle;
+  ASSERT_EQ(GEARMAN_SUCCESS, gearman_client_do_background(&client, __func__, NULL,
+                                                         test_literal_param("assign"),
+                                                         job_handle));
+
+  libgearman::Worker worker(libtest::default_port());
+  gearman_worker_add_options(&worker, GEARMAN_WORKER_ASSIGN_ON_COMPLETE);
+  gearman_worker_set_timeout(&worker, 3000);
+  ASSERT_EQ(GEARMAN_SUCCESS, gearman_worker_register(&worker, __func__, 1));
+
+  gearman_return_t ret;
+  gearman_job_st* job= gearman_worker_grab_job(&worker, NULL, &ret);
+  ASSERT_EQ(GEARMAN_SUCCESS, ret);
+  ASSERT_TRUE(job);
+
+  // Held past its timeout the job is taken back, so completing it is an error.
+  libtest::dream(2, 500000000);
+  ASSERT_EQ(GEARMAN_SUCCESS, gearman_job_send_complete(job, NULL, 0));
+  gearman_job_free(job);
+
+  // The ERROR is followed by the next assignment, here the same job again.
+  job= NULL;
+  for (uint32_t x= 0; x < 3 and job == NULL; ++x)
+  {
+    job= gearman_worker_grab_job(&worker, NULL, &ret);
+    ASSERT_NEQ(GEARMAN_TIMEOUT, ret);
+  }
+  ASSERT_EQ(GEARMAN_SUCCESS, ret);
+  ASSERT_TRUE(job);
+  ASSERT_STREQ(job_handle, gearman_job_handle(job));
+  ASSERT_EQ(GEARMAN_SUCCESS, gearman_job_send_complete(job, NULL, 0));
+  gearman_job_free(job);
+
+  gearman_worker_add_options(&worker, GEARMAN_WORKER_NON_BLOCKING);
+  do
+  {
+    job= gearman_worker_grab_job(&worker, NULL, &ret);
+  } while (ret == GEARMAN_IO_WAIT);
+  ASSERT_NULL(job);
+  ASSERT_EQ(GEARMAN_NO_JOBS, ret);
+
+  return TEST_SUCCESS;
+}
+
 static test_return_t echo_max_test(void *)
 {
   libgearman::Worker worker(libtest::default_port());;
@@ -1164,6 +1391,218 @@ static test_return_t gearman_job_send_exception_TEST(void *)
   return TEST_SUCCESS;
 }
 
+static gearman_return_t status_burst_WORKER(gearman_job_st* job, void *)
+{
+  // Three updates inside one interval, then quiet until the job completes.
+  for (uint32_t x= 1; x <= 3; ++x)
+  {
+    gearman_return_t ret= gearman_job_send_status(job, x, 10);
+    if (gearman_failed(ret))
+    {
+      return ret;
+    }
+  }
+
+  libtest::dream(2, 500000000);
+
+  return GEARMAN_SUCCESS;
+}
+
+static std::vector<std::pair<uint32_t, uint64_t> > status_received;
+
+static uint64_t status_now_ms()
+{
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return uint64_t(now.tv_sec) * 1000 + uint64_t(now.tv_usec) / 1000;
+}
+
+static gearman_return_t status_record_fn(gearman_task_st* task)
+{
+  status_received.push_back(std::make_pair(gearman_task_numerator(task), status_now_ms()));
+  return GEARMAN_SUCCESS;
+}
+
+static test_return_t gearman_job_send_status_interval_TEST(void *object)
+{
+  server_startup_st *servers= (server_startup_st*)object;
+
+  /*
+    Without the proc thread nothing but the server's own event flushes
+    the held status while the worker is quiet.
+  */
+  in_port_t status_port= libtest::get_free_port();
+  const char *argv[]= { "--threads=0", "--status-interval=1000", NULL };
+  ASSERT_TRUE(server_startup(*servers, "gearmand", status_port, argv));
+
+  libgearman::Client client(status_port);
+  gearman_client_set_status_fn(&client, status_record_fn);
+
+  gearman_function_t status_burst_WORKER_FN= gearman_function_create(status_burst_WORKER);
+  std::unique_ptr<worker_handle_st> handle(test_worker_start(status_port,
+                                                             NULL,
+                                                             __func__,
+                                                             status_burst_WORKER_FN,
+                                                             NULL,
+                                                             gearman_worker_options_t(),
+                                                             0)); // timeout
+
+  status_received.clear();
+  gearman_return_t ret;
+  gearman_task_st *task= gearman_client_add_task(&client, NULL, NULL,
+                                                 __func__, NULL, "status", 6,
+                                                 &ret);
+  ASSERT_TRUE(task);
+  ASSERT_EQ(ret, GEARMAN_SUCCESS);
+
+  do {
+    ret= gearman_client_run_tasks(&client);
+  } while (gearman_continue(ret));
+  uint64_t completed= status_now_ms();
+  ASSERT_EQ(GEARMAN_SUCCESS, gearman_task_return(task));
+
+  // The first update goes out, the other two are coalesced into the last.
+  ASSERT_EQ(2, status_received.size());
+  ASSERT_EQ(1, status_received[0].first);
+  ASSERT_EQ(3, status_received[1].first);
+
+  // The held update was flushed once its interval passed, not with the result.
+  ASSERT_TRUE(status_received[1].second - status_received[0].second >= 900);
+  ASSERT_TRUE(completed - status_received[1].second >= 1000);
+
+  return TEST_SUCCESS;
+}
+
+static gearman_return_t status_then_fail_WORKER(gearman_job_st* job, void *)
+{
+  // The second update is held, the fail follows well inside its interval.
+  for (uint32_t x= 1; x <= 2; ++x)
+  {
+    gearman_return_t ret= gearman_job_send_status(job, x, 10);
+    if (gearman_failed(ret))
+    {
+      return ret;
+    }
+  }
+
+  return GEARMAN_FAIL;
+}
+
+static test_return_t gearman_job_send_status_interval_fail_TEST(void *object)
+{
+  server_startup_st *servers= (server_startup_st*)object;
+
+  in_port_t status_port= libtest::get_free_port();
+  const char *argv[]= { "--status-interval=5000", NULL };
+  ASSERT_TRUE(server_startup(*servers, "gearmand", status_port, argv));
+
+  libgearman::Client client(status_port);
+  gearman_client_set_status_fn(&client, status_record_fn);
+
+  gearman_function_t status_then_fail_WORKER_FN= gearman_function_create(status_then_fail_WORKER);
+  std::unique_ptr<worker_handle_st> handle(test_worker_start(status_port,
+                                                             NULL,
+                                                             __func__,
+                                                             status_then_fail_WORKER_FN,
+                                                             NULL,
+                                                             gearman_worker_options_t(),
+                                                             0)); // timeout
+
+  status_received.clear();
+  gearman_return_t ret;
+  gearman_task_st *task= gearman_client_add_task(&client, NULL, NULL,
+                                                 __func__, NULL, "status", 6,
+                                                 &ret);
+  ASSERT_TRUE(task);
+  ASSERT_EQ(ret, GEARMAN_SUCCESS);
+
+  uint64_t started= status_now_ms();
+  do {
+    ret= gearman_client_run_tasks(&client);
+  } while (gearman_continue(ret));
+  ASSERT_EQ(GEARMAN_WORK_FAIL, gearman_task_return(task));
+
+  // The held status came ahead of the fail, not after the interval.
+  ASSERT_EQ(2, status_received.size());
+  ASSERT_EQ(1, status_received[0].first);
+  ASSERT_EQ(2, status_received[1].first);
+  ASSERT_TRUE(status_now_ms() - started < 5000);
+
+  return TEST_SUCCESS;
+}
+
+static gearman_return_t result_cache_WORKER(gearman_job_st* job, void *context)
+{
+  uint32_t *calls= (uint32_t *)context;
+  uint32_t call= __atomic_add_fetch(calls, 1, __ATOMIC_SEQ_CST);
+
+  char buffer[32];
+  int length= snprintf(buffer, sizeof(buffer), "%u", call);
+
+  // The cache keeps what WORK_COMPLETE carries, not earlier WORK_DATA.
+  return gearman_job_send_complete(job, buffer, size_t(length));
+}
+
+static std::string result_cache_do(gearman_client_st *client, const char *function_name)
+{
+  size_t result_size;
+  gearman_return_t ret;
+  char *result= (char *)gearman_client_do(client, function_name, "cached",
+                                          test_literal_param("payload"),
+                                          &result_size, &ret);
+  if (gearman_failed(ret) or result == NULL)
+  {
+    free(result);
+    return std::string();
+  }
+
+  std::string value(result, result_size);
+  free(result);
+
+  return value;
+}
+
+static test_return_t result_cache_TEST(void *)
+{
+  libtest::SimpleClient admin("localhost", libtest::default_port());
+
+  std::string response;
+  ASSERT_TRUE(admin.send_message(std::string("resultcache ") +__func__ + " -1", response));
+  ASSERT_EQ(0, response.compare(0, strlen("ERR INVALID_TTL"), "ERR INVALID_TTL"));
+  ASSERT_TRUE(admin.send_message(std::string("resultcache ") +__func__ + " 2x", response));
+  ASSERT_EQ(0, response.compare(0, strlen("ERR INVALID_TTL"), "ERR INVALID_TTL"));
+  ASSERT_TRUE(admin.send_message(std::string("resultcache ") +__func__ + " 4294967296", response));
+  ASSERT_EQ(0, response.compare(0, strlen("ERR INVALID_TTL"), "ERR INVALID_TTL"));
+  ASSERT_TRUE(admin.send_message(std::string("resultcache ") +__func__ + " 1", response));
+  ASSERT_EQ(0, response.compare(0, strlen("OK"), "OK"));
+
+  uint32_t calls= 0;
+  gearman_function_t result_cache_WORKER_FN= gearman_function_create(result_cache_WORKER);
+  std::unique_ptr<worker_handle_st> handle(test_worker_start(libtest::default_port(),
+                                                             NULL,
+                                                             __func__,
+                                                             result_cache_WORKER_FN,
+                                                             &calls,
+                                                             gearman_worker_options_t(),
+                                                             0)); // timeout
+
+  libgearman::Client client(libtest::default_port());
+
+  // The second submission is answered from the cache without the worker.
+  ASSERT_EQ(std::string("1"), result_cache_do(&client, __func__));
+  ASSERT_EQ(std::string("1"), result_cache_do(&client, __func__));
+  ASSERT_EQ(1, __atomic_load_n(&calls, __ATOMIC_SEQ_CST));
+
+  // Once the ttl has passed the job runs again.
+  libtest::dream(2, 500000000);
+  ASSERT_EQ(std::string("2"), result_cache_do(&client, __func__));
+  ASSERT_EQ(2, __atomic_load_n(&calls, __ATOMIC_SEQ_CST));
+
+  ASSERT_TRUE(admin.send_message(std::string("resultcache ") +__func__ + " 0", response));
+
+  return TEST_SUCCESS;
+}
+
 static test_return_t gearman_client_job_status_is_known_TEST(void *)
 {
   libgearman::Client client(libtest::default_port());
@@ -1858,7 +2297,7 @@ static test_return_t worker_connect_too_multiple_server_TEST(void *)
 
 static void *world_create(server_startup_st& servers, test_return_t&)
 {
-  const char *argv[]= { "--job-retries=30", NULL };
+  const char *argv[]= { "--job-retries=30", "--worker-timeout-min=1", NULL };
   ASSERT_TRUE(server_startup(servers, "gearmand", libtest::default_port(), argv));
 
   second_port= libtest::get_free_port();
@@ -1900,11 +2339,18 @@ test_st worker_TESTS[] ={
   {"gearman_client_run_tasks() GEARMAN_CLIENT_NON_BLOCKING", 0, gearman_client_run_tasks_increase_GEARMAN_CLIENT_NON_BLOCKING_TEST },
   {"gearman_client_run_tasks() chunked", 0, gearman_client_run_tasks_increase_chunk_TEST },
   {"gearman_client_job_status(is_known)", 0, gearman_client_job_status_is_known_TEST },
+  {"resultcache", 0, result_cache_TEST },
+  {"gearman_job_send_status(--status-interval)", 0, gearman_job_send_status_interval_TEST },
+  {"gearman_job_send_status(--status-interval) WORK_FAIL", 0, gearman_job_send_status_interval_fail_TEST },
   {"gearman_job_send_exception()", 0, gearman_job_send_exception_TEST },
   {"gearman_job_send_exception(mass)", 0, gearman_job_send_exception_mass_TEST },
   {"gearman_job_client()", 0, gearman_job_client_TEST },
   {"job order", 0, job_order_TEST },
   {"job background order", 0, job_order_background_TEST },
+  {"gearman_worker_set_grab_count()", 0, gearman_worker_set_grab_count_TEST },
+  {"gearman_worker_set_grab_count() multiple servers", 0, gearman_worker_set_grab_count_multiple_server_TEST },
+  {"gearman_worker_add_options(GEARMAN_WORKER_ASSIGN_ON_COMPLETE)", 0, gearman_worker_add_options_GEARMAN_WORKER_ASSIGN_ON_COMPLETE_TEST },
+  {"gearman_worker_add_options(GEARMAN_WORKER_ASSIGN_ON_COMPLETE) error", 0, gearman_worker_add_options_GEARMAN_WORKER_ASSIGN_ON_COMPLETE_error_TEST },
   {"check worker's connection to multiple servers", 0, worker_connect_too_multiple_server_TEST },
   {"echo_max", 0, echo_max_test },
   {"abandoned_worker", 0, abandoned_worker_test },
@@ -1923,6 +2369,7 @@ test_st gearman_worker_grab_job_TESTS[] ={
   {"gearman_worker_grab_job(GEARMAN_NO_REGISTERED_FUNCTIONS)", 0, gearman_worker_grab_job_GEARMAN_NO_REGISTERED_FUNCTIONS_TEST },
   {"gearman_worker_grab_job(GEARMAN_NO_SERVERS + GEARMAN_NO_REGISTERED_FUNCTIONS)", 0, gearman_worker_grab_job_GEARMAN_NO_SERVERS_NO_FUNCTIONS_TEST },
   {"gearman_worker_grab_job()", 0, gearman_worker_grab_job_GEARMAN_NO_SERVERS_NO_FUNCTIONS_TEST },
+  {"gearman_worker_grab_job(CAN_DO_TIMEOUT)", 0, gearman_worker_grab_job_timeout_TEST },
   {0, 0, 0}
 };
 
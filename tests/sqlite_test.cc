@@ -148,6 +148,23 @@ public:
     }
   }
 
+  bool exec(const std::string& query)
+  {
+    reset_error();
+
+    char *err= NULL;
+    sqlite3_exec(_db, query.c_str(), NULL, NULL, &err);
+
+    if (err != NULL)
+    {
+      _error_string= err;
+      sqlite3_free(err);
+      return false;
+    }
+
+    return true;
+  }
+
   bool has_error()
   {
     return _error_string.size();
@@ -212,6 +229,20 @@ static test_return_t gearmand_basic_option_without_table_test(void *)
   return TEST_SUCCESS;
 }
 
+static test_return_t gearmand_basic_option_pragmas_TEST(void *)
+{
+  const char *args[]= { "--check-args",
+    "--queue-type=libsqlite3",
+    "--libsqlite3-db=var/tmp/gearman.sql",
+    "--libsqlite3-journal-mode=wal",
+    "--libsqlite3-synchronous=normal",
+    "--libsqlite3-mmap-size=268435456",
+    0 };
+
+  ASSERT_EQ(EXIT_SUCCESS, exec_cmdline(gearmand_binary(), args, true));
+  return TEST_SUCCESS;
+}
+
 static test_return_t gearmand_basic_option_shutdown_queue_TEST(void *)
 {
   std::string sql_file= libtest::create_tmpfile("sqlite");
@@ -230,7 +261,7 @@ static test_return_t gearmand_basic_option_shutdown_queue_TEST(void *)
   return TEST_SUCCESS;
 }
 
-static test_return_t collection_init(void *object)
+static test_return_t collection_init(void *object, const char *extra_arg)
 {
   std::string sql_file= libtest::create_tmpfile("sqlite");
 
@@ -239,6 +270,7 @@ static test_return_t collection_init(void *object)
   const char *argv[]= {
     "--queue-type=libsqlite3", 
     sql_buffer,
+    extra_arg,
     0 };
 
   Context *test= (Context *)object;
@@ -252,10 +284,32 @@ static test_return_t collection_init(void *object)
   std::string sql_journal_file(sql_file);
   sql_journal_file+= "-journal";
   test->extra_file(sql_journal_file);
+  test->extra_file(sql_file + "-wal");
+  test->extra_file(sql_file + "-shm");
 
   return TEST_SUCCESS;
 }
 
+static test_return_t collection_init(void *object)
+{
+  return collection_init(object, NULL);
+}
+
+static test_return_t collection_async_init(void *object)
+{
+  return collection_init(object, "--queue-async=strict");
+}
+
+static test_return_t collection_lazy_data_init(void *object)
+{
+  return collection_init(object, "--queue-lazy-data=1");
+}
+
+static test_return_t collection_rollback_journal_init(void *object)
+{
+  return collection_init(object, "--libsqlite3-journal-mode=delete");
+}
+
 static test_return_t collection_cleanup(void *object)
 {
   Context *test= (Context *)object;
@@ -604,6 +658,312 @@ static test_return_t lp_1054377x200_TEST(void* object)
   return queue_restart_TEST(test, 200, 200);
 }
 
+/*
+  A batch the queue fails to store must not be acknowledged: the client
+  gets an error and the job never reaches a worker.
+*/
+static test_return_t queue_store_failure_TEST(void* object, const char *extra_arg)
+{
+  Context *test= (Context *)object;
+  server_startup_st &servers= test->_servers;
+
+  std::string sql_file= libtest::create_tmpfile("sqlite");
+
+  Sqlite sql_handle(sql_file);
+
+  char sql_buffer[1024];
+  snprintf(sql_buffer, sizeof(sql_buffer), "--libsqlite3-db=%.*s", int(sql_file.length()), sql_file.c_str());
+  const char *argv[]= {
+    "--queue-type=libsqlite3", 
+    sql_buffer,
+    extra_arg,
+    0 };
+
+  in_port_t first_port= libtest::get_free_port();
+  ASSERT_TRUE(server_startup(servers, "gearmand", first_port, argv));
+  test->extra_file(sql_file);
+
+  {
+    libgearman::Client client(first_port);
+    gearman_job_handle_t job_handle;
+    ASSERT_EQ(GEARMAN_SUCCESS,
+              gearman_client_do_background(&client, __func__, "stored", test_literal_param("stored"), job_handle));
+    ASSERT_EQ(1, sql_handle.vcount());
+
+    std::string drop_query("DROP TABLE ");
+    drop_query+= GEARMAN_QUEUE_SQLITE_DEFAULT_TABLE;
+    ASSERT_TRUE(sql_handle.exec(drop_query));
+
+    ASSERT_NEQ(GEARMAN_SUCCESS,
+               gearman_client_do_background(&client, __func__, "lost", test_literal_param("lost"), job_handle));
+  }
+
+  {
+    libgearman::Worker worker(first_port);
+    gearman_worker_set_timeout(&worker, 1000);
+
+    Called called;
+    gearman_function_t counter_function= gearman_function_create(called_worker);
+    ASSERT_EQ(GEARMAN_SUCCESS, gearman_worker_define_function(&worker,
+                                                              test_literal_param(__func__),
+                                                              counter_function,
+                                                              0, &called));
+
+    ASSERT_EQ(GEARMAN_SUCCESS, gearman_worker_work(&worker));
+    ASSERT_EQ(GEARMAN_TIMEOUT, gearman_worker_work(&worker));
+    ASSERT_EQ(1, called.count());
+  }
+
+  servers.clear();
+
+  return TEST_SUCCESS;
+}
+
+static test_return_t queue_store_failure_batch_TEST(void* object)
+{
+  return queue_store_failure_TEST(object, "--queue-batch");
+}
+
+static test_return_t queue_store_failure_async_TEST(void* object)
+{
+  return queue_store_failure_TEST(object, "--queue-async=strict");
+}
+
+/*
+  Two clients submit the same unique while its batch is open and the
+  store fails: both are told, and the one connection waiting does not
+  hold up the other.
+*/
+static test_return_t queue_store_failure_shared_TEST(void* object, const char *extra_arg)
+{
+  Context *test= (Context *)object;
+  server_startup_st &servers= test->_servers;
+
+  std::string sql_file= libtest::create_tmpfile("sqlite");
+
+  Sqlite sql_handle(sql_file);
+
+  char sql_buffer[1024];
+  snprintf(sql_buffer, sizeof(sql_buffer), "--libsqlite3-db=%.*s", int(sql_file.length()), sql_file.c_str());
+  const char *argv[]= {
+    "--queue-type=libsqlite3", 
+    sql_buffer,
+    "--queue-batch-delay=500",
+    extra_arg,
+    0 };
+
+  in_port_t first_port= libtest::get_free_port();
+  ASSERT_TRUE(server_startup(servers, "gearmand", first_port, argv));
+  test->extra_file(sql_file);
+
+  {
+    libgearman::Client client(first_port);
+    gearman_job_handle_t job_handle;
+    ASSERT_EQ(GEARMAN_SUCCESS,
+              gearman_client_do_background(&client, __func__, "stored", test_literal_param("stored"), job_handle));
+    ASSERT_EQ(1, sql_handle.vcount());
+
+    std::string drop_query("DROP TABLE ");
+    drop_query+= GEARMAN_QUEUE_SQLITE_DEFAULT_TABLE;
+    ASSERT_TRUE(sql_handle.exec(drop_query));
+
+    gearman_client_add_options(&client, GEARMAN_CLIENT_NON_BLOCKING);
+    gearman_return_t ret;
+    gearman_task_st *task= gearman_client_add_task_background(&client, NULL, NULL,
+                                                              __func__, "shared",
+                                                              test_literal_param("shared"),
+                                                              &ret);
+    ASSERT_EQ(GEARMAN_SUCCESS, ret);
+    ASSERT_TRUE(task);
+    ASSERT_EQ(GEARMAN_IO_WAIT, gearman_client_run_tasks(&client));
+
+    {
+      libgearman::Client other(first_port);
+      ASSERT_NEQ(GEARMAN_SUCCESS,
+                 gearman_client_do_background(&other, __func__, "shared", test_literal_param("shared"), job_handle));
+    }
+
+    gearman_client_remove_options(&client, GEARMAN_CLIENT_NON_BLOCKING);
+    do
+    {
+      ret= gearman_client_run_tasks(&client);
+    } while (gearman_continue(ret));
+    ASSERT_NEQ(GEARMAN_SUCCESS, gearman_task_return(task));
+  }
+
+  {
+    libgearman::Worker worker(first_port);
+    gearman_worker_set_timeout(&worker, 1000);
+
+    Called called;
+    gearman_function_t counter_function= gearman_function_create(called_worker);
+    ASSERT_EQ(GEARMAN_SUCCESS, gearman_worker_define_function(&worker,
+                                                              test_literal_param(__func__),
+                                                              counter_function,
+                                                              0, &called));
+
+    ASSERT_EQ(GEARMAN_SUCCESS, gearman_worker_work(&worker));
+    ASSERT_EQ(GEARMAN_TIMEOUT, gearman_worker_work(&worker));
+    ASSERT_EQ(1, called.count());
+  }
+
+  servers.clear();
+
+  return TEST_SUCCESS;
+}
+
+static test_return_t queue_store_failure_shared_batch_TEST(void* object)
+{
+  return queue_store_failure_shared_TEST(object, "--queue-batch");
+}
+
+static test_return_t queue_store_failure_shared_async_TEST(void* object)
+{
+  return queue_store_failure_shared_TEST(object, "--queue-async=strict");
+}
+
+// The client already has JOB_CREATED, so the job is kept in memory and still runs.
+static test_return_t queue_store_failure_relaxed_TEST(void* object)
+{
+  Context *test= (Context *)object;
+  server_startup_st &servers= test->_servers;
+
+  std::string sql_file= libtest::create_tmpfile("sqlite");
+
+  Sqlite sql_handle(sql_file);
+
+  char sql_buffer[1024];
+  snprintf(sql_buffer, sizeof(sql_buffer), "--libsqlite3-db=%.*s", int(sql_file.length()), sql_file.c_str());
+  const char *argv[]= {
+    "--queue-type=libsqlite3", 
+    sql_buffer,
+    "--queue-async=relaxed",
+    0 };
+
+  in_port_t first_port= libtest::get_free_port();
+  ASSERT_TRUE(server_startup(servers, "gearmand", first_port, argv));
+  test->extra_file(sql_file);
+
+  {
+    libgearman::Client client(first_port);
+    gearman_job_handle_t job_handle;
+    ASSERT_EQ(GEARMAN_SUCCESS,
+              gearman_client_do_background(&client, __func__, "stored", test_literal_param("stored"), job_handle));
+
+    // Stored behind JOB_CREATED.
+    for (int x= 0; x < 50 and sql_handle.vcount() != 1; ++x)
+    {
+      libtest::dream(0, 100000000);
+    }
+    ASSERT_EQ(1, sql_handle.vcount());
+
+    std::string drop_query("DROP TABLE ");
+    drop_query+= GEARMAN_QUEUE_SQLITE_DEFAULT_TABLE;
+    ASSERT_TRUE(sql_handle.exec(drop_query));
+
+    ASSERT_EQ(GEARMAN_SUCCESS,
+              gearman_client_do_background(&client, __func__, "kept", test_literal_param("kept"), job_handle));
+  }
+
+  {
+    libgearman::Worker worker(first_port);
+    gearman_worker_set_timeout(&worker, 1000);
+
+    Called called;
+    gearman_function_t counter_function= gearman_function_create(called_worker);
+    ASSERT_EQ(GEARMAN_SUCCESS, gearman_worker_define_function(&worker,
+                                                              test_literal_param(__func__),
+                                                              counter_function,
+                                                              0, &called));
+
+    ASSERT_EQ(GEARMAN_SUCCESS, gearman_worker_work(&worker));
+    ASSERT_EQ(GEARMAN_SUCCESS, gearman_worker_work(&worker));
+    ASSERT_EQ(GEARMAN_TIMEOUT, gearman_worker_work(&worker));
+    ASSERT_EQ(2, called.count());
+  }
+
+  servers.clear();
+
+  return TEST_SUCCESS;
+}
+
+// Counts the jobs whose data matches their unique.
+static gearman_return_t lazy_data_worker(gearman_job_st *job, void *object)
+{
+  Called *called= (Called *)object;
+
+  if (gearman_job_workload_size(job) == strlen(gearman_job_unique(job)) and
+      memcmp(gearman_job_workload(job), gearman_job_unique(job), gearman_job_workload_size(job)) == 0)
+  {
+    called->increment();
+  }
+
+  return GEARMAN_SUCCESS;
+}
+
+/*
+  With nothing read ahead every job's data is still being read when the
+  worker takes it: the worker sleeps until it is in, and gets every job
+  with its own data.
+*/
+static test_return_t queue_lazy_data_TEST(void* object)
+{
+  Context *test= (Context *)object;
+  server_startup_st &servers= test->_servers;
+
+  std::string sql_file= libtest::create_tmpfile("sqlite");
+
+  char sql_buffer[1024];
+  snprintf(sql_buffer, sizeof(sql_buffer), "--libsqlite3-db=%.*s", int(sql_file.length()), sql_file.c_str());
+  const char *argv[]= {
+    "--queue-type=libsqlite3", 
+    sql_buffer,
+    "--queue-lazy-data=1",
+    "--queue-prefetch=0",
+    0 };
+
+  in_port_t first_port= libtest::get_free_port();
+  ASSERT_TRUE(server_startup(servers, "gearmand", first_port, argv));
+  test->extra_file(sql_file);
+
+  const int job_count= 20;
+  {
+    libgearman::Client client(first_port);
+    for (int x= 0; x < job_count; ++x)
+    {
+      char unique[GEARMAN_MAX_UNIQUE_SIZE];
+      snprintf(unique, sizeof(unique), "lazy-%d", x);
+
+      gearman_job_handle_t job_handle;
+      ASSERT_EQ(GEARMAN_SUCCESS,
+                gearman_client_do_background(&client, __func__, unique, unique, strlen(unique), job_handle));
+    }
+  }
+
+  {
+    libgearman::Worker worker(first_port);
+    gearman_worker_set_timeout(&worker, 2000);
+
+    Called called;
+    gearman_function_t lazy_function= gearman_function_create(lazy_data_worker);
+    ASSERT_EQ(GEARMAN_SUCCESS, gearman_worker_define_function(&worker,
+                                                              test_literal_param(__func__),
+                                                              lazy_function,
+                                                              0, &called));
+
+    for (int x= 0; x < job_count; ++x)
+    {
+      ASSERT_EQ(GEARMAN_SUCCESS, gearman_worker_work(&worker));
+    }
+    ASSERT_EQ(GEARMAN_TIMEOUT, gearman_worker_work(&worker));
+    ASSERT_EQ(job_count, called.count());
+  }
+
+  servers.clear();
+
+  return TEST_SUCCESS;
+}
+
 static test_return_t skip_SETUP(void*)
 {
   SKIP_IF(true);
@@ -631,6 +991,7 @@ test_st gearmand_basic_option_tests[] ={
   {"--libsqlite3-db=var/tmp/schema --libsqlite3-table=custom_table", 0, gearmand_basic_option_test },
   {"--libsqlite3-db=var/tmp/schema", 0, gearmand_basic_option_without_table_test },
   {"--store-queue-on-shutdown", 0, gearmand_basic_option_shutdown_queue_TEST },
+  {"--libsqlite3-journal-mode=wal --libsqlite3-synchronous=normal --libsqlite3-mmap-size", 0, gearmand_basic_option_pragmas_TEST },
   {0, 0, 0}
 };
 
@@ -649,6 +1010,20 @@ test_st regressions[] ={
   {0, 0, 0}
 };
 
+test_st queue_failure_TESTS[] ={
+  {"--queue-batch", 0, queue_store_failure_batch_TEST },
+  {"--queue-async=strict", 0, queue_store_failure_async_TEST },
+  {"--queue-async=relaxed", 0, queue_store_failure_relaxed_TEST },
+  {"same unique --queue-batch", 0, queue_store_failure_shared_batch_TEST },
+  {"same unique --queue-async=strict", 0, queue_store_failure_shared_async_TEST },
+  {0, 0, 0}
+};
+
+test_st queue_lazy_data_TESTS[] ={
+  {"--queue-prefetch=0", 0, queue_lazy_data_TEST },
+  {0, 0, 0}
+};
+
 test_st queue_restart_TESTS[] ={
   {"lp:1054377", 0, lp_1054377_TEST },
   {"lp:1054377 x 200", 0, lp_1054377x200_TEST },
@@ -659,7 +1034,12 @@ test_st queue_restart_TESTS[] ={
 collection_st collection[] ={
   {"gearmand options", 0, 0, gearmand_basic_option_tests},
   {"sqlite queue", collection_init, collection_cleanup, tests},
+  {"sqlite queue --queue-async=strict", collection_async_init, collection_cleanup, tests},
+  {"sqlite queue --libsqlite3-journal-mode=delete", collection_rollback_journal_init, collection_cleanup, tests},
+  {"sqlite queue --queue-lazy-data=1", collection_lazy_data_init, collection_cleanup, tests},
   {"queue regression", collection_init, collection_cleanup, regressions},
+  {"queue store failure", 0, collection_cleanup, queue_failure_TESTS},
+  {"queue lazy data", 0, collection_cleanup, queue_lazy_data_TESTS},
   {"queue restart", skip_SETUP, 0, queue_restart_TESTS},
 #if 0
   {"sqlite queue change table", collection_init, collection_cleanup, tests},
@@ -41,6 +41,7 @@ test_return_t gearman_client_add_task_test(void *);
 test_return_t gearman_client_add_task_test_fail(void *);
 test_return_t gearman_client_add_task_test_bad_workload(void *);
 test_return_t gearman_client_add_task_background_test(void *);
+test_return_t gearman_client_add_task_background_batch_test(void *);
 test_return_t gearman_client_add_task_high_background_test(void *);
 test_return_t gearman_client_add_task_low_background_test(void *);
 test_return_t gearman_client_add_task_exception(void *);
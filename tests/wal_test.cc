@@ -0,0 +1,746 @@
+/*  vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * 
+ *  Gearmand client and server library.
+ *
+ *  Copyright (C) 2012 Data Differential, http://datadifferential.com/
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *
+ *      * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following disclaimer
+ *  in the documentation and/or other materials provided with the
+ *  distribution.
+ *
+ *      * The names of its contributors may not be used to endorse or
+ *  promote products derived from this software without specific prior
+ *  written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+
+#include "gear_config.h"
+#include <libtest/test.hpp>
+
+using namespace libtest;
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <set>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <libgearman/gearman.h>
+
+#include "tests/basic.h"
+#include "tests/context.h"
+
+#include "libgearman/client.hpp"
+#include "libgearman/worker.hpp"
+using namespace org::gearmand;
+
+#include "tests/workers/v2/called.h"
+
+#ifndef __INTEL_COMPILER
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#endif
+
+#define WAL_DIR "var/tmp/gearman_wal"
+
+static void wal_clean(void)
+{
+  DIR *dir= opendir(WAL_DIR);
+  if (dir)
+  {
+    struct dirent *entry;
+    while ((entry= readdir(dir)))
+    {
+      if (strcmp(entry->d_name, ".") and strcmp(entry->d_name, ".."))
+      {
+        unlink((std::string(WAL_DIR "/") + entry->d_name).c_str());
+      }
+    }
+    closedir(dir);
+    rmdir(WAL_DIR);
+  }
+}
+
+// Every file in the log directory, sorted, so segments read oldest first.
+static std::vector<std::string> wal_files(void)
+{
+  std::vector<std::string> names;
+  DIR *dir= opendir(WAL_DIR);
+  if (dir)
+  {
+    struct dirent *entry;
+    while ((entry= readdir(dir)))
+    {
+      if (strcmp(entry->d_name, ".") and strcmp(entry->d_name, ".."))
+      {
+        names.push_back(entry->d_name);
+      }
+    }
+    closedir(dir);
+  }
+  std::sort(names.begin(), names.end());
+
+  return names;
+}
+
+static std::string wal_segment(uint64_t first, uint64_t last)
+{
+  char name[64];
+  snprintf(name, sizeof(name), "%016llx-%016llx.wal", (unsigned long long)first, (unsigned long long)last);
+
+  return name;
+}
+
+// Compaction runs in the background, give it a few seconds to settle.
+static bool wal_wait_files(const std::vector<std::string>& expected)
+{
+  for (int x= 0; x < 100; ++x)
+  {
+    if (wal_files() == expected)
+    {
+      return true;
+    }
+    libtest::dream(0, 100000000);
+  }
+
+  return false;
+}
+
+static gearman_return_t unique_worker(gearman_job_st *job, void *context)
+{
+  std::set<std::string> *uniques= (std::set<std::string> *)context;
+  uniques->insert(gearman_job_unique(job));
+
+  return GEARMAN_SUCCESS;
+}
+
+// Runs jobs until limit were run or none came for a second, returns their uniques.
+static std::set<std::string> wal_work(in_port_t port, const char *function_name, size_t limit)
+{
+  std::set<std::string> uniques;
+
+  libgearman::Worker worker(port);
+  gearman_function_t unique_function= gearman_function_create(unique_worker);
+  if (gearman_failed(gearman_worker_define_function(&worker,
+                                                    function_name, strlen(function_name),
+                                                    unique_function,
+                                                    3000, &uniques)))
+  {
+    return uniques;
+  }
+  gearman_worker_set_timeout(&worker, 1000);
+
+  while (uniques.size() < limit and gearman_success(gearman_worker_work(&worker))) { }
+
+  return uniques;
+}
+
+static test_return_t gearmand_basic_option_test(void *)
+{
+  const char *args[]= { "--check-args",
+    "--queue-type=wal",
+    "--wal-dir=" WAL_DIR,
+    "--wal-segment-size=1",
+    "--wal-fsync-batch=0",
+    "--wal-fsync-interval=10",
+    0 };
+
+  ASSERT_EQ(EXIT_SUCCESS, exec_cmdline(gearmand_binary(), args, true));
+
+  return TEST_SUCCESS;
+}
+
+static test_return_t collection_init(void *object)
+{
+  const char *argv[]= {
+    "--wal-dir=" WAL_DIR,
+    "--queue-type=wal",
+    0 };
+
+  wal_clean();
+
+  Context *test= (Context *)object;
+  assert(test);
+
+  ASSERT_TRUE(test->initialize(argv));
+
+  return TEST_SUCCESS;
+}
+
+static test_return_t collection_batch_init(void *object)
+{
+  const char *argv[]= {
+    "--wal-dir=" WAL_DIR,
+    "--queue-type=wal",
+    "--queue-batch",
+    0 };
+
+  wal_clean();
+
+  Context *test= (Context *)object;
+  assert(test);
+
+  ASSERT_TRUE(test->initialize(argv));
+
+  return TEST_SUCCESS;
+}
+
+static test_return_t collection_async_init(void *object)
+{
+  const char *argv[]= {
+    "--wal-dir=" WAL_DIR,
+    "--queue-type=wal",
+    "--queue-async=strict",
+    0 };
+
+  wal_clean();
+
+  Context *test= (Context *)object;
+  assert(test);
+
+  ASSERT_TRUE(test->initialize(argv));
+
+  return TEST_SUCCESS;
+}
+
+static test_return_t collection_async_relaxed_init(void *object)
+{
+  const char *argv[]= {
+    "--wal-dir=" WAL_DIR,
+    "--queue-type=wal",
+    "--queue-async=relaxed",
+    0 };
+
+  wal_clean();
+
+  Context *test= (Context *)object;
+  assert(test);
+
+  ASSERT_TRUE(test->initialize(argv));
+
+  return TEST_SUCCESS;
+}
+
+static test_return_t queue_restart(void *object, const char **argv, const char *function_name)
+{
+  Context *test= (Context *)object;
+  ASSERT_TRUE(test);
+  server_startup_st &servers= test->_servers;
+
+  wal_clean();
+
+  const int32_t inserted_jobs= 8;
+  {
+    in_port_t first_port= libtest::get_free_port();
+
+    ASSERT_TRUE(server_startup(servers, "gearmand", first_port, argv));
+
+    {
+      libgearman::Worker worker(first_port);
+      ASSERT_EQ(gearman_worker_register(&worker, function_name, 0), GEARMAN_SUCCESS);
+    }
+
+    {
+      libgearman::Client client(first_port);
+      ASSERT_EQ(gearman_client_echo(&client, test_literal_param("This is my echo test")), GEARMAN_SUCCESS);
+      gearman_job_handle_t job_handle;
+      for (int32_t x= 0; x < inserted_jobs; ++x)
+      {
+        ASSERT_EQ(gearman_client_do_background(&client,
+                                                  function_name, // func
+                                                  NULL, // unique
+                                                  test_literal_param("foo"),
+                                                  job_handle), GEARMAN_SUCCESS);
+      }
+    }
+
+    servers.clear();
+  }
+
+  {
+    in_port_t first_port= libtest::get_free_port();
+
+    ASSERT_TRUE(server_startup(servers, "gearmand", first_port, argv));
+
+    {
+      libgearman::Worker worker(first_port);
+      Called called;
+      gearman_function_t counter_function= gearman_function_create(called_worker);
+      ASSERT_EQ(gearman_worker_define_function(&worker,
+                                                  function_name, strlen(function_name),
+                                                  counter_function,
+                                                  3000, &called), GEARMAN_SUCCESS);
+
+      const int32_t max_timeout= 4;
+      int32_t max_timeout_value= max_timeout;
+      int32_t job_count= 0;
+      gearman_return_t ret;
+      do
+      {
+        ret= gearman_worker_work(&worker);
+        if (gearman_success(ret))
+        {
+          job_count++;
+          max_timeout_value= max_timeout;
+          if (job_count == inserted_jobs)
+          {
+            break;
+          }
+        }
+        else if (ret == GEARMAN_TIMEOUT)
+        {
+          if ((--max_timeout_value) < 0)
+          {
+            break;
+          }
+        }
+      } while (ret == GEARMAN_TIMEOUT or ret == GEARMAN_SUCCESS);
+
+      ASSERT_EQ(called.count(), inserted_jobs);
+    }
+
+    servers.clear();
+  }
+
+  // Every job was done, nothing should come back.
+  {
+    in_port_t first_port= libtest::get_free_port();
+
+    ASSERT_TRUE(server_startup(servers, "gearmand", first_port, argv));
+
+    libgearman::Worker worker(first_port);
+    Called called;
+    gearman_function_t counter_function= gearman_function_create(called_worker);
+    ASSERT_EQ(gearman_worker_define_function(&worker,
+                                                function_name, strlen(function_name),
+                                                counter_function,
+                                                3000, &called), GEARMAN_SUCCESS);
+    gearman_worker_set_timeout(&worker, 1000);
+    ASSERT_EQ(gearman_worker_work(&worker), GEARMAN_TIMEOUT);
+    ASSERT_EQ(called.count(), 0);
+  }
+  wal_clean();
+
+  return TEST_SUCCESS;
+}
+
+static test_return_t queue_restart_TEST(void *object)
+{
+  const char *argv[]= {
+    "--wal-dir=" WAL_DIR,
+    "--queue-type=wal",
+    "--wal-fsync-batch=0",
+    "--wal-fsync-interval=10",
+    0 };
+
+  return queue_restart(object, argv, __func__);
+}
+
+static test_return_t queue_restart_batch_TEST(void *object)
+{
+  const char *argv[]= {
+    "--wal-dir=" WAL_DIR,
+    "--queue-type=wal",
+    "--queue-batch-delay=5",
+    0 };
+
+  return queue_restart(object, argv, __func__);
+}
+
+static test_return_t queue_restart_async_TEST(void *object)
+{
+  const char *argv[]= {
+    "--wal-dir=" WAL_DIR,
+    "--queue-type=wal",
+    "--queue-async=strict",
+    "--queue-batch-delay=5",
+    0 };
+
+  return queue_restart(object, argv, __func__);
+}
+
+static test_return_t queue_restart_async_relaxed_TEST(void *object)
+{
+  const char *argv[]= {
+    "--wal-dir=" WAL_DIR,
+    "--queue-type=wal",
+    "--queue-async=relaxed",
+    0 };
+
+  return queue_restart(object, argv, __func__);
+}
+
+static test_return_t queue_restart_replay_threads_TEST(void *object)
+{
+  const char *argv[]= {
+    "--wal-dir=" WAL_DIR,
+    "--queue-type=wal",
+    "--queue-replay-threads=2",
+    0 };
+
+  return queue_restart(object, argv, __func__);
+}
+
+static test_return_t queue_restart_replay_background_TEST(void *object)
+{
+  const char *argv[]= {
+    "--wal-dir=" WAL_DIR,
+    "--queue-type=wal",
+    "--queue-async=strict",
+    "--queue-replay-background",
+    "--queue-replay-threads=2",
+    0 };
+
+  return queue_restart(object, argv, __func__);
+}
+
+static test_return_t queue_compaction_TEST(void *object)
+{
+  Context *test= (Context *)object;
+  ASSERT_TRUE(test);
+  server_startup_st &servers= test->_servers;
+
+  const char *argv[]= {
+    "--wal-dir=" WAL_DIR,
+    "--queue-type=wal",
+    "--wal-segment-size=1",
+    0 };
+
+  wal_clean();
+
+  // A quarter of a segment per job, every fourth add closes a segment.
+  const std::string payload(256 * 1024, 'x');
+  {
+    in_port_t first_port= libtest::get_free_port();
+    ASSERT_TRUE(server_startup(servers, "gearmand", first_port, argv));
+
+    libgearman::Client client(first_port);
+    gearman_job_handle_t job_handle;
+    for (int32_t x= 0; x < 12; ++x)
+    {
+      ASSERT_EQ(gearman_client_do_background(&client, __func__, NULL,
+                                             payload.c_str(), payload.size(),
+                                             job_handle), GEARMAN_SUCCESS);
+    }
+
+    // The three closed segments are folded into one covering them all.
+    std::vector<std::string> expected;
+    expected.push_back(wal_segment(1, 3));
+    expected.push_back(wal_segment(4, 4));
+    ASSERT_TRUE(wal_wait_files(expected));
+
+    ASSERT_EQ(6, wal_work(first_port, __func__, 6).size());
+
+    // Closes the segment holding the dones, they drop out of the next compaction.
+    for (int32_t x= 0; x < 4; ++x)
+    {
+      ASSERT_EQ(gearman_client_do_background(&client, __func__, NULL,
+                                             payload.c_str(), payload.size(),
+                                             job_handle), GEARMAN_SUCCESS);
+    }
+
+    expected.clear();
+    expected.push_back(wal_segment(1, 4));
+    expected.push_back(wal_segment(5, 5));
+    ASSERT_TRUE(wal_wait_files(expected));
+
+    struct stat sb;
+    ASSERT_EQ(0, stat((std::string(WAL_DIR "/") + wal_segment(1, 4)).c_str(), &sb));
+    ASSERT_TRUE(size_t(sb.st_size) < 11 * payload.size());
+
+    servers.clear();
+  }
+
+  {
+    in_port_t first_port= libtest::get_free_port();
+    ASSERT_TRUE(server_startup(servers, "gearmand", first_port, argv));
+
+    ASSERT_EQ(10, wal_work(first_port, __func__, 11).size());
+
+    servers.clear();
+  }
+  wal_clean();
+
+  return TEST_SUCCESS;
+}
+
+/*
+  Damages the last record written before a restart, either cutting it short
+  as a crash in the middle of a write would or flipping a byte of its data.
+  Only the jobs before it come back.
+*/
+static test_return_t queue_torn_tail(void *object, const char *function_name, bool truncate_tail)
+{
+  Context *test= (Context *)object;
+  ASSERT_TRUE(test);
+  server_startup_st &servers= test->_servers;
+
+  const char *argv[]= {
+    "--wal-dir=" WAL_DIR,
+    "--queue-type=wal",
+    0 };
+
+  wal_clean();
+
+  const char *uniques[]= { "first", "second", "third" };
+  {
+    in_port_t first_port= libtest::get_free_port();
+    ASSERT_TRUE(server_startup(servers, "gearmand", first_port, argv));
+
+    libgearman::Client client(first_port);
+    gearman_job_handle_t job_handle;
+    for (size_t x= 0; x < 3; ++x)
+    {
+      ASSERT_EQ(gearman_client_do_background(&client, function_name, uniques[x],
+                                             test_literal_param("foo"),
+                                             job_handle), GEARMAN_SUCCESS);
+    }
+
+    servers.clear();
+  }
+
+  std::vector<std::string> files= wal_files();
+  ASSERT_EQ(1, files.size());
+  std::string path= std::string(WAL_DIR "/") + files[0];
+
+  struct stat sb;
+  ASSERT_EQ(0, stat(path.c_str(), &sb));
+  if (truncate_tail)
+  {
+    ASSERT_EQ(0, truncate(path.c_str(), sb.st_size - 2));
+  }
+  else
+  {
+    FILE *file= fopen(path.c_str(), "r+b");
+    ASSERT_TRUE(file);
+    ASSERT_EQ(0, fseek(file, long(sb.st_size) - 1, SEEK_SET));
+    ASSERT_EQ('o', fgetc(file));
+    ASSERT_EQ(0, fseek(file, long(sb.st_size) - 1, SEEK_SET));
+    ASSERT_EQ('x', fputc('x', file));
+    ASSERT_EQ(0, fclose(file));
+  }
+
+  {
+    in_port_t first_port= libtest::get_free_port();
+    ASSERT_TRUE(server_startup(servers, "gearmand", first_port, argv));
+
+    std::set<std::string> expected;
+    expected.insert(uniques[0]);
+    expected.insert(uniques[1]);
+    ASSERT_TRUE(wal_work(first_port, function_name, 3) == expected);
+
+    servers.clear();
+  }
+
+  // The damaged bytes were cut off on replay.
+  struct stat after;
+  ASSERT_EQ(0, stat(path.c_str(), &after));
+  ASSERT_TRUE(after.st_size < sb.st_size - 2);
+  wal_clean();
+
+  return TEST_SUCCESS;
+}
+
+static test_return_t queue_torn_tail_truncated_TEST(void *object)
+{
+  return queue_torn_tail(object, __func__, true);
+}
+
+static test_return_t queue_torn_tail_corrupt_TEST(void *object)
+{
+  return queue_torn_tail(object, __func__, false);
+}
+
+static test_return_t collection_cleanup(void *object)
+{
+  Context *test= (Context *)object;
+  test->reset();
+  wal_clean();
+
+  return TEST_SUCCESS;
+}
+
+
+static uint64_t wal_now_ms(void)
+{
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return uint64_t(now.tv_sec) * 1000 + uint64_t(now.tv_usec) / 1000;
+}
+
+/*
+  While a JOB_CREATED waits for its batch, a connection with nothing in
+  the batch is still answered right away.
+*/
+static test_return_t queue_batch_not_held(void *object, const char **argv)
+{
+  Context *test= (Context *)object;
+  ASSERT_TRUE(test);
+  server_startup_st &servers= test->_servers;
+
+  wal_clean();
+
+  in_port_t first_port= libtest::get_free_port();
+  ASSERT_TRUE(server_startup(servers, "gearmand", first_port, argv));
+
+  {
+    libgearman::Client submitter(first_port);
+    gearman_client_add_options(&submitter, GEARMAN_CLIENT_NON_BLOCKING);
+
+    gearman_return_t ret;
+    gearman_task_st *task= gearman_client_add_task_background(&submitter, NULL, NULL,
+                                                              __func__, NULL,
+                                                              test_literal_param("held"),
+                                                              &ret);
+    ASSERT_EQ(GEARMAN_SUCCESS, ret);
+    ASSERT_TRUE(task);
+
+    uint64_t submitted= wal_now_ms();
+    ASSERT_EQ(GEARMAN_IO_WAIT, gearman_client_run_tasks(&submitter));
+    libtest::dream(0, 200000000);
+
+    {
+      libgearman::Client other(first_port);
+      uint64_t start= wal_now_ms();
+      ASSERT_EQ(GEARMAN_SUCCESS, gearman_client_echo(&other, test_literal_param("not held")));
+      ASSERT_TRUE(wal_now_ms() - start < 1000);
+    }
+
+    // JOB_CREATED itself only came once the batch was stored.
+    gearman_client_remove_options(&submitter, GEARMAN_CLIENT_NON_BLOCKING);
+    do
+    {
+      ret= gearman_client_run_tasks(&submitter);
+    } while (gearman_continue(ret));
+    ASSERT_EQ(GEARMAN_SUCCESS, gearman_task_return(task));
+    ASSERT_TRUE(wal_now_ms() - submitted >= 1500);
+  }
+
+  servers.clear();
+  wal_clean();
+
+  return TEST_SUCCESS;
+}
+
+static test_return_t queue_batch_not_held_TEST(void *object)
+{
+  const char *argv[]= {
+    "--wal-dir=" WAL_DIR,
+    "--queue-type=wal",
+    "--queue-batch-delay=2000",
+    0 };
+
+  return queue_batch_not_held(object, argv);
+}
+
+static test_return_t queue_async_strict_not_held_TEST(void *object)
+{
+  const char *argv[]= {
+    "--wal-dir=" WAL_DIR,
+    "--queue-type=wal",
+    "--queue-async=strict",
+    "--queue-batch-delay=2000",
+    0 };
+
+  return queue_batch_not_held(object, argv);
+}
+
+static void *world_create(server_startup_st& servers, test_return_t&)
+{
+  SKIP_IF(HAVE_UUID_UUID_H != 1);
+
+  wal_clean();
+  return new Context(servers);
+}
+
+static bool world_destroy(void *object)
+{
+  Context *test= (Context *)object;
+
+  wal_clean();
+  delete test;
+
+  return TEST_SUCCESS;
+}
+
+test_st gearmand_basic_option_tests[] ={
+  {"--wal-dir=" WAL_DIR " --wal-fsync-interval=10", 0, gearmand_basic_option_test },
+  {0, 0, 0}
+};
+
+
+test_st tests[] ={
+  {"gearman_client_echo()", 0, client_echo_test },
+  {"gearman_client_echo() fail", 0, client_echo_fail_test },
+  {"gearman_worker_echo()", 0, worker_echo_test },
+  {"clean", 0, queue_clean },
+  {"add", 0, queue_add },
+  {"worker", 0, queue_worker },
+  {0, 0, 0}
+};
+
+test_st queue_restart_TESTS[] ={
+  {"replay", 0, queue_restart_TEST },
+  {"replay --queue-batch-delay=5", 0, queue_restart_batch_TEST },
+  {"replay --queue-async=strict", 0, queue_restart_async_TEST },
+  {"replay --queue-async=relaxed", 0, queue_restart_async_relaxed_TEST },
+  {"replay --queue-replay-threads=2", 0, queue_restart_replay_threads_TEST },
+  {"replay --queue-replay-background", 0, queue_restart_replay_background_TEST },
+  {"replay --wal-segment-size=1 compaction", 0, queue_compaction_TEST },
+  {"replay truncated last record", 0, queue_torn_tail_truncated_TEST },
+  {"replay corrupt last record", 0, queue_torn_tail_corrupt_TEST },
+  {0, 0, 0}
+};
+
+test_st queue_hold_TESTS[] ={
+  {"echo answered while a batch is open", 0, queue_batch_not_held_TEST },
+  {"echo answered while a batch is open --queue-async=strict", 0, queue_async_strict_not_held_TEST },
+  {0, 0, 0}
+};
+
+collection_st collection[] ={
+  {"gearmand options", 0, 0, gearmand_basic_option_tests},
+  {"wal queue", collection_init, collection_cleanup, tests},
+  {"wal queue --queue-batch", collection_batch_init, collection_cleanup, tests},
+  {"wal queue --queue-async=strict", collection_async_init, collection_cleanup, tests},
+  {"wal queue --queue-async=relaxed", collection_async_relaxed_init, collection_cleanup, tests},
+  {"queue restart", 0, 0, queue_restart_TESTS},
+  {"queue hold", 0, 0, queue_hold_TESTS},
+  {0, 0, 0, 0}
+};
+
+void get_world(libtest::Framework *world)
+{
+  world->collections(collection);
+  world->create(world_create);
+  world->destroy(world_destroy);
+}